@@ -1,15 +1,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #include "basket.h"
+#include "basket_v2.h"
 #include "box_t.h"
 #include "debug.h"
 #include "tests.h"
 #include "checksum.h"
 #include "optimization.h"
+#include "lz_block.h"
 
-static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const void *buffer, const box_u32_t buffer_size);
+/* Max number of segments for one writev() call; POSIX guarantees at least 16, Linux takes 1024 */
+#ifndef IOV_MAX
+	#define IOV_MAX (1024)
+#endif
+
+/* A view basket (see basket_view_from_buf()) is read only: refuse any modification */
+#define BASKET_VIEW_TEST(basket, ret) do { if ((basket)->flags & BASKET_FLAG_VIEW) { \
+	DE("The basket %p is a read only view, materialize it first\n", basket); ABORT_OR_RETURN(ret); } } while (0)
+
+static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const void *buffer, const box_u32_t buffer_size,
+										checksum_stream_t *checksum);
 
 /**
  * @author Sebastian Mountaniol (7/27/22)
@@ -82,6 +98,12 @@ ret_t basket_release(void *basket)
 	basket_t *_basket = basket;
 	TESTP_ABORT(_basket);
 
+	/* The view is one allocation; the boxes point into the flat buffer which is not ours */
+	if (_basket->flags & BASKET_FLAG_VIEW) {
+		basket_free_mem(_basket, __func__, __LINE__);
+		return 0;
+	}
+
 	/* TODO: Deallocate boxes */
 	if (_basket->boxes) {
 		/* Index variable to iterate boxes */
@@ -107,6 +129,51 @@ ret_t basket_release(void *basket)
 	return 0;
 }
 
+__attribute__((warn_unused_result))
+void *basket_clone(void *basket)
+{
+	basket_t  *_basket = basket;
+	basket_t  *clone;
+	box_u32_t box_index;
+	TESTP_ABORT(_basket);
+
+	/* The view data can not be shared: it belongs to the flat buffer */
+	if (_basket->flags & BASKET_FLAG_VIEW) {
+		return basket_view_materialize(_basket);
+	}
+
+	clone = basket_new();
+	TESTP(clone, NULL);
+
+	clone->ticket = _basket->ticket;
+	clone->checksum_alg = _basket->checksum_alg;
+	clone->compress_threshold = _basket->compress_threshold;
+
+	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
+		if (box_new_shared(clone, _basket, box_index) < 0) {
+			DE("Could not share box[%u] with the clone\n", box_index);
+			if (A_OK != basket_release(clone)) {
+				DE("Could not release basket\n");
+			}
+			ABORT_OR_RETURN(NULL);
+		}
+	}
+
+	if (_basket->zhash) {
+		clone->zhash = zhash_clone(_basket->zhash);
+		if (NULL == clone->zhash) {
+			DE("Could not copy the key/value table\n");
+			if (A_OK != basket_release(clone)) {
+				DE("Could not release basket\n");
+			}
+			/* Out of memory is not a wrong input: the caller gets NULL */
+			return NULL;
+		}
+	}
+
+	return clone;
+}
+
 /*** Getters / Setters */
 
 /* Internal function: get pointer of a box inside of the basket */
@@ -157,12 +224,53 @@ static box_s64_t basket_get_last_box_index(const void *basket)
 	return _basket->boxes_used - 1;
 }
 
+/* This is an internal function: take the box out of the running size counters; call it right before the box is changed */
+static void basket_sizes_box_out(basket_t *basket, const box_t *box)
+{
+	if (NULL == box) {
+		return;
+	}
+
+	basket->data_used -= bx_used_take(box);
+	basket->data_room -= bx_room_take(box) + bx_headroom_take(box);
+	if (bx_used_take(box) > 0) {
+		basket->boxes_nonempty--;
+	}
+}
+
+/* This is an internal function: add the box to the running size counters; call it right after the box is changed */
+static void basket_sizes_box_in(basket_t *basket, const box_t *box)
+{
+	if (NULL == box) {
+		return;
+	}
+
+	basket->data_used += bx_used_take(box);
+	basket->data_room += bx_room_take(box) + bx_headroom_take(box);
+	if (bx_used_take(box) > 0) {
+		basket->boxes_nonempty++;
+	}
+}
+
+void basket_sizes_recount(void *basket)
+{
+	basket_t  *_basket  = basket;
+	box_u32_t box_index;
+	TESTP_ABORT(_basket);
+
+	_basket->data_used = 0;
+	_basket->data_room = 0;
+	_basket->boxes_nonempty = 0;
+
+	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
+		basket_sizes_box_in(_basket, _basket->boxes[box_index]);
+	}
+}
+
 __attribute__((warn_unused_result, pure))
 size_t basket_memory_size(const void *basket)
 {
 	const basket_t *_basket  = basket;
-	/* Index variable to iterate boxes */
-	box_u32_t      box_index = 0;
 	/* Accumulator variable to count size */
 	size_t         size      = 0;
 
@@ -174,19 +282,8 @@ size_t basket_memory_size(const void *basket)
 	/* Number of pointers in ->boxes array */
 	size += _basket->boxes_allocated * sizeof(void *);
 
-	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
-		const box_t  *box = basket_get_box(_basket, box_index);
-
-		/* Size of box_t structure */
-		size += sizeof(box_t);
-		/* It can be NULL; normal */
-		if (NULL == box) {
-			continue;
-		}
-
-		/* Add size of the data buffer */
-		size += bx_room_take(box);
-	}
+	/* The box_t structures and the data buffers, with the headroom */
+	size += _basket->boxes_used * sizeof(box_t) + _basket->data_room;
 	return size;
 }
 
@@ -194,25 +291,8 @@ __attribute__((warn_unused_result, pure))
 size_t basket_data_size(const void *basket)
 {
 	const basket_t *_basket  = basket;
-	/* Index variable to iterate boxes */
-	box_u32_t      box_index = 0;
-	/* Accumulator variable to count size */
-	size_t         size      = 0;
-
 	TESTP_ABORT(_basket);
-
-	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
-		const box_t  *box = basket_get_box(_basket, box_index);
-
-		/* It can be NULL; normal */
-		if (NULL == box) {
-			continue;
-		}
-
-		/* Add size of the data buffer */
-		size += bx_room_take(box);
-	}
-	return size;
+	return _basket->data_used;
 }
 
 /* Clean all boxes */
@@ -222,6 +302,7 @@ ret_t basket_clean(void *basket)
 	basket_t *_basket  = basket;
 	uint32_t box_index;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 
 	/* Validity test 1 */
 	if (NULL == _basket->boxes && _basket->boxes_used > 0) {
@@ -229,9 +310,10 @@ ret_t basket_clean(void *basket)
 		abort();
 	}
 
-	/* Validity test 2 */
-	if (NULL != _basket->boxes && _basket->boxes_used == 0) {
-		DE("Error: if number of boxes == 0, the boxes array must not be NULL pointer, but it is not : %p\n", _basket->boxes);
+	/* Validity test 2: the boxes array can be allocated while no box added yet (see ::basket_reserve_boxes()),
+	   but it never holds more boxes than allocated */
+	if (_basket->boxes_used > _basket->boxes_allocated) {
+		DE("Error: number of boxes (%u) > number of allocated box pointers (%u)\n", _basket->boxes_used, _basket->boxes_allocated);
 		abort();
 	}
 
@@ -261,12 +343,17 @@ ret_t basket_clean(void *basket)
 	}
 
 	_basket->boxes_used = 0;
+	_basket->boxes_allocated = 0;
+	_basket->data_used = 0;
+	_basket->data_room = 0;
+	_basket->boxes_nonempty = 0;
 	basket_free_mem(_basket, __func__, __LINE__);
 	return 0;
 }
 
+/* This is an internal function: reallocate the basket->boxes array to 'boxes' pointers; the new pointers are NULL */
 __attribute__((warn_unused_result))
-static ret_t basket_grow_box_pointers(void *basket)
+static ret_t basket_grow_box_pointers(void *basket, const size_t boxes)
 {
 	basket_t *_basket             = basket;
 	void     *reallocated_mem     = NULL;
@@ -276,10 +363,9 @@ static ret_t basket_grow_box_pointers(void *basket)
 
 	TESTP_ABORT(_basket);
 
-	DDD("Going to call reallocarray(boxes = %p, basket->boxes_allocated + BASKET_BUFS_GROW_RATE = %u, sizeof(void *) = %zu)\n",
-		_basket->boxes, _basket->boxes_allocated + BASKET_BUFS_GROW_RATE, sizeof(void *));
+	DDD("Going to call reallocarray(boxes = %p, boxes = %zu, sizeof(void *) = %zu)\n", _basket->boxes, boxes, sizeof(void *));
 
-	reallocated_mem = reallocarray(_basket->boxes, _basket->boxes_allocated + BASKET_BUFS_GROW_RATE, sizeof(void *));
+	reallocated_mem = reallocarray(_basket->boxes, boxes, sizeof(void *));
 	if (NULL == reallocated_mem) {
 		DE("Allocation failed\n");
 		ABORT_OR_RETURN(-1);
@@ -287,28 +373,60 @@ static ret_t basket_grow_box_pointers(void *basket)
 
 	/* Clean the freshly allocated memory */
 	clean_start_bytes_p = (char *)reallocated_mem + (_basket->boxes_allocated * sizeof(void *));
-	clean_szie_bytes = BASKET_BUFS_GROW_RATE * sizeof(void *);
-	//DD("Going to clean: tmp (%p) + basket->boxes_allocated (%u) == %p, 0, BASKET_BUFS_GROW_RATE (%d) * sizeof(void *) %(zu)\n",
-	//   (char *) tmp, basket->boxes_allocated, (tmp + basket->boxes_allocated), BASKET_BUFS_GROW_RATE, sizeof(void *) );
+	clean_szie_bytes = (boxes - _basket->boxes_allocated) * sizeof(void *);
 	memset(clean_start_bytes_p, 0, clean_szie_bytes);
 
+	_basket->boxes_allocated = boxes;
+	_basket->boxes = reallocated_mem;
+	return 0;
+}
+
+/* This is an internal function: make room for 'boxes' box pointers in the basket->boxes array; -EINVAL if the number is too large for the basket */
+__attribute__((warn_unused_result))
+static ret_t basket_box_pointers_assure(basket_t *basket, const size_t boxes)
+{
+	size_t grow_to;
 
-	/* If we need to allocate more pointers in basket->boxes array,
-	 * we allocate more than on.
-	 * To be exact, we allocate BASKET_BUFS_GROW_RATE number of pointers.
-	   This way we decrease delays when user adds new boxes */
-	_basket->boxes_allocated += BASKET_BUFS_GROW_RATE;
+	if (boxes > MAX_VAL_NUM_BOXES_TYPE) {
+		DE("Too many boxes for a basket: %zu\n", boxes);
+		return -EINVAL;
+	}
 
-	if (reallocated_mem != _basket->boxes) {
-		/*
-		 * TODO: Free old box?
-		 * When it uncommented, we have a crash caused double free here
-		 */
-		// free(basket->boxes);
-		_basket->boxes = reallocated_mem;
+	if (boxes <= basket->boxes_allocated) {
+		return A_OK;
 	}
 
-	return 0;
+	/* The array grows twice: N boxes added one by one cost O(log N) reallocations */
+	grow_to = MAX((size_t)basket->boxes_allocated * 2, (size_t)BASKET_BUFS_GROW_RATE);
+	grow_to = MIN(MAX(grow_to, boxes), (size_t)MAX_VAL_NUM_BOXES_TYPE);
+
+	if (A_OK != basket_grow_box_pointers(basket, grow_to)) {
+		DE("Could not grow ->boxes pointers\n");
+		return -ENOMEM;
+	}
+
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_reserve_boxes(void *basket, const size_t boxes)
+{
+	basket_t *_basket = basket;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -EINVAL);
+
+	if (boxes > MAX_VAL_NUM_BOXES_TYPE) {
+		DE("Too many boxes for a basket: %zu\n", boxes);
+		return -EINVAL;
+	}
+
+	/* Exactly as asked: the caller knows the final number */
+	if (boxes > _basket->boxes_allocated && A_OK != basket_grow_box_pointers(_basket, boxes)) {
+		DE("Could not grow ->boxes pointers\n");
+		return -ENOMEM;
+	}
+
+	return A_OK;
 }
 
 /* TODO: Not tested yet */
@@ -323,13 +441,12 @@ ret_t box_insert_after(void *basket, const uint32_t after_index, const void *buf
 	void      *move_start_p           = NULL;
 	void      *move_end_p             = NULL;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 	TESTP_ABORT(_basket->boxes);
 
 	/* Test that we have enough allocated slots in basket->boxes to move all by 1 position */
-	if ((_basket->boxes_used + 1) > _basket->boxes_allocated) {
-		if (0 != basket_grow_box_pointers(_basket)) {
-			ABORT_OR_RETURN(-1);
-		}
+	if (A_OK != basket_box_pointers_assure(_basket, _basket->boxes_used + 1)) {
+		ABORT_OR_RETURN(-1);
 	}
 
 	/* Move memory */
@@ -357,6 +474,7 @@ ret_t box_insert_after(void *basket, const uint32_t after_index, const void *buf
 	}
 
 	_basket->boxes[after_index + 1] = box;
+	basket_sizes_box_in(_basket, box);
 
 
 	/* Increase boxes count */
@@ -373,6 +491,7 @@ ret_t box_swap(void *basket, const box_u32_t first_index, const box_u32_t second
 	basket_t *_basket = basket;
 	box_t    *tmp;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 
 	if (first_index > _basket->boxes_used || second_index > _basket->boxes_used) {
 		DE("One of asked boxes is out of range, first = %u, second = %u, number of boxes is %u\n",
@@ -386,12 +505,51 @@ ret_t box_swap(void *basket, const box_u32_t first_index, const box_u32_t second
 	return 0;
 }
 
+__attribute__((warn_unused_result))
+ret_t box_move(void *src_basket, const box_u32_t src_index, void *dst_basket, const box_u32_t dst_index)
+{
+	basket_t *_src    = src_basket;
+	basket_t *_dst    = dst_basket;
+	box_t    *box;
+	size_t   dst_used;
+
+	TESTP_ABORT(_src);
+	TESTP_ABORT(_dst);
+	BASKET_VIEW_TEST(_src, -EINVAL);
+	BASKET_VIEW_TEST(_dst, -EINVAL);
+
+	/* Moved inside of the same basket, the box is taken out first */
+	dst_used = (_src == _dst) ? _dst->boxes_used - 1U : _dst->boxes_used;
+
+	if (src_index >= _src->boxes_used || dst_index > dst_used) {
+		DE("Wrong box index: src %u of %u, dst %u of %zu\n", src_index, _src->boxes_used, dst_index, dst_used);
+		return -EINVAL;
+	}
+
+	/* The only step which can fail goes first: nothing is changed on failure */
+	if (A_OK != basket_box_pointers_assure(_dst, dst_used + 1)) {
+		return -ENOMEM;
+	}
+
+	box = _src->boxes[src_index];
+	basket_sizes_box_out(_src, box);
+	memmove(_src->boxes + src_index, _src->boxes + src_index + 1, (_src->boxes_used - src_index - 1) * sizeof(void *));
+	_src->boxes_used--;
+
+	memmove(_dst->boxes + dst_index + 1, _dst->boxes + dst_index, (_dst->boxes_used - dst_index) * sizeof(void *));
+	_dst->boxes[dst_index] = box;
+	_dst->boxes_used++;
+	basket_sizes_box_in(_dst, box);
+	return A_OK;
+}
+
 __attribute__((warn_unused_result))
 ret_t box_clean(void *basket, const box_u32_t box_index)
 {
 	basket_t *_basket = basket;
 	box_t    *box;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 	if (box_index > _basket->boxes_used) {
 		DE("Asked to remove a box (%u) out of range (%u)\n",
 		   box_index, _basket->boxes_used);
@@ -402,6 +560,7 @@ ret_t box_clean(void *basket, const box_u32_t box_index)
 
 	TESTP(box, -1);
 
+	basket_sizes_box_out(_basket, box);
 	if (A_OK != bx_clean_and_reset(box)) {
 		DE("An error on box removal (buf_clean_and_reset failed)\n");
 		ABORT_OR_RETURN(-1);
@@ -419,6 +578,7 @@ ret_t box_merge_box(void *basket, const box_u32_t src, const box_u32_t dst)
 	box_t    *box_dst;
 	ret_t    rc;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 
 	if (src > _basket->boxes_used || dst > _basket->boxes_used) {
 		DE("Src (%u) or dst (%u) box is out of range (%u)\n", src, dst, _basket->boxes_used);
@@ -444,7 +604,9 @@ ret_t box_merge_box(void *basket, const box_u32_t src, const box_u32_t dst)
 	 * - There are bos 'src' and 'dst' boxes
 	 * - There is some data in 'src' box
 	 */
+	basket_sizes_box_out(_basket, box_dst);
 	rc = bx_add(box_dst, bx_data_take(box_src), bx_used_take(box_src));
+	basket_sizes_box_in(_basket, box_dst);
 	if (rc) {
 		DE("Could not add data from box src (%u) to dst (%u)\n", src, dst);
 		ABORT_OR_RETURN(rc);
@@ -465,9 +627,9 @@ FATTR_WARN_UNUSED_RET ret_t box_bisect(__attribute__((unused))void *basket,
 __attribute__((warn_unused_result))
 ret_t basket_collapse(void *basket)
 {
-	basket_t  *_basket  = basket;
-	box_u32_t box_index;
+	basket_t *_basket = basket;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 	TESTP_ABORT(_basket->boxes);
 	const uint32_t minimal_number_ob_boxes = 2;
 
@@ -478,44 +640,140 @@ ret_t basket_collapse(void *basket)
 		return 0;
 	}
 
-	for (box_index = 1; box_index < _basket->boxes_used; box_index++) {
-		if (NULL == _basket->boxes[box_index]) {
-			DDD("Do not merge box[%u] of %u, because it is NULL pointer\n", box_index, _basket->boxes_used);
-			continue;
-		}
+	/* The box[0] grows once, every other box is copied once */
+	if (A_OK != bx_merge_many(_basket->boxes[0], (box_t **)_basket->boxes + 1, _basket->boxes_used - 1)) {
+		ABORT_OR_RETURN(-1);
+	}
 
-		if (0 == box_data_size(basket, box_index)) {
-			DDD("Do not merge box[%u] of %u, because it is 0 bytes length\n", box_index, _basket->boxes_used);
-			continue;
-		}
+	basket_sizes_recount(_basket);
+	return 0;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_collapse_range(void *basket, const box_u32_t first, const box_u32_t last)
+{
+	basket_t  *_basket  = basket;
+	box_u32_t box_index;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -EINVAL);
+
+	if (first > last || last >= _basket->boxes_used) {
+		DE("Wrong range [%u, %u], number of boxes is %u\n", first, last, _basket->boxes_used);
+		return -EINVAL;
+	}
+
+	if (first == last) {
+		return A_OK;
+	}
 
-		if (A_OK != bx_merge(_basket->boxes[0], _basket->boxes[box_index])) {
+	if (A_OK != bx_merge_many(_basket->boxes[first], (box_t **)_basket->boxes + first + 1, last - first)) {
+		DE("Could not merge boxes [%u, %u]\n", first, last);
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	/* The merged boxes are empty now: release them, and move the following boxes down */
+	for (box_index = first + 1; box_index <= last; box_index++) {
+		if (A_OK != bx_free(_basket->boxes[box_index])) {
+			DE("Could not release box[%u]\n", box_index);
 			ABORT_OR_RETURN(-1);
 		}
 	}
 
-	return 0;
+	memmove(_basket->boxes + first + 1, _basket->boxes + last + 1, (_basket->boxes_used - last - 1) * sizeof(void *));
+	_basket->boxes_used -= last - first;
+	basket_sizes_recount(_basket);
+	return A_OK;
 }
 
 __attribute__((warn_unused_result))
-size_t basket_flat_buf_size(const basket_t *basket)
+ret_t basket_splice(void *dst_basket, void *src_basket, const box_u32_t first, const box_u32_t last)
 {
-	box_u32_t box_index;
-	size_t    buf_size  = sizeof(basket_send_header_t);
+	basket_t     *_src      = src_basket;
+	basket_t     *_dst      = dst_basket;
+	const size_t num        = (size_t)last - first + 1;
+	box_u32_t    box_index;
+
+	TESTP_ABORT(_src);
+	TESTP_ABORT(_dst);
+	BASKET_VIEW_TEST(_src, -EINVAL);
+	BASKET_VIEW_TEST(_dst, -EINVAL);
+
+	if (_src == _dst || first > last || last >= _src->boxes_used) {
+		DE("Wrong range [%u, %u], number of boxes is %u\n", first, last, _src->boxes_used);
+		return -EINVAL;
+	}
 
-	/* And we need the struct box_dump_t per box */
-	//buf_size += sizeof(box_dump_t) * basket->boxes_used;
+	if (A_OK != basket_box_pointers_assure(_dst, _dst->boxes_used + num)) {
+		return -ENOMEM;
+	}
 
-	/* We need to dump the content of every box, so count total size of buffers in all boxes */
-	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
-		const uint32_t box_size = box_data_size(basket, box_index);
-		// const box_t *box = basket_get_box(basket, box_index);
+	/* Only the box pointers are moved, the boxes and their data stay where they are */
+	memcpy(_dst->boxes + _dst->boxes_used, _src->boxes + first, num * sizeof(void *));
+	_dst->boxes_used += num;
 
-		if (0 == box_size) {
-			continue;
-		}
+	for (box_index = first; box_index <= last; box_index++) {
+		basket_sizes_box_out(_src, _src->boxes[box_index]);
+		basket_sizes_box_in(_dst, _src->boxes[box_index]);
+	}
+
+	memmove(_src->boxes + first, _src->boxes + last + 1, (_src->boxes_used - last - 1) * sizeof(void *));
+	_src->boxes_used -= num;
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_concat(void *dst_basket, void *src_basket)
+{
+	basket_t *_src = src_basket;
+	basket_t *_dst = dst_basket;
+
+	TESTP_ABORT(_src);
+	TESTP_ABORT(_dst);
+	BASKET_VIEW_TEST(_src, -EINVAL);
+	BASKET_VIEW_TEST(_dst, -EINVAL);
+
+	if (_src == _dst) {
+		DE("Can not concatenate the basket with itself\n");
+		return -EINVAL;
+	}
+
+	/* The boxes go first: if they can not be moved, nothing is changed */
+	if (_src->boxes_used > 0 && A_OK != basket_splice(_dst, _src, 0, _src->boxes_used - 1)) {
+		return -ENOMEM;
+	}
+
+	if (NULL == _src->zhash) {
+		return A_OK;
+	}
+
+	/* The whole table is taken if there is none */
+	if (NULL == _dst->zhash) {
+		_dst->zhash = _src->zhash;
+		_src->zhash = NULL;
+		return A_OK;
+	}
+
+	if (0 != zhash_move_all(_dst->zhash, _src->zhash)) {
+		DE("Could not move the key/value entries\n");
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	zhash_release(_src->zhash, 1);
+	_src->zhash = NULL;
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+size_t basket_flat_buf_size(const basket_t *basket)
+{
+	size_t buf_size = sizeof(basket_send_header_t);
 
-		buf_size += sizeof(box_dump_t) + box_size;
+	/* Every box with data is dumped as the box_dump_t and the data */
+	buf_size += basket->boxes_nonempty * sizeof(box_dump_t) + basket->data_used;
+
+	/* A compressed box never takes more than its data and the box_compress_t */
+	if (basket->compress_threshold > 0) {
+		buf_size += basket->boxes_nonempty * sizeof(box_compress_t);
 	}
 
 	/* If there key/value hash, add the size of needded to dump it into calculation */
@@ -525,154 +783,249 @@ size_t basket_flat_buf_size(const basket_t *basket)
 	return buf_size;
 }
 
-/**
- * @author Sebastian Mountaniol (7/31/22)
- * @brief Fill the basket_send_header_t from basket_t structure 
- * @param basket_send_header_t* basket_buf_header_p
- * @param const basket_t* basket             
- * @param const size_t buf_size           
- * @details 
- */
-static void basket_fill_send_header_from_basket_t(basket_send_header_t *basket_buf_header_p,
-												  const basket_t *basket)
+/* This is an internal function: start the checksum of the flat buffer with its algorithm; it starts from 'ticket', the watermark and the checksum are not included */
+__attribute__((warn_unused_result))
+static int8_t basket_checksum_start(checksum_stream_t *checksum, const basket_send_header_t *basket_buf_header_p)
 {
-	box_u32_t box_index;
-	box_u32_t boxes_to_dump = 0;
-	size_t    buf_size      = sizeof(basket_send_header_t);
+	if (0 != checksum_stream_init_alg(checksum, basket_buf_header_p->checksum_alg)) {
+		return -1;
+	}
 
-	/* And we need the struct box_dump_t per box */
-	// buf_size += sizeof(box_dump_t) * basket->boxes_used;
+	checksum_stream_update(checksum, (const char *)basket_buf_header_p + offsetof(basket_send_header_t, ticket),
+						   sizeof(basket_send_header_t) - offsetof(basket_send_header_t, ticket));
+	return 0;
+}
 
-	/* We need to dump the content of every box, so count total size of buffers in all boxes */
-	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
-		const uint32_t box_size = box_data_size(basket, box_index);
-		if (0 == box_size) {
-			continue;
+/* This is an internal function: the checksum of one box data, with the algorithm of the buffer; a compressed box is restored into a temporary buffer. Returns -1 if the box is broken */
+__attribute__((warn_unused_result))
+static int8_t basket_box_data_checksum(const basket_send_header_t *basket_buf_header_p, const char *data, const size_t size,
+									   checksum_t *calculated_sum)
+{
+	checksum_stream_t    checksum;
+	const box_compress_t *box_compress = (const box_compress_t *)data;
+	char                 *raw          = NULL;
+	size_t               raw_size      = size;
+
+	if (BOX_COMPRESS_LZ == basket_buf_header_p->compress) {
+		if (size < sizeof(box_compress_t)) {
+			DE("Wrong compressed box: %zu bytes\n", size);
+			return -1;
 		}
 
-		buf_size += sizeof(box_dump_t);
-		buf_size += box_size;
-		boxes_to_dump++;
-	}
+		data += sizeof(box_compress_t);
+		raw_size = box_compress->raw_size;
 
-	basket_buf_header_p->ticket = basket->ticket;
-	basket_buf_header_p->total_len = buf_size;
-	basket_buf_header_p->boxes_used = basket->boxes_used;
-	basket_buf_header_p->boxes_dumped = boxes_to_dump;
+		if (BOX_COMPRESS_LZ == box_compress->method) {
+			raw = malloc(raw_size);
+			TESTP(raw, -1);
 
-	/* Watermark: a predefined pattern. */
-	basket_buf_header_p->watermark = WATERMARK_BASKET;
+			if (lz_block_decompress(data, size - sizeof(box_compress_t), raw, raw_size) != (ssize_t)raw_size) {
+				DE("Wrong compressed box: could not restore %zu bytes\n", raw_size);
+				free(raw);
+				return -1;
+			}
 
-	/* If there is key/value, hget the size */
-	if (basket->zhash) {
-		basket_buf_header_p->ztable_buf_size = (uint32_t)zhash_to_buf_allocation_size(basket->zhash);
+			data = raw;
+		} else if (BOX_COMPRESS_RAW != box_compress->method || size - sizeof(box_compress_t) != raw_size) {
+			DE("Wrong compressed box: method %u, size %zu\n", box_compress->method, raw_size);
+			return -1;
+		}
 	}
 
-	/* TODO: The checksum not implemented yet */
-	basket_buf_header_p->checksum = 0;
+	/* The algorithm is tested by the caller: these calls can not fail */
+	if (0 != checksum_stream_init_alg(&checksum, basket_buf_header_p->checksum_alg)) {
+		abort();
+	}
+
+	checksum_stream_update(&checksum, data, raw_size);
+	if (0 != checksum_stream_final(&checksum, calculated_sum)) {
+		abort();
+	}
+
+	free(raw);
+	return 0;
 }
 
-static void basket_checksum_set(basket_send_header_t *basket_buf_header_p)
+/* This is an internal function: walk the box headers of the flat buffer and calculate the buffer checksum; if 'test_boxes' is YES, every box data is tested against its box checksum. Returns -1 if a box is out of the buffer or broken */
+__attribute__((warn_unused_result))
+static int8_t basket_checksum_walk(const basket_send_header_t *basket_buf_header_p, const int test_boxes, checksum_t *calculated_sum)
 {
-	/* We start the checksum from 'ticket',
-	   we do not consider watermark and the checksum fields */
-	size_t start_offset      = offsetof(basket_send_header_t, ticket);
-	/* Size to count - the size of this buffer less two filelds, 'watermark' and 'checksum' */
-	size_t size_to_count     = basket_buf_header_p->total_len - start_offset;
-	/* Start from 'ticket' field */
-	char   *address_to_start = (char *)basket_buf_header_p + start_offset;
+	checksum_stream_t checksum;
+	const char        *buf_char         = (const char *)basket_buf_header_p;
+	size_t            buf_offset        = sizeof(basket_send_header_t);
+	uint32_t          box_index;
+
+	/* The header is a part of the checksummed area, so the start covers it; then the box headers follow */
+	if (0 != basket_checksum_start(&checksum, basket_buf_header_p)) {
+		return -1;
+	}
+
+	/* The buffer checksum covers the box headers; every box data is covered by the box checksum in its header */
+	for (box_index = 0; box_index < basket_buf_header_p->boxes_dumped; box_index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(buf_char + buf_offset);
+		const size_t     box_header_size    = sizeof(box_dump_t) + BASKET_ALIGN_PAD(buf_offset + sizeof(box_dump_t), basket_buf_header_p->align_log2);
+		checksum_t       box_sum;
+
+		if (buf_offset + sizeof(box_dump_t) > basket_buf_header_p->total_len ||
+			buf_offset + box_header_size + box_dump_header_p->box_size > basket_buf_header_p->total_len) {
+			DE("Wrong box[%u]: out of the buffer\n", box_index);
+			return -1;
+		}
+
+		checksum_stream_update(&checksum, buf_char + buf_offset, box_header_size);
+		buf_offset += box_header_size;
 
-	if (0 != checksum_buf_configured(address_to_start, size_to_count, &basket_buf_header_p->checksum)) {
+		if (YES == test_boxes) {
+			if (0 != basket_box_data_checksum(basket_buf_header_p, buf_char + buf_offset, box_dump_header_p->box_size, &box_sum) ||
+				box_dump_header_p->box_checksum != box_sum) {
+				DE("Wrong checksum of box[%u]\n", box_dump_header_p->box_index);
+				return -1;
+			}
+		}
+
+		buf_offset += box_dump_header_p->box_size;
+	}
+
+	if (0 != checksum_stream_final(&checksum, calculated_sum)) {
 		DE("Failed to calculate the final buffer checksum");
 		abort();
 	}
 
-	DDD("Checksum set: %X\n", basket_buf_header_p->checksum);
+	return 0;
 }
 
 __attribute__((warn_unused_result))
 static int8_t basket_checksum_test(const basket_send_header_t *basket_buf_header_p)
 {
-	int8_t     rc                = -1;
-	checksum_t calculated_sum    = 0;
-
-	/* We start the checksum from 'ticket',
-		we do not consider watermark and the checksum fields */
-	size_t     start_offset      = 0;
-	/* Size to count - the size of this buffer less two filelds, 'watermark' and 'checksum' */
-	size_t     size_to_count     = 0;
-	/* Start from 'ticket' field */
-	char       *address_to_start = NULL;
+	checksum_t calculated_sum = 0;
 
 	TESTP(basket_buf_header_p, -1);
 
-	/* If the checksum is 0, it means, it not set when the buffer created */
-	if (0 == basket_buf_header_p->checksum) {
-		return 0;
+	if (basket_buf_header_p->compress > BOX_COMPRESS_LZ) {
+		DE("Wrong buffer: unknown compression %u\n", basket_buf_header_p->compress);
+		return 1;
 	}
 
-	start_offset      = offsetof(basket_send_header_t, ticket);
-	size_to_count     = basket_buf_header_p->total_len - start_offset;
-	address_to_start = (char *)basket_buf_header_p + start_offset;
-
-	//rc = checksum_buf_to_32_bit(address_to_start, size_to_count, &calculated_sum);
-	rc = checksum_buf_configured(address_to_start, size_to_count, &calculated_sum);
-
-	if (0 != rc) {
-		DE("Failed to calculate the final buffer checksum");
-		abort();
+	/* The box checksums are always tested, even if the buffer checksum is not set */
+	if (0 != basket_checksum_walk(basket_buf_header_p, YES, &calculated_sum)) {
+		return 1;
 	}
 
-	if (basket_buf_header_p->checksum != calculated_sum) {
+	if (!(basket_buf_header_p->flags & BASKET_HEADER_NO_CHECKSUM) && basket_buf_header_p->checksum != calculated_sum) {
 		DE("Wrong checksum: expected %X but it is %X\n", basket_buf_header_p->checksum, calculated_sum);
 		return 1;
 	}
 	return 0;
 }
 
+/* This is an internal function: store the box data after the box_compress_t, compressed if it is worth it; return the size of the stored data, including the box_compress_t */
+__attribute__((warn_unused_result))
+static size_t basket_box_compress(box_t *box, char *dst, const size_t compress_threshold)
+{
+	box_compress_t   *box_compress = (box_compress_t *)dst;
+	const box_s64_t  box_used      = bx_used_take(box);
+	const char       *box_data     = bx_data_take(box);
+	size_t           compressed    = 0;
+
+	/* A small box is not worth it; the data which did not compress is not tried again until changed */
+	if ((size_t)box_used >= compress_threshold && NO == bx_is_incompressible(box)) {
+		/* Only an output smaller than the data is taken */
+		compressed = lz_block_compress(box_data, box_used, dst + sizeof(box_compress_t), box_used - 1);
+		if (0 == compressed) {
+			bx_incompressible_set(box);
+		}
+	}
+
+	box_compress->raw_size = box_used;
+
+	if (compressed > 0) {
+		box_compress->method = BOX_COMPRESS_LZ;
+		return sizeof(box_compress_t) + compressed;
+	}
+
+	box_compress->method = BOX_COMPRESS_RAW;
+	memcpy(dst + sizeof(box_compress_t), box_data, box_used);
+	return sizeof(box_compress_t) + box_used;
+}
+
 /**
  * @author Sebastian Mountaniol (7/31/22)
  * @brief Fill the box_dump_t from the box_t structure
  * @param box_dump_t* box_dump_header_p The pointer to
  *  				box_dump_t structure. WARNING: THis pointer
  *  				CAN be NULL, it is a legal situation!
- * @param const box_t* box The pointer to box_t structure
+ * @param box_t* box The pointer to box_t structure; its
+ *  		   checksum is cached
+ * @param uint32_t box_index The index of the box
+ * @param const size_t pad Number of zero bytes between the
+ *  			header and the data, see BASKET_ALIGN_PAD
+ * @param const uint8_t alg The checksum algorithm of the buffer
+ * @param const size_t compress_threshold If not 0, the data is
+ *  			stored after box_compress_t, and compressed if the
+ *  			box is this size or bigger
  * @return size_t The size (in bytes) of the resulting dump
  * @details This function assuption that the box_dump_header_p
  *  		points to a buffer big enoght for the box_dump_t
- *  		structure and all dumped data from the box. 
+ *  		structure and all dumped data from the box. The box
+ *  		data is hashed only if it changed since the box
+ *  		checksum was calculated last time.
  */
 __attribute__((warn_unused_result))
-static size_t basket_fill_send_box_from_box_t(box_dump_t *box_dump_header_p, const box_t *box, uint32_t box_index)
+static size_t basket_fill_send_box_from_box_t(box_dump_t *box_dump_header_p, box_t *box, uint32_t box_index, const size_t pad,
+											  const uint8_t alg, const size_t compress_threshold)
 {
-	char      *buf       = (char *)box_dump_header_p;
-	char      *box_data;
-	box_s64_t box_used   = 0;
-	size_t    buf_offset = 0;
+	char              *buf       = (char *)box_dump_header_p;
+	char              *box_data;
+	box_s64_t         box_used   = 0;
+	size_t            buf_offset = sizeof(box_dump_t) + pad;
+	checksum_stream_t box_checksum;
+	checksum_t        box_sum;
 
 	/* Fill the header, for every box we create and fill the header */
 	if (box) {
 		box_used = bx_used_take(box);
 	}
 
-	box_dump_header_p->box_size = box_used;
-	box_dump_header_p->box_index = box_index;
-	box_dump_header_p->watermark = WATERMARK_BOX;
-
-	// memcpy(buf + buf_offset, &box_dump_header, sizeof(box_dump_t));
-	buf_offset += sizeof(box_dump_t);
-
 	box_data = bx_data_take(box);
 
 	if (NULL == box_data) {
-		DE("Critical error: box data == NULL but box->used > 0 (%u)\n", box_dump_header_p->box_size);
+		DE("Critical error: box data == NULL but box->used > 0 (%u)\n", (uint32_t)box_used);
 		abort();
 	}
 
-	memcpy((buf + buf_offset), box_data, box_used);
-	buf_offset += box_used;
+	if (compress_threshold > 0) {
+		/* The box checksum is of the raw data: the receiver tests the restored data */
+		if (A_OK != bx_checksum_get(box, alg, &box_sum)) {
+			abort();
+		}
+
+		box_used = basket_box_compress(box, buf + buf_offset, compress_threshold);
+	} else if (YES == bx_checksum_cached(box, alg, &box_sum)) {
+		/* The data is read once: the box checksum is taken from the box, or calculated while the data copied */
+		memcpy(buf + buf_offset, box_data, box_used);
+	} else {
+		/* The algorithm is the one of the buffer checksum: this call can not fail */
+		if (0 != checksum_stream_init_alg(&box_checksum, alg)) {
+			abort();
+		}
+
+		checksum_stream_copy(&box_checksum, buf + buf_offset, box_data, box_used);
+		if (0 != checksum_stream_final(&box_checksum, &box_sum)) {
+			abort();
+		}
+
+		bx_checksum_set(box, alg, box_sum);
+	}
+
+	box_dump_header_p->box_checksum = box_sum;
+	box_dump_header_p->box_size = box_used;
+	box_dump_header_p->box_index = box_index;
+	box_dump_header_p->watermark = WATERMARK_BOX;
+
+	/* The padding is a part of the checksummed area: never leave garbage there */
+	memset(buf + sizeof(box_dump_t), 0, pad);
 
-	return buf_offset;
+	return buf_offset + box_used;
 }
 
 /* This function creates a flat buffer ready for sending/saving */
@@ -680,41 +1033,152 @@ __attribute__((warn_unused_result))
 void *basket_to_buf(const void *basket, size_t *size)
 {
 	const basket_t       *_basket             = basket;
-	box_u32_t            box_index;
-	uint32_t             boxes_dumped         = 0;
 	char                 *buf;
 	size_t               buf_size             = 0;
-	size_t               buf_offset           = 0;
-
-	basket_send_header_t *basket_buf_header_p;
+	size_t               written              = 0;
 
 	TESTP_ABORT(_basket);
 	TESTP_ABORT(size);
 
 	/* Let's calculate required buffer size */
+	buf_size = basket_flat_buf_size(_basket);
 
-	/*** 1. Fill the header of this buffer ***/
-
-	buf_size             = basket_flat_buf_size(_basket);
-	/* Alocate the memory buffer */
+	/* Alocate the memory buffer; no need to clean it, every byte is written */
 	buf = malloc(buf_size);
 	TESTP(buf, NULL);
 
-	memset(buf, 0, buf_size);
+	if (A_OK != basket_to_buf_into(_basket, buf, buf_size, &written)) {
+		DE("Could not dump the basket, buffer size %zu\n", buf_size);
+		free(buf);
+		ABORT_OR_RETURN(NULL);
+	}
 
-	/* Fill the header */
-	basket_buf_header_p = (basket_send_header_t *)buf;
-	basket_fill_send_header_from_basket_t(basket_buf_header_p, basket);
+	DDD("Returning buffer, size: %zu, written: %zu\n", buf_size, written);
+	*size = written;
+	return buf;
+}
 
-	/* Advance memory byffer poiter */
-	buf_offset += sizeof(basket_send_header_t);
+/* This is an internal function: size of the header and the boxes, the 'total_len'; the boxes are read only for an aligned buffer. With the compression on it is the worst case: every box is stored as is */
+__attribute__((warn_unused_result))
+static size_t basket_flat_boxes_size(const basket_t *basket, const uint8_t align_log2, uint32_t *boxes_dumped)
+{
+	box_u32_t box_index;
+	size_t    buf_size  = sizeof(basket_send_header_t);
+
+	*boxes_dumped = basket->boxes_nonempty;
+
+	/* The compressed box sizes are not known in advance: the padding can be any */
+	if (basket->compress_threshold > 0) {
+		return buf_size + basket->boxes_nonempty * (sizeof(box_dump_t) + ((size_t)1 << align_log2) - 1 + sizeof(box_compress_t)) +
+			basket->data_used;
+	}
+
+	/* No padding: the size is known from the counters */
+	if (0 == align_log2) {
+		return buf_size + basket->boxes_nonempty * sizeof(box_dump_t) + basket->data_used;
+	}
+
+	/* The padding depends on the offset of every box */
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		const box_t *box = basket_get_box(basket, box_index);
+
+		if (NULL == box || 0 == bx_used_take(box)) {
+			continue;
+		}
+
+		buf_size += sizeof(box_dump_t);
+		buf_size += BASKET_ALIGN_PAD(buf_size, align_log2) + bx_used_take(box);
+	}
+
+	return buf_size;
+}
+
+/* This is an internal function: the flat buffer size, with the box data padding and the index footer */
+__attribute__((warn_unused_result))
+static size_t basket_flat_buf_size_layout(const basket_t *basket, const int indexed, const uint8_t align_log2)
+{
+	uint32_t boxes_dumped;
+	size_t   buf_size     = basket_flat_boxes_size(basket, align_log2, &boxes_dumped);
+
+	if (basket->zhash) {
+		buf_size += zhash_to_buf_allocation_size(basket->zhash);
+	}
+
+	if (YES == indexed) {
+		buf_size += basket->boxes_used * sizeof(box_offset_t);
+	}
+
+	return buf_size;
+}
+
+/* This is an internal function: fill the box index footer from the box headers already written into the buffer */
+static void basket_fill_index(const basket_send_header_t *basket_buf_header_p, box_offset_t *index)
+{
+	const char *buf_char   = (const char *)basket_buf_header_p;
+	size_t     buf_offset  = sizeof(basket_send_header_t);
+	uint32_t   box_index;
+
+	/* The boxes not dumped are empty */
+	memset(index, 0, BASKET_FLAT_INDEX_SIZE(basket_buf_header_p));
+
+	for (box_index = 0; box_index < basket_buf_header_p->boxes_dumped; box_index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(buf_char + buf_offset);
+
+		/* The entry points to the box header, the data follows it after the padding */
+		index[box_dump_header_p->box_index].offset = buf_offset;
+		index[box_dump_header_p->box_index].size = box_dump_header_p->box_size;
+		buf_offset += sizeof(box_dump_t);
+		buf_offset += BASKET_ALIGN_PAD(buf_offset, basket_buf_header_p->align_log2) + box_dump_header_p->box_size;
+	}
+}
+
+/* This is an internal function: dump the basket into the buffer, with or without the index footer and the data alignment */
+__attribute__((warn_unused_result))
+static ret_t basket_to_buf_do(const void *basket, void *buf, const size_t buf_size, size_t *written, const int indexed, const uint8_t align_log2)
+{
+	const basket_t       *_basket             = basket;
+	box_u32_t            box_index;
+	uint32_t             boxes_dumped         = 0;
+	char                 *buf_char            = buf;
+	size_t               buf_offset           = 0;
+	size_t               total_len;
+	size_t               zsize                = 0;
+	basket_send_header_t *basket_buf_header_p;
+	checksum_t           checksum;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(buf);
+	TESTP_ABORT(written);
+
+	/*** 1. The header goes first. Only the box sizes are read here ***/
+	total_len = basket_flat_boxes_size(_basket, align_log2, &boxes_dumped);
+	if (total_len > buf_size) {
+		goto no_space;
+	}
+
+	if (_basket->zhash) {
+		zsize = zhash_to_buf_allocation_size(_basket->zhash);
+	}
 
-	/*** 2. Dump all boxes ***/
+	/* Every field is set, the buffer is not cleaned before */
+	basket_buf_header_p = (basket_send_header_t *)buf_char;
+	basket_buf_header_p->watermark = (YES == indexed) ? WATERMARK_BASKET_INDEXED : WATERMARK_BASKET;
+	basket_buf_header_p->checksum = 0;
+	basket_buf_header_p->ticket = _basket->ticket;
+	basket_buf_header_p->total_len = total_len;
+	basket_buf_header_p->boxes_used = _basket->boxes_used;
+	basket_buf_header_p->boxes_dumped = boxes_dumped;
+	basket_buf_header_p->ztable_buf_size = (uint32_t)zsize;
+	basket_buf_header_p->align_log2 = align_log2;
+	basket_buf_header_p->checksum_alg = _basket->checksum_alg;
+	basket_buf_header_p->compress = (_basket->compress_threshold > 0) ? BOX_COMPRESS_LZ : BOX_COMPRESS_RAW;
+	basket_buf_header_p->flags = 0;
+	buf_offset += sizeof(basket_send_header_t);
 
-	/* Now we run on array of boxes, and add one by one to the buffer */
+	/*** 2. Dump all boxes; only the boxes changed since the last dump are hashed ***/
 
 	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
-		const box_t *box = basket_get_box(_basket, box_index);
+		box_t *box = basket_get_box(_basket, box_index);
 
 		/* We don't pack boxes with 0 data */
 		if (NULL == box || 0 == bx_used_take(box)) {
@@ -722,34 +1186,437 @@ void *basket_to_buf(const void *basket, size_t *size)
 			continue;
 		}
 
-		box_dump_t  *box_dump_header_p;
-		box_dump_header_p = (box_dump_t *)(buf + buf_offset);
-
 		/* Advance memory byffer pointer bu size of the returned offset */
-		buf_offset += basket_fill_send_box_from_box_t(box_dump_header_p, box, box_index);
-		boxes_dumped++;
+		buf_offset += basket_fill_send_box_from_box_t((box_dump_t *)(buf_char + buf_offset), box, box_index,
+													  BASKET_ALIGN_PAD(buf_offset + sizeof(box_dump_t), align_log2),
+													  _basket->checksum_alg, _basket->compress_threshold);
 	}
 
-	/*** 3. Dump key/value hash ***/
-	/* TODO: Pass the buffer to fill to zhash from outside */
+	/* The compressed boxes take less than reserved: the real size is known now */
+	basket_buf_header_p->total_len = buf_offset;
+
+	/* The header and the box headers are in place; the algorithm is validated when set, this call can not fail */
+	if (0 != basket_checksum_walk(basket_buf_header_p, NO, &checksum)) {
+		abort();
+	}
+
+	basket_buf_header_p->checksum = checksum;
+
+	/*** 3. Dump key/value hash, directly into the buffer ***/
 	if (_basket->zhash) {
-		size_t zsize;
-		char   *zhash_dump_p = zhash_to_buf(_basket->zhash, &zsize);
-		TESTP_ABORT(zhash_dump_p);
-		memcpy((buf + buf_offset), zhash_dump_p, zsize);
-		free(zhash_dump_p);
+		if (0 != zhash_to_buf_into(_basket->zhash, buf_char + buf_offset, buf_size - buf_offset, &zsize, _basket->checksum_alg)) {
+			goto no_space;
+		}
+
 		buf_offset += zsize;
 	}
 
-	/* Calculate and set the buffer checksum */
-	/* This call can not fail; on failure the execution will be terminated */
-	basket_checksum_set(basket_buf_header_p);
+	/*** 4. The box index footer, after everything else ***/
+	if (YES == indexed) {
+		if (buf_offset + BASKET_FLAT_INDEX_SIZE(basket_buf_header_p) > buf_size) {
+			goto no_space;
+		}
+
+		basket_fill_index(basket_buf_header_p, (box_offset_t *)(buf_char + buf_offset));
+		buf_offset += BASKET_FLAT_INDEX_SIZE(basket_buf_header_p);
+	}
+
+	*written = buf_offset;
+	return A_OK;
+
+no_space:
+	/* Let the caller know how big the buffer should be */
+	*written = basket_flat_buf_size_layout(_basket, indexed, align_log2);
+	DDD("The buffer is too small: %zu, required: %zu\n", buf_size, *written);
+	return -ENOSPC;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_to_buf_into(const void *basket, void *buf, const size_t buf_size, size_t *written)
+{
+	return basket_to_buf_do(basket, buf, buf_size, written, NO, 0);
+}
+
+__attribute__((warn_unused_result))
+void *basket_to_buf_indexed(const void *basket, size_t *size)
+{
+	const basket_t *_basket  = basket;
+	char           *buf;
+	size_t         buf_size;
+	size_t         written   = 0;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(size);
+
+	buf_size = basket_flat_buf_size_layout(_basket, YES, 0);
+
+	buf = malloc(buf_size);
+	TESTP(buf, NULL);
+
+	if (A_OK != basket_to_buf_do(_basket, buf, buf_size, &written, YES, 0)) {
+		DE("Could not dump the basket, buffer size %zu\n", buf_size);
+		free(buf);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	*size = written;
+	return buf;
+}
+
+__attribute__((warn_unused_result))
+void *basket_to_buf_aligned(const void *basket, const size_t align, size_t *size)
+{
+	const basket_t *_basket   = basket;
+	void           *buf       = NULL;
+	size_t         buf_size;
+	size_t         written    = 0;
+	uint8_t        align_log2;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(size);
+
+	if (0 == align || 0 != (align & (align - 1)) || align > ((size_t)1 << BASKET_ALIGN_LOG2_MAX)) {
+		DE("Wrong alignment %zu: must be a power of 2, up to %u\n", align, 1U << BASKET_ALIGN_LOG2_MAX);
+		return NULL;
+	}
+
+	align_log2 = __builtin_ctzl(align);
+	buf_size = basket_flat_buf_size_layout(_basket, NO, align_log2);
+
+	/* The offsets are aligned inside of the buffer, so the buffer itself must be aligned */
+	if (0 != posix_memalign(&buf, MAX(align, sizeof(void *)), buf_size)) {
+		DE("Could not allocate %zu bytes aligned to %zu\n", buf_size, align);
+		return NULL;
+	}
 
-	DDD("Returning buffer, size: %zu, counted offset is: %zu\n", buf_size, buf_offset);
-	*size = buf_size;
+	if (A_OK != basket_to_buf_do(_basket, buf, buf_size, &written, NO, align_log2)) {
+		DE("Could not dump the basket, buffer size %zu\n", buf_size);
+		free(buf);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	*size = written;
 	return buf;
 }
 
+/* This is an internal function: find the box header and the box data in the indexed flat buffer; NULL if the box is empty or on an error */
+__attribute__((warn_unused_result))
+static const box_dump_t *basket_flat_box_find(const void *buf, const size_t size, const box_u32_t box_index, ssize_t *box_size,
+											  const char **data)
+{
+	const basket_send_header_t *basket_buf_header = buf;
+	const box_offset_t         *index;
+	const box_dump_t           *box_header;
+	size_t                     index_offset;
+	size_t                     data_offset;
+
+	TESTP_ABORT(buf);
+	TESTP_ABORT(box_size);
+
+	*box_size = -EINVAL;
+	*data = NULL;
+
+	if (size < sizeof(basket_send_header_t) || WATERMARK_BASKET_INDEXED != basket_buf_header->watermark) {
+		DE("Not an indexed flat buffer\n");
+		return NULL;
+	}
+
+	/* The compressed box data can not be used in place */
+	if (BOX_COMPRESS_RAW != basket_buf_header->compress) {
+		DE("The flat buffer is compressed, restore it with basket_from_buf()\n");
+		return NULL;
+	}
+
+	index_offset = (size_t)basket_buf_header->total_len + basket_buf_header->ztable_buf_size;
+	if (index_offset + BASKET_FLAT_INDEX_SIZE(basket_buf_header) > size) {
+		DE("Wrong buffer: the index is out of the buffer\n");
+		return NULL;
+	}
+
+	if (box_index >= basket_buf_header->boxes_used) {
+		DE("Wrong box index %u, the basket has %u boxes\n", box_index, (uint32_t)basket_buf_header->boxes_used);
+		return NULL;
+	}
+
+	index = (const box_offset_t *)((const char *)buf + index_offset) + box_index;
+	if (0 == index->offset) {
+		*box_size = 0;
+		return NULL;
+	}
+
+	/* The entry must point to the box header, and the data after it must be inside of the boxes area */
+	data_offset = (size_t)index->offset + sizeof(box_dump_t);
+	data_offset += BASKET_ALIGN_PAD(data_offset, basket_buf_header->align_log2);
+	if (index->offset < sizeof(basket_send_header_t) || data_offset + index->size > basket_buf_header->total_len) {
+		DE("Wrong index entry of box[%u]\n", box_index);
+		return NULL;
+	}
+
+	box_header = (const box_dump_t *)((const char *)buf + index->offset);
+	if (WATERMARK_BOX != box_header->watermark || box_index != box_header->box_index || index->size != box_header->box_size) {
+		DE("The index entry of box[%u] does not match the box header\n", box_index);
+		return NULL;
+	}
+
+	*box_size = index->size;
+	*data = (const char *)buf + data_offset;
+	return box_header;
+}
+
+__attribute__((warn_unused_result))
+const void *basket_flat_box_ptr(const void *buf, const size_t size, const box_u32_t box_index, ssize_t *box_size)
+{
+	const char *data;
+
+	if (NULL == basket_flat_box_find(buf, size, box_index, box_size, &data)) {
+		return NULL;
+	}
+
+	return data;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_flat_box_verify(const void *buf, const size_t size, const box_u32_t box_index)
+{
+	const basket_send_header_t *basket_buf_header = buf;
+	const box_dump_t           *box_header;
+	const char                 *data;
+	ssize_t                    box_size;
+	checksum_stream_t          checksum;
+	checksum_t                 calculated_sum;
+
+	box_header = basket_flat_box_find(buf, size, box_index, &box_size, &data);
+	if (box_size < 0) {
+		return -EINVAL;
+	}
+
+	/* An empty box has nothing to verify */
+	if (NULL == box_header) {
+		return A_OK;
+	}
+
+	if (0 != checksum_stream_init_alg(&checksum, basket_buf_header->checksum_alg)) {
+		DE("Wrong buffer header: unknown checksum algorithm %u\n", basket_buf_header->checksum_alg);
+		return -EINVAL;
+	}
+
+	checksum_stream_update(&checksum, data, box_size);
+	if (0 != checksum_stream_final(&checksum, &calculated_sum) || box_header->box_checksum != calculated_sum) {
+		DE("Wrong checksum of box[%u]: expected %X but it is %X\n", box_index, box_header->box_checksum, calculated_sum);
+		return -EINVAL;
+	}
+
+	return A_OK;
+}
+
+/* This is an internal function: count the boxes with data, they are the only boxes serialized */
+__attribute__((warn_unused_result, pure))
+static uint32_t basket_boxes_to_dump(const basket_t *basket, size_t *data_size)
+{
+	box_u32_t box_index;
+	uint32_t  boxes_to_dump = 0;
+
+	*data_size = 0;
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		const box_t *box = basket->boxes[box_index];
+
+		if (NULL == box || 0 == bx_used_take(box)) {
+			continue;
+		}
+
+		*data_size += bx_used_take(box);
+		boxes_to_dump++;
+	}
+
+	return boxes_to_dump;
+}
+
+__attribute__((warn_unused_result))
+int basket_iovec_num(const void *basket)
+{
+	const basket_t *_basket  = basket;
+	size_t         data_size;
+	TESTP_ABORT(_basket);
+
+	/* The basket header, then a header and data per box, then the key/value dump */
+	return 1 + 2 * basket_boxes_to_dump(_basket, &data_size) + (_basket->zhash ? 1 : 0);
+}
+
+__attribute__((warn_unused_result))
+int basket_to_iovec(const void *basket, struct iovec *iov, const int iov_max, void **headers)
+{
+	const basket_t       *_basket            = basket;
+	box_u32_t            box_index;
+	uint32_t             boxes_to_dump;
+	size_t               data_size;
+	size_t               zsize               = 0;
+	size_t               headers_size;
+	int                  iov_num             = 0;
+	char                 *headers_buf;
+	box_dump_t           *box_dump_header_p;
+	basket_send_header_t *basket_buf_header_p;
+	checksum_stream_t    checksum;
+	checksum_t           box_checksum;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(iov);
+	TESTP_ABORT(headers);
+
+	if (iov_max < basket_iovec_num(_basket)) {
+		DE("Not enough segments: %d, required %d\n", iov_max, basket_iovec_num(_basket));
+		return -ENOSPC;
+	}
+
+	boxes_to_dump = basket_boxes_to_dump(_basket, &data_size);
+
+	if (_basket->zhash) {
+		zsize = zhash_to_buf_allocation_size(_basket->zhash);
+	}
+
+	/* All the headers and the key/value dump in one buffer; the box data is not here */
+	headers_size = sizeof(basket_send_header_t) + boxes_to_dump * sizeof(box_dump_t) + zsize;
+	headers_buf = malloc(headers_size);
+	TESTP(headers_buf, -ENOMEM);
+
+	basket_buf_header_p = (basket_send_header_t *)headers_buf;
+	basket_buf_header_p->watermark = WATERMARK_BASKET;
+	basket_buf_header_p->checksum = 0;
+	basket_buf_header_p->ticket = _basket->ticket;
+	basket_buf_header_p->total_len = sizeof(basket_send_header_t) + boxes_to_dump * sizeof(box_dump_t) + data_size;
+	basket_buf_header_p->boxes_used = _basket->boxes_used;
+	basket_buf_header_p->boxes_dumped = boxes_to_dump;
+	basket_buf_header_p->ztable_buf_size = zsize;
+	basket_buf_header_p->align_log2 = 0;
+	basket_buf_header_p->checksum_alg = _basket->checksum_alg;
+	basket_buf_header_p->compress = BOX_COMPRESS_RAW;
+	basket_buf_header_p->flags = 0;
+
+	iov[iov_num].iov_base = basket_buf_header_p;
+	iov[iov_num].iov_len = sizeof(basket_send_header_t);
+	iov_num++;
+
+	/* The checksum is the same as of the flat buffer: the header from 'ticket' and the box headers */
+	if (0 != basket_checksum_start(&checksum, basket_buf_header_p)) {
+		abort();
+	}
+
+	box_dump_header_p = (box_dump_t *)(headers_buf + sizeof(basket_send_header_t));
+
+	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
+		const box_t *box = _basket->boxes[box_index];
+
+		if (NULL == box || 0 == bx_used_take(box)) {
+			continue;
+		}
+
+		/* The algorithm is validated when set: this call can not fail; only the checksum cache of the box is written,
+		   and it is safe to do from many threads (see ::bx_checksum_set()) */
+		if (A_OK != bx_checksum_get((box_t *)box, _basket->checksum_alg, &box_checksum)) {
+			abort();
+		}
+
+		box_dump_header_p->watermark = WATERMARK_BOX;
+		box_dump_header_p->box_index = box_index;
+		box_dump_header_p->box_size = bx_used_take(box);
+		box_dump_header_p->box_checksum = box_checksum;
+
+		iov[iov_num].iov_base = box_dump_header_p;
+		iov[iov_num].iov_len = sizeof(box_dump_t);
+		iov_num++;
+
+		/* The box data itself: no copy */
+		iov[iov_num].iov_base = bx_data_take(box);
+		iov[iov_num].iov_len = bx_used_take(box);
+		iov_num++;
+
+		checksum_stream_update(&checksum, (const char *)box_dump_header_p, sizeof(box_dump_t));
+
+		box_dump_header_p++;
+	}
+
+	if (0 != checksum_stream_final(&checksum, &basket_buf_header_p->checksum)) {
+		DE("Failed to calculate the checksum\n");
+		abort();
+	}
+
+	if (_basket->zhash) {
+		size_t written;
+
+		if (0 != zhash_to_buf_into(_basket->zhash, (char *)box_dump_header_p, zsize, &written, _basket->checksum_alg)) {
+			DE("Could not dump the key/value table\n");
+			free(headers_buf);
+			ABORT_OR_RETURN(-ENOMEM);
+		}
+
+		iov[iov_num].iov_base = box_dump_header_p;
+		iov[iov_num].iov_len = written;
+		iov_num++;
+	}
+
+	*headers = headers_buf;
+	return iov_num;
+}
+
+__attribute__((warn_unused_result))
+ssize_t basket_writev(int fd, const void *basket)
+{
+	struct iovec *iov;
+	void         *headers;
+	int          iov_num;
+	int          iov_index = 0;
+	ssize_t      total     = 0;
+
+	TESTP_ABORT(basket);
+
+	iov_num = basket_iovec_num(basket);
+	iov = malloc(iov_num * sizeof(struct iovec));
+	TESTP(iov, -ENOMEM);
+
+	iov_num = basket_to_iovec(basket, iov, iov_num, &headers);
+	if (iov_num < 0) {
+		free(iov);
+		return iov_num;
+	}
+
+	while (iov_index < iov_num) {
+		ssize_t written = writev(fd, iov + iov_index, MIN(iov_num - iov_index, IOV_MAX));
+
+		if (written < 0) {
+			struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+
+			if (EINTR == errno) {
+				continue;
+			}
+
+			/* A non-blocking descriptor: wait until it can take more; an interrupted wait is retried as the write */
+			if ((EAGAIN == errno || EWOULDBLOCK == errno) && (poll(&pfd, 1, -1) >= 0 || EINTR == errno)) {
+				continue;
+			}
+
+			DE("Could not write the basket: %s\n", strerror(errno));
+			total = -errno;
+			break;
+		}
+
+		total += written;
+
+		/* Skip the segments written; the segment written partially is adjusted */
+		while (iov_index < iov_num && (size_t)written >= iov[iov_index].iov_len) {
+			written -= iov[iov_index].iov_len;
+			iov_index++;
+		}
+
+		if (written > 0) {
+			iov[iov_index].iov_base = (char *)iov[iov_index].iov_base + written;
+			iov[iov_index].iov_len -= written;
+		}
+	}
+
+	free(headers);
+	free(iov);
+	return total;
+}
+
 __attribute__((warn_unused_result))
 void *basket_from_buf(void *buf, size_t size)
 {
@@ -758,9 +1625,17 @@ void *basket_from_buf(void *buf, size_t size)
 	basket_t             *basket;
 	basket_send_header_t *basket_buf_header;
 	char                 *buf_char          = buf;
+	checksum_stream_t    checksum;
+	checksum_stream_t    box_checksum;
+	checksum_t           calculated_sum     = 0;
 
 	TESTP_ABORT(buf);
 
+	/* The version 2 buffer starts with its magic, see basket_v2.h */
+	if (YES == basket_buf_is_v2(buf, (0 == size) ? BASKET_V2_MAGIC_SIZE : size)) {
+		return basket_from_buf_v2(buf, size);
+	}
+
 	/* If the user doesn't pass the buffer size, we just ignore this fact and assign it from the buffer itself */
 	if (0 == size) {
 		size = basket_get_size_from_flat_buffer(buf);
@@ -775,98 +1650,388 @@ void *basket_from_buf(void *buf, size_t size)
 	/* This must be the header of the basket flattern buffer */
 	basket_buf_header = (basket_send_header_t *)buf;
 	/* Let's check that there is a predefined 'watermask'; if not, it is not a basked */
-	if (WATERMARK_BASKET != basket_buf_header->watermark) {
+	if (!BASKET_WATERMARK_VALID(basket_buf_header->watermark)) {
 		DE("Wrong buffer: wrong watermark. Expected %X but it is %X\n", WATERMARK_BASKET, basket_buf_header->watermark);
 		ABORT_OR_RETURN(NULL);
 	}
 
-	/* Test the buffer checksum */
-	if (0 != basket_checksum_test(basket_buf_header)) {
-		DE("A wrong buffer, checksum not match\n");
+	if (basket_buf_header->total_len < sizeof(basket_send_header_t) ||
+		(size_t)basket_buf_header->total_len + basket_buf_header->ztable_buf_size > size) {
+		DE("Wrong buffer: the header claims %u + %u bytes, the buffer is %zu bytes\n",
+		   (uint32_t)basket_buf_header->total_len, basket_buf_header->ztable_buf_size, size);
 		return NULL;
 	}
 
+	if (basket_buf_header->align_log2 > BASKET_ALIGN_LOG2_MAX) {
+		DE("Wrong buffer: wrong box data alignment %u\n", 1U << basket_buf_header->align_log2);
+		return NULL;
+	}
+
+	if (basket_buf_header->compress > BOX_COMPRESS_LZ) {
+		DE("Wrong buffer: unknown compression %u\n", basket_buf_header->compress);
+		return NULL;
+	}
+
+	/* The box checksums are tested while the data copied, not in a separate pass over the buffer */
+	if (0 != basket_checksum_start(&checksum, basket_buf_header)) {
+		DE("Wrong buffer: unknown checksum algorithm %u\n", basket_buf_header->checksum_alg);
+		return NULL;
+	}
 
 	basket = basket_new();
 	TESTP(basket, NULL);
+	basket->checksum_alg = basket_buf_header->checksum_alg;
 
-	/* Now, we need to pre-allocate ->box pointers; grow it until we have enough */
-	while (basket_buf_header->boxes_used > basket->boxes_allocated) {
-		if (A_OK != basket_grow_box_pointers(basket)) {
-			DE("Could not grow ->bufs pointers\n");
-			ABORT_OR_RETURN(NULL);
-		}
+	/* The number of boxes is known: allocate the ->box pointers once */
+	if (A_OK != basket_reserve_boxes(basket, basket_buf_header->boxes_used)) {
+		DE("Could not allocate ->boxes pointers\n");
+		ABORT_OR_RETURN(NULL);
 	}
 
+	/* Create all boxes empty; the dumped boxes are filled below. The basket can be released at any step */
+	for (box_index = 0; box_index < basket_buf_header->boxes_used; box_index++) {
+		basket->boxes[box_index] = bx_new(0);
+		TESTP_ABORT(basket->boxes[box_index]);
+	}
+
+	basket->ticket = basket_buf_header->ticket;
+	basket->boxes_used = basket_buf_header->boxes_used;
+
 	buf_offset = sizeof(basket_send_header_t);
 
 	for (box_index = 0; box_index < basket_buf_header->boxes_dumped; box_index++) {
 
 		/* Advance the pointer to the next box header */
 		box_dump_t *box_dump_header_p = (box_dump_t *)(buf_char + buf_offset);
+		size_t     box_header_size;
+
+		if (buf_offset + sizeof(box_dump_t) > basket_buf_header->total_len) {
+			DE("Wrong box[%u]: out of the buffer\n", box_index);
+			goto err;
+		}
 
 		/* Test watermark */
 		if (WATERMARK_BOX != box_dump_header_p->watermark) {
 			DE("Wrong box[%u]: wrong watermark. Expected %X but it is %X\n", box_index, WATERMARK_BOX, box_dump_header_p->watermark);
-			if (0 != basket_release(basket)) {
-				DE("Could not release basket\n");
-			}
-			ABORT_OR_RETURN(NULL);
+			goto err;
 		}
 
-		/* Advance pointer: right after the box header is the box data */
-		buf_offset += sizeof(box_dump_t);
+		if (box_dump_header_p->box_index >= basket_buf_header->boxes_used) {
+			DE("Wrong box[%u]: index %u is out of range (%u)\n", box_index, box_dump_header_p->box_index, basket_buf_header->boxes_used);
+			goto err;
+		}
+
+		/* Every box is dumped once: its data and its checksum are the box header */
+		if (bx_used_take(basket->boxes[box_dump_header_p->box_index]) > 0) {
+			DE("Wrong box[%u]: index %u is dumped twice\n", box_index, box_dump_header_p->box_index);
+			goto err;
+		}
+
+		/* Advance pointer: right after the box header and its padding is the box data */
+		box_header_size = sizeof(box_dump_t) + BASKET_ALIGN_PAD(buf_offset + sizeof(box_dump_t), basket_buf_header->align_log2);
+		checksum_stream_update(&checksum, buf_char + buf_offset, box_header_size);
+		buf_offset += box_header_size;
 
-		/* If there no data, we do not even call the box creation, and the box pointer stays NULL */
+		/* If there no data, we do not even call the box creation, and the box stays empty */
 		if (0 == box_dump_header_p->box_size) {
 			continue;
 		}
 
-		/* Test that the memory area we pass to box_new_from_data_by_index() is in boundaries of the buf */
-		if (buf_offset + box_dump_header_p->box_size > size) {
-			DE("Wrong: The size of box[%u] overhead size of the whole buffer: %u = buf_offset (%u) + box_dump_header->box_size (%u) > size (%zu)\n",
-			   box_index, buf_offset + box_dump_header_p->box_size, buf_offset, box_dump_header_p->box_size, size);
-			abort();
-		}
+		/* The algorithm is tested above: this call can not fail */
+		if (0 != checksum_stream_init_alg(&box_checksum, basket_buf_header->checksum_alg)) {
+			abort();
+		}
+
+		/* Test that the memory area we pass to box_new_from_data_by_index() is in boundaries of the buf */
+		if (buf_offset + box_dump_header_p->box_size > basket_buf_header->total_len) {
+			DE("Wrong: The size of box[%u] overhead size of the whole buffer: %u = buf_offset (%u) + box_dump_header->box_size (%u) > total_len (%u)\n",
+			   box_index, buf_offset + box_dump_header_p->box_size, buf_offset, box_dump_header_p->box_size, (uint32_t)basket_buf_header->total_len);
+			goto err;
+		}
+
+		if (BOX_COMPRESS_LZ == basket_buf_header->compress) {
+			box_t *box = basket->boxes[box_dump_header_p->box_index];
+
+			/* The box checksum is of the restored data */
+			if (A_OK != basket_box_uncompress(box, buf_char + buf_offset, box_dump_header_p->box_size)) {
+				DE("Could not restore the compressed box[%u]\n", box_index);
+				goto err;
+			}
+
+			checksum_stream_update(&box_checksum, bx_data_take(box), bx_used_take(box));
+		} else if (A_OK != box_new_from_data_by_index(basket,
+													  box_dump_header_p->box_index,
+													  buf_char + buf_offset,
+													  box_dump_header_p->box_size,
+													  &box_checksum)) {
+			/* Fill the box */
+			DE("Adding a buffer size (%u) to tail of box (%u) failed\n", box_dump_header_p->box_size, box_index);
+			goto err;
+		}
+
+		if (0 != checksum_stream_final(&box_checksum, &calculated_sum)) {
+			DE("Failed to calculate the box checksum");
+			abort();
+		}
+
+		/* The box checksum is always set */
+		if (box_dump_header_p->box_checksum != calculated_sum) {
+			DE("Wrong checksum of box[%u]: expected %X but it is %X\n", box_dump_header_p->box_index, box_dump_header_p->box_checksum, calculated_sum);
+			goto err;
+		}
+
+		/* The box is sent again without hashing, if not changed */
+		bx_checksum_set(basket->boxes[box_dump_header_p->box_index], basket_buf_header->checksum_alg, calculated_sum);
+
+		/* Advance the offset */
+		buf_offset += box_dump_header_p->box_size;
+	}
+
+	/* The checksum covers exactly the header and the boxes */
+	if (buf_offset != basket_buf_header->total_len) {
+		DE("Wrong buffer: the boxes take %u bytes, the header claims %u\n", buf_offset, (uint32_t)basket_buf_header->total_len);
+		goto err;
+	}
+
+	/* The buffer checksum is not set if the header was sent before the box headers were known */
+	if (!(basket_buf_header->flags & BASKET_HEADER_NO_CHECKSUM)) {
+		if (0 != checksum_stream_final(&checksum, &calculated_sum)) {
+			DE("Failed to calculate the final buffer checksum");
+			abort();
+		}
+
+		if (basket_buf_header->checksum != calculated_sum) {
+			DE("Wrong checksum: expected %X but it is %X\n", basket_buf_header->checksum, calculated_sum);
+			DE("A wrong buffer, checksum not match\n");
+			goto err;
+		}
+	}
+
+	/*** Restore zhash, is presents ***/
+	if (basket_buf_header->ztable_buf_size > 0) {
+		basket->zhash = zhash_from_buf(buf_char + buf_offset, basket_buf_header->ztable_buf_size);
+		if (NULL == basket->zhash) {
+			DE("Wrong buffer: could not restore the key/value dump\n");
+			goto err;
+		}
+		buf_offset += basket_buf_header->ztable_buf_size;
+	}
+
+	/* The boxes are filled directly: count them once */
+	basket_sizes_recount(basket);
+	return basket;
+
+err:
+	if (0 != basket_release(basket)) {
+		DE("Could not release basket\n");
+	}
+	return NULL;
+}
+
+/* This is an internal function: open the view; the checksums are tested only if 'test_checksum' is YES */
+__attribute__((warn_unused_result))
+static void *basket_view_open(const void *buf, size_t size, const int test_checksum)
+{
+	uint32_t                   box_index;
+	size_t                     buf_offset;
+	basket_t                   *view;
+	box_t                      *view_boxes;
+	const basket_send_header_t *basket_buf_header;
+	const char                 *buf_char          = buf;
+
+	TESTP_ABORT(buf);
+
+	/* If the user doesn't pass the buffer size, take it from the buffer itself */
+	if (0 == size) {
+		size = basket_get_size_from_flat_buffer((void *)buf);
+	}
+
+	if (size < sizeof(basket_send_header_t)) {
+		DE("Wrong size: less than size of structure basket_send_header_t\n");
+		return NULL;
+	}
+
+	basket_buf_header = (const basket_send_header_t *)buf;
+	if (!BASKET_WATERMARK_VALID(basket_buf_header->watermark)) {
+		DE("Wrong buffer: wrong watermark. Expected %X but it is %X\n", WATERMARK_BASKET, basket_buf_header->watermark);
+		return NULL;
+	}
+
+	/* The boxes and the key/value dump must be inside of the buffer */
+	if ((size_t)basket_buf_header->total_len + basket_buf_header->ztable_buf_size > size) {
+		DE("Wrong buffer: the header claims %zu bytes, the buffer is %zu bytes\n",
+		   (size_t)basket_buf_header->total_len + basket_buf_header->ztable_buf_size, size);
+		return NULL;
+	}
+
+	/* The view boxes point into the buffer: the data must be there as is */
+	if (BOX_COMPRESS_RAW != basket_buf_header->compress) {
+		DE("The flat buffer is compressed, restore it with basket_from_buf()\n");
+		return NULL;
+	}
+
+	if (YES == test_checksum && 0 != basket_checksum_test(basket_buf_header)) {
+		DE("A wrong buffer, checksum not match\n");
+		return NULL;
+	}
+
+	if (basket_buf_header->align_log2 > BASKET_ALIGN_LOG2_MAX) {
+		DE("Wrong buffer: wrong box data alignment %u\n", 1U << basket_buf_header->align_log2);
+		return NULL;
+	}
+
+	/* One allocation: the basket, the array of box pointers and the boxes */
+	view = malloc(sizeof(basket_t) + basket_buf_header->boxes_used * (sizeof(void *) + sizeof(box_t)));
+	TESTP(view, NULL);
+	memset(view, 0, sizeof(basket_t) + basket_buf_header->boxes_used * (sizeof(void *) + sizeof(box_t)));
+
+	view->flags = BASKET_FLAG_VIEW;
+	view->ticket = basket_buf_header->ticket;
+	view->checksum_alg = basket_buf_header->checksum_alg;
+	view->flat_buf = buf_char;
+	view->flat_buf_size = size;
+	view->boxes_used = basket_buf_header->boxes_used;
+	view->boxes_allocated = basket_buf_header->boxes_used;
+
+	if (basket_buf_header->boxes_used > 0) {
+		view->boxes = (void **)(view + 1);
+		view_boxes = (box_t *)(view->boxes + basket_buf_header->boxes_used);
+
+		/* Every box starts empty; the boxes dumped with data are set below */
+		for (box_index = 0; box_index < basket_buf_header->boxes_used; box_index++) {
+			view->boxes[box_index] = view_boxes + box_index;
+		}
+	}
+
+	buf_offset = sizeof(basket_send_header_t);
+
+	for (box_index = 0; box_index < basket_buf_header->boxes_dumped; box_index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(buf_char + buf_offset);
+		const size_t     pad                = BASKET_ALIGN_PAD(buf_offset + sizeof(box_dump_t), basket_buf_header->align_log2);
+
+		if (buf_offset + sizeof(box_dump_t) > basket_buf_header->total_len ||
+			buf_offset + sizeof(box_dump_t) + pad + box_dump_header_p->box_size > basket_buf_header->total_len) {
+			DE("Wrong box[%u]: out of the buffer\n", box_index);
+			goto err;
+		}
+
+		if (WATERMARK_BOX != box_dump_header_p->watermark) {
+			DE("Wrong box[%u]: wrong watermark. Expected %X but it is %X\n", box_index, WATERMARK_BOX, box_dump_header_p->watermark);
+			goto err;
+		}
+
+		if (box_dump_header_p->box_index >= basket_buf_header->boxes_used) {
+			DE("Wrong box[%u]: index %u is out of range (%u)\n", box_index, box_dump_header_p->box_index, basket_buf_header->boxes_used);
+			goto err;
+		}
+
+		/* Every box is dumped once, as in ::basket_from_buf() */
+		if (bx_used_take(view->boxes[box_dump_header_p->box_index]) > 0) {
+			DE("Wrong box[%u]: index %u is dumped twice\n", box_index, box_dump_header_p->box_index);
+			goto err;
+		}
+
+		buf_offset += sizeof(box_dump_t) + pad;
+
+		/* The box borrows the buffer memory: no copy, and it is never released by the box */
+		if (box_dump_header_p->box_size > 0 &&
+			A_OK != bx_adopt(view->boxes[box_dump_header_p->box_index],
+							 (void *)(buf_char + buf_offset), box_dump_header_p->box_size, NULL)) {
+			DE("Could not set box[%u] memory\n", box_index);
+			goto err;
+		}
+
+		buf_offset += box_dump_header_p->box_size;
+	}
+
+	basket_sizes_recount(view);
+	return view;
+
+err:
+	basket_free_mem(view, __func__, __LINE__);
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+void *basket_view_from_buf(const void *buf, size_t size)
+{
+	return basket_view_open(buf, size, YES);
+}
+
+__attribute__((warn_unused_result))
+void *basket_view_from_buf_trusted(const void *buf, size_t size)
+{
+	return basket_view_open(buf, size, NO);
+}
+
+__attribute__((warn_unused_result))
+void *basket_view_materialize(const void *view)
+{
+	const basket_t *_view = view;
+	TESTP_ABORT(_view);
+
+	if (!(_view->flags & BASKET_FLAG_VIEW)) {
+		DE("The basket %p is not a view\n", _view);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	return basket_from_buf((void *)_view->flat_buf, _view->flat_buf_size);
+}
 
-		/* Create a new box */
-		if (A_OK != box_new_from_data_by_index(basket,
-											   box_dump_header_p->box_index,
-											   buf_char + buf_offset,
-											   box_dump_header_p->box_size)) {
-			DE("Adding a buffer size (%u) to tail of box (%u) failed\n", box_dump_header_p->box_size, box_index);
+__attribute__((warn_unused_result, pure))
+int basket_is_view(const void *basket)
+{
+	const basket_t *_basket = basket;
+	TESTP_ABORT(_basket);
+	return (_basket->flags & BASKET_FLAG_VIEW) ? YES : NO;
+}
 
+__attribute__((warn_unused_result))
+const void *basket_view_box_aligned(const void *view, const box_u32_t box_num, const size_t align, size_t *box_size)
+{
+	const basket_t *_view = view;
+	const box_t    *box;
+	const char     *data;
 
-			if (0 != basket_release(basket)) {
-				DE("Could not release basket\n");
-			}
-			ABORT_OR_RETURN(NULL);
-		}
+	TESTP_ABORT(_view);
+	TESTP_ABORT(box_size);
 
-		/* Advance the offset */
-		buf_offset += box_dump_header_p->box_size;
+	*box_size = 0;
 
-		/* Increase number of used boxes */
-		// basket->boxes_used++;
+	if (NO == basket_is_view(_view) || 0 == align || 0 != (align & (align - 1))) {
+		DE("Not a view, or wrong alignment %zu\n", align);
+		return NULL;
 	}
 
-	/* Additional iteration: create boxes from 0 to boxes_used; they must be allocated, otherwise crash unavoidable */
-	for (box_index = 0; box_index < basket_buf_header->boxes_used; box_index++) {
-		if (NULL == basket->boxes[box_index]) {
-			basket->boxes[box_index] = bx_new(0);
-			TESTP_ABORT(basket->boxes[box_index]);
-		}
+	box = basket_get_box(_view, box_num);
+	if (NULL == box || 0 == bx_used_take(box)) {
+		return NULL;
 	}
 
-	basket->boxes_used = basket_buf_header->boxes_used;
+	/* The data is in the flat buffer: aligned if the buffer was aligned when created and received */
+	data = bx_data_take(box);
+	if (0 != ((uintptr_t)data & (align - 1))) {
+		DDD("Box[%u] data is not aligned to %zu\n", box_num, align);
+		return NULL;
+	}
 
-	/*** Restore zhash, is presents ***/
-	if (basket_buf_header->ztable_buf_size > 0) {
-		basket->zhash = zhash_from_buf(buf_char + buf_offset, basket_buf_header->ztable_buf_size);
-		buf_offset += basket_buf_header->ztable_buf_size;
+	*box_size = bx_used_take(box);
+	return data;
+}
+
+/* This is an internal function: find the value in the key/value dump of the view flat buffer */
+__attribute__((warn_unused_result))
+static void *basket_view_keyval_find(const basket_t *view, const uint64_t key_int64, ssize_t *val_size)
+{
+	const basket_send_header_t *basket_buf_header = (const basket_send_header_t *)view->flat_buf;
+
+	if (0 == basket_buf_header->ztable_buf_size) {
+		*val_size = -1;
+		return NULL;
 	}
 
-	return basket;
+	return zhash_flat_find_by_int(view->flat_buf + basket_buf_header->total_len,
+								  basket_buf_header->ztable_buf_size, key_int64, val_size);
 }
 
 __attribute__((warn_unused_result))
@@ -940,35 +2105,37 @@ static ret_t box_add_new(void *basket)
 {
 	basket_t *_basket = basket;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 
-	/* If no boxes, we should allocate - call 'grow' func */
-	if (NULL == _basket->boxes) {
-		if (A_OK != basket_grow_box_pointers(_basket)) {
-			DE("Can not grow ->boxes pointers\n");
-			ABORT_OR_RETURN(-1);
-		}
-	}
-
-	/* Here it MUST be not NULL */
-	if (NULL == _basket->boxes) {
+	/* The array grows geometrically: most calls do not reallocate */
+	if (A_OK != basket_box_pointers_assure(_basket, _basket->boxes_used + 1)) {
+		DE("Could not grow basket->boxes\n");
 		ABORT_OR_RETURN(-1);
 	}
 
-	if (_basket->boxes_used == _basket->boxes_allocated) {
-		if (A_OK != basket_grow_box_pointers(_basket)) {
-			DE("Could not grow basket->boxes\n");
-			ABORT_OR_RETURN(-1);
-		}
-	}
-
 	/* The 'buf_new()' allocates a new box and cleans it, no need to clean */
 	_basket->boxes[_basket->boxes_used] = bx_new(0);
+	basket_sizes_box_in(_basket, _basket->boxes[_basket->boxes_used]);
 	_basket->boxes_used++;
 	DDD("Allocated a new box, set at index %u\n", _basket->boxes_used - 1);
 	bx_dump(_basket->boxes[_basket->boxes_used - 1], "box_add_new(): added a new box, must be all 0/NULL");
 	return A_OK;
 }
 
+/* This is an internal function: remove the last box, just added by box_add_new(), when it can not be filled */
+static void box_drop_last(basket_t *basket)
+{
+	box_t *box = basket->boxes[basket->boxes_used - 1];
+
+	basket_sizes_box_out(basket, box);
+	basket->boxes_used--;
+	basket->boxes[basket->boxes_used] = NULL;
+
+	if (A_OK != bx_free(box)) {
+		DE("Could not release box\n");
+	}
+}
+
 /* Create a new box in the basket and add data */
 /* Testing function: basket_test.c::box_new_from_data_test() */
 __attribute__((warn_unused_result))
@@ -1016,20 +2183,126 @@ ssize_t box_new(void *basket, const void *buffer, const box_u32_t buffer_size)
 	}
 	DDD("Going to add data in the tail of a new buf, new data size is %u\n", buffer_size);
 
+	basket_sizes_box_out(_basket, box);
 	if (A_OK != bx_add(box, buffer, buffer_size)) {
 		DE("Could not add data into the last (new) box: new data size %u\n", buffer_size);
 		ABORT_OR_RETURN(-1);
 	}
 
+	basket_sizes_box_in(_basket, box);
+
 	bx_dump(box, "box_new_from_data(): Added new data");
 
 	/* Return the number of the new box */
 	return basket_get_last_box_index(_basket);
 }
 
+/* Create a new box in the basket and adopt the buffer, no copy */
+__attribute__((warn_unused_result))
+ssize_t box_new_ref(void *basket, void *buffer, const box_u32_t buffer_size, box_free_fn_t free_fn)
+{
+	basket_t *_basket = basket;
+	ssize_t  box_index;
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(buffer);
+
+	if (0 == buffer_size) {
+		DE("Wrong: buffer != NULL && buffer_size == 0\n");
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Create an empty box */
+	box_index = box_new(_basket, NULL, 0);
+	if (box_index < 0) {
+		DE("Can not add another box into Basket\n");
+		ABORT_OR_RETURN(-1);
+	}
+
+	if (A_OK != box_adopt(_basket, box_index, buffer, buffer_size, free_fn)) {
+		DE("Could not adopt buffer into the new box[%zd]\n", box_index);
+		/* The buffer stays with the caller, the basket is as before */
+		box_drop_last(_basket);
+		ABORT_OR_RETURN(-1);
+	}
+
+	return box_index;
+}
+
+__attribute__((warn_unused_result))
+ret_t box_adopt(void *basket, const box_u32_t box_num, void *buffer, const size_t buffer_size, box_free_fn_t free_fn)
+{
+	basket_t *_basket = basket;
+	box_t    *box;
+	ret_t    rc;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
+	TESTP_ABORT(buffer);
+
+	if (box_num >= _basket->boxes_used) {
+		DE("Asked box is out of range: asked box %u, number of boxes is %u\n", box_num, _basket->boxes_used);
+		ABORT_OR_RETURN(-1);
+	}
+
+	box = basket_get_box(_basket, box_num);
+	if (NULL == box) {
+		DE("Could not get box pointer - stopping\n");
+		ABORT_OR_RETURN(-1);
+	}
+
+	basket_sizes_box_out(_basket, box);
+	rc = bx_adopt(box, buffer, buffer_size, free_fn);
+	basket_sizes_box_in(_basket, box);
+	return rc;
+}
+
+/* Create a new box in the basket sharing the data of another box, no copy */
+__attribute__((warn_unused_result))
+ssize_t box_new_shared(void *basket, void *src_basket, const box_u32_t src_box_num)
+{
+	basket_t *_src_basket = src_basket;
+	box_t    *src_box;
+	ssize_t  box_index;
+	TESTP_ABORT(basket);
+	TESTP_ABORT(_src_basket);
+	BASKET_VIEW_TEST((basket_t *)basket, -1);
+
+	if (src_box_num >= _src_basket->boxes_used) {
+		DE("Asked box is out of range: asked box %u, number of boxes is %u\n", src_box_num, _src_basket->boxes_used);
+		ABORT_OR_RETURN(-1);
+	}
+
+	/* Create an empty box */
+	box_index = box_new(basket, NULL, 0);
+	if (box_index < 0) {
+		DE("Can not add another box into Basket\n");
+		ABORT_OR_RETURN(-1);
+	}
+
+	/* Get the source box after the new box added: the basket and src_basket can be the same */
+	src_box = basket_get_box(_src_basket, src_box_num);
+	if (NULL == src_box) {
+		DE("Could not get box pointer - stopping\n");
+		box_drop_last(basket);
+		ABORT_OR_RETURN(-1);
+	}
+
+	basket_sizes_box_out(basket, basket_get_box(basket, box_index));
+	if (A_OK != bx_share(basket_get_box(basket, box_index), src_box)) {
+		DE("Could not share box[%u] data with the new box[%zd]\n", src_box_num, box_index);
+		basket_sizes_box_in(basket, basket_get_box(basket, box_index));
+		box_drop_last(basket);
+		ABORT_OR_RETURN(-1);
+	}
+
+	basket_sizes_box_in(basket, basket_get_box(basket, box_index));
+
+	return box_index;
+}
+
 /* Set a box in certain position; we need this function when restore basket from a flat buffer */
 __attribute__((warn_unused_result))
-static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const void *buffer, const box_u32_t buffer_size)
+static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const void *buffer, const box_u32_t buffer_size,
+										checksum_stream_t *checksum)
 {
 	basket_t *_basket = basket;
 	box_t    *box;
@@ -1037,10 +2310,8 @@ static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const
 	TESTP_ABORT(buffer);
 
 	/* Add a new box */
-	while (_basket->boxes_allocated < box_index) {
-		if (0 != basket_grow_box_pointers(_basket)) {
-			ABORT_OR_RETURN(-1);
-		}
+	if (A_OK != basket_box_pointers_assure(_basket, (size_t)box_index + 1)) {
+		ABORT_OR_RETURN(-1);
 	}
 
 	if (NULL == _basket->boxes[box_index]) {
@@ -1056,11 +2327,23 @@ static ret_t box_new_from_data_by_index(void *basket, box_u32_t box_index, const
 	}
 
 	DDD("Going to add data in the tail of a the buf[%u], new data size is %u\n", box_index, buffer_size);
-	if (A_OK != bx_add(box, buffer, buffer_size)) {
+	if (NULL == checksum && A_OK != bx_add(box, buffer, buffer_size)) {
 		DE("Could not add data into the new box[%u]: new data size %u\n", box_index, buffer_size);
 		ABORT_OR_RETURN(-1);
 	}
 
+	/* The data is read once: the checksum is calculated while it copied */
+	if (checksum) {
+		if (A_OK != bx_room_assure(box, buffer_size)) {
+			DE("Could not add data into the new box[%u]: new data size %u\n", box_index, buffer_size);
+			ABORT_OR_RETURN(-1);
+		}
+
+		checksum_stream_copy(checksum, (char *)bx_data_take(box) + bx_used_take(box), buffer, buffer_size);
+		bx_used_inc(box, buffer_size);
+		bx_members_set(box, 1);
+	}
+
 	bx_dump(box, "box_new_from_data(): Added new data");
 
 	/* Now set the box at given index */
@@ -1076,7 +2359,9 @@ ret_t box_add(void *basket, const box_u32_t box_num, const void *buffer, const s
 {
 	basket_t *_basket = basket;
 	box_t    *box;
+	ret_t    rc;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 	TESTP_ABORT(buffer);
 
 	if (box_num > _basket->boxes_used) {
@@ -1090,7 +2375,10 @@ ret_t box_add(void *basket, const box_u32_t box_num, const void *buffer, const s
 		ABORT_OR_RETURN(-1);
 	}
 
-	return bx_add(box, buffer, buffer_size);
+	basket_sizes_box_out(_basket, box);
+	rc = bx_add(box, buffer, buffer_size);
+	basket_sizes_box_in(_basket, box);
+	return rc;
 }
 
 __attribute__((warn_unused_result))
@@ -1098,7 +2386,9 @@ ret_t box_data_replace(void *basket, const box_u32_t box_num, const void *buffer
 {
 	basket_t *_basket = basket;
 	box_t    *box;
+	ret_t    rc;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 	TESTP_ABORT(buffer);
 	if (buffer_size < 1) {
 		DE("The new buffer size must be > 0\n");
@@ -1111,10 +2401,60 @@ ret_t box_data_replace(void *basket, const box_u32_t box_num, const void *buffer
 		ABORT_OR_RETURN(-1);
 	}
 
-	return bx_replace_data(box, buffer, buffer_size);
+	basket_sizes_box_out(_basket, box);
+	rc = bx_replace_data(box, buffer, buffer_size);
+	basket_sizes_box_in(_basket, box);
+	return rc;
 }
 
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
+ret_t box_prepend(void *basket, const box_u32_t box_num, const void *buffer, const size_t buffer_size)
+{
+	basket_t *_basket = basket;
+	box_t    *box;
+	ret_t    rc;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
+	TESTP_ABORT(buffer);
+	if (buffer_size < 1) {
+		DE("The buffer size must be > 0\n");
+		return -EINVAL;
+	}
+
+	box = basket_get_box(_basket, box_num);
+	if (NULL == box) {
+		DE("Could not take pointer for the box (%u) - stopping\n", box_num);
+		ABORT_OR_RETURN(-1);
+	}
+
+	basket_sizes_box_out(_basket, box);
+	rc = bx_prepend(box, buffer, buffer_size);
+	basket_sizes_box_in(_basket, box);
+	return rc;
+}
+
+__attribute__((warn_unused_result))
+ret_t box_headroom_reserve(void *basket, const box_u32_t box_num, const size_t headroom)
+{
+	basket_t *_basket = basket;
+	box_t    *box;
+	ret_t    rc;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
+
+	box = basket_get_box(_basket, box_num);
+	if (NULL == box) {
+		DE("Could not take pointer for the box (%u) - stopping\n", box_num);
+		ABORT_OR_RETURN(-1);
+	}
+
+	basket_sizes_box_out(_basket, box);
+	rc = bx_headroom_reserve(box, headroom);
+	basket_sizes_box_in(_basket, box);
+	return rc;
+}
+
+__attribute__((warn_unused_result))
 void *box_data_ptr(const void *basket, const box_u32_t box_num)
 {
 	const basket_t *_basket = basket;
@@ -1122,6 +2462,9 @@ void *box_data_ptr(const void *basket, const box_u32_t box_num)
 	TESTP_ABORT(_basket);
 	TESTP_ABORT(_basket->boxes);
 
+	/* The view data is the caller's flat buffer, maybe mapped read only: see ::box_data_ptr_const() */
+	BASKET_VIEW_TEST(_basket, NULL);
+
 	if (box_num > _basket->boxes_used) {
 		DE("Asked box (%u) is out of range (%u)\n", box_num, _basket->boxes_used);
 		ABORT_OR_RETURN(NULL);
@@ -1135,6 +2478,32 @@ void *box_data_ptr(const void *basket, const box_u32_t box_num)
 		abort();
 	}
 
+	/* The caller can change the data through the pointer */
+	bx_checksum_invalidate(box);
+	return bx_data_take(box);
+}
+
+__attribute__((warn_unused_result))
+const void *box_data_ptr_const(const void *basket, const box_u32_t box_num)
+{
+	const basket_t *_basket = basket;
+	const box_t    *box;
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(_basket->boxes);
+
+	if (box_num >= _basket->boxes_used) {
+		DE("Asked box (%u) is out of range (%u)\n", box_num, _basket->boxes_used);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	box = basket_get_box(_basket, box_num);
+
+	/* This should not happen never */
+	if (NULL == box) {
+		DE("There is no buffer by asked index: %u\n", box_num);
+		abort();
+	}
+
 	return bx_data_take(box);
 }
 
@@ -1195,9 +2564,10 @@ ssize_t box_data_size(const void *basket, const box_u32_t box_num)
 __attribute__((warn_unused_result))
 ret_t box_data_free(void *basket, const box_u32_t box_num)
 {
-	const basket_t *_basket = basket;
-	box_t          *box;
+	basket_t *_basket = basket;
+	box_t    *box;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -1);
 
 	box = basket_get_box(_basket, box_num);
 
@@ -1206,14 +2576,17 @@ ret_t box_data_free(void *basket, const box_u32_t box_num)
 		return 0;
 	}
 
+	basket_sizes_box_out(_basket, box);
 	return bx_clean_and_reset(box);
 }
 
 __attribute__((warn_unused_result))
 void *box_steal_data(void *basket, const box_u32_t box_num)
 {
-	const basket_t *_basket = basket;
+	basket_t *_basket = basket;
+	void     *data;
 	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, NULL);
 
 	box_t  *box = basket_get_box(_basket, box_num);
 
@@ -1227,7 +2600,10 @@ void *box_steal_data(void *basket, const box_u32_t box_num)
 		return NULL;
 	}
 
-	return bx_data_steal(box);
+	basket_sizes_box_out(_basket, box);
+	data = bx_data_steal(box);
+	basket_sizes_box_in(_basket, box);
+	return data;
 }
 
 void basket_set_ticket(void *basket, uint64_t ticket)
@@ -1237,6 +2613,90 @@ void basket_set_ticket(void *basket, uint64_t ticket)
 	_basket->ticket = ticket;
 }
 
+__attribute__((warn_unused_result))
+ret_t basket_checksum_alg_set(void *basket, const uint8_t alg)
+{
+	basket_t *_basket = basket;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -EINVAL);
+
+	if (alg >= CHECKSUM_ALG_MAX) {
+		DE("Unknown checksum algorithm: %u\n", alg);
+		return -EINVAL;
+	}
+
+	_basket->checksum_alg = alg;
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_compress_set(void *basket, const size_t threshold)
+{
+	basket_t *_basket = basket;
+	TESTP_ABORT(_basket);
+	BASKET_VIEW_TEST(_basket, -EINVAL);
+
+	if (threshold > UINT32_MAX) {
+		DE("Wrong compression threshold: %zu\n", threshold);
+		return -EINVAL;
+	}
+
+	_basket->compress_threshold = (uint32_t)threshold;
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_box_uncompress(void *box, const void *data, const size_t size)
+{
+	box_t                *_box         = box;
+	const box_compress_t *box_compress = data;
+	const char           *payload      = (const char *)data + sizeof(box_compress_t);
+	ssize_t              restored;
+
+	TESTP_ABORT(_box);
+	TESTP_ABORT(data);
+
+	if (size < sizeof(box_compress_t)) {
+		DE("Wrong compressed box: %zu bytes\n", size);
+		return -EINVAL;
+	}
+
+	if (BOX_COMPRESS_RAW == box_compress->method) {
+		if (box_compress->raw_size != size - sizeof(box_compress_t)) {
+			DE("Wrong box: %u bytes claimed, %zu stored\n", (uint32_t)box_compress->raw_size, size - sizeof(box_compress_t));
+			return -EINVAL;
+		}
+
+		if (0 == box_compress->raw_size) {
+			return A_OK;
+		}
+
+		return (A_OK == bx_add(_box, payload, box_compress->raw_size)) ? A_OK : -ENOMEM;
+	}
+
+	if (BOX_COMPRESS_LZ != box_compress->method) {
+		DE("Wrong compressed box: unknown method %u\n", box_compress->method);
+		return -EINVAL;
+	}
+
+	/* Restore directly into the box memory */
+	if (A_OK != bx_room_assure(_box, box_compress->raw_size)) {
+		DE("Could not allocate %u bytes\n", (uint32_t)box_compress->raw_size);
+		return -ENOMEM;
+	}
+
+	restored = lz_block_decompress(payload, size - sizeof(box_compress_t), (char *)bx_data_take(_box) + bx_used_take(_box),
+								   box_compress->raw_size);
+	if (restored != (ssize_t)box_compress->raw_size) {
+		DE("Wrong compressed box: could not restore %u bytes\n", (uint32_t)box_compress->raw_size);
+		return -EINVAL;
+	}
+
+	bx_used_inc(_box, restored);
+	bx_members_set(_box, 1);
+	return A_OK;
+}
+
 __attribute__((warn_unused_result, pure))
 uint64_t basket_get_ticket(void *basket)
 {
@@ -1258,7 +2718,13 @@ size_t basket_get_size_from_flat_buffer(void *flat_buffer)
 {
 	const basket_send_header_t *basket_send_header = (basket_send_header_t *)flat_buffer;
 	TESTP_ABORT(basket_send_header);
-	return basket_send_header->total_len;
+
+	if (YES == basket_buf_is_v2(flat_buffer, BASKET_V2_MAGIC_SIZE)) {
+		const ssize_t size = basket_buf_size_v2(flat_buffer, BASKET_V2_PREFIX_MAX);
+		return (size < 0) ? 0 : (size_t)size;
+	}
+
+	return (size_t)basket_send_header->total_len + basket_send_header->ztable_buf_size + BASKET_FLAT_INDEX_SIZE(basket_send_header);
 }
 
 __attribute__((warn_unused_result, pure))
@@ -1269,6 +2735,26 @@ int basket_validate_flat_buffer(void *flat_buffer)
 	return basket_checksum_test(basket_send_header);
 }
 
+__attribute__((warn_unused_result))
+int basket_validate_flat_headers(const void *flat_buffer)
+{
+	const basket_send_header_t *basket_send_header = flat_buffer;
+	checksum_t                 calculated_sum      = 0;
+
+	TESTP(flat_buffer, -1);
+
+	/* The buffer checksum is not set if the header was sent before the box headers were known */
+	if (basket_send_header->flags & BASKET_HEADER_NO_CHECKSUM) {
+		return 0;
+	}
+
+	if (0 != basket_checksum_walk(basket_send_header, NO, &calculated_sum) || basket_send_header->checksum != calculated_sum) {
+		DE("Wrong checksum: expected %X but it is %X\n", basket_send_header->checksum, calculated_sum);
+		return 1;
+	}
+	return 0;
+}
+
 
 /*** KEY/VALUE ***/
 
@@ -1290,6 +2776,7 @@ ret_t basket_keyval_add_by_int64(void *basket, uint64_t key_int64, void *val, si
 	TESTP(val, -1);
 
 	basket_t *_basket = basket;
+	BASKET_VIEW_TEST(_basket, -1);
 	basket_validate_zhash(basket);
 	return zhash_insert_by_int(_basket->zhash, key_int64, val, val_size);
 }
@@ -1301,6 +2788,7 @@ ret_t basket_keyval_add_by_str(void *basket, char *key_str, size_t key_str_len,
 	TESTP(val, -1);
 
 	basket_t *_basket = basket;
+	BASKET_VIEW_TEST(_basket, -1);
 	basket_validate_zhash(basket);
 	return zhash_insert_by_str(_basket->zhash, key_str, key_str_len, val, val_size);
 }
@@ -1312,13 +2800,17 @@ uint64_t basket_keyval_str_to_int64(char *key_str, size_t key_str_len)
 	return zhash_key_int64_from_key_str(key_str, key_str_len);
 }
 
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
 void *basket_keyval_find_by_int64(void *basket, uint64_t key_int64, ssize_t *val_size)
 {
 	TESTP(basket, NULL);
 	TESTP(val_size, NULL);
 
 	basket_t *_basket = basket;
+	if (_basket->flags & BASKET_FLAG_VIEW) {
+		return basket_view_keyval_find(_basket, key_int64, val_size);
+	}
+
 	if (NULL == _basket->zhash) {
 		*val_size = -1;
 		return NULL;
@@ -1327,7 +2819,7 @@ void *basket_keyval_find_by_int64(void *basket, uint64_t key_int64, ssize_t *val
 	return zhash_find_by_int(_basket->zhash, key_int64, val_size);
 }
 
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
 void *basket_keyval_find_by_str(void *basket, char *key_str, size_t key_str_len, ssize_t *val_size)
 {
 	TESTP(basket, NULL);
@@ -1335,6 +2827,10 @@ void *basket_keyval_find_by_str(void *basket, char *key_str, size_t key_str_len,
 	TESTP(val_size, NULL);
 
 	basket_t *_basket = basket;
+	if (_basket->flags & BASKET_FLAG_VIEW) {
+		return basket_view_keyval_find(_basket, zhash_key_int64_from_key_str(key_str, key_str_len), val_size);
+	}
+
 	if (NULL == _basket->zhash) {
 		*val_size = -1;
 		return NULL;
@@ -1350,6 +2846,7 @@ void *basket_keyval_extract_by_in64(void *basket, uint64_t key_int64, ssize_t *s
 	TESTP(size, NULL);
 
 	basket_t *_basket = basket;
+	BASKET_VIEW_TEST(_basket, NULL);
 	if (NULL == _basket->zhash) {
 		*size = -1;
 		return NULL;
@@ -1366,6 +2863,7 @@ void *basket_keyval_extract_by_str(void *basket, char *key_str, size_t key_str_l
 	TESTP(size, NULL);
 
 	basket_t *_basket = basket;
+	BASKET_VIEW_TEST(_basket, NULL);
 	if (NULL == _basket->zhash) {
 		*size = -1;
 		return NULL;
@@ -7,6 +7,7 @@
  * typedef int ret_t;
  */
 #include <stdint.h>
+#include <sys/uio.h>
 #include "box_t.h"
 #include "zhash3.h"
 
@@ -38,8 +39,12 @@
  * Moreover, it can create for you a flat memory buffer from the Busket,
  * and later (or on another machine) you can restore the Basket from this memory buffer.
  *
- * WARNING: All operations will copy buffers into Busket. Always.
- * You can not "set" a buffer into a box.
+ * WARNING: All operations will copy buffers into Busket, except the adopting ones:
+ * ::box_adopt() and ::box_new_ref() place your buffer into a box without copying it;
+ * see ::bx_adopt() for the ownership contract.
+ * ::box_new_shared() and ::basket_clone() share box data between boxes and baskets;
+ * the shared data is copied on the first write, see ::bx_share().
+ * ::basket_view_from_buf() opens a received flat buffer as a read only Basket, no copy.
  * Also, you never need to release buffers manually. When you finished with a Basket,
  * just release it, and all the memory in all boxes will be released.
  *
@@ -47,9 +52,17 @@
 
 /**
  * @def
- * @details How many basket->bufs pointers allocated at once
+ * @details How many basket->boxes pointers allocated at once, at
+ *  		least; when the array is full, it grows twice
  */
-#define BASKET_BUFS_GROW_RATE (1)
+#define BASKET_BUFS_GROW_RATE (8)
+
+/**
+ * @def BASKET_FLAG_VIEW
+ * @details The basket is a read only view over a flat buffer,
+ *  		see ::basket_view_from_buf()
+ */
+#define BASKET_FLAG_VIEW (1 << 0)
 
 typedef struct {
 	void **boxes; /**< Array of buf_t structs */
@@ -57,26 +70,90 @@ typedef struct {
 	num_boxes_t boxes_used; /**< Number of bufs in the array */
 	num_boxes_t boxes_allocated; /**< For internal use: how many buf_t pointers are allocated in the 'bufs' */
 	ztable_t *zhash; /**< Zhash: the Zhash table, for key/value keeping */
+	uint8_t flags; /**< BASKET_FLAG_* bits */
+	const char *flat_buf; /**< View only: the flat buffer the boxes point into, see ::basket_view_from_buf() */
+	size_t flat_buf_size; /**< View only: size of the flat buffer */
+	uint8_t checksum_alg; /**< The checksum algorithm of the flat buffers, checksum_alg_t; see ::basket_checksum_alg_set() */
+	uint32_t compress_threshold; /**< The boxes of this size and bigger are compressed in the flat buffers, 0: no compression; see ::basket_compress_set() */
+	size_t data_used; /**< For internal use: the sum of the data sizes of all boxes */
+	size_t data_room; /**< For internal use: the sum of the allocated data buffers of all boxes, with the headroom */
+	num_boxes_t boxes_nonempty; /**< For internal use: number of boxes with data */
 } basket_t;
 
 typedef struct __attribute__((packed)){
 	watermark_t watermark; 	/**< Watermark: filled with a predefined pattern WATERMARK_BOX */
 	num_boxes_t box_index; 	/**< The box index (place in Basket) in original Basket */
 	box_type_t box_size; 	/**< The size of the box, not include ::box_size and ::box_checksum fields */
+	checksum_t box_checksum; /**< The checksum of the box data, with the algorithm of the basket header */
 }
 box_dump_t;
 
 typedef struct __attribute__((packed)){
 	watermark_t watermark; /**< Watermark: filled with a predefined pattern WATERMARK_BASKET */
-	checksum_t 	checksum; /**< The checksum of box buffer, means ::box_dump field; This field is optional, and ignored if == 0 */
+	checksum_t 	checksum; /**< The checksum of the header and all box headers (with their ::box_checksum) in order; not set if ::flags has BASKET_HEADER_NO_CHECKSUM */
 	ticket_t 	ticket; /**< The same as ticket in ::basket_t, for free use */
 	box_type_t 	total_len; /**< Total length of this buffer, including all fields */
 	num_boxes_t boxes_used; /**< Number of Boxed used in original basket */
 	num_boxes_t boxes_dumped; /**< Number of Boxed dumped from the original basked */
 	uint32_t 	ztable_buf_size; /**< Size (in bytes) of ztable buffer. If '0' meant no ztable */
+	uint8_t 	align_log2; /**< The box data is aligned to (1 << align_log2) bytes, see ::basket_to_buf_aligned(); 0 if not aligned */
+	uint8_t 	checksum_alg; /**< The algorithm of the ::checksum field, checksum_alg_t */
+	uint8_t 	compress; /**< BOX_COMPRESS_LZ if every box data starts with box_compress_t, BOX_COMPRESS_RAW (0) otherwise */
+	uint8_t 	flags; /**< BASKET_HEADER_* bits */
 }
 basket_send_header_t;
 
+/*
+ * The ::checksum of basket_send_header_t is not set: the header is sent
+ * before the box headers are known, see ::basket_encoder_init(). The box
+ * checksums are always set, and always tested.
+ */
+#define BASKET_HEADER_NO_CHECKSUM (1 << 0)
+
+/*
+ * The compressed flat buffer, see ::basket_compress_set(): the data of
+ * every dumped box starts with box_compress_t, and box_dump_t::box_size
+ * is the stored size, including it. The box checksum is of the raw data.
+ */
+typedef struct __attribute__((packed)){
+	uint8_t 	method; /**< BOX_COMPRESS_LZ: the data is compressed by lz_block_compress(); BOX_COMPRESS_RAW: stored as is */
+	box_type_t 	raw_size; /**< The size of the box data when restored */
+}
+box_compress_t;
+
+/* The box data is stored as is */
+#define BOX_COMPRESS_RAW (0)
+
+/* The box data is compressed, see lz_block.h */
+#define BOX_COMPRESS_LZ (1)
+
+/*
+ * The index footer of the flat buffer, see ::basket_to_buf_indexed().
+ * When the header watermark is WATERMARK_BASKET_INDEXED, an array of
+ * 'boxes_used' box_offset_t entries follows the key/value dump:
+ * the entry N describes the box N, and its data is found without
+ * walking the preceding boxes.
+ */
+typedef struct __attribute__((packed)){
+	box_type_t offset; /**< Offset of the box header from the beginning of the buffer; 0 if the box is not dumped (empty) */
+	box_type_t size; /**< Size of the box data */
+}
+box_offset_t;
+
+/* Both the plain and the indexed flat buffers are valid */
+#define BASKET_WATERMARK_VALID(watermark) (WATERMARK_BASKET == (watermark) || WATERMARK_BASKET_INDEXED == (watermark))
+
+/* The max box data alignment of the flat buffer, log2: 64 bytes, a cache line */
+#define BASKET_ALIGN_LOG2_MAX (6)
+
+/* Number of padding bytes after 'offset' to align it to (1 << align_log2) */
+#define BASKET_ALIGN_PAD(offset, align_log2) \
+	((((size_t)1 << (align_log2)) - ((offset) & (((size_t)1 << (align_log2)) - 1))) & (((size_t)1 << (align_log2)) - 1))
+
+/* Size of the index footer of the flat buffer, 0 if there is no index */
+#define BASKET_FLAT_INDEX_SIZE(header) \
+	((WATERMARK_BASKET_INDEXED == (header)->watermark) ? (size_t)(header)->boxes_used * sizeof(box_offset_t) : 0)
+
 /*** Getter / Setter functions ***/
 /* We populate these function for test purposes. Should not be used out of test */
 
@@ -102,6 +179,23 @@ extern void *basket_get_box(const void *basket, const box_u32_t box_index);
 __attribute__((warn_unused_result))
 extern void *basket_new(void);
 
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Allocate the box pointers for the given number of
+ *  	  boxes at once
+ * @param void* basket Basket
+ * @param const size_t boxes The number of boxes the basket is
+ *  			going to have
+ * @return ret_t A_OK on success; -EINVAL if the number is too
+ *  	   large for a basket; -ENOMEM on a memory error
+ * @details Without it the box pointers array grows twice every
+ *  		time it is full; with it, adding up to 'boxes' boxes
+ *  		does not reallocate the array. The boxes themselves
+ *  		are not created.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_reserve_boxes(void *basket, const size_t boxes);
+
 /**
  * @author Sebastian Mountaniol (7/15/22)
  * @brief Return total size of basket object (bytes)  in memory
@@ -110,7 +204,8 @@ extern void *basket_new(void);
  *  	   all boxes
  * @details This function calculates size of current buffer in
  *  		memory. If you want to know what size of flat memory
- *  		buffer will be, use ::basket_flat_buf_size()
+ *  		buffer will be, use ::basket_flat_buf_size(). O(1):
+ *  		the sizes are counted when the boxes change.
  */
 __attribute__((warn_unused_result, pure))
 extern size_t basket_memory_size(const void *basket);
@@ -119,12 +214,24 @@ extern size_t basket_memory_size(const void *basket);
  * @author Sebastian Mountaniol (7/15/22)
  * @brief Return total size (bytes) of data saved in boxes 
  * @param const void *basket  Basket to measure
- * @return size_t Size of the all buffers in all boxes
- * @details
+ * @return size_t Size of the data in all boxes; the allocated
+ *  	   but not used room is not counted
+ * @details O(1): the sizes are counted when the boxes change
  */
 __attribute__((warn_unused_result, pure))
 extern size_t basket_data_size(const void *basket);
 
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Count the basket sizes from scratch
+ * @param void* basket Basket to count
+ * @details The basket keeps the data size, the allocated size
+ *  		and the number of not empty boxes up to date on every
+ *  		box_* call. Call it once after the boxes were changed
+ *  		directly, through the box_t API (see ::basket_get_box())
+ */
+extern void basket_sizes_recount(void *basket);
+
 /**
  * @author Sebastian Mountaniol (7/31/22)
  * @brief Calculate size of a memoty buffer needded to hold the
@@ -135,7 +242,9 @@ extern size_t basket_data_size(const void *basket);
  * @details This function calculates the size of memory buffer
  *  		needded to hold 'flat memory' representation of the
  *  		basket. Uf you want to know the size of the basket
- *  		in memory, use ::basket_memory_size() function
+ *  		in memory, use ::basket_memory_size() function. With
+ *  		the compression on (see ::basket_compress_set()) it is
+ *  		the worst case, the buffer is usually smaller.
  */
 __attribute__((warn_unused_result))
 extern size_t basket_flat_buf_size(const basket_t *basket);
@@ -153,6 +262,28 @@ extern size_t basket_flat_buf_size(const basket_t *basket);
 __attribute__((warn_unused_result))
 extern ret_t basket_release(void *basket);
 
+/**
+ * @author Sebastian Mountaniol (8/21/22)
+ * @brief Create a copy of the basket which shares the box
+ *  	  data with the original basket
+ * @param void* basket The basket to clone
+ * @return void* A new basket on success, NULL on an error
+ * @details The cost of this operation is O(number of boxes),
+ *  		not O(bytes): the boxes of the new basket reference
+ *  		the same memory as the boxes of the original basket
+ *  		(see ::bx_share()). The memory is copied on the first
+ *  		modification of a box, in any of the baskets. This
+ *  		way one payload can be sent to many recipients
+ *  		(for example, APEX_DST_ALL) with the memory
+ *  		consumption independent of the number of
+ *  		recipients.<br>
+ *  		The key/value table is copied, see ::zhash_clone().
+ *  		The clone and the original basket are released
+ *  		independently, in any order.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_clone(void *basket);
+
 /**
  * @author Sebastian Mountaniol (6/12/22)
  * @brief Remove all boxes from the basket_t object
@@ -211,6 +342,26 @@ extern ret_t box_insert_after(void *basket, const uint32_t after_index, const vo
 __attribute__((warn_unused_result))
 extern ret_t box_swap(void *basket, const box_u32_t first_index, const box_u32_t second_index);
 
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Move a box from one basket to another, or to another
+ *  	  place of the same basket
+ * @param void* src_basket The basket to take the box from
+ * @param const box_u32_t src_index The box to move; the
+ *  			following boxes move down
+ * @param void* dst_basket The basket to put the box into
+ * @param const box_u32_t dst_index The new index of the box;
+ *  			the box at this index and the following move up.
+ *  			It can be the number of boxes: the box is added
+ *  			at the tail.
+ * @return ret_t A_OK on success; -EINVAL if an index is wrong
+ *  	   or the basket has too many boxes; -ENOMEM on a memory
+ *  	   error. Nothing is changed on an error.
+ * @details The box is moved by pointer, the data is not copied.
+ */
+__attribute__((warn_unused_result))
+extern ret_t box_move(void *src_basket, const box_u32_t src_index, void *dst_basket, const box_u32_t dst_index);
+
 /**
  * @author Sebastian Mountaniol (6/12/22)
  * @brief Remove content of one box by box index (starts from
@@ -281,14 +432,74 @@ extern ret_t box_bisect(void *basket, const box_u32_t box_num, const size_t from
  * @return ret_t OK on success
  * @details After this operation only one box with index 0
  *  		remains, which includes merged memory of all other
- *  		boxes. The boxes are united one by one
- *  		sequentionally, i.e., the memory of the box 1 added
- *  		in tail of the box 0, then added memory of the box
- *  		3 and so on.
+ *  		boxes; the other boxes stay empty. The memory of the
+ *  		box 1 is added in tail of the box 0, then the memory
+ *  		of the box 2 and so on. The final size is calculated
+ *  		first: the box 0 is reallocated once, and every box
+ *  		is copied once.
  */
 __attribute__((warn_unused_result))
 extern ret_t basket_collapse(void *basket);
 
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Unite (merge) the range of boxes into one box
+ * @param void* basket The Basket object
+ * @param const box_u32_t first The first box of the range; all
+ *  			the range is merged into it
+ * @param const box_u32_t last  The last box of the range,
+ *  			included
+ * @return ret_t A_OK on success; -EINVAL if the range is wrong,
+ *  	   or the result is too large for a box; -ENOMEM on a
+ *  	   memory error
+ * @details The box 'first' is reallocated once, and every box of
+ *  		the range is copied once. Unlike ::basket_collapse(),
+ *  		the merged boxes are removed: the box 'last + 1'
+ *  		becomes the box 'first + 1', and the basket has
+ *  		'last - first' boxes less.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_collapse_range(void *basket, const box_u32_t first, const box_u32_t last);
+
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Move a range of boxes to the tail of another basket
+ * @param void* dst_basket The basket to add the boxes to
+ * @param void* src_basket The basket to take the boxes from
+ * @param const box_u32_t first The first box of the range
+ * @param const box_u32_t last  The last box of the range,
+ *  			included
+ * @return ret_t A_OK on success; -EINVAL if the range is wrong,
+ *  	   the baskets are the same or the result has too many
+ *  	   boxes; -ENOMEM on a memory error. Nothing is changed
+ *  	   on an error.
+ * @details The boxes are moved by pointer, the data is not
+ *  		copied. The boxes after the range in 'src_basket'
+ *  		move down.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_splice(void *dst_basket, void *src_basket, const box_u32_t first, const box_u32_t last);
+
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Move all boxes and key/value entries of one basket to
+ *  	  another
+ * @param void* dst_basket The basket to add to; its boxes are
+ *  		  followed by the boxes of 'src_basket'
+ * @param void* src_basket The basket to take from; it stays
+ *  		  empty, the caller releases it
+ * @return ret_t A_OK on success; -EINVAL if the baskets are the
+ *  	   same or the result has too many boxes; -ENOMEM on a
+ *  	   memory error
+ * @details Nothing is copied: the boxes are moved by pointer,
+ *  		the key/value entries are relinked (see
+ *  		::zhash_move_all()), the cost is O(boxes + entries).
+ *  		An entry of 'src_basket' replaces the entry of
+ *  		'dst_basket' with the same key.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_concat(void *dst_basket, void *src_basket);
+
 /**
  * @author Sebastian Mountaniol (6/16/22)
  * @brief Prepare the Basket for sending to another host through
@@ -307,6 +518,157 @@ extern ret_t basket_collapse(void *basket);
 __attribute__((warn_unused_result))
 extern void *basket_to_buf(const void *basket, size_t *size);
 
+/**
+ * @author Sebastian Mountaniol (8/25/22)
+ * @brief Serialize the Basket into a buffer provided by the
+ *  	  caller; the result is the same as of ::basket_to_buf()
+ * @param const void* basket Basket to serialize
+ * @param void* buf   The buffer to serialize into
+ * @param const size_t buf_size Size of the buffer
+ * @param size_t* written Number of bytes written returned here;
+ *  			if the buffer is too small, the required size
+ *  			is returned here
+ * @return ret_t A_OK on success, -ENOSPC if the buffer is too
+ *  	   small. In this case the content of the buffer is
+ *  	   undefined.
+ * @details One pass: every box and the key/value hash are
+ *  		copied directly into their place in the buffer, no
+ *  		intermediate buffers. The buffer is not cleaned
+ *  		before. The required size can be known in advance
+ *  		with ::basket_flat_buf_size(); this way the caller
+ *  		can reuse one buffer for many baskets.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_to_buf_into(const void *basket, void *buf, const size_t buf_size, size_t *written);
+
+/**
+ * @author Sebastian Mountaniol (8/31/22)
+ * @brief Create the flat buffer with the box index footer
+ * @param const void* basket Basket to serialize
+ * @param size_t* size  Size of the buffer returned here
+ * @return void* The buffer, NULL on an error. The caller must
+ *  	   free() it.
+ * @details The same as ::basket_to_buf(), plus a table of the
+ *  		box offsets at the end of the buffer. A box of the
+ *  		received or mmap'ed buffer is found in O(1) with
+ *  		::basket_flat_box_ptr(). The buffer is restored with
+ *  		::basket_from_buf() as usual.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_to_buf_indexed(const void *basket, size_t *size);
+
+/**
+ * @author Sebastian Mountaniol (9/1/22)
+ * @brief Create the flat buffer with the box data aligned
+ * @param const void* basket Basket to serialize
+ * @param const size_t align The alignment of the box data:
+ *  		   8, 16, 32 or 64 bytes
+ * @param size_t* size  Size of the buffer returned here
+ * @return void* The buffer, aligned to 'align' bytes; NULL on an
+ *  	   error. The caller must free() it.
+ * @details Every box data starts at an 'align' bytes boundary of
+ *  		the buffer: zero bytes are padded after the box
+ *  		header. If the receiver keeps the buffer at the
+ *  		same alignment, a box of the ::basket_view_from_buf()
+ *  		view can be used in place as an array of structures
+ *  		or a SIMD operand, see ::basket_view_box_aligned().
+ *  		The buffer is restored with ::basket_from_buf() as
+ *  		usual.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_to_buf_aligned(const void *basket, const size_t align, size_t *size);
+
+/**
+ * @author Sebastian Mountaniol (8/31/22)
+ * @brief Find a box data in the indexed flat buffer, without
+ *  	  restoring the Basket
+ * @param const void* buf   The flat buffer, result of
+ *  			::basket_to_buf_indexed()
+ * @param const size_t size  Size of the buffer
+ * @param const box_u32_t box_index Index of the box
+ * @param ssize_t* box_size  Size of the box data returned here;
+ *  			 0 if the box is empty, -EINVAL on an error
+ * @return const void* Pointer to the box data inside of the
+ *  	   buffer; NULL if the box is empty or on an error
+ * @details Only the header, the index entry and the box header
+ *  		are read. The checksum is not tested: test it once with
+ *  		::basket_validate_flat_buffer() if the buffer is not
+ *  		trusted.
+ */
+__attribute__((warn_unused_result))
+extern const void *basket_flat_box_ptr(const void *buf, const size_t size, const box_u32_t box_index, ssize_t *box_size);
+
+/**
+ * @author Sebastian Mountaniol (9/3/22)
+ * @brief Test the checksum of one box of the indexed flat buffer
+ * @param const void* buf   The flat buffer, result of
+ *  			::basket_to_buf_indexed()
+ * @param const size_t size  Size of the buffer
+ * @param const box_u32_t box_index Index of the box
+ * @return ret_t A_OK if the box data matches its checksum (or the
+ *  	   buffer is not checksummed, or the box is empty);
+ *  	   -EINVAL on a mismatch or an error
+ * @details Every box header keeps the checksum of its data, so
+ *  		the receiver tests only the boxes it reads, when it
+ *  		reads them. Only the box data is read; the box headers
+ *  		are covered by the buffer checksum, see
+ *  		::basket_validate_flat_buffer().
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_flat_box_verify(const void *buf, const size_t size, const box_u32_t box_index);
+
+/**
+ * @author Sebastian Mountaniol (8/27/22)
+ * @brief Return the number of memory segments
+ *  	  ::basket_to_iovec() needs for the Basket
+ * @param const void* basket The Basket
+ * @return int Number of segments
+ */
+__attribute__((warn_unused_result))
+extern int basket_iovec_num(const void *basket);
+
+/**
+ * @author Sebastian Mountaniol (8/27/22)
+ * @brief Serialize the Basket as memory segments, ready for
+ *  	  writev(); the segments together are the same bytes as
+ *  	  ::basket_to_buf() produces
+ * @param const void* basket Basket to serialize
+ * @param struct iovec* iov The array of segments to fill
+ * @param const int iov_max Number of segments in the array, see
+ *  			::basket_iovec_num()
+ * @param void** headers The memory holding the headers and the
+ *  			key/value dump is returned here; the caller
+ *  			must free() it when the segments are written
+ * @return int Number of segments filled; -ENOSPC if the array
+ *  	   is too small; -ENOMEM on an allocation error
+ * @details The box data is not copied: every box is a segment
+ *  		pointing to the box memory. Only the small headers
+ *  		and the key/value table are placed into one
+ *  		allocated buffer. The Basket must not be changed
+ *  		until the segments are written.
+ */
+__attribute__((warn_unused_result))
+extern int basket_to_iovec(const void *basket, struct iovec *iov, const int iov_max, void **headers);
+
+/**
+ * @author Sebastian Mountaniol (8/27/22)
+ * @brief Write the Basket into a file descriptor, without
+ *  	  flattening it
+ * @param int fd    The file descriptor: a socket, a pipe, a file
+ * @param const void* basket Basket to write
+ * @return ssize_t Number of bytes written, the whole serialized
+ *  	   Basket; a negative errno on an error
+ * @details The Basket is written with writev() over
+ *  		::basket_to_iovec() segments. Partial writes are
+ *  		continued; on a non-blocking descriptor the
+ *  		function waits with poll() until the descriptor is
+ *  		writable, so it always returns after the whole
+ *  		Basket is written or on an error. The receiver
+ *  		restores the Basket with ::basket_from_buf().
+ */
+__attribute__((warn_unused_result))
+extern ssize_t basket_writev(int fd, const void *basket);
+
 /**
  * @author Sebastian Mountaniol (7/17/22)
  * @brief Restore Basket object from the regular memory buffer.
@@ -326,6 +688,95 @@ extern void *basket_to_buf(const void *basket, size_t *size);
 __attribute__((warn_unused_result))
 extern void *basket_from_buf(void *buf, size_t size);
 
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Open a flat buffer, the result of ::basket_to_buf(),
+ *  	  as a read only Basket; the boxes point into the buffer
+ * @param const void* buf   The flat buffer
+ * @param size_t size  Size of the buffer; if 0, the size is
+ *  			 taken from the buffer header
+ * @return void* The view Basket; NULL if the buffer is invalid
+ *  	   or on an allocation error
+ * @details No box data and no key/value is copied: the view is
+ *  		one allocation holding the basket_t, the box
+ *  		pointers and the box_t structures.
+ *  		::box_data_ptr_const(), ::box_data_size(),
+ *  		::box_data_copy() and the key/value finds work on
+ *  		the view; they return pointers into the buffer. Any
+ *  		modification of the view is refused, ::box_data_ptr()
+ *  		too; use ::basket_view_materialize() to get a regular
+ *  		Basket. The buffer checksum is tested here, once: a
+ *  		broken buffer, a box out of the buffer or a box
+ *  		dumped twice is refused.
+ *  		The buffer must stay valid and unchanged until the
+ *  		view is released with ::basket_release(); the view
+ *  		never releases the buffer.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_view_from_buf(const void *buf, size_t size);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Open a flat buffer tested already as a read only
+ *  	  Basket, see ::basket_view_from_buf()
+ * @param const void* buf   The flat buffer, its checksums are
+ *  			tested by the caller, e.g. with
+ *  			::basket_validate_flat_buffer() or
+ *  			::basket_batch_validate()
+ * @param size_t size  Size of the buffer; if 0, the size is
+ *  			 taken from the buffer header
+ * @return void* The view Basket; NULL if the buffer is invalid
+ *  	   or on an allocation error
+ * @details The same as ::basket_view_from_buf(), but neither
+ *  		the buffer checksum nor the box checksums are tested:
+ *  		the data is not read at all. The sizes, the box indexes
+ *  		and the watermarks are tested as usual.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_view_from_buf_trusted(const void *buf, size_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Create a regular (writable) Basket from the view
+ * @param const void* view  The view, see
+ *  			::basket_view_from_buf()
+ * @return void* A new Basket, the data copied from the view
+ *  	   buffer; NULL on an error
+ * @details The view is not changed and must be released by the
+ *  		caller. The same as ::basket_from_buf() on the view
+ *  		buffer.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_view_materialize(const void *view);
+
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Test whether the Basket is a read only view
+ * @param const void* basket Basket to test
+ * @return int YES if the basket is a view, NO if it is a
+ *  	   regular Basket
+ */
+__attribute__((warn_unused_result, pure))
+extern int basket_is_view(const void *basket);
+
+/**
+ * @author Sebastian Mountaniol (9/1/22)
+ * @brief Get the box data of the view, only if it is aligned
+ * @param const void* view  The view, see ::basket_view_from_buf()
+ * @param const box_u32_t box_num Box number
+ * @param const size_t align Required alignment, a power of 2
+ * @param size_t* box_size Size of the box data returned here
+ * @return const void* Pointer to the box data inside of the flat
+ *  	   buffer; NULL if the box is empty, or its data is not
+ *  	   aligned to 'align' bytes, or on an error
+ * @details The data is aligned if the buffer was created with
+ *  		::basket_to_buf_aligned() with at least this alignment,
+ *  		and the received buffer is kept aligned the same way.
+ *  		Then the box is read as a typed array directly.
+ */
+__attribute__((warn_unused_result))
+extern const void *basket_view_box_aligned(const void *view, const box_u32_t box_num, const size_t align, size_t *box_size);
+
 /**
  * @author Sebastian Mountaniol (7/26/22)
  * @brief Compare tow baskets, including box data. 
@@ -356,6 +807,65 @@ extern int8_t basket_compare_basket(const void *basket_right, const void *basket
 __attribute__((warn_unused_result))
 extern ssize_t box_new(void *basket, const void *buffer, const box_u32_t buffer_size);
 
+/**
+ * @author Sebastian Mountaniol (8/20/22)
+ * @brief Create a new box and place the buffer into the box
+ *  	  without copying it
+ * @param void* basket       Basket to add a new box
+ * @param void* buffer     	 Buffer to place into the new box, must
+ *  		  not be NULL
+ * @param size_t buffer_size Size of the buffer, must be > 0
+ * @param box_free_fn_t free_fn Destructor of the buffer; NULL
+ *  			if the buffer is borrowed
+ * @return ssize_t The number of created box on success, which
+ *  	   is 0 or more. A negative value on failure.
+ * @details This is a zero-copy version of ::box_new(). The
+ *  		ownership contract is described in ::bx_adopt():
+ *  		with 'free_fn' the basket owns the buffer and calls
+ *  		free_fn(buffer) when done with it; without 'free_fn'
+ *  		the buffer is borrowed, never modified nor released
+ *  		by the basket, and must stay alive until the basket
+ *  		is released. On failure no box is added and the
+ *  		buffer stays with the caller.
+ */
+__attribute__((warn_unused_result))
+extern ssize_t box_new_ref(void *basket, void *buffer, const box_u32_t buffer_size, box_free_fn_t free_fn);
+
+/**
+ * @author Sebastian Mountaniol (8/20/22)
+ * @brief Place a buffer into an existing box without copying it
+ * @param void* basket       Basket containing the box
+ * @param box_u32_t box_num  Box number; the current content of
+ *  			the box is released
+ * @param void* buffer     	 Buffer to adopt, must not be NULL
+ * @param size_t buffer_size Size of the buffer, must be > 0
+ * @param box_free_fn_t free_fn Destructor of the buffer; NULL
+ *  			if the buffer is borrowed
+ * @return ret_t OK on success, negative value on failure.
+ * @details See ::box_new_ref() and ::bx_adopt() for the
+ *  		ownership contract. The opposite operation, taking a
+ *  		buffer out of a box, is ::box_steal_data()
+ */
+__attribute__((warn_unused_result))
+extern ret_t box_adopt(void *basket, const box_u32_t box_num, void *buffer, const size_t buffer_size, box_free_fn_t free_fn);
+
+/**
+ * @author Sebastian Mountaniol (8/21/22)
+ * @brief Create a new box which shares the data of a box from
+ *  	  another (or the same) basket, without copying
+ * @param void* basket     Basket to add the new box to
+ * @param void* src_basket Basket containing the box to share
+ * @param box_u32_t src_box_num The number of the box to share
+ * @return ssize_t The number of the new box, a negative value
+ *  	   on failure
+ * @details The data is copied on the first modification of any
+ *  		of the boxes sharing it (box_add(),
+ *  		box_data_replace(), box_merge_box() etc.).
+ *  		See ::bx_share().
+ */
+__attribute__((warn_unused_result))
+extern ssize_t box_new_shared(void *basket, void *src_basket, const box_u32_t src_box_num);
+
 /**
  * @author Sebastian Mountaniol (7/12/22)
  * @brief Copy the memory buffer into the tail of the "box_num"
@@ -393,6 +903,42 @@ extern ret_t box_add(void *basket, const box_u32_t box_num, const void *buffer,
 __attribute__((warn_unused_result))
 extern ret_t box_data_replace(void *basket, const box_u32_t box_num, const void *buffer, const size_t buffer_size);
 
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Copy the memory buffer in front of the "box_num"
+ *  	  internal buffer
+ * @param void* basket       Basket containing the box
+ * @param box_u32_t box_num  Box number to prepend the buffer to
+ * @param void* buffer     	 Buffer to copy, usually a protocol
+ *  			header
+ * @param size_t buffer_size Buffer size to copy
+ * @return ret_t OK on success, negative value on failure.
+ * @details If the box 1 contains "car", after
+ *  		box_prepend(basket, 1, "Blue ", 5) it contains "Blue
+ *  		car". The header is written into the box headroom,
+ *  		the box data is not moved; the cost is O(buffer_size).
+ *  		If the headroom is too small, it grows once (see
+ *  		::bx_push()). Reserve the headroom in advance with
+ *  		::box_headroom_reserve() when the headers size is
+ *  		known.
+ */
+__attribute__((warn_unused_result))
+extern ret_t box_prepend(void *basket, const box_u32_t box_num, const void *buffer, const size_t buffer_size);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Reserve space in front of the box data for prepending
+ *  	  headers, see ::box_prepend()
+ * @param void* basket       Basket containing the box
+ * @param box_u32_t box_num  Box number
+ * @param size_t headroom    Number of bytes to reserve
+ * @return ret_t OK on success, negative value on failure.
+ * @details Can be called for an empty box as well, before the
+ *  		payload is added.
+ */
+__attribute__((warn_unused_result))
+extern ret_t box_headroom_reserve(void *basket, const box_u32_t box_num, const size_t headroom);
+
 /**
  * @author Sebastian Mountaniol (7/12/22)
  * @brief This function returns a pointer to internal buffer of
@@ -405,10 +951,27 @@ extern ret_t box_data_replace(void *basket, const box_u32_t box_num, const void
  *  		buffer. Please be very careful with this function.
  *  		WARNING: Do not release this memory! You do not own
  *  		it! If you do, the basket_release will fail.
+ *  		The cached checksum of the box is dropped, as the
+ *  		caller can change the data through the pointer.
+ *  		Refused for a view, see ::box_data_ptr_const().
  */
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
 extern void *box_data_ptr(const void *basket, const box_u32_t box_num);
 
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Get a read only pointer to the box data
+ * @param const void* basket Basket containing a box; a regular
+ *  			Basket or a view, see ::basket_view_from_buf()
+ * @param const box_u32_t box_num Number of the box
+ * @return const void* Pointer to the box data; NULL if the box
+ *  	   is empty or on an error
+ * @details For a view the pointer is into the flat buffer,
+ *  		which can be mapped read only. Do not release it.
+ */
+__attribute__((warn_unused_result))
+extern const void *box_data_ptr_const(const void *basket, const box_u32_t box_num);
+
 /**
  * @author Sebastian Mountaniol (8/8/22)
  * @brief Copy data from a box to user's buffer
@@ -456,7 +1019,10 @@ extern ret_t box_data_free(void *basket, const box_u32_t box_num);
  *  		  from
  * @return void* Memory buffer address. NULL if the box is empty
  *  	   or on an error
- * @details 
+ * @details The returned buffer always belongs to the caller
+ *  		and must be released with free(). If the box holds
+ *  		an adopted buffer (see ::box_adopt()), a copy is
+ *  		returned and the adopted buffer is released.
  */
 __attribute__((warn_unused_result))
 extern void *box_steal_data(void *_basket, const box_u32_t box_num);
@@ -473,6 +1039,65 @@ extern void *box_steal_data(void *_basket, const box_u32_t box_num);
  */
 extern void basket_set_ticket(void *basket, uint64_t ticket);
 
+/**
+ * @author Sebastian Mountaniol (9/2/22)
+ * @brief Choose the checksum algorithm of the flat buffers
+ *  	  created from this basket
+ * @param void* basket Basket
+ * @param const uint8_t alg   The algorithm, see checksum_alg_t:
+ *  			CHECKSUM_ALG_FNV1A (the default) or
+ *  			CHECKSUM_ALG_CRC32C
+ * @return ret_t A_OK on success, -EINVAL if the algorithm is
+ *  	   unknown or the basket is a view
+ * @details The algorithm is saved in the buffer header; the
+ *  		receiver validates the buffer with it, whatever its
+ *  		own setting is. CRC32C uses the SSE4.2 instruction when
+ *  		the CPU has it, and is many times faster than FNV-1a on
+ *  		big baskets. A restored Basket keeps the algorithm of
+ *  		the buffer.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_checksum_alg_set(void *basket, const uint8_t alg);
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Compress the boxes in the flat buffers created from
+ *  	  this basket
+ * @param void* basket Basket
+ * @param const size_t threshold The boxes of this size and
+ *  			bigger are compressed; 0 turns the compression off
+ *  			(the default)
+ * @return ret_t A_OK on success, -EINVAL if the threshold is out
+ *  	   of range or the basket is a view
+ * @details Every box is compressed on its own with a fast LZ
+ *  		codec (see lz_block.h), so one box is restored without
+ *  		the others. A box which does not get smaller is stored
+ *  		as is, and not tried again until its data is changed.
+ *  		The buffer is restored by ::basket_from_buf() and
+ *  		::basket_decoder_feed() as usual; a view and the
+ *  		indexed access refuse it. ::basket_to_buf_into() needs
+ *  		the buffer for the uncompressed size, see
+ *  		::basket_flat_buf_size().
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_compress_set(void *basket, const size_t threshold);
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Restore the box data dumped in a compressed flat
+ *  	  buffer
+ * @param void* box   An empty box_t to restore the data into
+ * @param const void* data  The box data as it is in the
+ *  			buffer, starting with box_compress_t
+ * @param const size_t size  The stored size, see
+ *  			box_dump_t::box_size
+ * @return ret_t A_OK on success; -EINVAL if the data is broken;
+ *  	   -ENOMEM on a memory error
+ * @details For the flat buffer readers, not for the end use
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_box_uncompress(void *box, const void *data, const size_t size);
+
 /**
  * @author Sebastian Mountaniol (8/8/22)
  * @brief Get ticket from basket object
@@ -501,7 +1126,8 @@ extern uint64_t basket_get_ticket_from_flat_buffer(void *flat_buffer);
  * @brief Get the size of the flat buffer
  * @param void* flat_buffer Pointer to memory buffer containing
  *  		  flat buffer representation of the basket
- * @return size_t Size of this buffer
+ * @return size_t Size of this buffer, including the key/value
+ *  	   dump and the box index
  * @details The flat memory basket buffer contains its size. It
  *  		set when the buffer created.
  */
@@ -520,6 +1146,22 @@ extern size_t basket_get_size_from_flat_buffer(void *flat_buffer);
 __attribute__((warn_unused_result, pure))
 extern int basket_validate_flat_buffer(void *flat_buffer);
 
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Validate the header and the box headers of the flat
+ *  	  buffer, not the box data
+ * @param const void* flat_buffer The flat buffer
+ * @return int 0 if the headers are valid, 1 if not, -1 on an
+ *  	   error
+ * @details The buffer checksum covers the box headers, with
+ *  		their box checksums; the box data can be tested later,
+ *  		box by box, see ::basket_flat_verify_par(). Without
+ *  		the buffer checksum (BASKET_HEADER_NO_CHECKSUM) there
+ *  		is nothing to test here.
+ */
+__attribute__((warn_unused_result))
+extern int basket_validate_flat_headers(const void *flat_buffer);
+
 /*** KEY/VALUE API ***/
 
 /*
@@ -634,7 +1276,7 @@ extern uint64_t basket_keyval_str_to_int64(char *key_str, size_t key_str_len);
  *  		buffer from this basket, avoid operations changing
  *  		the value buffer size.
  */
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
 extern void *basket_keyval_find_by_int64(void *_basket, uint64_t key_int64, ssize_t *val_size);
 
 /**
@@ -658,7 +1300,7 @@ extern void *basket_keyval_find_by_int64(void *_basket, uint64_t key_int64, ssiz
  *  		if you want to create a flat buffer from this
  *  		basket.
  */
-__attribute__((warn_unused_result, pure))
+__attribute__((warn_unused_result))
 extern void *basket_keyval_find_by_str(void *_basket, char *key_str, size_t key_str_len, ssize_t *val_size);
 
 /**
@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "basket.h"
+#include "basket_batch.h"
+#include "debug.h"
+#include "tests.h"
+#include "checksum.h"
+#include "optimization.h"
+
+/* Initial number of Basket pointers in the batch; then it grows twice every time */
+#define BASKET_BATCH_GROW_RATE (16)
+
+/* This is an internal function: the size of the Basket of the frame entry at 'offset' */
+__attribute__((warn_unused_result, pure))
+static uint32_t basket_batch_entry_size(const char *buf, const size_t offset)
+{
+	uint32_t size;
+	memcpy(&size, buf + offset, sizeof(uint32_t));
+	return size;
+}
+
+/* This is an internal function: the frame checksum; the entries are tested by the caller */
+__attribute__((warn_unused_result))
+static int8_t basket_batch_checksum(const basket_batch_header_t *header, checksum_t *sum)
+{
+	const char        *buf    = (const char *)header;
+	size_t            offset  = sizeof(basket_batch_header_t);
+	checksum_stream_t checksum;
+	uint32_t          index;
+
+	if (0 != checksum_stream_init_alg(&checksum, header->checksum_alg)) {
+		DE("Unknown checksum algorithm %u\n", header->checksum_alg);
+		return -1;
+	}
+
+	checksum_stream_update(&checksum, buf + offsetof(basket_batch_header_t, total_len),
+						   sizeof(basket_batch_header_t) - offsetof(basket_batch_header_t, total_len));
+
+	/* The size and the flat header of every Basket; the Basket checksum covers the rest */
+	for (index = 0; index < header->baskets_num; index++) {
+		checksum_stream_update(&checksum, buf + offset, sizeof(uint32_t) + sizeof(basket_send_header_t));
+		offset += sizeof(uint32_t) + basket_batch_entry_size(buf, offset);
+	}
+
+	return checksum_stream_final(&checksum, sum);
+}
+
+__attribute__((warn_unused_result))
+basket_batch_t *basket_batch_new(void)
+{
+	basket_batch_t *batch = calloc(1, sizeof(basket_batch_t));
+	TESTP(batch, NULL);
+	return batch;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_batch_release(basket_batch_t *batch)
+{
+	TESTP_ABORT(batch);
+	free(batch->baskets);
+	free(batch);
+	return A_OK;
+}
+
+void basket_batch_clean(basket_batch_t *batch)
+{
+	TESTP_ABORT(batch);
+	batch->baskets_num = 0;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_batch_add(basket_batch_t *batch, const void *basket)
+{
+	TESTP_ABORT(batch);
+	TESTP_ABORT(basket);
+
+	if (YES == basket_is_view(basket)) {
+		DE("The basket %p is a read only view, materialize it first\n", basket);
+		return -EINVAL;
+	}
+
+	if (batch->baskets_num == batch->baskets_allocated) {
+		const uint32_t allocated = (0 == batch->baskets_allocated) ? BASKET_BATCH_GROW_RATE : batch->baskets_allocated * 2;
+		const void     **baskets = realloc(batch->baskets, allocated * sizeof(void *));
+
+		TESTP(baskets, -ENOMEM);
+		batch->baskets = baskets;
+		batch->baskets_allocated = allocated;
+	}
+
+	batch->baskets[batch->baskets_num] = basket;
+	batch->baskets_num++;
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+void *basket_batch_to_buf(const basket_batch_t *batch, size_t *size)
+{
+	basket_batch_header_t *header_p;
+	char                  *buf;
+	size_t                buf_size   = sizeof(basket_batch_header_t);
+	size_t                offset     = sizeof(basket_batch_header_t);
+	checksum_t            checksum;
+	uint32_t              index;
+
+	TESTP_ABORT(batch);
+	TESTP_ABORT(size);
+
+	/* The sizes are known without reading the boxes; with the compression it is the worst case */
+	for (index = 0; index < batch->baskets_num; index++) {
+		buf_size += sizeof(uint32_t) + basket_flat_buf_size(batch->baskets[index]);
+	}
+
+	if (buf_size > UINT32_MAX) {
+		DE("The batch is too big: %zu bytes\n", buf_size);
+		return NULL;
+	}
+
+	/* Every byte is written, no need to clean */
+	buf = malloc(buf_size);
+	TESTP(buf, NULL);
+
+	for (index = 0; index < batch->baskets_num; index++) {
+		size_t   written;
+		uint32_t entry_size;
+
+		if (A_OK != basket_to_buf_into(batch->baskets[index], buf + offset + sizeof(uint32_t),
+									   buf_size - offset - sizeof(uint32_t), &written)) {
+			DE("Could not write basket[%u] into the batch\n", index);
+			free(buf);
+			return NULL;
+		}
+
+		entry_size = (uint32_t)written;
+		memcpy(buf + offset, &entry_size, sizeof(uint32_t));
+		offset += sizeof(uint32_t) + written;
+	}
+
+	header_p = (basket_batch_header_t *)buf;
+	header_p->watermark = WATERMARK_BASKET_BATCH;
+	header_p->checksum = 0;
+	header_p->total_len = offset;
+	header_p->baskets_num = batch->baskets_num;
+	header_p->checksum_alg = (batch->baskets_num > 0) ? ((const basket_t *)batch->baskets[0])->checksum_alg : CHECKSUM_ALG_FNV1A;
+
+	/* The algorithm is validated when set: this call can not fail */
+	if (0 != basket_batch_checksum(header_p, &checksum)) {
+		abort();
+	}
+
+	header_p->checksum = checksum;
+	*size = offset;
+	return buf;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_batch_validate(const void *buf, const size_t size)
+{
+	const basket_batch_header_t *header         = buf;
+	const char                  *buf_char       = buf;
+	size_t                      offset          = sizeof(basket_batch_header_t);
+	checksum_t                  calculated_sum  = 0;
+	uint32_t                    index;
+
+	TESTP_ABORT(buf);
+
+	if (size < sizeof(basket_batch_header_t) || WATERMARK_BASKET_BATCH != header->watermark ||
+		header->total_len < sizeof(basket_batch_header_t) || header->total_len > size) {
+		DE("Wrong batch: wrong watermark or size\n");
+		return -EINVAL;
+	}
+
+	/* Every Basket must be inside of the frame, with its key/value dump */
+	for (index = 0; index < header->baskets_num; index++) {
+		const basket_send_header_t *basket_header = (const basket_send_header_t *)(buf_char + offset + sizeof(uint32_t));
+		uint32_t                   entry_size;
+
+		if (offset + sizeof(uint32_t) + sizeof(basket_send_header_t) > header->total_len) {
+			DE("Wrong batch: basket[%u] is out of the frame\n", index);
+			return -EINVAL;
+		}
+
+		entry_size = basket_batch_entry_size(buf_char, offset);
+		if (entry_size < sizeof(basket_send_header_t) || offset + sizeof(uint32_t) + entry_size > header->total_len ||
+			!BASKET_WATERMARK_VALID(basket_header->watermark) ||
+			(size_t)basket_header->total_len + basket_header->ztable_buf_size > entry_size) {
+			DE("Wrong batch: basket[%u], size %u\n", index, entry_size);
+			return -EINVAL;
+		}
+
+		offset += sizeof(uint32_t) + entry_size;
+	}
+
+	if (offset != header->total_len) {
+		DE("Wrong batch: the baskets take %zu bytes, the header claims %u\n", offset, header->total_len);
+		return -EINVAL;
+	}
+
+	/* The frame is always checksummed: 0 is a valid checksum too */
+	if (0 != basket_batch_checksum(header, &calculated_sum) || header->checksum != calculated_sum) {
+		DE("Wrong batch checksum: expected %X but it is %X\n", header->checksum, calculated_sum);
+		return -EINVAL;
+	}
+
+	/* Every Basket and every box data: the iterator opens them without a second test */
+	for (offset = sizeof(basket_batch_header_t), index = 0; index < header->baskets_num; index++) {
+		if (0 != basket_validate_flat_buffer((void *)(buf_char + offset + sizeof(uint32_t)))) {
+			DE("Wrong batch: basket[%u] is broken\n", index);
+			return -EINVAL;
+		}
+
+		offset += sizeof(uint32_t) + basket_batch_entry_size(buf_char, offset);
+	}
+
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+void *basket_batch_iter(const void *buf, const size_t size, size_t *offset, ret_t *rc)
+{
+	const basket_batch_header_t *header     = buf;
+	const char                  *buf_char   = buf;
+	const basket_send_header_t  *basket_header;
+	const char                  *basket_buf;
+	void                        *basket;
+	uint32_t                    entry_size;
+
+	TESTP_ABORT(buf);
+	TESTP_ABORT(offset);
+	TESTP_ABORT(rc);
+
+	*rc = -EINVAL;
+
+	if (size < sizeof(basket_batch_header_t) || header->total_len < sizeof(basket_batch_header_t) || header->total_len > size) {
+		DE("Wrong batch: wrong size\n");
+		return NULL;
+	}
+
+	if (0 == *offset) {
+		*offset = sizeof(basket_batch_header_t);
+	}
+
+	/* No more Baskets */
+	if (*offset == header->total_len) {
+		*rc = A_OK;
+		return NULL;
+	}
+
+	if (*offset < sizeof(basket_batch_header_t) || *offset + sizeof(uint32_t) > header->total_len) {
+		DE("Wrong batch: the offset %zu is out of the frame\n", *offset);
+		return NULL;
+	}
+
+	entry_size = basket_batch_entry_size(buf_char, *offset);
+	if (entry_size < sizeof(basket_send_header_t) || *offset + sizeof(uint32_t) + entry_size > header->total_len) {
+		DE("Wrong batch: the basket at offset %zu, size %u\n", *offset, entry_size);
+		return NULL;
+	}
+
+	basket_buf = buf_char + *offset + sizeof(uint32_t);
+	basket_header = (const basket_send_header_t *)basket_buf;
+
+	/* The compressed boxes must be restored: such a Basket is copied. The view is not tested again, see ::basket_batch_validate() */
+	if (BOX_COMPRESS_RAW != basket_header->compress) {
+		basket = basket_from_buf((void *)basket_buf, entry_size);
+	} else {
+		basket = basket_view_from_buf_trusted(basket_buf, entry_size);
+	}
+
+	if (NULL == basket) {
+		DE("Wrong batch: can not open the basket at offset %zu\n", *offset);
+		return NULL;
+	}
+
+	*offset += sizeof(uint32_t) + entry_size;
+	*rc = A_OK;
+	return basket;
+}
@@ -0,0 +1,138 @@
+#ifndef _BASKET_BATCH_H_
+#define _BASKET_BATCH_H_
+
+#include <sys/types.h>
+#include "basket.h"
+
+/*
+ * Many Baskets in one flat buffer.
+ *
+ * A lot of small Baskets sent one by one cost one allocation, one header
+ * and one write per Basket. The batch frame packs them back to back:
+ *
+ *  [ basket_batch_header_t ]
+ *  [ uint32_t size | flat Basket, see ::basket_to_buf() ] ...
+ *
+ * The frame checksum covers the batch header, and for every Basket its
+ * size and its flat header. The flat header holds the Basket checksum,
+ * which covers the box headers with the box data checksums.
+ *
+ * The receiver tests the whole frame once, with ::basket_batch_validate():
+ * the frame checksum, then every Basket checksum and every box data
+ * checksum. Then every Basket of the frame is opened as a read only view
+ * (see ::basket_view_from_buf_trusted()), no copy and no second test. The
+ * key/value entries are tested when found, by their own checksums.
+ */
+
+typedef struct __attribute__((packed)){
+	watermark_t watermark; /**< Watermark: filled with a predefined pattern WATERMARK_BASKET_BATCH */
+	checksum_t 	checksum; /**< The checksum of the frame, see above */
+	uint32_t 	total_len; /**< Total length of the frame, including this header */
+	uint32_t 	baskets_num; /**< Number of Baskets in the frame */
+	uint8_t 	checksum_alg; /**< The algorithm of the checksum, checksum_alg_t */
+}
+basket_batch_header_t;
+
+typedef struct {
+	const void **baskets; /**< The Baskets to pack; not owned by the batch */
+	uint32_t baskets_num; /**< Number of Baskets added */
+	uint32_t baskets_allocated; /**< For internal use: number of allocated pointers in 'baskets' */
+} basket_batch_t;
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Create a new empty batch
+ * @return basket_batch_t* The batch, NULL on an error
+ */
+__attribute__((warn_unused_result))
+extern basket_batch_t *basket_batch_new(void);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Release the batch
+ * @param basket_batch_t* batch The batch to release
+ * @return ret_t A_OK on success
+ * @details The Baskets added into the batch are not released
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_batch_release(basket_batch_t *batch);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Forget all added Baskets, the batch can be filled
+ *  	  again
+ * @param basket_batch_t* batch The batch to clean
+ * @details The memory of the batch is kept for the next round
+ */
+extern void basket_batch_clean(basket_batch_t *batch);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Add a Basket into the batch
+ * @param basket_batch_t* batch The batch
+ * @param const void* basket The Basket to add
+ * @return ret_t A_OK on success; -EINVAL if the basket is a
+ *  	   view; -ENOMEM on a memory error
+ * @details Only the pointer is kept: the Basket must stay valid
+ *  		until ::basket_batch_to_buf() is called
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_batch_add(basket_batch_t *batch, const void *basket);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Pack all added Baskets into one flat buffer
+ * @param const basket_batch_t* batch The batch
+ * @param size_t* size  Size of the frame returned here
+ * @return void* The frame, NULL on an error. The caller must
+ *  	   free() it.
+ * @details One allocation for all Baskets; every Basket is
+ *  		written directly into the frame, see
+ *  		::basket_to_buf_into(). The frame checksum uses the
+ *  		algorithm of the first Basket.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_batch_to_buf(const basket_batch_t *batch, size_t *size);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Test the frame: the header, the Basket sizes and
+ *  	  headers, the frame checksum, the Basket checksums and
+ *  	  the box data checksums
+ * @param const void* buf   The frame
+ * @param const size_t size  Size of the frame
+ * @return ret_t A_OK if the frame is valid; -EINVAL if not
+ * @details Call it once before ::basket_batch_iter(). All the
+ *  		box data of the frame is read.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_batch_validate(const void *buf, const size_t size);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Open the next Basket of the frame
+ * @param const void* buf   The frame, it must pass
+ *  			::basket_batch_validate() before the first call
+ * @param const size_t size  Size of the frame
+ * @param size_t* offset The position in the frame; set it to 0
+ *  			to get the first Basket, it is moved to the next
+ *  			one on every call
+ * @param ret_t* rc    A_OK if a Basket is returned or there are
+ *  			no more Baskets; -EINVAL if the Basket can not be
+ *  			opened, the offset is not moved then
+ * @return void* The Basket; NULL at the end of the frame (rc is
+ *  	   A_OK) or on an error (rc is -EINVAL). Release it with
+ *  	   ::basket_release().
+ * @details Only the Basket sizes are tested here, not the
+ *  		checksums: an unvalidated frame can give wrong Baskets.
+ *  		A raw Basket is a read only view over the frame, no
+ *  		copy: the frame must stay valid until the view is
+ *  		released. A compressed Basket can not be a view, it is
+ *  		restored with ::basket_from_buf() into a copy, which
+ *  		does not depend on the frame. Tell them with
+ *  		::basket_is_view().
+ */
+__attribute__((warn_unused_result))
+extern void *basket_batch_iter(const void *buf, const size_t size, size_t *offset, ret_t *rc);
+
+#endif /* _BASKET_BATCH_H_ */
@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "basket.h"
+#include "basket_decoder.h"
+#include "box_t.h"
+#include "debug.h"
+#include "tests.h"
+#include "checksum.h"
+#include "optimization.h"
+
+/* This is an internal function: collect up to 'size' bytes of a fixed size item; return number of bytes taken */
+static size_t basket_decoder_collect(basket_decoder_t *dec, void *item, const size_t size, const char *chunk, const size_t len)
+{
+	const size_t to_copy = MIN(size - dec->have, len);
+
+	memcpy((char *)item + dec->have, chunk, to_copy);
+	dec->have += to_copy;
+	return to_copy;
+}
+
+/* This is an internal function: the stream is broken, the decoder can not continue */
+static ssize_t basket_decoder_fail(basket_decoder_t *dec, const ssize_t err)
+{
+	dec->state = BASKET_DECODER_ERROR;
+	return err;
+}
+
+/* This is an internal function: the basket header is received; create the basket and its boxes */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_header_done(basket_decoder_t *dec)
+{
+	const basket_send_header_t *header    = &dec->header;
+	uint32_t                   box_index;
+
+	if (!BASKET_WATERMARK_VALID(header->watermark)) {
+		DE("Wrong buffer: wrong watermark. Expected %X but it is %X\n", WATERMARK_BASKET, header->watermark);
+		return -EINVAL;
+	}
+
+	if (header->total_len < sizeof(basket_send_header_t) || header->boxes_dumped > header->boxes_used ||
+		header->align_log2 > BASKET_ALIGN_LOG2_MAX || header->compress > BOX_COMPRESS_LZ) {
+		DE("Wrong buffer header: total_len %u, boxes used %u, boxes dumped %u, alignment %u, compression %u\n",
+		   (uint32_t)header->total_len, (uint32_t)header->boxes_used, (uint32_t)header->boxes_dumped, 1U << header->align_log2,
+		   header->compress);
+		return -EINVAL;
+	}
+
+	/* The buffer is validated with the algorithm it was created with */
+	if (0 != checksum_stream_init_alg(&dec->checksum, header->checksum_alg)) {
+		DE("Wrong buffer header: unknown checksum algorithm %u\n", header->checksum_alg);
+		return -EINVAL;
+	}
+
+	dec->basket = basket_new();
+	TESTP(dec->basket, -ENOMEM);
+	dec->basket->ticket = header->ticket;
+	dec->basket->checksum_alg = header->checksum_alg;
+
+	if (A_OK != basket_reserve_boxes(dec->basket, header->boxes_used)) {
+		return -ENOMEM;
+	}
+
+	/* All boxes are created empty; the dumped boxes are filled as their data arrives */
+	for (box_index = 0; box_index < header->boxes_used; box_index++) {
+		if (box_new(dec->basket, NULL, 0) < 0) {
+			DE("Could not create box[%u]\n", box_index);
+			return -ENOMEM;
+		}
+	}
+
+	checksum_stream_update(&dec->checksum, (const char *)header + offsetof(basket_send_header_t, ticket),
+						   sizeof(basket_send_header_t) - offsetof(basket_send_header_t, ticket));
+
+	dec->received = sizeof(basket_send_header_t);
+	return A_OK;
+}
+
+/* This is an internal function: a box header is received; prepare the destination box */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_box_header_done(basket_decoder_t *dec)
+{
+	const box_dump_t *box_header = &dec->box_header;
+
+	if (WATERMARK_BOX != box_header->watermark) {
+		DE("Wrong box[%u]: wrong watermark. Expected %X but it is %X\n", dec->boxes_done, WATERMARK_BOX, box_header->watermark);
+		return -EINVAL;
+	}
+
+	dec->pad = BASKET_ALIGN_PAD(dec->received + sizeof(box_dump_t), dec->header.align_log2);
+
+	if (box_header->box_index >= dec->header.boxes_used ||
+		dec->received + sizeof(box_dump_t) + dec->pad + box_header->box_size > dec->header.total_len) {
+		DE("Wrong box[%u]: index %u, size %u\n", dec->boxes_done, (uint32_t)box_header->box_index, (uint32_t)box_header->box_size);
+		return -EINVAL;
+	}
+
+	checksum_stream_update(&dec->checksum, (const char *)box_header, sizeof(box_dump_t));
+	dec->received += sizeof(box_dump_t);
+
+	dec->box = basket_get_box(dec->basket, box_header->box_index);
+	TESTP(dec->box, -EINVAL);
+
+	/* Every box is dumped once: its data and its checksum are the box header */
+	if (bx_used_take(dec->box) > 0) {
+		DE("Wrong box[%u]: index %u is dumped twice\n", dec->boxes_done, (uint32_t)box_header->box_index);
+		return -EINVAL;
+	}
+
+	/* The algorithm is tested in basket_decoder_header_done(): this call can not fail */
+	if (0 != checksum_stream_init_alg(&dec->box_checksum, dec->header.checksum_alg)) {
+		abort();
+	}
+
+	if (0 == box_header->box_size) {
+		return A_OK;
+	}
+
+	/* The compressed data is collected, and restored into the box when complete */
+	if (BOX_COMPRESS_LZ == dec->header.compress) {
+		dec->box_buf = malloc(box_header->box_size);
+		TESTP(dec->box_buf, -ENOMEM);
+		return A_OK;
+	}
+
+	/* Allocate the final size at once: the data is added without reallocations */
+	if (A_OK != bx_room_assure(dec->box, box_header->box_size)) {
+		DE("Could not allocate %u bytes for box[%u]\n", (uint32_t)box_header->box_size, (uint32_t)box_header->box_index);
+		return -ENOMEM;
+	}
+
+	return A_OK;
+}
+
+/* This is an internal function: the key/value dump is received; the index footer is not needed, skip it */
+static void basket_decoder_tail(basket_decoder_t *dec)
+{
+	dec->have = 0;
+	dec->state = (BASKET_FLAT_INDEX_SIZE(&dec->header) > 0) ? BASKET_DECODER_INDEX : BASKET_DECODER_DONE;
+}
+
+/* This is an internal function: all boxes received; test the checksum, then go to the key/value dump */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_boxes_done(basket_decoder_t *dec)
+{
+	checksum_t calculated_sum = 0;
+
+	if (dec->received != dec->header.total_len) {
+		DE("Wrong buffer: received %zu bytes, the header claims %u\n", dec->received, (uint32_t)dec->header.total_len);
+		return -EINVAL;
+	}
+
+	/* The buffer checksum is not set if the header was sent before the box headers were known */
+	if (!(dec->header.flags & BASKET_HEADER_NO_CHECKSUM)) {
+		if (0 != checksum_stream_final(&dec->checksum, &calculated_sum)) {
+			return -EINVAL;
+		}
+
+		if (dec->header.checksum != calculated_sum) {
+			DE("Wrong checksum: expected %X but it is %X\n", dec->header.checksum, calculated_sum);
+			return -EINVAL;
+		}
+	}
+
+	if (0 == dec->header.ztable_buf_size) {
+		basket_decoder_tail(dec);
+		return A_OK;
+	}
+
+	dec->zbuf = malloc(dec->header.ztable_buf_size);
+	TESTP(dec->zbuf, -ENOMEM);
+	dec->have = 0;
+	dec->state = BASKET_DECODER_ZHASH;
+	return A_OK;
+}
+
+/* This is an internal function: go to the next box header, or finish the boxes */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_next_box(basket_decoder_t *dec)
+{
+	dec->have = 0;
+	dec->box = NULL;
+
+	if (dec->boxes_done < dec->header.boxes_dumped) {
+		dec->state = BASKET_DECODER_BOX_HEADER;
+		return A_OK;
+	}
+
+	return basket_decoder_boxes_done(dec);
+}
+
+/* This is an internal function: the box data is received; test it against the box header, then go to the next box */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_box_done(basket_decoder_t *dec)
+{
+	checksum_t calculated_sum = 0;
+
+	/* The box checksum is of the restored data */
+	if (dec->box_buf) {
+		const ret_t rc = basket_box_uncompress(dec->box, dec->box_buf, dec->box_header.box_size);
+
+		free(dec->box_buf);
+		dec->box_buf = NULL;
+
+		if (A_OK != rc) {
+			DE("Could not restore the compressed box[%u]\n", (uint32_t)dec->box_header.box_index);
+			return rc;
+		}
+
+		checksum_stream_update(&dec->box_checksum, bx_data_take(dec->box), bx_used_take(dec->box));
+	}
+
+	if (0 != checksum_stream_final(&dec->box_checksum, &calculated_sum)) {
+		return -EINVAL;
+	}
+
+	/* The box checksum is always set */
+	if (dec->box_header.box_checksum != calculated_sum) {
+		DE("Wrong checksum of box[%u]: expected %X but it is %X\n", (uint32_t)dec->box_header.box_index, dec->box_header.box_checksum, calculated_sum);
+		return -EINVAL;
+	}
+
+	/* The box is sent again without hashing, if not changed */
+	bx_checksum_set(dec->box, dec->header.checksum_alg, calculated_sum);
+
+	dec->boxes_done++;
+	return basket_decoder_next_box(dec);
+}
+
+/* This is an internal function: the box header and the padding are received; go to the box data */
+__attribute__((warn_unused_result))
+static ssize_t basket_decoder_box_data_start(basket_decoder_t *dec)
+{
+	dec->have = 0;
+	dec->state = BASKET_DECODER_BOX_DATA;
+
+	/* An empty box: no data follows the header */
+	if (0 == dec->box_header.box_size) {
+		return basket_decoder_box_done(dec);
+	}
+
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+basket_decoder_t *basket_decoder_new(void)
+{
+	basket_decoder_t *dec = malloc(sizeof(basket_decoder_t));
+	TESTP(dec, NULL);
+
+	memset(dec, 0, sizeof(basket_decoder_t));
+	dec->state = BASKET_DECODER_HEADER;
+	return dec;
+}
+
+void basket_decoder_release(basket_decoder_t *dec)
+{
+	TESTP_ABORT(dec);
+
+	if (dec->basket && 0 != basket_release(dec->basket)) {
+		DE("Could not release basket\n");
+	}
+
+	free(dec->zbuf);
+	free(dec->box_buf);
+	free(dec);
+}
+
+__attribute__((warn_unused_result))
+ssize_t basket_decoder_feed(basket_decoder_t *dec, const void *chunk, size_t len)
+{
+	const char *chunk_char = chunk;
+	size_t     consumed    = 0;
+	ssize_t    rc          = A_OK;
+
+	TESTP_ABORT(dec);
+	TESTP_ABORT(chunk);
+
+	if (BASKET_DECODER_ERROR == dec->state) {
+		DE("The decoder is in the error state\n");
+		return -EINVAL;
+	}
+
+	while (consumed < len && BASKET_DECODER_DONE != dec->state) {
+		const char   *pos   = chunk_char + consumed;
+		const size_t avail  = len - consumed;
+		size_t       taken;
+
+		switch (dec->state) {
+		case BASKET_DECODER_HEADER:
+			consumed += basket_decoder_collect(dec, &dec->header, sizeof(basket_send_header_t), pos, avail);
+			if (dec->have < sizeof(basket_send_header_t)) {
+				break;
+			}
+
+			rc = basket_decoder_header_done(dec);
+			if (A_OK == rc) {
+				rc = basket_decoder_next_box(dec);
+			}
+			break;
+
+		case BASKET_DECODER_BOX_HEADER:
+			consumed += basket_decoder_collect(dec, &dec->box_header, sizeof(box_dump_t), pos, avail);
+			if (dec->have < sizeof(box_dump_t)) {
+				break;
+			}
+
+			rc = basket_decoder_box_header_done(dec);
+			if (A_OK != rc) {
+				break;
+			}
+
+			if (dec->pad > 0) {
+				dec->have = 0;
+				dec->state = BASKET_DECODER_BOX_PAD;
+				break;
+			}
+
+			rc = basket_decoder_box_data_start(dec);
+			break;
+
+		case BASKET_DECODER_BOX_PAD:
+			/* The padding is a part of the checksummed area */
+			taken = MIN(dec->pad - dec->have, avail);
+			checksum_stream_update(&dec->checksum, pos, taken);
+			dec->have += taken;
+			dec->received += taken;
+			consumed += taken;
+
+			if (dec->have == dec->pad) {
+				rc = basket_decoder_box_data_start(dec);
+			}
+			break;
+
+		case BASKET_DECODER_BOX_DATA:
+			/* The data goes directly into the destination box, unless it is compressed */
+			taken = MIN(dec->box_header.box_size - dec->have, avail);
+			if (dec->box_buf) {
+				memcpy(dec->box_buf + dec->have, pos, taken);
+			} else if (A_OK != bx_add(dec->box, pos, taken)) {
+				rc = -ENOMEM;
+				break;
+			} else {
+				checksum_stream_update(&dec->box_checksum, pos, taken);
+			}
+
+			dec->have += taken;
+			dec->received += taken;
+			consumed += taken;
+
+			if (dec->have == dec->box_header.box_size) {
+				rc = basket_decoder_box_done(dec);
+			}
+			break;
+
+		case BASKET_DECODER_ZHASH:
+			consumed += basket_decoder_collect(dec, dec->zbuf, dec->header.ztable_buf_size, pos, avail);
+			if (dec->have < dec->header.ztable_buf_size) {
+				break;
+			}
+
+			dec->basket->zhash = zhash_from_buf(dec->zbuf, dec->header.ztable_buf_size);
+			free(dec->zbuf);
+			dec->zbuf = NULL;
+			if (NULL == dec->basket->zhash) {
+				rc = -EINVAL;
+				break;
+			}
+
+			basket_decoder_tail(dec);
+			break;
+
+		case BASKET_DECODER_INDEX:
+			taken = MIN(BASKET_FLAT_INDEX_SIZE(&dec->header) - dec->have, avail);
+			dec->have += taken;
+			consumed += taken;
+
+			if (dec->have == BASKET_FLAT_INDEX_SIZE(&dec->header)) {
+				dec->state = BASKET_DECODER_DONE;
+			}
+			break;
+
+		default:
+			DE("Wrong decoder state: %d\n", dec->state);
+			rc = -EINVAL;
+			break;
+		}
+
+		if (A_OK != rc) {
+			return basket_decoder_fail(dec, rc);
+		}
+	}
+
+	return consumed;
+}
+
+__attribute__((warn_unused_result, pure))
+int basket_decoder_is_done(const basket_decoder_t *dec)
+{
+	TESTP_ABORT(dec);
+	return (BASKET_DECODER_DONE == dec->state) ? YES : NO;
+}
+
+__attribute__((warn_unused_result))
+void *basket_decoder_take(basket_decoder_t *dec)
+{
+	basket_t *basket;
+	TESTP_ABORT(dec);
+
+	if (BASKET_DECODER_DONE != dec->state) {
+		return NULL;
+	}
+
+	basket = dec->basket;
+
+	/* The boxes were filled directly: count them once */
+	basket_sizes_recount(basket);
+
+	/* Ready for the next basket in the stream */
+	memset(dec, 0, sizeof(basket_decoder_t));
+	dec->state = BASKET_DECODER_HEADER;
+	return basket;
+}
@@ -0,0 +1,117 @@
+#ifndef _BASKET_DECODER_H_
+#define _BASKET_DECODER_H_
+
+#include <sys/types.h>
+#include "basket.h"
+#include "checksum.h"
+
+/*
+ * Incremental decoder of the Basket flat buffer (the result of ::basket_to_buf(),
+ * ::basket_to_iovec() etc.)
+ *
+ * The flat buffer arrives from a socket in chunks of any size. The decoder
+ * takes the chunks one by one, as they arrive, and restores the Basket on the fly:
+ *
+ *  [ basket_send_header_t ][ box_dump_t | data ] ... [ box_dump_t | data ][ zhash dump ]
+ *
+ * The headers are collected in the decoder itself; the box data is copied
+ * directly into its destination box, which is allocated to the final size
+ * when the box header arrives. The flat buffer is never kept in memory as a whole.
+ * Only the key/value dump is collected into a temporary buffer, if there is one.
+ *
+ * Usage:
+ *
+ *  dec = basket_decoder_new();
+ *  while (... read a chunk from the socket ...) {
+ *      consumed = basket_decoder_feed(dec, chunk, chunk_size);
+ *      if (consumed < 0) -> error, the stream is broken
+ *      if (YES == basket_decoder_is_done(dec)) {
+ *          basket = basket_decoder_take(dec);
+ *          the rest of the chunk (chunk_size - consumed) is the beginning of the next basket
+ *      }
+ *  }
+ *  basket_decoder_release(dec);
+ */
+
+typedef enum {
+	BASKET_DECODER_HEADER = 0,	/**< Waiting for the basket header */
+	BASKET_DECODER_BOX_HEADER,	/**< Waiting for a box header */
+	BASKET_DECODER_BOX_PAD,		/**< Skipping the padding before the box data, see ::basket_to_buf_aligned() */
+	BASKET_DECODER_BOX_DATA,	/**< Receiving the box data */
+	BASKET_DECODER_ZHASH,		/**< Receiving the key/value dump */
+	BASKET_DECODER_INDEX,		/**< Skipping the box index footer, see ::basket_to_buf_indexed() */
+	BASKET_DECODER_DONE,		/**< The Basket is complete, see ::basket_decoder_take() */
+	BASKET_DECODER_ERROR,		/**< The stream is broken, the decoder can not continue */
+} basket_decoder_state_t;
+
+typedef struct {
+	basket_decoder_state_t state; /**< Current state */
+	basket_send_header_t header; /**< The basket header, collected */
+	box_dump_t box_header; /**< The current box header, collected */
+	size_t have; /**< Number of bytes of the current item received */
+	size_t pad; /**< Number of padding bytes before the current box data */
+	size_t received; /**< Number of bytes of the basket (without the key/value dump) received */
+	uint32_t boxes_done; /**< Number of boxes received */
+	box_t *box; /**< The destination box of the current box data */
+	basket_t *basket; /**< The Basket being restored */
+	char *zbuf; /**< The key/value dump, collected */
+	char *box_buf; /**< The current box data of a compressed buffer, collected; see ::basket_box_uncompress() */
+	checksum_stream_t checksum; /**< Running checksum of the received headers */
+	checksum_stream_t box_checksum; /**< Running checksum of the current box data */
+} basket_decoder_t;
+
+/**
+ * @author Sebastian Mountaniol (8/28/22)
+ * @brief Allocate a new decoder
+ * @return basket_decoder_t* The decoder, NULL on an error
+ */
+__attribute__((warn_unused_result))
+extern basket_decoder_t *basket_decoder_new(void);
+
+/**
+ * @author Sebastian Mountaniol (8/28/22)
+ * @brief Release the decoder and the Basket it restores, if any
+ * @param basket_decoder_t* dec   The decoder
+ */
+extern void basket_decoder_release(basket_decoder_t *dec);
+
+/**
+ * @author Sebastian Mountaniol (8/28/22)
+ * @brief Pass the next chunk of the stream to the decoder
+ * @param basket_decoder_t* dec   The decoder
+ * @param const void* chunk The bytes received
+ * @param size_t len   Number of bytes in the chunk
+ * @return ssize_t Number of bytes consumed from the chunk; it is
+ *  	   less than 'len' when the Basket is complete before
+ *  	   the end of the chunk. -EINVAL if the stream is
+ *  	   broken (a wrong watermark, size or checksum), -ENOMEM
+ *  	   on an allocation error; after an error the decoder
+ *  	   can only be released.
+ * @details Nothing is consumed when the decoder is done; take
+ *  		the Basket with ::basket_decoder_take() first.
+ */
+__attribute__((warn_unused_result))
+extern ssize_t basket_decoder_feed(basket_decoder_t *dec, const void *chunk, size_t len);
+
+/**
+ * @author Sebastian Mountaniol (8/28/22)
+ * @brief Test whether the Basket is completely received
+ * @param const basket_decoder_t* dec   The decoder
+ * @return int YES if the Basket is ready, NO otherwise
+ */
+__attribute__((warn_unused_result, pure))
+extern int basket_decoder_is_done(const basket_decoder_t *dec);
+
+/**
+ * @author Sebastian Mountaniol (8/28/22)
+ * @brief Take the restored Basket from the decoder
+ * @param basket_decoder_t* dec   The decoder
+ * @return void* The Basket, the caller owns it; NULL if the
+ *  	   Basket is not complete yet
+ * @details The decoder is reset and ready for the next Basket
+ *  		of the stream.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_decoder_take(basket_decoder_t *dec);
+
+#endif /* _BASKET_DECODER_H_ */
@@ -0,0 +1,477 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "basket.h"
+#include "basket_diff.h"
+#include "box_t.h"
+#include "debug.h"
+#include "tests.h"
+#include "checksum.h"
+#include "optimization.h"
+
+/* This is an internal function: the checksum of the box data; calculated only if the box changed since the last time */
+__attribute__((warn_unused_result))
+static checksum_t basket_diff_box_checksum(const box_t *box, const uint8_t alg)
+{
+	checksum_t checksum = 0;
+
+	/* The algorithm is tested by the caller: this call can not fail; only the checksum cache of the box is written,
+	   and it is safe to do from many threads (see ::bx_checksum_set()) */
+	if (A_OK != bx_checksum_get((box_t *)box, alg, &checksum)) {
+		abort();
+	}
+
+	return checksum;
+}
+
+/* This is an internal function: the checksum of the box sizes and the box checksums, in order; identifies the version of the Basket */
+__attribute__((warn_unused_result))
+static checksum_t basket_diff_base_checksum(const basket_t *basket, const uint8_t alg)
+{
+	checksum_stream_t checksum;
+	checksum_t        calculated_sum = 0;
+	box_u32_t         box_index;
+
+	/* The algorithm is tested by the caller: this call can not fail */
+	if (0 != checksum_stream_init_alg(&checksum, alg)) {
+		abort();
+	}
+
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		const box_t *box     = basket_get_box(basket, box_index);
+		box_type_t  box_size = 0;
+		checksum_t  box_sum  = 0;
+
+		if (box) {
+			box_size = bx_used_take(box);
+			box_sum = basket_diff_box_checksum(box, alg);
+		}
+
+		checksum_stream_update(&checksum, (const char *)&box_size, sizeof(box_type_t));
+		checksum_stream_update(&checksum, (const char *)&box_sum, sizeof(checksum_t));
+	}
+
+	if (0 != checksum_stream_final(&checksum, &calculated_sum)) {
+		abort();
+	}
+
+	return calculated_sum;
+}
+
+/* This is an internal function: YES if both boxes hold the same data; a missed box is an empty box */
+__attribute__((warn_unused_result))
+static int basket_diff_box_same(const box_t *old_box, const box_t *new_box, const uint8_t alg)
+{
+	const box_s64_t old_used = old_box ? bx_used_take(old_box) : 0;
+	const box_s64_t new_used = new_box ? bx_used_take(new_box) : 0;
+	checksum_t      old_checksum;
+	checksum_t      new_checksum;
+
+	if (old_used != new_used) {
+		return NO;
+	}
+
+	/* Empty, or the data shared between the baskets (see ::basket_clone()) */
+	if (0 == new_used || bx_data_take(old_box) == bx_data_take(new_box)) {
+		return YES;
+	}
+
+	/* Different cached checksums: the box is changed, no need to read the data */
+	if (YES == bx_checksum_cached(old_box, alg, &old_checksum) &&
+		YES == bx_checksum_cached(new_box, alg, &new_checksum) &&
+		old_checksum != new_checksum) {
+		return NO;
+	}
+
+	return (0 == memcmp(bx_data_take(old_box), bx_data_take(new_box), new_used)) ? YES : NO;
+}
+
+/* This is an internal function: YES if the old key/value table holds the same value for the key */
+__attribute__((warn_unused_result))
+static int basket_diff_key_same(const ztable_t *old_zhash, const zentry_t *entry)
+{
+	void    *val;
+	ssize_t val_size;
+
+	if (NULL == old_zhash || false == zhash_exists_by_int(old_zhash, entry->Key.key_int64)) {
+		return NO;
+	}
+
+	val = zhash_find_by_int(old_zhash, entry->Key.key_int64, &val_size);
+	if (val_size != (ssize_t)entry->Val.val_size) {
+		return NO;
+	}
+
+	return (0 == val_size || 0 == memcmp(val, entry->Val.val, val_size)) ? YES : NO;
+}
+
+/**
+ * @author Sebastian Mountaniol (9/4/22)
+ * @brief Write the diff entries after the header
+ * @param const basket_t* old_basket The previous version
+ * @param const basket_t* new_basket The new version
+ * @param char* buf   The diff buffer; WARNING: it CAN be NULL,
+ *  		  then only the size is calculated
+ * @param basket_diff_header_t* header The header; the entry
+ *  						   counters are set here
+ * @return size_t The size of the diff, including the header
+ * @details Called twice: to calculate the size, and to fill the
+ *  		allocated buffer. The counters are the same both
+ *  		times.
+ */
+__attribute__((warn_unused_result))
+static size_t basket_diff_fill(const basket_t *old_basket, const basket_t *new_basket, char *buf, basket_diff_header_t *header)
+{
+	size_t    buf_offset = sizeof(basket_diff_header_t);
+	box_u32_t box_index;
+	zentry_t  *entry;
+	size_t    zindex;
+
+	header->boxes_changed = 0;
+	header->keys_changed = 0;
+	header->keys_removed = 0;
+
+	/*** 1. The changed and added boxes; the new data ***/
+	for (box_index = 0; box_index < new_basket->boxes_used; box_index++) {
+		const box_t *new_box  = basket_get_box(new_basket, box_index);
+		const box_t *old_box  = (box_index < old_basket->boxes_used) ? basket_get_box(old_basket, box_index) : NULL;
+		box_s64_t   box_size;
+
+		if (YES == basket_diff_box_same(old_box, new_box, header->checksum_alg)) {
+			continue;
+		}
+
+		box_size = new_box ? bx_used_take(new_box) : 0;
+
+		if (buf) {
+			box_dump_t *box_dump_header_p = (box_dump_t *)(buf + buf_offset);
+			checksum_t box_checksum       = box_size ? basket_diff_box_checksum(new_box, header->checksum_alg) : 0;
+
+			box_dump_header_p->watermark = WATERMARK_BOX;
+			box_dump_header_p->box_index = box_index;
+			box_dump_header_p->box_size = box_size;
+			box_dump_header_p->box_checksum = box_checksum;
+
+			if (box_size > 0) {
+				memcpy(buf + buf_offset + sizeof(box_dump_t), bx_data_take(new_box), box_size);
+			}
+		}
+
+		buf_offset += sizeof(box_dump_t) + box_size;
+		header->boxes_changed++;
+	}
+
+	/*** 2. The changed and added key/value entries ***/
+	zindex = 0;
+	entry = NULL;
+	while (new_basket->zhash && NULL != (entry = zhash_list(new_basket->zhash, &zindex, entry))) {
+		if (YES == basket_diff_key_same(old_basket->zhash, entry)) {
+			continue;
+		}
+
+		if (buf) {
+			zhash_entry_t *zentry = (zhash_entry_t *)(buf + buf_offset);
+			char          *pos    = buf + buf_offset + sizeof(zhash_entry_t);
+
+			zentry->watemark = ZENTRY_WATERMARK;
+			zentry->checksum = 0;
+			zentry->key_int64 = entry->Key.key_int64;
+			zentry->key_str_len = entry->Key.key_str ? entry->Key.key_str_len : 0;
+			zentry->val_size = entry->Val.val_size;
+
+			if (zentry->key_str_len > 0) {
+				memcpy(pos, entry->Key.key_str, zentry->key_str_len);
+			}
+
+			if (entry->Val.val_size > 0) {
+				memcpy(pos + zentry->key_str_len, entry->Val.val, entry->Val.val_size);
+			}
+		}
+
+		buf_offset += sizeof(zhash_entry_t) + (entry->Key.key_str ? entry->Key.key_str_len : 0) + entry->Val.val_size;
+		header->keys_changed++;
+	}
+
+	/*** 3. The removed keys ***/
+	zindex = 0;
+	entry = NULL;
+	while (old_basket->zhash && NULL != (entry = zhash_list(old_basket->zhash, &zindex, entry))) {
+		if (new_basket->zhash && zhash_exists_by_int(new_basket->zhash, entry->Key.key_int64)) {
+			continue;
+		}
+
+		if (buf) {
+			memcpy(buf + buf_offset, &entry->Key.key_int64, sizeof(uint64_t));
+		}
+
+		buf_offset += sizeof(uint64_t);
+		header->keys_removed++;
+	}
+
+	return buf_offset;
+}
+
+__attribute__((warn_unused_result))
+void *basket_diff_to_buf(const void *old_basket, const void *new_basket, size_t *size)
+{
+	const basket_t       *_old          = old_basket;
+	const basket_t       *_new          = new_basket;
+	basket_diff_header_t header;
+	basket_diff_header_t *header_p;
+	checksum_stream_t    checksum;
+	checksum_t           calculated_sum = 0;
+	char                 *buf;
+	size_t               total_len;
+
+	TESTP_ABORT(_old);
+	TESTP_ABORT(_new);
+	TESTP_ABORT(size);
+
+	if (YES == basket_is_view(_old) || YES == basket_is_view(_new)) {
+		DE("Can not make the diff of a view, materialize it first\n");
+		return NULL;
+	}
+
+	/* Only the sizes are calculated here */
+	memset(&header, 0, sizeof(basket_diff_header_t));
+	header.checksum_alg = _new->checksum_alg;
+	total_len = basket_diff_fill(_old, _new, NULL, &header);
+
+	if (total_len > UINT32_MAX) {
+		DE("The diff is too big: %zu bytes\n", total_len);
+		return NULL;
+	}
+
+	/* Every byte is written, no need to clean */
+	buf = malloc(total_len);
+	TESTP(buf, NULL);
+
+	header_p = (basket_diff_header_t *)buf;
+	header_p->watermark = WATERMARK_BASKET_DIFF;
+	header_p->checksum = 0;
+	header_p->ticket = _new->ticket;
+	header_p->total_len = total_len;
+	header_p->base_checksum = basket_diff_base_checksum(_old, _new->checksum_alg);
+	header_p->base_boxes_used = _old->boxes_used;
+	header_p->boxes_used = _new->boxes_used;
+	header_p->checksum_alg = _new->checksum_alg;
+
+	if (basket_diff_fill(_old, _new, buf, header_p) != total_len) {
+		DE("Critical error: the diff size is changed while written\n");
+		abort();
+	}
+
+	/* The algorithm is validated when set: these calls can not fail */
+	if (0 != checksum_stream_init_alg(&checksum, header_p->checksum_alg)) {
+		abort();
+	}
+
+	checksum_stream_update(&checksum, buf + offsetof(basket_diff_header_t, ticket), total_len - offsetof(basket_diff_header_t, ticket));
+	if (0 != checksum_stream_final(&checksum, &calculated_sum)) {
+		abort();
+	}
+
+	header_p->checksum = calculated_sum;
+	*size = total_len;
+	return buf;
+}
+
+/* This is an internal function: test that every entry of the diff is complete and inside of the diff */
+__attribute__((warn_unused_result))
+static ret_t basket_diff_test(const basket_diff_header_t *header)
+{
+	const char *diff_char  = (const char *)header;
+	size_t     buf_offset  = sizeof(basket_diff_header_t);
+	uint32_t   index;
+
+	for (index = 0; index < header->boxes_changed; index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(diff_char + buf_offset);
+
+		if (buf_offset + sizeof(box_dump_t) > header->total_len ||
+			buf_offset + sizeof(box_dump_t) + box_dump_header_p->box_size > header->total_len) {
+			DE("Wrong diff: box entry %u is out of the diff\n", index);
+			return -EINVAL;
+		}
+
+		if (WATERMARK_BOX != box_dump_header_p->watermark || box_dump_header_p->box_index >= header->boxes_used) {
+			DE("Wrong diff: box entry %u, index %u\n", index, (uint32_t)box_dump_header_p->box_index);
+			return -EINVAL;
+		}
+
+		buf_offset += sizeof(box_dump_t) + box_dump_header_p->box_size;
+	}
+
+	for (index = 0; index < header->keys_changed; index++) {
+		const zhash_entry_t *zentry = (const zhash_entry_t *)(diff_char + buf_offset);
+
+		if (buf_offset + sizeof(zhash_entry_t) > header->total_len ||
+			buf_offset + sizeof(zhash_entry_t) + (uint64_t)zentry->key_str_len + zentry->val_size > header->total_len) {
+			DE("Wrong diff: key/value entry %u is out of the diff\n", index);
+			return -EINVAL;
+		}
+
+		if (ZENTRY_WATERMARK != zentry->watemark) {
+			DE("Wrong diff: key/value entry %u, wrong watermark %X\n", index, zentry->watemark);
+			return -EINVAL;
+		}
+
+		buf_offset += sizeof(zhash_entry_t) + zentry->key_str_len + zentry->val_size;
+	}
+
+	buf_offset += (size_t)header->keys_removed * sizeof(uint64_t);
+
+	if (buf_offset != header->total_len) {
+		DE("Wrong diff: the entries take %zu bytes, the header claims %u\n", buf_offset, header->total_len);
+		return -EINVAL;
+	}
+
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_apply_diff(void *basket, const void *diff, const size_t size)
+{
+	basket_t                   *_basket       = basket;
+	const basket_diff_header_t *header        = diff;
+	const char                 *diff_char     = diff;
+	size_t                     buf_offset     = sizeof(basket_diff_header_t);
+	checksum_stream_t          checksum;
+	checksum_t                 calculated_sum = 0;
+	uint32_t                   index;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(diff);
+
+	if (YES == basket_is_view(_basket)) {
+		DE("The basket %p is a read only view, materialize it first\n", _basket);
+		return -EINVAL;
+	}
+
+	if (size < sizeof(basket_diff_header_t) || WATERMARK_BASKET_DIFF != header->watermark ||
+		header->total_len < sizeof(basket_diff_header_t) || header->total_len > size) {
+		DE("Wrong diff: wrong watermark or size\n");
+		return -EINVAL;
+	}
+
+	if (0 != checksum_stream_init_alg(&checksum, header->checksum_alg)) {
+		DE("Wrong diff: unknown checksum algorithm %u\n", header->checksum_alg);
+		return -EINVAL;
+	}
+
+	/* The diff is always checksummed: 0 is a valid checksum too */
+	checksum_stream_update(&checksum, diff_char + offsetof(basket_diff_header_t, ticket),
+						   header->total_len - offsetof(basket_diff_header_t, ticket));
+	if (0 != checksum_stream_final(&checksum, &calculated_sum) || header->checksum != calculated_sum) {
+		DE("Wrong diff checksum: expected %X but it is %X\n", header->checksum, calculated_sum);
+		return -EINVAL;
+	}
+
+	/* The diff is made against one version of the basket */
+	if (header->base_boxes_used != _basket->boxes_used ||
+		header->base_checksum != basket_diff_base_checksum(_basket, header->checksum_alg)) {
+		DE("The diff is made for another version of the basket\n");
+		return -EINVAL;
+	}
+
+	/* Everything is tested before the basket is changed */
+	if (A_OK != basket_diff_test(header)) {
+		return -EINVAL;
+	}
+
+	/*** 1. The number of boxes: the new boxes are empty, the boxes after the last one are removed ***/
+	if (A_OK != basket_reserve_boxes(_basket, header->boxes_used)) {
+		return -ENOMEM;
+	}
+
+	while (_basket->boxes_used < header->boxes_used) {
+		if (box_new(_basket, NULL, 0) < 0) {
+			DE("Could not add a box\n");
+			return -ENOMEM;
+		}
+	}
+
+	while (_basket->boxes_used > header->boxes_used) {
+		_basket->boxes_used--;
+		if (bx_free(_basket->boxes[_basket->boxes_used]) < 0) {
+			DE("Could not release box[%u]\n", (uint32_t)_basket->boxes_used);
+			ABORT_OR_RETURN(-ENOMEM);
+		}
+		_basket->boxes[_basket->boxes_used] = NULL;
+	}
+
+	/* The removed boxes are not in the counters anymore */
+	basket_sizes_recount(_basket);
+
+	/*** 2. The changed boxes ***/
+	for (index = 0; index < header->boxes_changed; index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(diff_char + buf_offset);
+		ret_t            rc;
+
+		buf_offset += sizeof(box_dump_t);
+
+		if (0 == box_dump_header_p->box_size) {
+			rc = box_clean(_basket, box_dump_header_p->box_index);
+		} else {
+			rc = box_data_replace(_basket, box_dump_header_p->box_index, diff_char + buf_offset, box_dump_header_p->box_size);
+		}
+
+		if (A_OK != rc) {
+			DE("Could not set box[%u]\n", (uint32_t)box_dump_header_p->box_index);
+			return -ENOMEM;
+		}
+
+		/* The data is covered by the diff checksum: the box checksum in the entry is right */
+		if (box_dump_header_p->box_size > 0) {
+			bx_checksum_set(basket_get_box(_basket, box_dump_header_p->box_index), header->checksum_alg,
+							box_dump_header_p->box_checksum);
+		}
+
+		buf_offset += box_dump_header_p->box_size;
+	}
+
+	/*** 3. The changed key/value entries: the old value is replaced ***/
+	for (index = 0; index < header->keys_changed; index++) {
+		const zhash_entry_t *zentry  = (const zhash_entry_t *)(diff_char + buf_offset);
+		const char          *key_str = diff_char + buf_offset + sizeof(zhash_entry_t);
+		ssize_t             old_size;
+		char                *val;
+		ret_t               rc;
+
+		free(basket_keyval_extract_by_in64(_basket, zentry->key_int64, &old_size));
+
+		/* The basket owns the value */
+		val = malloc(MAX(zentry->val_size, 1));
+		TESTP(val, -ENOMEM);
+		memcpy(val, key_str + zentry->key_str_len, zentry->val_size);
+
+		if (zentry->key_str_len > 0) {
+			rc = basket_keyval_add_by_str(_basket, (char *)key_str, zentry->key_str_len, val, zentry->val_size);
+		} else {
+			rc = basket_keyval_add_by_int64(_basket, zentry->key_int64, val, zentry->val_size);
+		}
+
+		if (0 != rc) {
+			DE("Could not set the key %lX\n", zentry->key_int64);
+			free(val);
+			return -ENOMEM;
+		}
+
+		buf_offset += sizeof(zhash_entry_t) + zentry->key_str_len + zentry->val_size;
+	}
+
+	/*** 4. The removed keys ***/
+	for (index = 0; index < header->keys_removed; index++) {
+		uint64_t key_int64;
+		ssize_t  old_size;
+
+		memcpy(&key_int64, diff_char + buf_offset, sizeof(uint64_t));
+		free(basket_keyval_extract_by_in64(_basket, key_int64, &old_size));
+		buf_offset += sizeof(uint64_t);
+	}
+
+	_basket->ticket = header->ticket;
+	return A_OK;
+}
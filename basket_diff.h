@@ -0,0 +1,80 @@
+#ifndef _BASKET_DIFF_H_
+#define _BASKET_DIFF_H_
+
+#include <sys/types.h>
+#include "basket.h"
+#include "zhash3.h"
+
+/*
+ * Delta of two versions of a Basket.
+ *
+ * When a Basket is sent again and again with only a few boxes or key/value
+ * entries changed, the receiver keeps the previous version and gets only
+ * the difference:
+ *
+ *  [ basket_diff_header_t ]
+ *  [ box_dump_t | data ] ...                        the changed and added boxes, new data
+ *  [ zhash_entry_t | key string | value ] ...       the changed and added key/value entries
+ *  [ uint64_t key ] ...                             the removed keys
+ *
+ * A box removed from the tail is not listed: the header holds the new
+ * number of boxes. A box which became empty is listed with size 0.
+ *
+ * The diff is applied only to the same version it was created against:
+ * the header holds the checksum of the old boxes (see ::bx_checksum_get()),
+ * and ::basket_apply_diff() refuses a diff made for another version.
+ */
+
+typedef struct __attribute__((packed)){
+	watermark_t watermark; /**< Watermark: filled with a predefined pattern WATERMARK_BASKET_DIFF */
+	checksum_t 	checksum; /**< The checksum of the diff from ::ticket up to the end */
+	ticket_t 	ticket; /**< The ticket of the new Basket */
+	uint32_t 	total_len; /**< Total length of the diff, including this header */
+	checksum_t 	base_checksum; /**< The checksum of the boxes of the old Basket */
+	num_boxes_t base_boxes_used; /**< Number of boxes of the old Basket */
+	num_boxes_t boxes_used; /**< Number of boxes of the new Basket */
+	num_boxes_t boxes_changed; /**< Number of box_dump_t entries */
+	uint32_t 	keys_changed; /**< Number of zhash_entry_t entries */
+	uint32_t 	keys_removed; /**< Number of removed keys */
+	uint8_t 	checksum_alg; /**< The algorithm of the checksums, checksum_alg_t */
+}
+basket_diff_header_t;
+
+/**
+ * @author Sebastian Mountaniol (9/4/22)
+ * @brief Create the diff between two versions of the Basket
+ * @param const void* old_basket The previous version, the one
+ *  			the receiver has
+ * @param const void* new_basket The new version
+ * @param size_t* size  Size of the diff returned here
+ * @return void* The diff, NULL on an error. The caller must
+ *  	   free() it.
+ * @details Only the changed boxes and key/value entries are
+ *  		copied. A box is compared by its size first; the boxes
+ *  		sharing the data (see ::basket_clone()) are not read.
+ *  		Different cached checksums mark a changed box without
+ *  		reading it; otherwise the data of both boxes is
+ *  		compared, so an unchanged box is always read. The
+ *  		checksum of the old boxes, in the header, hashes every
+ *  		box of the old Basket which has no cached checksum.
+ *  		The baskets must be regular baskets, not views. Apply
+ *  		the diff with ::basket_apply_diff().
+ */
+__attribute__((warn_unused_result))
+extern void *basket_diff_to_buf(const void *old_basket, const void *new_basket, size_t *size);
+
+/**
+ * @author Sebastian Mountaniol (9/4/22)
+ * @brief Apply the diff to the previous version of the Basket
+ * @param void* basket The previous version; becomes the new
+ *  		  version
+ * @param const void* diff   The diff, see ::basket_diff_to_buf()
+ * @param const size_t size  Size of the diff
+ * @return ret_t A_OK on success; -EINVAL if the diff is broken
+ *  	   or made for another version of the Basket, the Basket
+ *  	   is not changed then; -ENOMEM on a memory error
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_apply_diff(void *basket, const void *diff, const size_t size);
+
+#endif /* _BASKET_DIFF_H_ */
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "basket.h"
+#include "basket_encoder.h"
+#include "box_t.h"
+#include "debug.h"
+#include "tests.h"
+#include "checksum.h"
+#include "optimization.h"
+
+/* This is an internal function: copy the rest of the item from 'offset', up to 'size' bytes; return number of bytes copied */
+static size_t basket_encoder_copy(char *buf, const size_t size, const void *item, const size_t item_size, size_t *offset)
+{
+	const size_t to_copy = MIN(item_size - *offset, size);
+
+	memcpy(buf, (const char *)item + *offset, to_copy);
+	*offset += to_copy;
+	return to_copy;
+}
+
+/* This is an internal function: find the next box with data, starting from 'box_index'; return boxes_used if no more */
+__attribute__((warn_unused_result))
+static uint32_t basket_encoder_next_box(const basket_t *basket, uint32_t box_index)
+{
+	for (; box_index < basket->boxes_used; box_index++) {
+		const box_t *box = basket_get_box(basket, box_index);
+
+		if (box && bx_used_take(box) > 0) {
+			break;
+		}
+	}
+
+	return box_index;
+}
+
+/* This is an internal function: fill the box header of the box; the box data is hashed only if changed since the last time */
+static void basket_encoder_fill_box_header(box_dump_t *box_header, const box_t *box, const uint32_t box_index, const uint8_t alg)
+{
+	checksum_t box_checksum;
+
+	/* The algorithm is tested in basket_encoder_init(): this call can not fail; only the checksum cache of the box is
+	   written, and it is safe to do from many threads (see ::bx_checksum_set()) */
+	if (A_OK != bx_checksum_get((box_t *)box, alg, &box_checksum)) {
+		abort();
+	}
+
+	box_header->watermark = WATERMARK_BOX;
+	box_header->box_index = box_index;
+	box_header->box_size = bx_used_take(box);
+	box_header->box_checksum = box_checksum;
+}
+
+/* This is an internal function: write the whole buffer, continue partial writes */
+__attribute__((warn_unused_result))
+static ssize_t basket_encoder_write_all(int fd, const char *buf, const size_t size)
+{
+	size_t written = 0;
+
+	while (written < size) {
+		ssize_t rc = write(fd, buf + written, size - written);
+
+		if (rc < 0) {
+			struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+
+			if (EINTR == errno) {
+				continue;
+			}
+
+			/* A non-blocking descriptor: wait until it can take more; an interrupted wait is retried as the write */
+			if ((EAGAIN == errno || EWOULDBLOCK == errno) && (poll(&pfd, 1, -1) >= 0 || EINTR == errno)) {
+				continue;
+			}
+
+			DE("Could not write the basket: %s\n", strerror(errno));
+			return -errno;
+		}
+
+		written += rc;
+	}
+
+	return written;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_encoder_init(basket_encoder_t *enc, const void *basket, const int checksum_first)
+{
+	const basket_t *_basket   = basket;
+	uint32_t       box_index;
+	size_t         total_len  = sizeof(basket_send_header_t);
+	uint32_t       boxes_dumped = 0;
+
+	TESTP_ABORT(enc);
+	TESTP_ABORT(_basket);
+
+	memset(enc, 0, sizeof(basket_encoder_t));
+	enc->basket = _basket;
+	enc->state = BASKET_ENCODER_HEADER;
+	enc->checksum_first = (YES == checksum_first);
+
+	/* Only the sizes are needed for the header: no data touched here */
+	for (box_index = basket_encoder_next_box(_basket, 0); box_index < _basket->boxes_used;
+		 box_index = basket_encoder_next_box(_basket, box_index + 1)) {
+		total_len += sizeof(box_dump_t) + bx_used_take(basket_get_box(_basket, box_index));
+		boxes_dumped++;
+	}
+
+	if (bx_if_size_fits_box_type(total_len)) {
+		DE("The basket is too big for the flat buffer: %zu bytes\n", total_len);
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	enc->header.watermark = WATERMARK_BASKET;
+	enc->header.checksum = 0;
+	enc->header.ticket = _basket->ticket;
+	enc->header.total_len = total_len;
+	enc->header.boxes_used = _basket->boxes_used;
+	enc->header.boxes_dumped = boxes_dumped;
+	enc->header.ztable_buf_size = _basket->zhash ? zhash_to_buf_allocation_size(_basket->zhash) : 0;
+	enc->header.align_log2 = 0;
+	enc->header.checksum_alg = _basket->checksum_alg;
+	enc->header.compress = BOX_COMPRESS_RAW;
+	enc->header.flags = 0;
+
+	/* The checksum starts from 'ticket', the header fields are known now */
+	if (0 != checksum_stream_init_alg(&enc->checksum, enc->header.checksum_alg)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+	checksum_stream_update(&enc->checksum, (const char *)&enc->header + offsetof(basket_send_header_t, ticket),
+						   sizeof(basket_send_header_t) - offsetof(basket_send_header_t, ticket));
+
+	/* The checksum covers the final header; the first chunk tells the receiver it is not set yet */
+	if (!enc->checksum_first) {
+		enc->header.flags |= BASKET_HEADER_NO_CHECKSUM;
+		return A_OK;
+	}
+
+	/* The box headers carry the box checksums: only the changed boxes are hashed, the header is final before the first chunk */
+	for (box_index = basket_encoder_next_box(_basket, 0); box_index < _basket->boxes_used;
+		 box_index = basket_encoder_next_box(_basket, box_index + 1)) {
+		box_dump_t box_header;
+
+		basket_encoder_fill_box_header(&box_header, basket_get_box(_basket, box_index), box_index, enc->header.checksum_alg);
+		checksum_stream_update(&enc->checksum, (const char *)&box_header, sizeof(box_dump_t));
+	}
+
+	if (0 != checksum_stream_final(&enc->checksum, &enc->header.checksum)) {
+		DE("Failed to calculate the checksum\n");
+		abort();
+	}
+
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+size_t basket_encoder_next(basket_encoder_t *enc, void *buf, const size_t buf_size)
+{
+	char   *buf_char = buf;
+	size_t written   = 0;
+
+	TESTP_ABORT(enc);
+	TESTP_ABORT(buf);
+
+	while (written < buf_size && BASKET_ENCODER_DONE != enc->state) {
+		const box_t *box;
+		size_t      copied;
+
+		switch (enc->state) {
+		case BASKET_ENCODER_HEADER:
+			written += basket_encoder_copy(buf_char + written, buf_size - written,
+										   &enc->header, sizeof(basket_send_header_t), &enc->offset);
+			if (enc->offset == sizeof(basket_send_header_t)) {
+				enc->offset = 0;
+				enc->box_index = basket_encoder_next_box(enc->basket, 0);
+				enc->state = BASKET_ENCODER_BOX_HEADER;
+			}
+			break;
+
+		case BASKET_ENCODER_BOX_HEADER:
+			/* No more boxes: the checksum is complete */
+			if (enc->box_index >= enc->basket->boxes_used) {
+				if (!enc->checksum_first && 0 != checksum_stream_final(&enc->checksum, &enc->header.checksum)) {
+					DE("Failed to calculate the checksum\n");
+					abort();
+				}
+
+				enc->header.flags &= ~BASKET_HEADER_NO_CHECKSUM;
+
+				enc->state = enc->basket->zhash ? BASKET_ENCODER_ZHASH : BASKET_ENCODER_DONE;
+				break;
+			}
+
+			if (0 == enc->offset) {
+				basket_encoder_fill_box_header(&enc->box_header, basket_get_box(enc->basket, enc->box_index), enc->box_index,
+											   enc->header.checksum_alg);
+				if (!enc->checksum_first) {
+					checksum_stream_update(&enc->checksum, (const char *)&enc->box_header, sizeof(box_dump_t));
+				}
+			}
+
+			written += basket_encoder_copy(buf_char + written, buf_size - written,
+										   &enc->box_header, sizeof(box_dump_t), &enc->offset);
+			if (enc->offset == sizeof(box_dump_t)) {
+				enc->offset = 0;
+				enc->state = BASKET_ENCODER_BOX_DATA;
+			}
+			break;
+
+		case BASKET_ENCODER_BOX_DATA:
+			box = basket_get_box(enc->basket, enc->box_index);
+			copied = basket_encoder_copy(buf_char + written, buf_size - written,
+										 bx_data_take(box), bx_used_take(box), &enc->offset);
+			written += copied;
+			if (enc->offset == (size_t)bx_used_take(box)) {
+				enc->offset = 0;
+				enc->box_index = basket_encoder_next_box(enc->basket, enc->box_index + 1);
+				enc->state = BASKET_ENCODER_BOX_HEADER;
+			}
+			break;
+
+		case BASKET_ENCODER_ZHASH:
+			copied = zhash_to_buf_stream(enc->basket->zhash, &enc->zs, buf_char + written, buf_size - written,
+										  enc->basket->checksum_alg);
+			if (0 == copied) {
+				enc->state = BASKET_ENCODER_DONE;
+			}
+			written += copied;
+			break;
+
+		default:
+			DE("Wrong encoder state: %d\n", enc->state);
+			abort();
+		}
+	}
+
+	return written;
+}
+
+__attribute__((warn_unused_result, pure))
+const basket_send_header_t *basket_encoder_header(const basket_encoder_t *enc)
+{
+	TESTP_ABORT(enc);
+
+	if (BASKET_ENCODER_DONE != enc->state) {
+		return NULL;
+	}
+
+	return &enc->header;
+}
+
+__attribute__((warn_unused_result))
+ssize_t basket_write_fd(int fd, const void *basket)
+{
+	basket_encoder_t enc;
+	char             *chunk;
+	off_t            start;
+	int              seekable;
+	ssize_t          total    = 0;
+
+	TESTP_ABORT(basket);
+
+	/* A file opened for append can not be rewritten with pwrite() */
+	start = lseek(fd, 0, SEEK_CUR);
+	seekable = (start >= 0 && !(fcntl(fd, F_GETFL) & O_APPEND)) ? YES : NO;
+
+	if (A_OK != basket_encoder_init(&enc, basket, (YES == seekable) ? NO : YES)) {
+		return -EINVAL;
+	}
+
+	chunk = malloc(BASKET_ENCODER_CHUNK_SIZE);
+	TESTP(chunk, -ENOMEM);
+
+	while (BASKET_ENCODER_DONE != enc.state) {
+		const size_t size = basket_encoder_next(&enc, chunk, BASKET_ENCODER_CHUNK_SIZE);
+		ssize_t      rc   = basket_encoder_write_all(fd, chunk, size);
+
+		if (rc < 0) {
+			free(chunk);
+			return rc;
+		}
+
+		total += rc;
+	}
+
+	free(chunk);
+
+	/* The checksum was calculated on the fly: put the final header in place */
+	if (YES == seekable &&
+		(ssize_t)sizeof(basket_send_header_t) != pwrite(fd, basket_encoder_header(&enc), sizeof(basket_send_header_t), start)) {
+		DE("Could not rewrite the basket header: %s\n", strerror(errno));
+		return -EIO;
+	}
+
+	return total;
+}
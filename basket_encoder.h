@@ -0,0 +1,123 @@
+#ifndef _BASKET_ENCODER_H_
+#define _BASKET_ENCODER_H_
+
+#include <sys/types.h>
+#include "basket.h"
+#include "checksum.h"
+#include "zhash3.h"
+
+/*
+ * Chunked encoder of the Basket flat buffer: the counterpart of basket_decoder.h
+ *
+ * The encoder produces the same bytes as ::basket_to_buf(), but chunk by chunk,
+ * into a staging buffer of any size provided by the caller:
+ *
+ *  [ basket_send_header_t ][ box_dump_t | data ] ... [ box_dump_t | data ][ zhash dump ]
+ *
+ * The flat buffer is never allocated; the memory needed to save a Basket
+ * is the staging buffer, disregarding the Basket size.
+ *
+ * The checksum is in the header, which is the very first chunk. It covers the
+ * box headers, and every box header carries the checksum of its box data:
+ * a box is hashed only if it changed since its checksum was calculated last
+ * time (see ::bx_checksum_get()). The encoder can calculate it in two ways:
+ * - Before the encoding: the changed boxes are hashed first, no memory needed.
+ *   The produced chunks are final.
+ * - During the encoding: a changed box is hashed right before its header
+ *   is produced, but the header checksum is known
+ *   only when all the chunks produced. Then the caller rewrites the header
+ *   (see ::basket_encoder_header()) in the beginning of the output, which is
+ *   possible for a file, but not for a pipe or a socket.
+ */
+
+/**
+ * @def BASKET_ENCODER_CHUNK_SIZE
+ * @details Size of the staging buffer ::basket_write_fd() uses
+ */
+#define BASKET_ENCODER_CHUNK_SIZE (16 * 1024)
+
+typedef enum {
+	BASKET_ENCODER_HEADER = 0,	/**< Producing the basket header */
+	BASKET_ENCODER_BOX_HEADER,	/**< Producing a box header */
+	BASKET_ENCODER_BOX_DATA,	/**< Producing the box data */
+	BASKET_ENCODER_ZHASH,		/**< Producing the key/value dump */
+	BASKET_ENCODER_DONE,		/**< Everything produced */
+} basket_encoder_state_t;
+
+typedef struct {
+	basket_encoder_state_t state; /**< Current state */
+	const basket_t *basket; /**< The Basket to encode, must not be changed while encoded */
+	basket_send_header_t header; /**< The basket header */
+	box_dump_t box_header; /**< The current box header */
+	uint32_t box_index; /**< The current box */
+	size_t offset; /**< Bytes of the current item produced */
+	int8_t checksum_first; /**< The checksum is calculated before the encoding */
+	checksum_stream_t checksum; /**< Running checksum of the produced headers */
+	zhash_stream_t zs; /**< Position in the key/value dump */
+} basket_encoder_t;
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief Prepare the encoder for the Basket
+ * @param basket_encoder_t* enc   The encoder, usually on the
+ *  						stack; no memory is allocated
+ * @param const void* basket The Basket to encode
+ * @param const int checksum_first YES: calculate the checksum
+ *  		   before the encoding, the header chunk is final;
+ *  		   NO: calculate the checksum while encoding, see
+ *  		   ::basket_encoder_header()
+ * @return ret_t A_OK on success, -EINVAL on an error
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_encoder_init(basket_encoder_t *enc, const void *basket, const int checksum_first);
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief Produce the next chunk of the flat buffer
+ * @param basket_encoder_t* enc   The encoder
+ * @param void* buf   The staging buffer
+ * @param const size_t buf_size Size of the staging buffer
+ * @return size_t Number of bytes produced; less than the
+ *  	   buf_size only for the last chunk; 0 when everything
+ *  	   is produced
+ */
+__attribute__((warn_unused_result))
+extern size_t basket_encoder_next(basket_encoder_t *enc, void *buf, const size_t buf_size);
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief Return the final basket header, the first bytes of
+ *  	  the flat buffer
+ * @param const basket_encoder_t* enc   The encoder, done
+ * @return const basket_send_header_t* The header; NULL if the
+ *  	   encoder is not done yet
+ * @details When the checksum is calculated during the encoding,
+ *  		the header produced as the first chunk has no checksum,
+ *  		marked with BASKET_HEADER_NO_CHECKSUM (the receiver
+ *  		tests only the box checksums). Overwrite it with this
+ *  		one.
+ */
+__attribute__((warn_unused_result, pure))
+extern const basket_send_header_t *basket_encoder_header(const basket_encoder_t *enc);
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief Save the Basket into a file descriptor without
+ *  	  creating the flat buffer
+ * @param int fd    The file descriptor
+ * @param const void* basket Basket to save
+ * @return ssize_t Number of bytes written; a negative errno on
+ *  	   an error
+ * @details Writes through a staging buffer of
+ *  		::BASKET_ENCODER_CHUNK_SIZE bytes. For a seekable
+ *  		descriptor (a file) the checksum is calculated on
+ *  		the fly, and the header is rewritten at the end with
+ *  		pwrite(); for a pipe or a socket the checksum is
+ *  		calculated before writing. The result can be
+ *  		restored with ::basket_from_buf() or
+ *  		::basket_decoder_feed().
+ */
+__attribute__((warn_unused_result))
+extern ssize_t basket_write_fd(int fd, const void *basket);
+
+#endif /* _BASKET_ENCODER_H_ */
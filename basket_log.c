@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "basket.h"
+#include "basket_log.h"
+#include "debug.h"
+#include "tests.h"
+#include "optimization.h"
+
+/* The records are aligned to 8 bytes: the record header is read in place */
+#define BASKET_LOG_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
+/* The offset of the first record in a segment */
+#define BASKET_LOG_RECORDS_START BASKET_LOG_ALIGN(sizeof(basket_log_segment_header_t))
+
+/* Initial number of segment pointers and index entries; then they grow twice every time */
+#define BASKET_LOG_GROW_RATE (8)
+
+/* This is an internal function: the segment header */
+__attribute__((warn_unused_result, pure))
+static basket_log_segment_header_t *basket_log_header(const basket_log_segment_t *segment)
+{
+	return (basket_log_segment_header_t *)segment->mem;
+}
+
+/* This is an internal function: the path of the segment file */
+static void basket_log_segment_path(const basket_log_t *log, const uint32_t num, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/%08u.blog", log->dir, num);
+}
+
+/* This is an internal function: map an existing segment file; NULL if it is not a valid segment */
+__attribute__((warn_unused_result))
+static basket_log_segment_t *basket_log_segment_map(const char *path, const int writable)
+{
+	basket_log_segment_t *segment;
+	struct stat          st;
+	const int            fd      = open(path, writable ? O_RDWR : O_RDONLY);
+
+	if (fd < 0) {
+		DE("Could not open segment %s\n", path);
+		return NULL;
+	}
+
+	if (0 != fstat(fd, &st) || (size_t)st.st_size < BASKET_LOG_RECORDS_START) {
+		DE("Wrong segment %s: too small\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	segment = calloc(1, sizeof(basket_log_segment_t));
+	if (NULL == segment) {
+		close(fd);
+		return NULL;
+	}
+
+	segment->fd = fd;
+	segment->size = st.st_size;
+	segment->mem = mmap(NULL, segment->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == segment->mem) {
+		DE("Could not map segment %s\n", path);
+		close(fd);
+		free(segment);
+		return NULL;
+	}
+
+	if (WATERMARK_BASKET_LOG != basket_log_header(segment)->watermark ||
+		__atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE) > segment->size) {
+		DE("Wrong segment %s: wrong watermark or size\n", path);
+		munmap(segment->mem, segment->size);
+		close(fd);
+		free(segment);
+		return NULL;
+	}
+
+	/* The records reserved but never published are dropped */
+	segment->reserved = __atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE);
+	segment->indexed_to = BASKET_LOG_RECORDS_START;
+	segment->next_index_at = BASKET_LOG_RECORDS_START;
+	return segment;
+}
+
+/* This is an internal function: release the mapped segment */
+static void basket_log_segment_unmap(basket_log_segment_t *segment)
+{
+	munmap(segment->mem, segment->size);
+	close(segment->fd);
+	free(segment->index);
+	free(segment);
+}
+
+/* This is an internal function: create the segment file with its full size; it appears under its name ready to be mapped */
+__attribute__((warn_unused_result))
+static basket_log_segment_t *basket_log_segment_create(const basket_log_t *log, const uint32_t num)
+{
+	basket_log_segment_header_t header;
+	char                        path[PATH_MAX];
+	char                        tmp_path[PATH_MAX + 4];
+	int                         fd;
+
+	basket_log_segment_path(log, num, path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		DE("Could not create segment %s\n", tmp_path);
+		return NULL;
+	}
+
+	memset(&header, 0, sizeof(basket_log_segment_header_t));
+	header.committed = BASKET_LOG_RECORDS_START;
+	header.watermark = WATERMARK_BASKET_LOG;
+
+	if (0 != ftruncate(fd, log->segment_size) ||
+		sizeof(basket_log_segment_header_t) != pwrite(fd, &header, sizeof(basket_log_segment_header_t), 0) ||
+		0 != rename(tmp_path, path)) {
+		DE("Could not create segment %s\n", path);
+		close(fd);
+		unlink(tmp_path);
+		return NULL;
+	}
+
+	close(fd);
+	return basket_log_segment_map(path, YES);
+}
+
+/* This is an internal function: add the segment to the log; called with the log lock held */
+__attribute__((warn_unused_result))
+static ret_t basket_log_segments_push(basket_log_t *log, basket_log_segment_t *segment)
+{
+	if (log->segments_num == log->segments_allocated) {
+		const uint32_t       allocated = (0 == log->segments_allocated) ? BASKET_LOG_GROW_RATE : log->segments_allocated * 2;
+		basket_log_segment_t **segments = realloc(log->segments, allocated * sizeof(void *));
+
+		TESTP(segments, -ENOMEM);
+		log->segments = segments;
+		log->segments_allocated = allocated;
+	}
+
+	log->segments[log->segments_num] = segment;
+	log->segments_num++;
+	return A_OK;
+}
+
+/* This is an internal function: map the segments created since the last call; called with the log lock held */
+static void basket_log_segments_discover(basket_log_t *log)
+{
+	char path[PATH_MAX];
+
+	for (;;) {
+		basket_log_segment_t *segment;
+
+		basket_log_segment_path(log, log->segments_num, path);
+		if (0 != access(path, F_OK)) {
+			return;
+		}
+
+		segment = basket_log_segment_map(path, log->flags & BASKET_LOG_WRITE);
+		if (NULL == segment) {
+			return;
+		}
+
+		if (A_OK != basket_log_segments_push(log, segment)) {
+			basket_log_segment_unmap(segment);
+			return;
+		}
+	}
+}
+
+/* This is an internal function: a crashed writer can leave a full segment not sealed, or sealed after records it never
+   published; every segment but the last one ends at its published records, the readers go over it. Called by the writer */
+static void basket_log_segments_repair(basket_log_t *log)
+{
+	uint32_t index;
+
+	for (index = 0; index < log->segments_num; index++) {
+		basket_log_segment_header_t *header    = basket_log_header(log->segments[index]);
+		const uint64_t              committed  = __atomic_load_n(&header->committed, __ATOMIC_ACQUIRE);
+		const uint64_t              sealed_len = __atomic_load_n(&header->sealed_len, __ATOMIC_ACQUIRE);
+
+		/* The last segment is appended, unless it was sealed: then the next append creates the next one */
+		if (index + 1 == log->segments_num && 0 == sealed_len) {
+			continue;
+		}
+
+		if (sealed_len != committed) {
+			DE("Segment %u is sealed at %lu, its records end at %lu: sealed again\n", index, sealed_len, committed);
+			__atomic_store_n(&header->sealed_len, committed, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+/* This is an internal function: the published record at 'offset'; NULL if it is broken */
+__attribute__((warn_unused_result))
+static const basket_log_record_t *basket_log_record(const basket_log_segment_t *segment, const uint64_t offset, const uint64_t committed)
+{
+	const basket_log_record_t *record = (const basket_log_record_t *)(segment->mem + offset);
+
+	if (record->record_len < sizeof(basket_log_record_t) || record->record_len != BASKET_LOG_ALIGN(record->record_len) ||
+		offset + record->record_len > committed ||
+		(record->basket_size > 0 && record->basket_size < sizeof(basket_send_header_t)) ||
+		record->basket_size > record->record_len - sizeof(basket_log_record_t)) {
+		DE("Wrong record at offset %lu: record size %u, basket size %u\n", offset, record->record_len, record->basket_size);
+		return NULL;
+	}
+
+	return record;
+}
+
+/* This is an internal function: the ticket of the record */
+__attribute__((warn_unused_result, pure))
+static ticket_t basket_log_record_ticket(const basket_log_record_t *record)
+{
+	const basket_send_header_t *header = (const basket_send_header_t *)(record + 1);
+	return header->ticket;
+}
+
+/* This is an internal function: add the records published since the last call to the segment index; called with the index lock held */
+static void basket_log_segment_index(basket_log_segment_t *segment)
+{
+	const uint64_t committed = __atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE);
+
+	while (segment->indexed_to < committed) {
+		const basket_log_record_t *record = basket_log_record(segment, segment->indexed_to, committed);
+		ticket_t                  ticket;
+
+		if (NULL == record) {
+			return;
+		}
+
+		/* Not written record: no ticket */
+		if (0 == record->basket_size) {
+			segment->indexed_to += record->record_len;
+			continue;
+		}
+
+		if (segment->indexed_to >= segment->next_index_at) {
+			if (segment->index_num == segment->index_allocated) {
+				const uint32_t     allocated = (0 == segment->index_allocated) ? BASKET_LOG_GROW_RATE : segment->index_allocated * 2;
+				basket_log_index_t *index    = realloc(segment->index, allocated * sizeof(basket_log_index_t));
+
+				/* Without the new entry the seek only reads more records */
+				if (NULL == index) {
+					return;
+				}
+
+				segment->index = index;
+				segment->index_allocated = allocated;
+			}
+
+			segment->index[segment->index_num].max_ticket = segment->max_ticket;
+			segment->index[segment->index_num].offset = segment->indexed_to;
+			segment->index_num++;
+			segment->next_index_at = segment->indexed_to + BASKET_LOG_INDEX_INTERVAL;
+		}
+
+		ticket = basket_log_record_ticket(record);
+		if (0 == segment->records || ticket > segment->max_ticket) {
+			segment->max_ticket = ticket;
+		}
+
+		segment->records++;
+		segment->indexed_to += record->record_len;
+	}
+}
+
+__attribute__((warn_unused_result))
+basket_log_t *basket_log_open(const char *dir, size_t segment_size, const int flags)
+{
+	basket_log_t *log;
+	char         path[PATH_MAX];
+
+	TESTP_ABORT(dir);
+
+	if (0 == segment_size) {
+		segment_size = BASKET_LOG_SEGMENT_SIZE;
+	}
+
+	if (segment_size <= BASKET_LOG_RECORDS_START || segment_size > UINT32_MAX) {
+		DE("Wrong segment size %zu\n", segment_size);
+		return NULL;
+	}
+
+	if ((flags & BASKET_LOG_WRITE) && 0 != mkdir(dir, 0755) && EEXIST != errno) {
+		DE("Could not create the log directory %s\n", dir);
+		return NULL;
+	}
+
+	log = calloc(1, sizeof(basket_log_t));
+	TESTP(log, NULL);
+
+	log->segment_size = segment_size;
+	log->flags = flags;
+	log->lock_fd = -1;
+	log->dir = strdup(dir);
+	if (NULL == log->dir || 0 != pthread_mutex_init(&log->lock, NULL)) {
+		free(log->dir);
+		free(log);
+		return NULL;
+	}
+
+	if (0 != pthread_mutex_init(&log->index_lock, NULL)) {
+		pthread_mutex_destroy(&log->lock);
+		free(log->dir);
+		free(log);
+		return NULL;
+	}
+
+	/* One writer process: the others wait for the lock file */
+	if (flags & BASKET_LOG_WRITE) {
+		snprintf(path, sizeof(path), "%s/lock", dir);
+		log->lock_fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (log->lock_fd < 0 || 0 != flock(log->lock_fd, LOCK_EX | LOCK_NB)) {
+			DE("The log %s is written by another process\n", dir);
+			goto err;
+		}
+	}
+
+	basket_log_segments_discover(log);
+
+	if (flags & BASKET_LOG_WRITE) {
+		basket_log_segments_repair(log);
+	}
+
+	if ((flags & BASKET_LOG_WRITE) && 0 == log->segments_num) {
+		basket_log_segment_t *segment = basket_log_segment_create(log, 0);
+
+		if (NULL == segment || A_OK != basket_log_segments_push(log, segment)) {
+			if (segment) {
+				basket_log_segment_unmap(segment);
+			}
+			goto err;
+		}
+	}
+
+	return log;
+
+err:
+	if (A_OK != basket_log_close(log)) {
+		DE("Could not close the log\n");
+	}
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_log_close(basket_log_t *log)
+{
+	uint32_t index;
+	TESTP_ABORT(log);
+
+	for (index = 0; index < log->segments_num; index++) {
+		basket_log_segment_unmap(log->segments[index]);
+	}
+
+	/* The lock is released with the file */
+	if (log->lock_fd >= 0) {
+		close(log->lock_fd);
+	}
+
+	pthread_mutex_destroy(&log->index_lock);
+	pthread_mutex_destroy(&log->lock);
+	free(log->segments);
+	free(log->dir);
+	free(log);
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_log_append(basket_log_t *log, const void *basket)
+{
+	basket_log_segment_t *segment;
+	basket_log_record_t  *record;
+	uint64_t             start;
+	size_t               written;
+	uint32_t             record_len;
+
+	TESTP_ABORT(log);
+	TESTP_ABORT(basket);
+
+	if (!(log->flags & BASKET_LOG_WRITE) || YES == basket_is_view(basket)) {
+		DE("The log is read only, or the basket is a view\n");
+		return -EINVAL;
+	}
+
+	/* O(1): the size is known without reading the boxes; with the compression it is the worst case */
+	if (BASKET_LOG_ALIGN(sizeof(basket_log_record_t) + basket_flat_buf_size(basket)) > log->segment_size - BASKET_LOG_RECORDS_START) {
+		DE("The basket is too big for a segment: %zu bytes\n", basket_flat_buf_size(basket));
+		return -EFBIG;
+	}
+
+	record_len = BASKET_LOG_ALIGN(sizeof(basket_log_record_t) + basket_flat_buf_size(basket));
+
+	/*** 1. Reserve the record; only here the appenders wait for each other ***/
+	pthread_mutex_lock(&log->lock);
+	segment = log->segments[log->segments_num - 1];
+
+	if (segment->reserved + record_len > segment->size || 0 != __atomic_load_n(&basket_log_header(segment)->sealed_len, __ATOMIC_ACQUIRE)) {
+		basket_log_segment_t *next;
+
+		/* Sealed before the next segment appears: the readers go to the next segment after this point. If the next
+		   segment can not be created, the segment stays sealed and the next append tries again */
+		__atomic_store_n(&basket_log_header(segment)->sealed_len, segment->reserved, __ATOMIC_RELEASE);
+
+		next = basket_log_segment_create(log, log->segments_num);
+		if (NULL == next || A_OK != basket_log_segments_push(log, next)) {
+			pthread_mutex_unlock(&log->lock);
+			if (next) {
+				basket_log_segment_unmap(next);
+			}
+			return -EIO;
+		}
+
+		segment = next;
+	}
+
+	start = segment->reserved;
+	segment->reserved += record_len;
+	pthread_mutex_unlock(&log->lock);
+
+	/*** 2. Write the basket directly into the segment ***/
+	record = (basket_log_record_t *)(segment->mem + start);
+	record->record_len = record_len;
+	if (A_OK == basket_to_buf_into(basket, record + 1, record_len - sizeof(basket_log_record_t), &written)) {
+		record->basket_size = written;
+	} else {
+		/* The record is published anyway, the readers skip it */
+		DE("Could not write the basket into the log\n");
+		record->basket_size = 0;
+	}
+
+	/*** 3. Publish in order: the records before this one are written first ***/
+	while (__atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE) != start) {
+		sched_yield();
+	}
+
+	__atomic_store_n(&basket_log_header(segment)->committed, start + record_len, __ATOMIC_RELEASE);
+	return (record->basket_size > 0) ? A_OK : -ENOMEM;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_log_sync(basket_log_t *log)
+{
+	ret_t    rc    = A_OK;
+	uint32_t index;
+
+	TESTP_ABORT(log);
+
+	pthread_mutex_lock(&log->lock);
+	for (index = 0; index < log->segments_num; index++) {
+		const basket_log_segment_t *segment = log->segments[index];
+
+		if (0 != msync(segment->mem, __atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE), MS_SYNC)) {
+			DE("Could not sync segment %u\n", index);
+			rc = -EIO;
+		}
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	return rc;
+}
+
+__attribute__((warn_unused_result))
+basket_log_reader_t *basket_log_reader_new(basket_log_t *log)
+{
+	basket_log_reader_t *reader;
+	TESTP_ABORT(log);
+
+	reader = calloc(1, sizeof(basket_log_reader_t));
+	TESTP(reader, NULL);
+
+	reader->log = log;
+	return reader;
+}
+
+void basket_log_reader_release(basket_log_reader_t *reader)
+{
+	free(reader);
+}
+
+/* This is an internal function: the mapped segment 'num'; the segments array can be reallocated by the appenders, the segment itself stays */
+__attribute__((warn_unused_result))
+static basket_log_segment_t *basket_log_segment_get(basket_log_t *log, const uint32_t num)
+{
+	basket_log_segment_t *segment;
+
+	pthread_mutex_lock(&log->lock);
+	segment = log->segments[num];
+	pthread_mutex_unlock(&log->lock);
+	return segment;
+}
+
+/* This is an internal function: the current segment of the reader, the new segments are mapped if needed; NULL if there is no such segment yet */
+__attribute__((warn_unused_result))
+static basket_log_segment_t *basket_log_reader_segment(basket_log_reader_t *reader)
+{
+	basket_log_t         *log     = reader->log;
+	basket_log_segment_t *segment = NULL;
+
+	pthread_mutex_lock(&log->lock);
+	if (reader->segment >= log->segments_num) {
+		basket_log_segments_discover(log);
+	}
+
+	if (reader->segment < log->segments_num) {
+		segment = log->segments[reader->segment];
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	if (segment && 0 == reader->offset) {
+		reader->offset = BASKET_LOG_RECORDS_START;
+	}
+
+	return segment;
+}
+
+__attribute__((warn_unused_result))
+void *basket_log_next(basket_log_reader_t *reader)
+{
+	basket_log_segment_t *segment;
+
+	TESTP_ABORT(reader);
+
+	while (NULL != (segment = basket_log_reader_segment(reader))) {
+		const uint64_t committed = __atomic_load_n(&basket_log_header(segment)->committed, __ATOMIC_ACQUIRE);
+		uint64_t       sealed_len;
+
+		if (reader->offset < committed) {
+			const basket_log_record_t  *record = basket_log_record(segment, reader->offset, committed);
+			const basket_send_header_t *header;
+
+			if (NULL == record) {
+				return NULL;
+			}
+
+			reader->offset += record->record_len;
+			if (0 == record->basket_size) {
+				continue;
+			}
+
+			/* The compressed boxes must be restored: such a Basket is copied */
+			header = (const basket_send_header_t *)(record + 1);
+			if (BOX_COMPRESS_RAW != header->compress) {
+				return basket_from_buf((void *)header, record->basket_size);
+			}
+
+			return basket_view_from_buf(header, record->basket_size);
+		}
+
+		/* All records of a sealed segment are read: go to the next one */
+		sealed_len = __atomic_load_n(&basket_log_header(segment)->sealed_len, __ATOMIC_ACQUIRE);
+		if (0 == sealed_len || reader->offset < sealed_len) {
+			return NULL;
+		}
+
+		reader->segment++;
+		reader->offset = 0;
+	}
+
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_log_seek(basket_log_reader_t *reader, const ticket_t ticket)
+{
+	basket_log_t         *log     = NULL;
+	basket_log_segment_t *segment = NULL;
+	uint32_t             segments_num;
+	uint32_t             num;
+	uint32_t             low      = 0;
+	uint32_t             high;
+	uint64_t             offset;
+
+	TESTP_ABORT(reader);
+	log = reader->log;
+
+	/* The indexes are built under their own lock: the appenders take the log lock only for a short moment */
+	pthread_mutex_lock(&log->index_lock);
+
+	pthread_mutex_lock(&log->lock);
+	basket_log_segments_discover(log);
+	segments_num = log->segments_num;
+	pthread_mutex_unlock(&log->lock);
+
+	/* The first segment holding such a ticket */
+	for (num = 0; num < segments_num; num++) {
+		segment = basket_log_segment_get(log, num);
+		basket_log_segment_index(segment);
+		if (segment->records > 0 && segment->max_ticket >= ticket) {
+			break;
+		}
+	}
+
+	/* Not yet in the log: the reader waits at the end */
+	if (num == segments_num) {
+		reader->segment = (segments_num > 0) ? segments_num - 1 : 0;
+		reader->offset = (segments_num > 0) ? basket_log_segment_get(log, reader->segment)->indexed_to : 0;
+		pthread_mutex_unlock(&log->index_lock);
+		return A_OK;
+	}
+
+	/* The last index entry with all tickets before it smaller: the record is after it */
+	high = segment->index_num;
+	while (low < high) {
+		const uint32_t middle = (low + high) / 2;
+
+		if (segment->index[middle].max_ticket < ticket) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	offset = (low > 0) ? segment->index[low - 1].offset : BASKET_LOG_RECORDS_START;
+
+	/* Only the indexed records are read: the segment holds such a ticket, it is found before 'indexed_to' */
+	while (offset < segment->indexed_to) {
+		const basket_log_record_t *record = (const basket_log_record_t *)(segment->mem + offset);
+
+		if (record->basket_size > 0 && basket_log_record_ticket(record) >= ticket) {
+			break;
+		}
+
+		offset += record->record_len;
+	}
+
+	reader->segment = num;
+	reader->offset = offset;
+	pthread_mutex_unlock(&log->index_lock);
+	return A_OK;
+}
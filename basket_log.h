@@ -0,0 +1,210 @@
+#ifndef _BASKET_LOG_H_
+#define _BASKET_LOG_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "basket.h"
+
+/*
+ * Append-only log of Baskets.
+ *
+ * The log is a directory of segment files, 00000000.blog, 00000001.blog ...
+ * Every segment is created with its full size and mapped into memory; a
+ * Basket is written by ::basket_to_buf_into() directly into the mapping:
+ *
+ *  [ basket_log_segment_header_t ]
+ *  [ basket_log_record_t | flat Basket | padding to 8 ] ...
+ *
+ * Appenders reserve the space of a record under a short lock, write the
+ * Basket without the lock, then publish the records in order: the
+ * 'committed' field of the segment header is moved forward only when all
+ * records before it are written. Readers, in this process or in any other
+ * one, see only the published records, and follow the log while it grows.
+ *
+ * Only one process writes the log (it holds a lock on the 'lock' file of the
+ * directory); any number of its threads may append at the same time.
+ *
+ * The readers get every Basket as a read only view over the mapping, no
+ * copy (see ::basket_view_from_buf()). The sparse index, one entry per
+ * BASKET_LOG_INDEX_INTERVAL bytes of a segment, is kept in memory and
+ * built on the first seek; it holds the biggest ticket of the records
+ * before the entry, so the seek works even if the tickets are not
+ * appended in order.
+ */
+
+/**
+ * @def BASKET_LOG_WRITE
+ * @details Open the log to append, see ::basket_log_open()
+ */
+#define BASKET_LOG_WRITE (1 << 0)
+
+/**
+ * @def BASKET_LOG_SEGMENT_SIZE
+ * @details The default size of a segment file
+ */
+#define BASKET_LOG_SEGMENT_SIZE (4 * 1024 * 1024)
+
+/**
+ * @def BASKET_LOG_INDEX_INTERVAL
+ * @details Every this number of bytes of a segment gets an entry
+ *  		in the sparse index
+ */
+#define BASKET_LOG_INDEX_INTERVAL (4096)
+
+typedef struct {
+	uint64_t committed; /**< The end of the published records; moved forward by the appenders, read by the readers */
+	uint64_t sealed_len; /**< 0 while the segment is appended; the end of its last record, set before the next segment is created */
+	watermark_t watermark; /**< Watermark: filled with a predefined pattern WATERMARK_BASKET_LOG */
+}
+basket_log_segment_header_t;
+
+typedef struct {
+	uint32_t record_len; /**< Size of the record, this header and the padding included */
+	uint32_t basket_size; /**< Size of the flat Basket; 0 if the record was not written */
+}
+basket_log_record_t;
+
+typedef struct {
+	ticket_t max_ticket; /**< The biggest ticket of the segment records before 'offset' */
+	uint64_t offset; /**< The offset of a record in the segment */
+}
+basket_log_index_t;
+
+typedef struct {
+	char *mem; /**< The mapped segment file */
+	size_t size; /**< Size of the segment file */
+	int fd; /**< The segment file */
+	uint64_t reserved; /**< Writer only: the end of the reserved records */
+	basket_log_index_t *index; /**< The sparse index */
+	uint32_t index_num; /**< Number of entries in the 'index' */
+	uint32_t index_allocated; /**< For internal use: number of allocated entries in the 'index' */
+	uint64_t indexed_to; /**< The end of the records in the 'index' */
+	uint64_t next_index_at; /**< The offset where the next index entry is added */
+	ticket_t max_ticket; /**< The biggest ticket of the indexed records */
+	uint32_t records; /**< Number of the indexed records */
+}
+basket_log_segment_t;
+
+typedef struct {
+	char *dir; /**< The log directory */
+	size_t segment_size; /**< Size of a new segment file */
+	int flags; /**< BASKET_LOG_* flags */
+	int lock_fd; /**< Writer only: the locked 'lock' file */
+	pthread_mutex_t lock; /**< Protects the segments array and the reservations of the last segment */
+	pthread_mutex_t index_lock; /**< Protects the indexes: they are built without blocking the appenders */
+	basket_log_segment_t **segments; /**< The mapped segments, in order */
+	uint32_t segments_num; /**< Number of mapped segments */
+	uint32_t segments_allocated; /**< For internal use: number of allocated pointers in 'segments' */
+}
+basket_log_t;
+
+typedef struct {
+	basket_log_t *log; /**< The log to read */
+	uint32_t segment; /**< The current segment */
+	uint64_t offset; /**< The next record in the current segment; 0 - the first one */
+}
+basket_log_reader_t;
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Open the log
+ * @param const char* dir   The log directory; created when the
+ *  			log is opened to write
+ * @param const size_t segment_size Size of a new segment file, 0
+ *  			for BASKET_LOG_SEGMENT_SIZE
+ * @param const int flags  BASKET_LOG_WRITE to append, 0 to read
+ *  			only
+ * @return basket_log_t* The log, NULL on an error or if another
+ *  	   process writes the log
+ * @details All existing segments are mapped. The records
+ *  		reserved but never published, by a crashed writer, are
+ *  		dropped; when the log is opened to write, every segment
+ *  		but the last one is sealed at its published records.
+ */
+__attribute__((warn_unused_result))
+extern basket_log_t *basket_log_open(const char *dir, size_t segment_size, const int flags);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Close the log
+ * @param basket_log_t* log   The log to close
+ * @return ret_t A_OK on success
+ * @details All views got from the log readers and the readers
+ *  		must be released before
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_log_close(basket_log_t *log);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Append the Basket to the log
+ * @param basket_log_t* log   The log, opened with
+ *  			BASKET_LOG_WRITE
+ * @param const void* basket The Basket to append
+ * @return ret_t A_OK on success; -EINVAL if the log is read only
+ *  	   or the basket is a view; -EFBIG if the Basket does not
+ *  	   fit into a segment; -EIO if a new segment can not be
+ *  	   created
+ * @details Thread safe. The Basket is visible to the readers
+ *  		when all Baskets appended before it are written too.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_log_append(basket_log_t *log, const void *basket);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Write the published records to the disk
+ * @param basket_log_t* log   The log
+ * @return ret_t A_OK on success, -EIO on an error
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_log_sync(basket_log_t *log);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Create a reader of the log, set to the first Basket
+ * @param basket_log_t* log   The log
+ * @return basket_log_reader_t* The reader, NULL on an error.
+ *  	   Release it with ::basket_log_reader_release().
+ */
+__attribute__((warn_unused_result))
+extern basket_log_reader_t *basket_log_reader_new(basket_log_t *log);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Release the reader
+ * @param basket_log_reader_t* reader The reader
+ */
+extern void basket_log_reader_release(basket_log_reader_t *reader);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Get the next Basket of the log
+ * @param basket_log_reader_t* reader The reader
+ * @return void* The Basket; NULL if there is no more published
+ *  	   Baskets yet. Release it with ::basket_release().
+ * @details The Basket is a read only view over the segment
+ *  		mapping, no copy; a compressed Basket can not be a view,
+ *  		it is restored with ::basket_from_buf(). Call it again
+ *  		after NULL to follow the log: the Baskets appended
+ *  		later, and the new segments, are found.
+ */
+__attribute__((warn_unused_result))
+extern void *basket_log_next(basket_log_reader_t *reader);
+
+/**
+ * @author Sebastian Mountaniol (9/7/22)
+ * @brief Set the reader to the first Basket with the ticket
+ *  	  equal or bigger than asked
+ * @param basket_log_reader_t* reader The reader
+ * @param const ticket_t ticket The ticket
+ * @return ret_t A_OK on success; the reader is set to the end
+ *  	   of the log if there is no such Basket yet
+ * @details The first Basket in the log order. The segment
+ *  		indexes are extended up to the published records; only
+ *  		the records of one index interval are read.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_log_seek(basket_log_reader_t *reader, const ticket_t ticket);
+
+#endif /* _BASKET_LOG_H_ */
@@ -0,0 +1,499 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "basket.h"
+#include "basket_par.h"
+#include "basket_v2.h"
+#include "box_t.h"
+#include "debug.h"
+#include "tests.h"
+#include "checksum.h"
+#include "optimization.h"
+
+/*** THE POOL ***/
+
+typedef struct basket_pool_job {
+	basket_pool_task_t task;
+	void *arg;
+	struct basket_pool_job *next;
+} basket_pool_job_t;
+
+typedef struct {
+	basket_pool_t pool; /**< Must be the first: the pool is released by this pointer */
+	pthread_t *threads; /**< The pool threads */
+	uint32_t threads_started; /**< Number of started threads */
+	pthread_mutex_t lock; /**< Protects the queue */
+	pthread_cond_t wake; /**< Signaled on a new job and on the stop */
+	basket_pool_job_t *head; /**< The first queued job */
+	basket_pool_job_t *tail; /**< The last queued job */
+	int stop; /**< YES when the threads must stop */
+} basket_pool_impl_t;
+
+/* This is an internal function: a pool thread, runs the jobs until the pool is stopped and the queue is empty */
+static void *basket_pool_thread(void *arg)
+{
+	basket_pool_impl_t *impl = arg;
+
+	for (;;) {
+		basket_pool_job_t *job;
+
+		pthread_mutex_lock(&impl->lock);
+		while (NULL == impl->head && NO == impl->stop) {
+			pthread_cond_wait(&impl->wake, &impl->lock);
+		}
+
+		job = impl->head;
+		if (NULL == job) {
+			pthread_mutex_unlock(&impl->lock);
+			return NULL;
+		}
+
+		impl->head = job->next;
+		if (NULL == impl->head) {
+			impl->tail = NULL;
+		}
+		pthread_mutex_unlock(&impl->lock);
+
+		job->task(job->arg);
+		free(job);
+	}
+}
+
+/* This is an internal function: the 'submit' of the simple pool */
+static int basket_pool_submit(void *ctx, basket_pool_task_t task, void *arg)
+{
+	basket_pool_impl_t *impl = ctx;
+	basket_pool_job_t  *job  = malloc(sizeof(basket_pool_job_t));
+
+	TESTP(job, -ENOMEM);
+	job->task = task;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&impl->lock);
+	if (impl->tail) {
+		impl->tail->next = job;
+	} else {
+		impl->head = job;
+	}
+	impl->tail = job;
+	pthread_cond_signal(&impl->wake);
+	pthread_mutex_unlock(&impl->lock);
+	return 0;
+}
+
+__attribute__((warn_unused_result))
+basket_pool_t *basket_pool_new(const uint32_t threads)
+{
+	basket_pool_impl_t *impl;
+
+	if (0 == threads) {
+		DE("The pool must have threads\n");
+		return NULL;
+	}
+
+	impl = calloc(1, sizeof(basket_pool_impl_t));
+	TESTP(impl, NULL);
+
+	impl->threads = calloc(threads, sizeof(pthread_t));
+	if (NULL == impl->threads) {
+		free(impl);
+		return NULL;
+	}
+
+	impl->pool.submit = basket_pool_submit;
+	impl->pool.ctx = impl;
+	impl->pool.threads = threads;
+	impl->stop = NO;
+	pthread_mutex_init(&impl->lock, NULL);
+	pthread_cond_init(&impl->wake, NULL);
+
+	for (impl->threads_started = 0; impl->threads_started < threads; impl->threads_started++) {
+		if (0 != pthread_create(&impl->threads[impl->threads_started], NULL, basket_pool_thread, impl)) {
+			DE("Could not start thread %u\n", impl->threads_started);
+			if (A_OK != basket_pool_release(&impl->pool)) {
+				DE("Could not release the pool\n");
+			}
+			return NULL;
+		}
+	}
+
+	return &impl->pool;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_pool_release(basket_pool_t *pool)
+{
+	basket_pool_impl_t *impl = (basket_pool_impl_t *)pool;
+	uint32_t           index;
+
+	TESTP_ABORT(impl);
+
+	pthread_mutex_lock(&impl->lock);
+	impl->stop = YES;
+	pthread_cond_broadcast(&impl->wake);
+	pthread_mutex_unlock(&impl->lock);
+
+	for (index = 0; index < impl->threads_started; index++) {
+		pthread_join(impl->threads[index], NULL);
+	}
+
+	pthread_cond_destroy(&impl->wake);
+	pthread_mutex_destroy(&impl->lock);
+	free(impl->threads);
+	free(impl);
+	return A_OK;
+}
+
+/*** THE PARALLEL RESTORE ***/
+
+/* One dumped box, found by the header scan */
+typedef struct {
+	const char *data; /**< The box data in the flat buffer */
+	box_type_t size; /**< Size of the data in the buffer */
+	checksum_t checksum; /**< The checksum from the box header */
+	num_boxes_t box_index; /**< The box index in the Basket */
+} basket_par_box_t;
+
+/* The common state of all parts of one call */
+typedef struct {
+	const basket_send_header_t *header; /**< The flat buffer header */
+	const basket_par_box_t *boxes; /**< The dumped boxes */
+	basket_t *basket; /**< The restored Basket; NULL - the boxes are only tested */
+	pthread_mutex_t lock; /**< Protects 'parts_left' and 'rc' */
+	pthread_cond_t done; /**< Signaled when a part is done */
+	uint32_t parts_left; /**< Number of parts not done yet */
+	ret_t rc; /**< A_OK, or the error of a part */
+} basket_par_job_t;
+
+/* One part: a range of the dumped boxes */
+typedef struct {
+	basket_par_job_t *job;
+	uint32_t first; /**< The first box of the part */
+	uint32_t last; /**< The box after the last one of the part */
+} basket_par_part_t;
+
+/* This is an internal function: restore (or only test) one box, checksum it while copied */
+__attribute__((warn_unused_result))
+static ret_t basket_par_box(const basket_par_job_t *job, const basket_par_box_t *par_box)
+{
+	const basket_send_header_t *header = job->header;
+	box_t                      *box    = NULL;
+	checksum_stream_t          checksum;
+	checksum_t                 calculated_sum = 0;
+	ret_t                      rc             = A_OK;
+
+	/* The box stays empty, as in ::basket_from_buf() */
+	if (0 == par_box->size) {
+		return A_OK;
+	}
+
+	/* The algorithm is tested by the caller: this call can not fail */
+	if (0 != checksum_stream_init_alg(&checksum, header->checksum_alg)) {
+		abort();
+	}
+
+	if (job->basket) {
+		box = job->basket->boxes[par_box->box_index];
+	} else if (BOX_COMPRESS_LZ == header->compress) {
+		/* The compressed box is tested on its restored data */
+		box = bx_new(0);
+		TESTP(box, -ENOMEM);
+	}
+
+	if (BOX_COMPRESS_LZ == header->compress) {
+		if (A_OK != basket_box_uncompress(box, par_box->data, par_box->size)) {
+			DE("Could not restore the compressed box[%u]\n", (uint32_t)par_box->box_index);
+			rc = -EINVAL;
+			goto end;
+		}
+
+		checksum_stream_update(&checksum, bx_data_take(box), bx_used_take(box));
+	} else if (box) {
+		if (A_OK != bx_room_assure(box, par_box->size)) {
+			rc = -ENOMEM;
+			goto end;
+		}
+
+		checksum_stream_copy(&checksum, bx_data_take(box), par_box->data, par_box->size);
+		bx_used_inc(box, par_box->size);
+		bx_members_set(box, 1);
+	} else {
+		checksum_stream_update(&checksum, par_box->data, par_box->size);
+	}
+
+	if (0 != checksum_stream_final(&checksum, &calculated_sum)) {
+		abort();
+	}
+
+	/* The box checksum is always set */
+	if (par_box->checksum != calculated_sum) {
+		DE("Wrong checksum of box[%u]: expected %X but it is %X\n", (uint32_t)par_box->box_index, par_box->checksum, calculated_sum);
+		rc = -EINVAL;
+		goto end;
+	}
+
+	/* The box is sent again without hashing, if not changed */
+	if (job->basket) {
+		bx_checksum_set(box, header->checksum_alg, calculated_sum);
+	}
+
+end:
+	if (NULL == job->basket && box && A_OK != bx_free(box)) {
+		DE("Could not release the box\n");
+	}
+	return rc;
+}
+
+/* This is an internal function: the pool task, one part of the boxes */
+static void basket_par_part(void *arg)
+{
+	const basket_par_part_t *part  = arg;
+	basket_par_job_t        *job   = part->job;
+	ret_t                   rc     = A_OK;
+	uint32_t                index;
+
+	for (index = part->first; index < part->last && A_OK == rc; index++) {
+		rc = basket_par_box(job, &job->boxes[index]);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	if (A_OK != rc) {
+		job->rc = rc;
+	}
+	job->parts_left--;
+	pthread_cond_signal(&job->done);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/* This is an internal function: test the header, scan the box headers; returns the dumped boxes, NULL if the buffer is invalid */
+__attribute__((warn_unused_result))
+static basket_par_box_t *basket_par_scan(const void *buf, const size_t size)
+{
+	const basket_send_header_t *header     = buf;
+	const char                 *buf_char   = buf;
+	size_t                     buf_offset  = sizeof(basket_send_header_t);
+	basket_par_box_t           *boxes;
+	uint8_t                    *dumped;
+	uint32_t                   index;
+
+	if (size < sizeof(basket_send_header_t) || !BASKET_WATERMARK_VALID(header->watermark) ||
+		header->total_len < sizeof(basket_send_header_t) ||
+		(size_t)header->total_len + header->ztable_buf_size > size ||
+		header->boxes_dumped > header->boxes_used || header->align_log2 > BASKET_ALIGN_LOG2_MAX ||
+		header->compress > BOX_COMPRESS_LZ || header->checksum_alg >= CHECKSUM_ALG_MAX) {
+		DE("Wrong buffer: wrong header\n");
+		return NULL;
+	}
+
+	boxes = malloc(MAX(header->boxes_dumped, 1) * sizeof(basket_par_box_t));
+	dumped = calloc(MAX(header->boxes_used, 1), sizeof(uint8_t));
+	if (NULL == boxes || NULL == dumped) {
+		free(boxes);
+		free(dumped);
+		return NULL;
+	}
+
+	for (index = 0; index < header->boxes_dumped; index++) {
+		const box_dump_t *box_dump_header_p = (const box_dump_t *)(buf_char + buf_offset);
+
+		if (buf_offset + sizeof(box_dump_t) > header->total_len || WATERMARK_BOX != box_dump_header_p->watermark ||
+			box_dump_header_p->box_index >= header->boxes_used || dumped[box_dump_header_p->box_index]) {
+			DE("Wrong box[%u]: out of the buffer, wrong watermark or index\n", index);
+			goto err;
+		}
+
+		buf_offset += sizeof(box_dump_t) + BASKET_ALIGN_PAD(buf_offset + sizeof(box_dump_t), header->align_log2);
+		if (buf_offset + box_dump_header_p->box_size > header->total_len) {
+			DE("Wrong box[%u]: the data is out of the buffer\n", index);
+			goto err;
+		}
+
+		dumped[box_dump_header_p->box_index] = 1;
+		boxes[index].data = buf_char + buf_offset;
+		boxes[index].size = box_dump_header_p->box_size;
+		boxes[index].checksum = box_dump_header_p->box_checksum;
+		boxes[index].box_index = box_dump_header_p->box_index;
+		buf_offset += box_dump_header_p->box_size;
+	}
+
+	/* The header checksum covers exactly the header and the box headers; the data is tested by the threads */
+	if (buf_offset != header->total_len || 0 != basket_validate_flat_headers(buf)) {
+		DE("Wrong buffer: the boxes take %zu bytes, the header claims %u, or the checksum not match\n",
+		   buf_offset, (uint32_t)header->total_len);
+		goto err;
+	}
+
+	free(dumped);
+	return boxes;
+
+err:
+	free(boxes);
+	free(dumped);
+	return NULL;
+}
+
+/* This is an internal function: split the boxes into parts of about the same size, run them on the pool and wait */
+__attribute__((warn_unused_result))
+static ret_t basket_par_run(basket_par_job_t *job, basket_pool_t *pool)
+{
+	const uint32_t    boxes_num  = job->header->boxes_dumped;
+	const uint32_t    parts_num  = MIN(((NULL == pool) ? 0 : pool->threads) + 1, MAX(boxes_num, 1));
+	size_t            total      = 0;
+	size_t            taken      = 0;
+	basket_par_part_t *parts;
+	uint32_t          index;
+	uint32_t          part       = 0;
+
+	parts = calloc(parts_num, sizeof(basket_par_part_t));
+	TESTP(parts, -ENOMEM);
+
+	for (index = 0; index < boxes_num; index++) {
+		total += job->boxes[index].size;
+	}
+
+	/* A part ends when its share of the bytes is taken */
+	for (index = 0; index < boxes_num; index++) {
+		taken += job->boxes[index].size;
+		if (part + 1 < parts_num && taken * parts_num >= total * (part + 1)) {
+			parts[part].last = index + 1;
+			part++;
+			parts[part].first = index + 1;
+		}
+	}
+
+	parts[part].last = boxes_num;
+
+	job->rc = A_OK;
+	job->parts_left = parts_num;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->done, NULL);
+
+	for (index = 0; index < parts_num; index++) {
+		parts[index].job = job;
+	}
+
+	/* The first part is taken by the calling thread; a part not accepted by the pool too */
+	for (index = 1; index < parts_num; index++) {
+		if (0 != pool->submit(pool->ctx, basket_par_part, &parts[index])) {
+			basket_par_part(&parts[index]);
+		}
+	}
+
+	basket_par_part(&parts[0]);
+
+	pthread_mutex_lock(&job->lock);
+	while (job->parts_left > 0) {
+		pthread_cond_wait(&job->done, &job->lock);
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	pthread_cond_destroy(&job->done);
+	pthread_mutex_destroy(&job->lock);
+	free(parts);
+	return job->rc;
+}
+
+__attribute__((warn_unused_result))
+void *basket_from_buf_par(void *buf, size_t size, basket_pool_t *pool)
+{
+	const basket_send_header_t *header = buf;
+	basket_par_job_t           job;
+	basket_t                   *basket;
+	uint32_t                   box_index;
+
+	TESTP_ABORT(buf);
+
+	if (0 == size) {
+		size = basket_get_size_from_flat_buffer(buf);
+	}
+
+	/* Not worth the threads */
+	if (NULL == pool || size < BASKET_PAR_MIN_SIZE || YES == basket_buf_is_v2(buf, size)) {
+		return basket_from_buf(buf, size);
+	}
+
+	memset(&job, 0, sizeof(basket_par_job_t));
+	job.header = header;
+	job.boxes = basket_par_scan(buf, size);
+	if (NULL == job.boxes) {
+		return NULL;
+	}
+
+	basket = basket_new();
+	if (NULL == basket) {
+		free((void *)job.boxes);
+		return NULL;
+	}
+
+	basket->checksum_alg = header->checksum_alg;
+	basket->ticket = header->ticket;
+
+	/* All boxes are created here: the threads only fill them */
+	if (A_OK != basket_reserve_boxes(basket, header->boxes_used)) {
+		goto err;
+	}
+
+	for (box_index = 0; box_index < header->boxes_used; box_index++) {
+		basket->boxes[box_index] = bx_new(0);
+		if (NULL == basket->boxes[box_index]) {
+			goto err;
+		}
+		basket->boxes_used++;
+	}
+
+	job.basket = basket;
+	if (A_OK != basket_par_run(&job, pool)) {
+		goto err;
+	}
+
+	/*** Restore zhash, is presents ***/
+	if (header->ztable_buf_size > 0) {
+		basket->zhash = zhash_from_buf((const char *)buf + header->total_len, header->ztable_buf_size);
+		if (NULL == basket->zhash) {
+			DE("Wrong buffer: could not restore the key/value dump\n");
+			goto err;
+		}
+	}
+
+	free((void *)job.boxes);
+
+	/* The boxes are filled directly: count them once */
+	basket_sizes_recount(basket);
+	return basket;
+
+err:
+	free((void *)job.boxes);
+	if (0 != basket_release(basket)) {
+		DE("Could not release basket\n");
+	}
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+ret_t basket_flat_verify_par(const void *buf, size_t size, basket_pool_t *pool)
+{
+	basket_par_job_t job;
+	ret_t            rc;
+
+	TESTP_ABORT(buf);
+
+	if (0 == size) {
+		size = basket_get_size_from_flat_buffer((void *)buf);
+	}
+
+	memset(&job, 0, sizeof(basket_par_job_t));
+	job.header = buf;
+	job.boxes = basket_par_scan(buf, size);
+	if (NULL == job.boxes) {
+		return -EINVAL;
+	}
+
+	/* Not worth the threads: the calling thread does all */
+	rc = basket_par_run(&job, (size < BASKET_PAR_MIN_SIZE) ? NULL : pool);
+	free((void *)job.boxes);
+	return rc;
+}
@@ -0,0 +1,98 @@
+#ifndef _BASKET_PAR_H_
+#define _BASKET_PAR_H_
+
+#include <sys/types.h>
+#include "basket.h"
+
+/*
+ * Restore and verify a big flat buffer on many cores.
+ *
+ * The box headers are scanned once, on the calling thread: it is quick,
+ * only the headers are read, and it gives the offset of every box. Then the
+ * boxes are split into parts of about the same number of bytes, and every
+ * part is copied (or decompressed) and checksummed on a thread of the pool.
+ * The calling thread takes one part itself.
+ *
+ * The pool belongs to the caller: any thread pool can be used through
+ * basket_pool_t. ::basket_pool_new() creates a simple one.
+ */
+
+/**
+ * @def BASKET_PAR_MIN_SIZE
+ * @details A smaller flat buffer is restored on the calling thread:
+ *  		the threads cost more than they give. With BOX_16_BITS
+ *  		the whole flat buffer is less than 64 Kb.
+ */
+#if defined BOX_16_BITS
+#define BASKET_PAR_MIN_SIZE (16 * 1024)
+#else
+#define BASKET_PAR_MIN_SIZE (256 * 1024)
+#endif
+
+/* The task to run on a pool thread */
+typedef void (*basket_pool_task_t)(void *arg);
+
+typedef struct {
+	int (*submit)(void *ctx, basket_pool_task_t task, void *arg); /**< Run 'task(arg)' on a pool thread; 0 if the task is accepted, else it is run by the caller */
+	void *ctx; /**< The pool of the caller, passed to 'submit' */
+	uint32_t threads; /**< Number of the pool threads: the work is split into as many parts, plus one for the calling thread */
+} basket_pool_t;
+
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Create a simple thread pool
+ * @param const uint32_t threads Number of threads
+ * @return basket_pool_t* The pool, NULL on an error. Release it
+ *  	   with ::basket_pool_release().
+ */
+__attribute__((warn_unused_result))
+extern basket_pool_t *basket_pool_new(const uint32_t threads);
+
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Stop the threads and release the pool created with
+ *  	  ::basket_pool_new()
+ * @param basket_pool_t* pool The pool
+ * @return ret_t A_OK on success
+ * @details The queued tasks are run before the threads stop
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_pool_release(basket_pool_t *pool);
+
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Restore the Basket from the flat buffer, the boxes are
+ *  	  copied and checksummed by the pool threads
+ * @param void* buf   The flat buffer, see ::basket_to_buf()
+ * @param size_t size  Size of the buffer; if 0, it is taken from
+ *  			 the buffer header
+ * @param basket_pool_t* pool The thread pool; NULL - the same as
+ *  					 ::basket_from_buf()
+ * @return void* The Basket; NULL if the buffer is invalid or on
+ *  	   an error
+ * @details The result is the same as of ::basket_from_buf();
+ *  		a buffer smaller than BASKET_PAR_MIN_SIZE, or of the
+ *  		version 2, is restored by ::basket_from_buf().
+ */
+__attribute__((warn_unused_result))
+extern void *basket_from_buf_par(void *buf, size_t size, basket_pool_t *pool);
+
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Test the flat buffer: the header checksum and the data
+ *  	  checksum of every box, by the pool threads
+ * @param const void* buf   The flat buffer, see ::basket_to_buf()
+ * @param size_t size  Size of the buffer; if 0, it is taken from
+ *  			 the buffer header
+ * @param basket_pool_t* pool The thread pool; NULL - everything is
+ *  					 tested on the calling thread
+ * @return ret_t A_OK if the buffer is valid; -EINVAL if not;
+ *  	   -ENOMEM on a memory error
+ * @details Nothing is copied, but the compressed boxes which are
+ *  		restored to be tested. Then the buffer can be opened
+ *  		with ::basket_view_from_buf() without more tests.
+ */
+__attribute__((warn_unused_result))
+extern ret_t basket_flat_verify_par(const void *buf, size_t size, basket_pool_t *pool);
+
+#endif /* _BASKET_PAR_H_ */
@@ -69,6 +69,10 @@ typedef uint64_t num_boxes_t;
 typedef uint8_t watermark_t;
 #define MAX_VAL_WATERMARK_TYPE 	(0xFF)
 #define WATERMARK_BASKET 		(0xB9)
+#define WATERMARK_BASKET_INDEXED (0xBA)
+#define WATERMARK_BASKET_DIFF 	(0xBB)
+#define WATERMARK_BASKET_BATCH 	(0xBC)
+#define WATERMARK_BASKET_LOG 	(0xBD)
 #define WATERMARK_BOX 			(0xB3)
 
 #elif defined (WATERMARK_16_BITS)
@@ -76,6 +80,10 @@ typedef uint8_t watermark_t;
 typedef uint16_t watermark_t;
 #define MAX_VAL_WATERMARK_TYPE 	(0xFFFF)
 #define WATERMARK_BASKET 		(0xB977)
+#define WATERMARK_BASKET_INDEXED (0xB978)
+#define WATERMARK_BASKET_DIFF 	(0xB979)
+#define WATERMARK_BASKET_BATCH 	(0xB97A)
+#define WATERMARK_BASKET_LOG 	(0xB97B)
 #define WATERMARK_BOX 			(0xB37F)
 
 #elif defined (WATERMARK_32_BITS)
@@ -83,6 +91,10 @@ typedef uint16_t watermark_t;
 typedef uint32_t watermark_t;
 #define MAX_VAL_WATERMARK_TYPE 	(0xFFFFFFFF)
 #define WATERMARK_BASKET 		(0xB977AA35)
+#define WATERMARK_BASKET_INDEXED (0xB977AA36)
+#define WATERMARK_BASKET_DIFF 	(0xB977AA37)
+#define WATERMARK_BASKET_BATCH 	(0xB977AA38)
+#define WATERMARK_BASKET_LOG 	(0xB977AA39)
 #define WATERMARK_BOX 			(0xB37FAH56)
 
 #elif defined (WATERMARK_64_BITS)
@@ -90,6 +102,10 @@ typedef uint32_t watermark_t;
 typedef uint64_t watermark_t;
 #define MAX_VAL_WATERMARK_TYPE 	(0xFFFFFFFFFFFFFFFF)
 #define WATERMARK_BASKET 		(0xB977AA35E337137H)
+#define WATERMARK_BASKET_INDEXED (0xB977AA35E3371380)
+#define WATERMARK_BASKET_DIFF 	(0xB977AA35E3371381)
+#define WATERMARK_BASKET_BATCH 	(0xB977AA35E3371382)
+#define WATERMARK_BASKET_LOG 	(0xB977AA35E3371383)
 #define WATERMARK_BOX    		(0xB37FAH5648B829CD)
 
 #else
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "basket.h"
+#include "basket_v2.h"
+#include "box_t.h"
+#include "debug.h"
+#include "tests.h"
+#include "optimization.h"
+#include "fnv/fnv.h"
+
+/* The version 2 magic: never the first byte of the version 1 watermark */
+static const uint8_t basket_v2_magic[BASKET_V2_MAGIC_SIZE] = {'B', 'K', 2};
+
+/* Size of the trailing checksum */
+#define BASKET_V2_CHECKSUM_SIZE (sizeof(uint32_t))
+
+/* Max size of a 64 bit LEB128 varint */
+#define VARINT_MAX_SIZE (10)
+
+/* This is an internal function: number of bytes the varint takes */
+__attribute__((warn_unused_result, const))
+static size_t varint_len(uint64_t val)
+{
+	size_t len = 1;
+
+	while (val >= 0x80) {
+		val >>= 7;
+		len++;
+	}
+	return len;
+}
+
+/* This is an internal function: write the varint, return number of bytes written */
+static size_t varint_put(uint8_t *buf, uint64_t val)
+{
+	size_t len = 0;
+
+	while (val >= 0x80) {
+		buf[len++] = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+
+	buf[len++] = (uint8_t)val;
+	return len;
+}
+
+/* This is an internal function: read the varint, at most 'size' bytes; return number of bytes read, 0 on an error */
+__attribute__((warn_unused_result))
+static size_t varint_get(const uint8_t *buf, const size_t size, uint64_t *val)
+{
+	size_t   len   = 0;
+	uint64_t res   = 0;
+	uint32_t shift = 0;
+
+	while (len < size && len < VARINT_MAX_SIZE) {
+		const uint8_t byte = buf[len++];
+
+		res |= (uint64_t)(byte & 0x7F) << shift;
+		if (0 == (byte & 0x80)) {
+			*val = res;
+			return len;
+		}
+		shift += 7;
+	}
+
+	/* Truncated, or longer than 64 bit */
+	return 0;
+}
+
+/* This is an internal function: the size of everything but the total length varint */
+__attribute__((warn_unused_result))
+static size_t basket_v2_body_size(const basket_t *basket, uint32_t *boxes_dumped, size_t *zsize)
+{
+	box_u32_t box_index;
+	size_t    size       = BASKET_V2_MAGIC_SIZE + BASKET_V2_CHECKSUM_SIZE;
+
+	*boxes_dumped = 0;
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		const box_t *box = basket_get_box(basket, box_index);
+
+		if (NULL == box || 0 == bx_used_take(box)) {
+			continue;
+		}
+
+		size += varint_len(box_index) + varint_len(bx_used_take(box)) + bx_used_take(box);
+		(*boxes_dumped)++;
+	}
+
+	*zsize = basket->zhash ? zhash_to_buf_allocation_size(basket->zhash) : 0;
+
+	size += varint_len(basket->ticket) + varint_len(basket->boxes_used) + varint_len(*boxes_dumped) + varint_len(*zsize);
+	return size + *zsize;
+}
+
+/* This is an internal function: the total length, which includes its own varint */
+__attribute__((warn_unused_result, const))
+static size_t basket_v2_total_size(const size_t body_size)
+{
+	size_t total = body_size + 1;
+
+	while (body_size + varint_len(total) != total) {
+		total = body_size + varint_len(total);
+	}
+	return total;
+}
+
+__attribute__((warn_unused_result))
+size_t basket_flat_buf_size_v2(const void *basket)
+{
+	uint32_t boxes_dumped;
+	size_t   zsize;
+	TESTP_ABORT(basket);
+
+	return basket_v2_total_size(basket_v2_body_size(basket, &boxes_dumped, &zsize));
+}
+
+__attribute__((warn_unused_result))
+void *basket_to_buf_v2(const void *basket, size_t *size)
+{
+	const basket_t *_basket     = basket;
+	box_u32_t      box_index;
+	uint32_t       boxes_dumped;
+	uint32_t       checksum;
+	size_t         zsize;
+	size_t         total;
+	size_t         offset       = 0;
+	uint8_t        *buf;
+
+	TESTP_ABORT(_basket);
+	TESTP_ABORT(size);
+
+	total = basket_v2_total_size(basket_v2_body_size(_basket, &boxes_dumped, &zsize));
+
+	/* Every byte is written, no need to clean */
+	buf = malloc(total);
+	TESTP(buf, NULL);
+
+	memcpy(buf, basket_v2_magic, BASKET_V2_MAGIC_SIZE);
+	offset += BASKET_V2_MAGIC_SIZE;
+
+	offset += varint_put(buf + offset, total);
+	offset += varint_put(buf + offset, _basket->ticket);
+	offset += varint_put(buf + offset, _basket->boxes_used);
+	offset += varint_put(buf + offset, boxes_dumped);
+	offset += varint_put(buf + offset, zsize);
+
+	for (box_index = 0; box_index < _basket->boxes_used; box_index++) {
+		const box_t *box = basket_get_box(_basket, box_index);
+
+		if (NULL == box || 0 == bx_used_take(box)) {
+			continue;
+		}
+
+		offset += varint_put(buf + offset, box_index);
+		offset += varint_put(buf + offset, bx_used_take(box));
+		memcpy(buf + offset, bx_data_take(box), bx_used_take(box));
+		offset += bx_used_take(box);
+	}
+
+	if (_basket->zhash) {
+		size_t written;
+
+		if (0 != zhash_to_buf_into(_basket->zhash, (char *)buf + offset, zsize, &written, _basket->checksum_alg)) {
+			DE("Could not dump the key/value table\n");
+			free(buf);
+			ABORT_OR_RETURN(NULL);
+		}
+		offset += written;
+	}
+
+	/* The checksum is always little endian */
+	checksum = fnv_32a_buf(buf, offset, FNV1_32A_INIT);
+	buf[offset++] = (uint8_t)checksum;
+	buf[offset++] = (uint8_t)(checksum >> 8);
+	buf[offset++] = (uint8_t)(checksum >> 16);
+	buf[offset++] = (uint8_t)(checksum >> 24);
+
+	if (offset != total) {
+		DE("Critical error: written %zu bytes, calculated %zu\n", offset, total);
+		abort();
+	}
+
+	*size = total;
+	return buf;
+}
+
+__attribute__((warn_unused_result, pure))
+int basket_buf_is_v2(const void *buf, const size_t size)
+{
+	TESTP_ABORT(buf);
+
+	if (size < BASKET_V2_MAGIC_SIZE || 0 != memcmp(buf, basket_v2_magic, BASKET_V2_MAGIC_SIZE)) {
+		return NO;
+	}
+	return YES;
+}
+
+__attribute__((warn_unused_result))
+ssize_t basket_buf_size_v2(const void *buf, const size_t size)
+{
+	uint64_t total;
+
+	if (NO == basket_buf_is_v2(buf, size) ||
+		0 == varint_get((const uint8_t *)buf + BASKET_V2_MAGIC_SIZE, size - BASKET_V2_MAGIC_SIZE, &total)) {
+		return -EINVAL;
+	}
+
+	return total;
+}
+
+__attribute__((warn_unused_result))
+void *basket_from_buf_v2(const void *buf, size_t size)
+{
+	const uint8_t *buf_u8    = buf;
+	basket_t      *basket;
+	uint64_t      total;
+	uint64_t      ticket;
+	uint64_t      boxes_used;
+	uint64_t      boxes_dumped;
+	uint64_t      zsize;
+	uint64_t      index;
+	uint32_t      checksum;
+	size_t        offset     = BASKET_V2_MAGIC_SIZE;
+	size_t        len;
+	uint8_t       *dumped    = NULL;
+
+	TESTP_ABORT(buf);
+
+	/* If the user doesn't pass the buffer size, take it from the buffer itself */
+	if (0 == size) {
+		const ssize_t buf_size = basket_buf_size_v2(buf, BASKET_V2_PREFIX_MAX);
+
+		if (buf_size < 0) {
+			DE("Not a version 2 buffer\n");
+			return NULL;
+		}
+		size = buf_size;
+	}
+
+	if (NO == basket_buf_is_v2(buf, size)) {
+		DE("Not a version 2 buffer\n");
+		return NULL;
+	}
+
+	len = varint_get(buf_u8 + offset, size - offset, &total);
+	if (0 == len || total > size || total < BASKET_V2_MAGIC_SIZE + BASKET_V2_CHECKSUM_SIZE + len) {
+		DE("Wrong buffer: wrong total length\n");
+		return NULL;
+	}
+
+	/* From now on the buffer is known to be 'total' bytes */
+	size = total;
+	offset += len;
+
+	checksum = (uint32_t)buf_u8[size - 4] | ((uint32_t)buf_u8[size - 3] << 8) |
+		((uint32_t)buf_u8[size - 2] << 16) | ((uint32_t)buf_u8[size - 1] << 24);
+	if (checksum != fnv_32a_buf(buf_u8, size - BASKET_V2_CHECKSUM_SIZE, FNV1_32A_INIT)) {
+		DE("A wrong buffer, checksum not match\n");
+		return NULL;
+	}
+
+	/* Only the checksum follows the data */
+	size -= BASKET_V2_CHECKSUM_SIZE;
+
+	len = varint_get(buf_u8 + offset, size - offset, &ticket);
+	offset += len;
+	if (len) {
+		len = varint_get(buf_u8 + offset, size - offset, &boxes_used);
+		offset += len;
+	}
+	if (len) {
+		len = varint_get(buf_u8 + offset, size - offset, &boxes_dumped);
+		offset += len;
+	}
+	if (len) {
+		len = varint_get(buf_u8 + offset, size - offset, &zsize);
+		offset += len;
+	}
+
+	if (0 == len || boxes_dumped > boxes_used || zsize > size - offset) {
+		DE("Wrong buffer: broken header\n");
+		return NULL;
+	}
+
+	/* The buffer is valid, but this build can not hold it */
+	if ((num_boxes_t)boxes_used != boxes_used || (ticket_t)ticket != ticket) {
+		DE("The buffer holds %" PRIu64 " boxes, ticket %" PRIX64 ": this build does not support it\n", boxes_used, ticket);
+		return NULL;
+	}
+
+	basket = basket_new();
+	TESTP(basket, NULL);
+	basket->ticket = ticket;
+
+	if (A_OK != basket_reserve_boxes(basket, boxes_used)) {
+		goto err;
+	}
+
+	/* Every box is dumped once: a second dump of the same index is a broken buffer */
+	dumped = calloc(MAX(boxes_used, 1), sizeof(uint8_t));
+	if (NULL == dumped) {
+		goto err;
+	}
+
+	for (index = 0; index < boxes_used; index++) {
+		if (box_new(basket, NULL, 0) < 0) {
+			DE("Could not create box[%" PRIu64 "]\n", index);
+			goto err;
+		}
+	}
+
+	for (index = 0; index < boxes_dumped; index++) {
+		uint64_t box_index;
+		uint64_t box_size;
+
+		len = varint_get(buf_u8 + offset, size - offset, &box_index);
+		offset += len;
+		if (len) {
+			len = varint_get(buf_u8 + offset, size - offset, &box_size);
+			offset += len;
+		}
+
+		if (0 == len || box_index >= boxes_used || box_size > size - offset) {
+			DE("Wrong box[%" PRIu64 "]\n", index);
+			goto err;
+		}
+
+		if (dumped[box_index]) {
+			DE("Wrong box[%" PRIu64 "]: index %" PRIu64 " is dumped twice\n", index, box_index);
+			goto err;
+		}
+		dumped[box_index] = 1;
+
+		if (bx_if_size_fits_box_type(box_size)) {
+			DE("The box[%" PRIu64 "] is %" PRIu64 " bytes: this build does not support it\n", box_index, box_size);
+			goto err;
+		}
+
+		if (box_size > 0 && A_OK != box_add(basket, box_index, buf_u8 + offset, box_size)) {
+			DE("Could not restore box[%" PRIu64 "]\n", box_index);
+			goto err;
+		}
+
+		offset += box_size;
+	}
+
+	if (offset + zsize != size) {
+		DE("Wrong buffer: %zu bytes left, the key/value dump is %" PRIu64 " bytes\n", size - offset, zsize);
+		goto err;
+	}
+
+	if (zsize > 0) {
+		basket->zhash = zhash_from_buf((const char *)buf_u8 + offset, zsize);
+		if (NULL == basket->zhash) {
+			goto err;
+		}
+	}
+
+	free(dumped);
+	return basket;
+
+err:
+	free(dumped);
+	if (0 != basket_release(basket)) {
+		DE("Could not release basket\n");
+	}
+	return NULL;
+}
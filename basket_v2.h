@@ -0,0 +1,100 @@
+#ifndef _BASKET_V2_H_
+#define _BASKET_V2_H_
+
+#include <sys/types.h>
+#include "basket.h"
+
+/*
+ * Flat buffer format version 2.
+ *
+ * The version 1 (::basket_to_buf()) uses the build configured types for the sizes:
+ * with BOX_16_BITS the whole buffer is limited to 64 KB, with NUM_BOXES_8_BITS
+ * the number of boxes is limited to 255. The version 2 is self describing:
+ * all the numbers are LEB128 varints, the total length is 64 bit. A small number
+ * takes 1 byte, a big one takes as many bytes as it needs.
+ *
+ *  [ 'B' 'K' 2 ]                                  magic and version, 3 bytes
+ *  [ total_len ]                                  varint, the whole buffer including the checksum
+ *  [ ticket ][ boxes_used ][ boxes_dumped ][ zhash_size ]  varints
+ *  [ box_index ][ box_size ][ data ] ...          varints + data, per box with data
+ *  [ zhash dump ]                                 see ::zhash_to_buf(), zhash_size bytes
+ *  [ checksum ]                                   FNV-1a 32 bit of all the bytes before, little endian
+ *
+ * The magic never matches the first byte of the version 1 watermark,
+ * so ::basket_from_buf() restores both versions.
+ * A Basket restored from a version 2 buffer is still limited by the build
+ * configured types; a buffer holding a bigger box than the build supports is refused.
+ */
+
+/**
+ * @def BASKET_V2_MAGIC_SIZE
+ * @details Size of the magic + version prefix of the version 2 buffer
+ */
+#define BASKET_V2_MAGIC_SIZE (3)
+
+/**
+ * @def BASKET_V2_PREFIX_MAX
+ * @details Max size of the magic + the total length varint: this
+ *  		many bytes are enough to know the buffer size
+ */
+#define BASKET_V2_PREFIX_MAX (BASKET_V2_MAGIC_SIZE + 10)
+
+/**
+ * @author Sebastian Mountaniol (8/30/22)
+ * @brief Calculate the size of the version 2 flat buffer
+ * @param const void* basket The Basket
+ * @return size_t Size of the buffer ::basket_to_buf_v2() will
+ *  	   create, bytes
+ */
+__attribute__((warn_unused_result))
+extern size_t basket_flat_buf_size_v2(const void *basket);
+
+/**
+ * @author Sebastian Mountaniol (8/30/22)
+ * @brief Create the version 2 flat buffer of the Basket
+ * @param const void* basket Basket to serialize
+ * @param size_t* size  Size of the buffer returned here
+ * @return void* The buffer, NULL on an error. The caller must
+ *  	   free() it.
+ * @details Restore it with ::basket_from_buf()
+ */
+__attribute__((warn_unused_result))
+extern void *basket_to_buf_v2(const void *basket, size_t *size);
+
+/**
+ * @author Sebastian Mountaniol (8/30/22)
+ * @brief Restore the Basket from the version 2 flat buffer
+ * @param const void* buf   The buffer
+ * @param size_t size  Size of the buffer; 0 to take it from the
+ *  			 buffer
+ * @return void* New Basket, NULL if the buffer is invalid
+ * @details Usually called by ::basket_from_buf(), which detects
+ *  		the buffer version
+ */
+__attribute__((warn_unused_result))
+extern void *basket_from_buf_v2(const void *buf, size_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/30/22)
+ * @brief Test whether the buffer is a version 2 flat buffer
+ * @param const void* buf   The buffer
+ * @param const size_t size  Size of the buffer, at least the
+ *  		   magic must be there
+ * @return int YES if the buffer starts with the version 2 magic,
+ *  	   NO otherwise
+ */
+__attribute__((warn_unused_result, pure))
+extern int basket_buf_is_v2(const void *buf, const size_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/30/22)
+ * @brief Read the total length of the version 2 flat buffer
+ * @param const void* buf   The buffer
+ * @param const size_t size  Number of bytes available
+ * @return ssize_t The total length; -EINVAL if the buffer is not
+ *  	   version 2, or the length is not complete
+ */
+__attribute__((warn_unused_result))
+extern ssize_t basket_buf_size_v2(const void *buf, const size_t size);
+
+#endif /* _BASKET_V2_H_ */
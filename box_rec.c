@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "box_t.h"
+#include "box_rec.h"
+
+#include "box_t_debug.h"
+#include "tests.h"
+#include "optimization.h"
+
+/* An element of the sort array: the key of a record and the record index */
+typedef struct {
+	uint64_t key;
+	uint32_t index;
+} box_rec_key_t;
+
+/* Test that the box is in the record mode; if not, abort or return the 'ret' */
+#define REC_TEST(box, ret) do { TESTP_ABORT(box); if (0 == (box)->stride) { \
+	DE("The box %p is not in the record mode\n", box); ABORT_OR_RETURN(ret); } } while (0)
+
+/* This is an internal function: test the key description against the record size */
+__attribute__((warn_unused_result))
+static int bx_rec_key_is_valid(const box_t *box, const size_t key_offset, const size_t key_width)
+{
+	if (1 != key_width && 2 != key_width && 4 != key_width && 8 != key_width) {
+		DE("Wrong key width: %zu, must be 1, 2, 4 or 8\n", key_width);
+		return NO;
+	}
+
+	if (key_offset + key_width > box->stride) {
+		DE("The key (offset %zu, width %zu) is out of the record (size %u)\n",
+		   key_offset, key_width, (uint32_t)box->stride);
+		return NO;
+	}
+
+	return YES;
+}
+
+/* This is an internal function: read the key of the record */
+__attribute__((warn_unused_result, pure, hot))
+static uint64_t bx_rec_key_take(const char *rec, const size_t key_width)
+{
+	uint8_t  key_8;
+	uint16_t key_16;
+	uint32_t key_32;
+	uint64_t key_64;
+
+	/* The key is not aligned, so it is copied */
+	switch (key_width) {
+	case 1:
+		key_8 = *(const uint8_t *)rec;
+		return key_8;
+	case 2:
+		memcpy(&key_16, rec, sizeof(key_16));
+		return key_16;
+	case 4:
+		memcpy(&key_32, rec, sizeof(key_32));
+		return key_32;
+	default:
+		memcpy(&key_64, rec, sizeof(key_64));
+		return key_64;
+	}
+}
+
+__attribute__((warn_unused_result))
+box_t *bx_rec_new(const size_t rec_size, const size_t capacity)
+{
+	box_t *box;
+
+	if (0 == rec_size || bx_if_size_fits_box_type(rec_size * capacity) || bx_if_size_fits_box_type(rec_size)) {
+		DE("Wrong record size (%zu) or capacity (%zu)\n", rec_size, capacity);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	box = bx_new(rec_size * capacity);
+	TESTP(box, NULL);
+
+	box->stride = rec_size;
+	return box;
+}
+
+__attribute__((warn_unused_result, pure))
+size_t bx_rec_count(const box_t *box)
+{
+	REC_TEST(box, 0);
+	return box->members;
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_rec_append(box_t *box, const void *recs, const size_t num)
+{
+	size_t members;
+
+	REC_TEST(box, -EINVAL);
+	TESTP_ABORT(recs);
+
+	if (0 == num) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* bx_add() sets members to 1 when the box was empty; restore the real number */
+	members = box->members + num;
+
+	if (A_OK != bx_add(box, recs, box->stride * num)) {
+		DE("Could not add %zu records\n", num);
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	bx_members_set(box, members);
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+void *bx_rec_get(box_t *box, const size_t index)
+{
+	REC_TEST(box, NULL);
+	return bx_member_ptr(box, index);
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_rec_set(box_t *box, const size_t index, const void *rec)
+{
+	REC_TEST(box, -EINVAL);
+	TESTP_ABORT(rec);
+
+	if (index >= box->members) {
+		DE("Record index (%zu) is out of range (%u)\n", index, (uint32_t)box->members);
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Never write into shared or borrowed memory */
+	if (A_OK != bx_make_writable(box)) {
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	memcpy(box->data + index * box->stride, rec, box->stride);
+	return A_OK;
+}
+
+/* This is an internal function: stable bottom-up merge sort of the keys array */
+static void bx_rec_merge_sort(box_rec_key_t *keys, box_rec_key_t *tmp, const size_t num)
+{
+	size_t        width;
+	box_rec_key_t *src   = keys;
+	box_rec_key_t *dst   = tmp;
+
+	for (width = 1; width < num; width *= 2) {
+		size_t        start;
+		box_rec_key_t *swap;
+
+		for (start = 0; start < num; start += 2 * width) {
+			size_t left      = start;
+			size_t mid       = MIN(start + width, num);
+			size_t right     = mid;
+			size_t end       = MIN(start + 2 * width, num);
+			size_t out       = start;
+
+			/* '<=' takes the left element on equal keys: this makes the sort stable */
+			while (left < mid && right < end) {
+				if (src[left].key <= src[right].key) {
+					dst[out++] = src[left++];
+				} else {
+					dst[out++] = src[right++];
+				}
+			}
+
+			while (left < mid) {
+				dst[out++] = src[left++];
+			}
+
+			while (right < end) {
+				dst[out++] = src[right++];
+			}
+		}
+
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	/* The sorted array must be in 'keys' */
+	if (src != keys) {
+		memcpy(keys, src, num * sizeof(box_rec_key_t));
+	}
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_rec_sort(box_t *box, const size_t key_offset, const size_t key_width)
+{
+	box_rec_key_t *keys;
+	char          *sorted;
+	size_t        num;
+	size_t        index;
+	size_t        stride;
+
+	REC_TEST(box, -EINVAL);
+	stride = box->stride;
+
+	if (NO == bx_rec_key_is_valid(box, key_offset, key_width)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	num = box->members;
+	if (num < 2) {
+		return A_OK;
+	}
+
+	if (A_OK != bx_make_writable(box)) {
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	/* One allocation for two arrays of keys (the second one is the merge buffer) and the sorted records */
+	keys = malloc(num * sizeof(box_rec_key_t) * 2 + num * stride);
+	TESTP(keys, -ENOMEM);
+	sorted = (char *)(keys + num * 2);
+
+	for (index = 0; index < num; index++) {
+		keys[index].key = bx_rec_key_take(box->data + index * stride + key_offset, key_width);
+		keys[index].index = index;
+	}
+
+	bx_rec_merge_sort(keys, keys + num, num);
+
+	/* Gather the records in the sorted order, then copy them back at once */
+	for (index = 0; index < num; index++) {
+		memcpy(sorted + index * stride, box->data + keys[index].index * stride, stride);
+	}
+
+	memcpy(box->data, sorted, num * stride);
+	free(keys);
+	return A_OK;
+}
+
+#ifdef __SSE2__
+/* This is an internal function: SSE2 linear search in an array of bare keys.
+ * Compares 16 bytes of keys per step; returns the index of the first found key, or -1 */
+__attribute__((warn_unused_result, pure, hot))
+static ssize_t bx_rec_find_sse2(const char *keys, const size_t num, const size_t key_width, const uint64_t key)
+{
+	const size_t per_step = sizeof(__m128i) / key_width;
+	size_t       index    = 0;
+	__m128i      needle;
+
+	switch (key_width) {
+	case 1:
+		needle = _mm_set1_epi8((char)key);
+		break;
+	case 2:
+		needle = _mm_set1_epi16((short)key);
+		break;
+	case 4:
+		needle = _mm_set1_epi32((int)key);
+		break;
+	default:
+		needle = _mm_set1_epi64x((long long)key);
+		break;
+	}
+
+	for (index = 0; index + per_step <= num; index += per_step) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(keys + index * key_width));
+		__m128i equal;
+		int     mask;
+
+		switch (key_width) {
+		case 1:
+			equal = _mm_cmpeq_epi8(block, needle);
+			break;
+		case 2:
+			equal = _mm_cmpeq_epi16(block, needle);
+			break;
+		case 4:
+			equal = _mm_cmpeq_epi32(block, needle);
+			break;
+		default:
+			/* SSE2 has no 64 bit compare: both 32 bit halves must be equal */
+			equal = _mm_cmpeq_epi32(block, needle);
+			equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+			break;
+		}
+
+		/* One bit per byte; an equal key sets 'key_width' bits */
+		mask = _mm_movemask_epi8(equal);
+		if (mask) {
+			return index + __builtin_ctz(mask) / key_width;
+		}
+	}
+
+	/* The tail, less than 16 bytes */
+	for (; index < num; index++) {
+		if (key == bx_rec_key_take(keys + index * key_width, key_width)) {
+			return index;
+		}
+	}
+
+	return -1;
+}
+#endif /* __SSE2__ */
+
+__attribute__((warn_unused_result))
+ssize_t bx_rec_find(const box_t *box, const size_t key_offset, const size_t key_width, const uint64_t key)
+{
+	size_t       index;
+	size_t       stride;
+
+	REC_TEST(box, -EINVAL);
+	stride = box->stride;
+
+	if (NO == bx_rec_key_is_valid(box, key_offset, key_width)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* The key does not fit the key width: no record can have it */
+	if (key_width < sizeof(uint64_t) && (key >> (key_width * 8))) {
+		return -1;
+	}
+
+#ifdef __SSE2__
+	/* The records are bare keys: the keys are contiguous */
+	if (stride == key_width) {
+		return bx_rec_find_sse2(box->data, box->members, key_width, key);
+	}
+#endif
+
+	for (index = 0; index < box->members; index++) {
+		if (key == bx_rec_key_take(box->data + index * stride + key_offset, key_width)) {
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+__attribute__((warn_unused_result))
+ssize_t bx_rec_bsearch(const box_t *box, const size_t key_offset, const size_t key_width, const uint64_t key)
+{
+	size_t       low    = 0;
+	size_t       high;
+	size_t       stride;
+
+	REC_TEST(box, -EINVAL);
+	stride = box->stride;
+
+	if (NO == bx_rec_key_is_valid(box, key_offset, key_width)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Lower bound: the first record with the key >= the asked key */
+	high = box->members;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (bx_rec_key_take(box->data + mid * stride + key_offset, key_width) < key) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if (low < box->members && key == bx_rec_key_take(box->data + low * stride + key_offset, key_width)) {
+		return low;
+	}
+
+	return -1;
+}
@@ -0,0 +1,135 @@
+#ifndef _BOX_REC_H_
+#define _BOX_REC_H_
+
+#include <sys/types.h>
+#include "box_t.h"
+
+/*
+ * Record mode of box_t: a typed array of fixed size records.
+ *
+ * The box keeps 'members' records of 'stride' bytes each, one after another:
+ *
+ *  box->data
+ *  |
+ *  [ record 0 | record 1 | ... | record N - 1 ]
+ *
+ *  box->used == box->members * box->stride
+ *
+ * A record is usually a small structure. The structures are stored as is,
+ * so they can be queried without unpacking: get / set by index, stable sort
+ * by an integer key field, linear and binary search by an integer key field.
+ *
+ * The key is an unsigned integer of 1, 2, 4 or 8 bytes, in the native byte order,
+ * placed at 'key_offset' bytes from the beginning of the record.
+ *
+ * The record box is a regular box: it can be placed into a basket, shared, dumped
+ * into a flat buffer etc.
+ * Don't use the linear box operations (bx_add(), bx_push() etc.) on a record box,
+ * they do not keep box->members in sync with records.
+ */
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Allocate a new box in the record mode
+ * @param const size_t rec_size Size of one record, must be > 0
+ * @param const size_t capacity Number of records to preallocate,
+ *  		   can be 0
+ * @return box_t* New box on success, NULL on an error
+ */
+__attribute__((warn_unused_result))
+extern box_t *bx_rec_new(const size_t rec_size, const size_t capacity);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Return number of records in the box
+ * @param const box_t* box   The record box
+ * @return size_t Number of records
+ */
+__attribute__((warn_unused_result, pure))
+extern size_t bx_rec_count(const box_t *box);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Copy records into the tail of the box
+ * @param box_t* box   The record box
+ * @param const void* recs  Array of records to copy
+ * @param const size_t num  Number of records in the array
+ * @return ret_t A_OK on success, -EINVAL on wrong arguments,
+ *  	   -ENOMEM if memory could not be allocated
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_rec_append(box_t *box, const void *recs, const size_t num);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Return pointer to the record
+ * @param box_t* box   The record box
+ * @param const size_t index Index of the record
+ * @return void* Pointer to the record in the box memory, NULL
+ *  	   if the index is out of range
+ * @details Don't write through this pointer: the box memory can
+ *  		be shared with other boxes. Use ::bx_rec_set().
+ */
+__attribute__((warn_unused_result))
+extern void *bx_rec_get(box_t *box, const size_t index);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Overwrite the record
+ * @param box_t* box   The record box
+ * @param const size_t index Index of the record
+ * @param const void* rec   The new record content
+ * @return ret_t A_OK on success, -EINVAL on wrong arguments,
+ *  	   -ENOMEM if the shared memory could not be copied
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_rec_set(box_t *box, const size_t index, const void *rec);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Stable sort of the records by the key, ascending
+ * @param box_t* box   The record box
+ * @param const size_t key_offset Offset of the key in the record
+ * @param const size_t key_width Size of the key: 1, 2, 4 or 8
+ * @return ret_t A_OK on success, -EINVAL on wrong arguments,
+ *  	   -ENOMEM if memory could not be allocated
+ * @details Merge sort of (key, index) pairs, then the records
+ *  		are moved once to their places: every record is
+ *  		copied two times, disregarding the number of
+ *  		records. Records with equal keys keep their order.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_rec_sort(box_t *box, const size_t key_offset, const size_t key_width);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Linear search of the first record with the key
+ * @param const box_t* box   The record box
+ * @param const size_t key_offset Offset of the key in the record
+ * @param const size_t key_width Size of the key: 1, 2, 4 or 8
+ * @param const uint64_t key The key value to find
+ * @return ssize_t Index of the first record with the key; -1 if
+ *  	   not found; -EINVAL on wrong arguments
+ * @details When the records are bare keys (the record size ==
+ *  		key_width) the search compares 16 bytes of keys per
+ *  		step with SSE2, if the code compiled for a CPU
+ *  		supporting it.
+ */
+__attribute__((warn_unused_result))
+extern ssize_t bx_rec_find(const box_t *box, const size_t key_offset, const size_t key_width, const uint64_t key);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Binary search of the first record with the key in a
+ *  	  box sorted by this key, see ::bx_rec_sort()
+ * @param const box_t* box   The record box, sorted by the key
+ * @param const size_t key_offset Offset of the key in the record
+ * @param const size_t key_width Size of the key: 1, 2, 4 or 8
+ * @param const uint64_t key The key value to find
+ * @return ssize_t Index of the first record with the key; -1 if
+ *  	   not found; -EINVAL on wrong arguments
+ */
+__attribute__((warn_unused_result))
+extern ssize_t bx_rec_bsearch(const box_t *box, const size_t key_offset, const size_t key_width, const uint64_t key);
+
+#endif /* _BOX_REC_H_ */
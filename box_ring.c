@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "box_t.h"
+#include "box_ring.h"
+
+#include "box_t_debug.h"
+#include "tests.h"
+#include "optimization.h"
+
+/* Test that the box is a ring box; if not, abort or return the 'ret' */
+#define RING_TEST(ring, ret) do { TESTP_ABORT(ring); if (!((ring)->flags & BOX_FLAG_RING)) { \
+	DE("The box %p is not a ring buffer\n", ring); ABORT_OR_RETURN(ret); } } while (0)
+
+/* This is an internal function: the offset of the first free byte */
+__attribute__((warn_unused_result, pure))
+static box_s64_t bx_ring_tail(const box_t *ring)
+{
+	box_s64_t tail = (box_s64_t)ring->head + ring->used;
+
+	if (tail >= ring->room) {
+		tail -= ring->room;
+	}
+	return tail;
+}
+
+/* This is an internal function: advance the offset 'pos' by 'size' with wrap around */
+__attribute__((warn_unused_result, pure))
+static box_s64_t bx_ring_advance(const box_t *ring, const box_s64_t pos, const box_s64_t size)
+{
+	box_s64_t new_pos = pos + size;
+
+	if (new_pos >= ring->room) {
+		new_pos -= ring->room;
+	}
+	return new_pos;
+}
+
+/* This is an internal function: keep box->members consistent with box->used */
+static void bx_ring_members_update(box_t *ring)
+{
+	bx_members_set(ring, (ring->used > 0) ? 1 : 0);
+}
+
+/* This is an internal function: reverse 'size' bytes in place */
+static void bx_ring_reverse(char *mem, box_s64_t size)
+{
+	char      *start = mem;
+	char      *end   = mem + size - 1;
+
+	while (start < end) {
+		char tmp = *start;
+		*start++ = *end;
+		*end-- = tmp;
+	}
+}
+
+__attribute__((warn_unused_result))
+box_t *bx_ring_new(const box_s64_t capacity)
+{
+	box_t *ring;
+
+	if (capacity < 1) {
+		DE("Wrong ring capacity: %ld\n", capacity);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	ring = bx_new(capacity);
+	TESTP(ring, NULL);
+
+	ring->flags |= BOX_FLAG_RING;
+	ring->head = 0;
+	return ring;
+}
+
+__attribute__((warn_unused_result, pure))
+box_s64_t bx_ring_space_take(const box_t *ring)
+{
+	RING_TEST(ring, -EINVAL);
+	return bx_room_take(ring) - bx_used_take(ring);
+}
+
+__attribute__((warn_unused_result))
+box_s64_t bx_ring_write(box_t *ring, const void *buf, const box_s64_t size)
+{
+	struct iovec iov[BOX_RING_IOV_MAX];
+	int          iov_num;
+	int          i;
+	box_s64_t    written = 0;
+
+	RING_TEST(ring, -EINVAL);
+	TESTP_ABORT(buf);
+
+	if (size < 0) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	iov_num = bx_ring_space_iovec(ring, iov);
+
+	for (i = 0; i < iov_num && written < size; i++) {
+		box_s64_t to_copy = MIN((box_s64_t)iov[i].iov_len, size - written);
+		memcpy(iov[i].iov_base, (const char *)buf + written, to_copy);
+		written += to_copy;
+	}
+
+	if (A_OK != bx_ring_commit(ring, written)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	return written;
+}
+
+__attribute__((warn_unused_result))
+box_s64_t bx_ring_peek(const box_t *ring, void *buf, const box_s64_t size)
+{
+	struct iovec iov[BOX_RING_IOV_MAX];
+	int          iov_num;
+	int          i;
+	box_s64_t    copied  = 0;
+
+	RING_TEST(ring, -EINVAL);
+	TESTP_ABORT(buf);
+
+	if (size < 0) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	iov_num = bx_ring_data_iovec(ring, iov);
+
+	for (i = 0; i < iov_num && copied < size; i++) {
+		box_s64_t to_copy = MIN((box_s64_t)iov[i].iov_len, size - copied);
+		memcpy((char *)buf + copied, iov[i].iov_base, to_copy);
+		copied += to_copy;
+	}
+
+	return copied;
+}
+
+__attribute__((warn_unused_result))
+box_s64_t bx_ring_read(box_t *ring, void *buf, const box_s64_t size)
+{
+	box_s64_t copied = bx_ring_peek(ring, buf, size);
+
+	if (copied < 0) {
+		return copied;
+	}
+
+	if (A_OK != bx_ring_consume(ring, copied)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	return copied;
+}
+
+__attribute__((warn_unused_result))
+int bx_ring_data_iovec(const box_t *ring, struct iovec iov[BOX_RING_IOV_MAX])
+{
+	box_s64_t first;
+
+	RING_TEST(ring, 0);
+	TESTP_ABORT(iov);
+
+	if (0 == ring->used) {
+		return 0;
+	}
+
+	/* From the head up to the tail, or up to the end of the buffer if the data wraps */
+	first = MIN((box_s64_t)ring->used, (box_s64_t)ring->room - ring->head);
+
+	iov[0].iov_base = ring->data + ring->head;
+	iov[0].iov_len = first;
+
+	if (first == ring->used) {
+		return 1;
+	}
+
+	/* The rest is in the beginning of the buffer */
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = ring->used - first;
+	return 2;
+}
+
+__attribute__((warn_unused_result))
+int bx_ring_space_iovec(const box_t *ring, struct iovec iov[BOX_RING_IOV_MAX])
+{
+	box_s64_t space;
+	box_s64_t tail;
+	box_s64_t first;
+
+	RING_TEST(ring, 0);
+	TESTP_ABORT(iov);
+
+	space = bx_ring_space_take(ring);
+	if (0 == space) {
+		return 0;
+	}
+
+	/* From the tail up to the head, or up to the end of the buffer if the free space wraps */
+	tail = bx_ring_tail(ring);
+	first = MIN(space, (box_s64_t)ring->room - tail);
+
+	iov[0].iov_base = ring->data + tail;
+	iov[0].iov_len = first;
+
+	if (first == space) {
+		return 1;
+	}
+
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = space - first;
+	return 2;
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_ring_consume(box_t *ring, const box_s64_t size)
+{
+	RING_TEST(ring, -EINVAL);
+
+	if (size < 0 || size > bx_used_take(ring)) {
+		DE("Can not consume %ld bytes, the ring holds %ld\n", size, bx_used_take(ring));
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	bx_used_dec(ring, size);
+
+	/* An empty ring starts from the beginning: the free space is contiguous again */
+	if (0 == ring->used) {
+		ring->head = 0;
+	} else {
+		ring->head = bx_ring_advance(ring, ring->head, size);
+	}
+
+	bx_ring_members_update(ring);
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_ring_commit(box_t *ring, const box_s64_t size)
+{
+	RING_TEST(ring, -EINVAL);
+
+	if (size < 0 || size > bx_ring_space_take(ring)) {
+		DE("Can not commit %ld bytes, the ring has %ld free bytes\n", size, bx_ring_space_take(ring));
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	bx_used_inc(ring, size);
+	bx_ring_members_update(ring);
+	return A_OK;
+}
+
+__attribute__((warn_unused_result))
+void *bx_ring_linearize(box_t *ring)
+{
+	RING_TEST(ring, NULL);
+
+	if (0 == ring->head) {
+		return ring->data;
+	}
+
+	/* Rotate the whole buffer left by 'head' bytes: three reversals, in place */
+	bx_ring_reverse(ring->data, ring->head);
+	bx_ring_reverse(ring->data + ring->head, ring->room - ring->head);
+	bx_ring_reverse(ring->data, ring->room);
+	bx_checksum_invalidate(ring);
+
+	ring->head = 0;
+	return ring->data;
+}
@@ -0,0 +1,165 @@
+#ifndef _BOX_RING_H_
+#define _BOX_RING_H_
+
+#include <sys/uio.h>
+#include "box_t.h"
+
+/*
+ * Circular (ring) buffer mode of box_t.
+ *
+ * A ring box is a bounded byte FIFO: the writer appends bytes at the tail,
+ * the reader consumes bytes from the head. The memory is allocated once,
+ * when the ring is created, and the data is never moved by write / read.
+ *
+ *  box->data                                          box->data + box->room
+ *  |                                                  |
+ *  [ ... free ... | head ... unread bytes ... | free ]
+ *                   ^box->head                ^tail = (head + used) % room
+ *
+ * The unread bytes may wrap around the end of the buffer; this way the data
+ * is represented by up to two memory segments. These segments can be passed
+ * directly to writev() (see ::bx_ring_data_iovec()), and the free space can be
+ * passed directly to readv() (see ::bx_ring_space_iovec()), no linearization
+ * needed.
+ *
+ * The ring box is a regular box_t, released with ::bx_free().
+ * The linear box operations (bx_add(), bx_replace_data(), bx_push() etc.)
+ * refuse a ring box.
+ */
+
+/**
+ * @def BOX_RING_IOV_MAX
+ * @details The max number of memory segments of a ring buffer
+ */
+#define BOX_RING_IOV_MAX (2)
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Allocate a new ring box
+ * @param const box_s64_t capacity Size of the ring, bytes; must
+ *  		   be > 0
+ * @return box_t* New ring box on success, NULL on an error
+ * @details The ring never grows: a write into a full ring
+ *  		writes nothing.
+ */
+__attribute__((warn_unused_result))
+extern box_t *bx_ring_new(const box_s64_t capacity);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Return the number of bytes can be written into the
+ *  	  ring
+ * @param const box_t* ring  The ring box
+ * @return box_s64_t Number of free bytes
+ * @details The number of unread bytes is ::bx_used_take()
+ */
+__attribute__((warn_unused_result, pure))
+extern box_s64_t bx_ring_space_take(const box_t *ring);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Copy bytes into the tail of the ring
+ * @param box_t* ring  The ring box
+ * @param const void* buf   Buffer to copy
+ * @param const box_s64_t size  Size of the buffer
+ * @return box_s64_t Number of bytes written, can be less than
+ *  	   'size' if the ring is (almost) full; -EINVAL on an
+ *  	   error
+ * @details O(1): at most two memcpy(), no memory moved
+ */
+__attribute__((warn_unused_result))
+extern box_s64_t bx_ring_write(box_t *ring, const void *buf, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Copy bytes from the head of the ring, without
+ *  	  consuming them
+ * @param const box_t* ring  The ring box
+ * @param void* buf   Buffer to copy the bytes to
+ * @param const box_s64_t size  Size of the buffer
+ * @return box_s64_t Number of bytes copied, can be less than
+ *  	   'size' if the ring holds less; -EINVAL on an error
+ */
+__attribute__((warn_unused_result))
+extern box_s64_t bx_ring_peek(const box_t *ring, void *buf, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Copy bytes from the head of the ring and consume them
+ * @param box_t* ring  The ring box
+ * @param void* buf   Buffer to copy the bytes to
+ * @param const box_s64_t size  Size of the buffer
+ * @return box_s64_t Number of bytes read, can be less than
+ *  	   'size' if the ring holds less; -EINVAL on an error
+ * @details O(1): at most two memcpy(), no memory moved
+ */
+__attribute__((warn_unused_result))
+extern box_s64_t bx_ring_read(box_t *ring, void *buf, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Export the unread bytes of the ring as memory
+ *  	  segments, ready for writev()
+ * @param const box_t* ring  The ring box
+ * @param struct iovec iov[BOX_RING_IOV_MAX] The segments are
+ *  			 returned here
+ * @return int Number of segments filled: 0, 1 or 2
+ * @details The bytes are not consumed; after writev() call
+ *  		::bx_ring_consume() with the number of bytes
+ *  		written.
+ */
+__attribute__((warn_unused_result))
+extern int bx_ring_data_iovec(const box_t *ring, struct iovec iov[BOX_RING_IOV_MAX]);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Export the free space of the ring as memory segments,
+ *  	  ready for readv()
+ * @param const box_t* ring  The ring box
+ * @param struct iovec iov[BOX_RING_IOV_MAX] The segments are
+ *  			 returned here
+ * @return int Number of segments filled: 0, 1 or 2
+ * @details After readv() call ::bx_ring_commit() with the
+ *  		number of bytes read.
+ */
+__attribute__((warn_unused_result))
+extern int bx_ring_space_iovec(const box_t *ring, struct iovec iov[BOX_RING_IOV_MAX]);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Consume (drop) bytes from the head of the ring
+ * @param box_t* ring  The ring box
+ * @param const box_s64_t size  Number of bytes to drop, must be
+ *  		   <= number of unread bytes
+ * @return ret_t A_OK on success, -EINVAL on an error
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_ring_consume(box_t *ring, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Mark bytes written directly into the free space (see
+ *  	  ::bx_ring_space_iovec()) as the ring data
+ * @param box_t* ring  The ring box
+ * @param const box_s64_t size  Number of bytes written, must be
+ *  		   <= ::bx_ring_space_take()
+ * @return ret_t A_OK on success, -EINVAL on an error
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_ring_commit(box_t *ring, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/23/22)
+ * @brief Move the unread bytes to the beginning of the ring
+ *  	  buffer, so they are one contiguous memory
+ * @param box_t* ring  The ring box
+ * @return void* Pointer to the first unread byte, which is
+ *  	   box->data; NULL on an error
+ * @details O(room), in place, no memory allocated. Use it only
+ *  		when a contiguous buffer is a must; ::bx_ring_data_iovec()
+ *  		is cheaper.
+ */
+__attribute__((warn_unused_result))
+extern void *bx_ring_linearize(box_t *ring);
+
+#endif /* _BOX_RING_H_ */
@@ -8,12 +8,16 @@
 #include <linux/errno.h>
 
 #include "box_t.h"
+#include "checksum.h"
 
 #include "box_t_debug.h"
 #include "box_t_memory.h"
 #include "tests.h"
 #include "optimization.h"
 
+static ret_t bx_realloc(box_t *box, const size_t new_size);
+static ret_t bx_realloc_headroom(box_t *box, const size_t new_headroom, const size_t new_size);
+
 /* Syntax Note:
  *
  * *** General ***
@@ -95,6 +99,85 @@ int bx_if_size_fits_box_type(ssize_t size)
  *** Get (Take), Set, INcrease and Decrease value of 'used' and 'room' ***
  *************************************************************************/
 
+/*** box->checksum field ***/
+
+void bx_checksum_invalidate(box_t *box)
+{
+	TESTP_ABORT(box);
+	__atomic_and_fetch(&box->cache_flags, (uint8_t)~(BOX_FLAG_CHECKSUM | BOX_FLAG_INCOMPRESSIBLE), __ATOMIC_RELAXED);
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_checksum_get(box_t *box, const uint8_t alg, checksum_t *checksum)
+{
+	checksum_stream_t stream;
+
+	TESTP_ABORT(box);
+	TESTP_ABORT(checksum);
+
+	if (YES == bx_checksum_cached(box, alg, checksum)) {
+		return A_OK;
+	}
+
+	if (0 != checksum_stream_init_alg(&stream, alg)) {
+		return -EINVAL;
+	}
+
+	checksum_stream_update(&stream, box->data, box->used);
+	if (0 != checksum_stream_final(&stream, checksum)) {
+		return -EINVAL;
+	}
+
+	bx_checksum_set(box, alg, *checksum);
+	return A_OK;
+}
+
+/* The serializers of one Basket may fill the cache of the same box at the same time: they write the same values,
+   every field is stored atomically and the flag is published after the checksum */
+void bx_checksum_set(box_t *box, const uint8_t alg, const checksum_t checksum)
+{
+	TESTP_ABORT(box);
+	__atomic_store_n(&box->checksum, checksum, __ATOMIC_RELAXED);
+	__atomic_store_n(&box->checksum_alg, alg, __ATOMIC_RELAXED);
+	__atomic_or_fetch(&box->cache_flags, BOX_FLAG_CHECKSUM, __ATOMIC_RELEASE);
+}
+
+__attribute__((warn_unused_result))
+int bx_checksum_cached(const box_t *box, const uint8_t alg, checksum_t *checksum)
+{
+	TESTP_ABORT(box);
+	TESTP_ABORT(checksum);
+
+	if (!(__atomic_load_n(&box->cache_flags, __ATOMIC_ACQUIRE) & BOX_FLAG_CHECKSUM) ||
+		alg != __atomic_load_n(&box->checksum_alg, __ATOMIC_RELAXED)) {
+		return NO;
+	}
+
+	*checksum = __atomic_load_n(&box->checksum, __ATOMIC_RELAXED);
+	return YES;
+}
+
+__attribute__((warn_unused_result))
+int bx_checksum_is_valid(const box_t *box, const uint8_t alg)
+{
+	checksum_t checksum;
+	return bx_checksum_cached(box, alg, &checksum);
+}
+
+void bx_incompressible_set(box_t *box)
+{
+	TESTP_ABORT(box);
+	__atomic_or_fetch(&box->cache_flags, BOX_FLAG_INCOMPRESSIBLE, __ATOMIC_RELAXED);
+}
+
+int bx_is_incompressible(const box_t *box)
+{
+	TESTP_ABORT(box);
+	return (__atomic_load_n(&box->cache_flags, __ATOMIC_RELAXED) & BOX_FLAG_INCOMPRESSIBLE) ? YES : NO;
+}
+
+/*** End of box->checksum field ***/
+
 /*** box->used field ***/
 
 __attribute__((warn_unused_result, pure))
@@ -113,6 +196,7 @@ void bx_used_set(box_t *box, const box_s64_t used)
 		abort();
 	}
 	box->used = used;
+	bx_checksum_invalidate(box);
 }
 
 void bx_used_inc(box_t *box, const box_s64_t inc)
@@ -125,11 +209,13 @@ void bx_used_inc(box_t *box, const box_s64_t inc)
 		abort();
 	}
 	box->used += inc;
+	bx_checksum_invalidate(box);
 }
 
 void bx_used_dec(box_t *box, const box_s64_t dec)
 {
 	TESTP_ABORT(box);
+	bx_checksum_invalidate(box);
 
 	if (bx_if_size_fits_box_type(dec)) {
 		DE("The asked size is too large for the box\n");
@@ -211,6 +297,12 @@ __attribute__((warn_unused_result, pure))
 size_t bx_member_size(box_t *box)
 {
 	TESTP_ABORT(box);
+
+	/* In the record mode the record size is known even for an empty box */
+	if (box->stride > 0) {
+		return box->stride;
+	}
+
 	if (0 == bx_members_take(box)) {
 		return 0;
 	}
@@ -230,15 +322,18 @@ void *bx_member_ptr(box_t *box, size_t member)
 		return NULL;
 	}
 
-	if (member > num_members) {
-		DDE("Asked member (%zu) > number of members (%zu) in the box\n",
+	if (member >= num_members) {
+		DDE("Asked member (%zu) >= number of members (%zu) in the box\n",
 			member, num_members);
 		return NULL;
 	}
 
 
+	/* The caller can write through the pointer */
+	bx_checksum_invalidate(box);
+
 	data = bx_data_take(box);
-	return (data + member);
+	return (data + member * bx_member_size(box));
 }
 
 __attribute__((warn_unused_result))
@@ -262,6 +357,7 @@ ret_t bx_member_copy(box_t *box, size_t member, void *buf, size_t buf_size)
 	if (buf_size < member_size) {
 		DE("Can not copy: member size (%zu) > user's buffer size (%zu)\n",
 		   member_size, buf_size);
+		return -1;
 	}
 
 	memcpy(buf, mem_ptr, member_size);
@@ -364,10 +460,10 @@ ret_t bx_is_valid(const box_t *box, const char *who, const int line)
 		return (-ECANCELED);
 	}
 
-	/* The box->data can be NULL if and only if (box->used + box->room + box->members) == 0;
+	/* The box->data can be NULL if and only if (box->used + box->room + box->members + box->headroom) == 0;
 	 * However, we don't check box->used: we tested that it <= box->room already */
 	if ((NULL == box->data) &&
-		((bx_room_take(box) +  bx_used_take(box) + bx_members_take(box)) > 0)) {
+		((bx_room_take(box) +  bx_used_take(box) + bx_members_take(box) + bx_headroom_take(box)) > 0)) {
 		DE("/%s +%d/ : Invalid box: box->data == NULL but box->room > 0 (%ld) / box->used (%ld)\n",
 		   who, line, bx_room_take(box), bx_used_take(box));
 		bx_dump(box, "from box_is_valid(), before terminating 2");
@@ -375,9 +471,36 @@ ret_t bx_is_valid(const box_t *box, const char *who, const int line)
 		return (-ECANCELED);
 	}
 
-	/* And vice versa: if box->data != NULL the box->room must be > 0 */
-	if ((NULL != box->data) && (0 == bx_room_take(box))) {
-		DE("/%s +%d/: Invalid box: box->data != NULL but box->room == 0\n", who, line);
+	/* A shared box always points to the shared memory */
+	if ((NULL != box->share) && (box->data - bx_headroom_take(box) != box->share->mem)) {
+		DE("/%s +%d/: Invalid box: box->share is set but box->data (%p) - headroom (%ld) != box->share->mem (%p)\n",
+		   who, line, box->data, bx_headroom_take(box), box->share->mem);
+		bx_dump(box, "from box_is_valid(), before terminating 3");
+		TRY_ABORT();
+		return (-ECANCELED);
+	}
+
+	/* Only a ring buffer has a head, and the head is always inside of the buffer */
+	if ((!(box->flags & BOX_FLAG_RING) && 0 != box->head) ||
+		((box->flags & BOX_FLAG_RING) && box->head > 0 && box->head >= box->room)) {
+		DE("/%s +%d/: Invalid box: box->head (%ld) is wrong, box->room (%ld), ring flag: %d\n",
+		   who, line, (uint64_t)box->head, bx_room_take(box), !!(box->flags & BOX_FLAG_RING));
+		bx_dump(box, "from box_is_valid(), before terminating 3");
+		TRY_ABORT();
+		return (-ECANCELED);
+	}
+
+	/* A destructor makes sense only for an adopted buffer */
+	if ((NULL != box->free_fn) && !(box->flags & BOX_FLAG_FOREIGN)) {
+		DE("/%s +%d/: Invalid box: box->free_fn is set but the box data is not adopted\n", who, line);
+		bx_dump(box, "from box_is_valid(), before terminating 3");
+		TRY_ABORT();
+		return (-ECANCELED);
+	}
+
+	/* And vice versa: if box->data != NULL the box->room or box->headroom must be > 0 */
+	if ((NULL != box->data) && (0 == bx_room_take(box) + bx_headroom_take(box))) {
+		DE("/%s +%d/: Invalid box: box->data != NULL but box->room == 0 and box->headroom == 0\n", who, line);
 		bx_dump(box, "from box_is_valid(), before terminating 3");
 		TRY_ABORT();
 		return (-ECANCELED);
@@ -391,14 +514,20 @@ ret_t bx_is_valid(const box_t *box, const char *who, const int line)
 
 __attribute__((warn_unused_result))
 box_t *bx_new(const box_s64_t size)
+{
+	return bx_new_with_headroom(size, 0);
+}
+
+__attribute__((warn_unused_result))
+box_t *bx_new_with_headroom(const box_s64_t size, const box_s64_t headroom)
 {
 	box_t  *box;
 
-	if (size < 0) {
+	if (size < 0 || headroom < 0) {
 		ABORT_OR_RETURN(NULL);
 	}
 
-	if (bx_if_size_fits_box_type(size)) {
+	if (bx_if_size_fits_box_type(size) || bx_if_size_fits_box_type(headroom)) {
 		DE("The asked size is too large for the box\n");
 		abort();
 	}
@@ -406,11 +535,13 @@ box_t *bx_new(const box_s64_t size)
 	box = (box_t *)zmalloc(sizeof(box_t));
 	T_RET_ABORT(box, NULL);
 
-	/* If a size is given than allocate a data */
-	if (size > 0) {
+	/* If a size is given than allocate a data; the data starts right after the headroom */
+	if (size + headroom > 0) {
 
-		box->data = (char *)zmalloc(size);
+		box->data = (char *)zmalloc(size + headroom);
 		TESTP_ASSERT(box->data, "Can't allocate box->data");
+		box->data += headroom;
+		box->headroom = headroom;
 	}
 
 	/* Assigned value to box->room field */
@@ -452,6 +583,10 @@ ret_t bx_data_set(box_t *box, char *data, const box_s64_t size, const box_s64_t
 	}
 
 	box->data = data;
+	box->free_fn = NULL;
+	box->flags &= ~BOX_FLAG_FOREIGN;
+	box->share = NULL;
+	box->headroom = 0;
 	bx_room_set(box, size);
 	bx_used_set(box, len);
 
@@ -474,6 +609,32 @@ void *bx_data_steal(box_t *box)
 	/* Keep temporarly pointer of intennal data buffer */
 	void *data;
 	TESTP_ABORT(box);
+
+	/* The data of a wrapped ring is not in order in the buffer; see ::bx_ring_linearize() */
+	if (box->flags & BOX_FLAG_RING) {
+		DE("The box is a ring, linearize it first\n");
+		ABORT_OR_RETURN(NULL);
+	}
+
+	/* The caller expects a buffer it can free(); adopted or shared memory must be copied first */
+	if (A_OK != bx_make_writable(box)) {
+		DE("Could not copy the shared buffer\n");
+		ABORT_OR_RETURN(NULL);
+	}
+
+	if ((box->flags & BOX_FLAG_FOREIGN) && A_OK != bx_realloc(box, bx_room_take(box))) {
+		DE("Could not copy the adopted buffer\n");
+		ABORT_OR_RETURN(NULL);
+	}
+
+	/* The caller gets the beginning of the allocated memory: move the data over the headroom */
+	if (bx_headroom_take(box) > 0) {
+		data = box->data - bx_headroom_take(box);
+		memmove(data, box->data, bx_used_take(box));
+		box->data = data;
+		box->headroom = 0;
+	}
+
 	data = box->data;
 	box->data = NULL;
 	bx_room_set(box, 0);
@@ -499,12 +660,105 @@ ret_t bx_is_data_null(const box_t *box)
 	return NO;
 }
 
+/* Return YES if the box data is borrowed: not ours to write or release */
+__attribute__((warn_unused_result, pure))
+static int bx_is_borrowed(const box_t *box)
+{
+	if ((box->flags & BOX_FLAG_FOREIGN) && NULL == box->free_fn) {
+		return YES;
+	}
+	return NO;
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_is_shared(const box_t *box)
+{
+	TESTP_ABORT(box);
+	if (NULL != box->share && __atomic_load_n(&box->share->refs, __ATOMIC_ACQUIRE) > 1) {
+		return YES;
+	}
+	return NO;
+}
+
+/* Return YES if the box may not write into its data: the data is borrowed or shared */
+__attribute__((warn_unused_result))
+static int bx_is_read_only(const box_t *box)
+{
+	if (YES == bx_is_borrowed(box) || YES == bx_is_shared(box)) {
+		return YES;
+	}
+	return NO;
+}
+
+/* Return YES if the box is a ring buffer: linear operations are not allowed on it */
+__attribute__((warn_unused_result))
+static int bx_is_ring(const box_t *box)
+{
+	if (box->flags & BOX_FLAG_RING) {
+		DE("The operation is not supported for a ring buffer box\n");
+		return YES;
+	}
+	return NO;
+}
+
+/* This is an internal function. Release memory according to its ownership attributes */
+static void bx_mem_release(char *mem, const box_s64_t room, box_free_fn_t free_fn, const uint8_t flags)
+{
+	if (flags & BOX_FLAG_FOREIGN) {
+		/* Adopted memory: release with the user's destructor; borrowed memory: don't touch it */
+		if (free_fn) {
+			free_fn(mem);
+		}
+	} else {
+		/* Security: zero memory before it freed */
+		memset(mem, 0, room);
+		free(mem);
+	}
+}
+
+/* This is an internal function. Release box->data according to its ownership.
+ * The box fields are not changed except box->data, box->free_fn, box->flags and box->share */
+static void bx_data_release(box_t *box)
+{
+	if (NULL == box->data) {
+		return;
+	}
+
+	if (box->share) {
+		box_share_t *share = box->share;
+
+		/* Shared memory: the last reference releases it */
+		if (0 == __atomic_sub_fetch(&share->refs, 1, __ATOMIC_ACQ_REL)) {
+			bx_mem_release(share->mem, share->room, share->free_fn, share->flags);
+			TFREE_SIZE(share, sizeof(box_share_t));
+		}
+		box->share = NULL;
+	} else {
+		bx_mem_release(box->data - bx_headroom_take(box), bx_room_take(box) + bx_headroom_take(box),
+					   box->free_fn, box->flags);
+	}
+
+	box->data = NULL;
+	box->headroom = 0;
+	box->free_fn = NULL;
+	box->flags &= ~BOX_FLAG_FOREIGN;
+}
+
 /* This is an internal function. Here we realloc the internal box_t buffer */
 __attribute__((warn_unused_result))
 static ret_t bx_realloc(box_t *box, const size_t new_size)
+{
+	TESTP_ABORT(box);
+	return bx_realloc_headroom(box, bx_headroom_take(box), new_size);
+}
+
+/* This is an internal function. Realloc the internal box_t buffer with 'new_headroom' bytes in front of the data.
+ * The box->headroom is set to the new value; the box->room is not changed */
+__attribute__((warn_unused_result))
+static ret_t bx_realloc_headroom(box_t *box, const size_t new_headroom, const size_t new_size)
 {
 	size_t size_to_copy = 0;
-	void   *tmp         = NULL;
+	char   *tmp         = NULL;
 
 	TESTP_ABORT(box);
 
@@ -513,7 +767,7 @@ static ret_t bx_realloc(box_t *box, const size_t new_size)
 	// box_dump(box, "in Box Realloc, before");
 
 	//DDD("Going to allocate new buffer %zu size; room = %zu, size_to_copy = %zu\n", new_size, room, size_to_copy);
-	tmp = malloc(new_size);
+	tmp = malloc(new_headroom + new_size);
 	//DDD("Allocated size %zu\n", new_size);
 
 	if (NULL == tmp) {
@@ -523,15 +777,248 @@ static ret_t bx_realloc(box_t *box, const size_t new_size)
 
 	/* The new size can be less than previous; so we use minimal between bif->room and new_size to copy data */
 	if (box->data) {
-		memcpy(tmp, box->data, size_to_copy);
-		free(box->data);
-		box->data = NULL;
+		memcpy(tmp + new_headroom, box->data, size_to_copy);
+		bx_data_release(box);
 	}
 
-	box->data = tmp;
+	/* From now on the data is our own private buffer */
+	box->data = tmp + new_headroom;
+	box->headroom = new_headroom;
 	return A_OK;
 }
 
+__attribute__((warn_unused_result))
+ret_t bx_adopt(box_t *box, void *mem, const box_s64_t size, box_free_fn_t free_fn)
+{
+	TESTP_ABORT(box);
+	TESTP_ABORT(mem);
+
+	if (size < 1 || bx_if_size_fits_box_type(size)) {
+		DE("Wrong size of the adopted buffer: %ld\n", size);
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Release whatever the box holds now */
+	bx_data_release(box);
+
+	box->data = mem;
+	box->free_fn = free_fn;
+	box->flags |= BOX_FLAG_FOREIGN;
+
+	/* The adopted buffer is full: there is no spare room in it */
+	bx_room_set(box, size);
+	bx_used_set(box, size);
+	bx_members_set(box, 1);
+
+	BOX_TEST(box);
+	return (A_OK);
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_make_writable(box_t *box)
+{
+	TESTP_ABORT(box);
+
+	/* The data is going to be changed in place */
+	bx_checksum_invalidate(box);
+
+	/* The last reference to the shared memory: take the ownership back, no need to copy */
+	if (box->share && NO == bx_is_shared(box)) {
+		box_share_t *share = box->share;
+
+		box->free_fn = share->free_fn;
+		box->flags |= share->flags & BOX_FLAG_FOREIGN;
+		box->share = NULL;
+		TFREE_SIZE(share, sizeof(box_share_t));
+	}
+
+	if (NO == bx_is_read_only(box)) {
+		return (A_OK);
+	}
+
+	/* Copy the borrowed or shared memory into a private buffer of the same size */
+	return bx_realloc(box, bx_room_take(box));
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_share(box_t *dst, box_t *src)
+{
+	TESTP_ABORT(dst);
+	TESTP_ABORT(src);
+
+	if (YES == bx_is_ring(src) || YES == bx_is_ring(dst)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Nothing to do: the same box, or the boxes already share the same memory */
+	if (dst == src || (NULL != dst->share && dst->share == src->share)) {
+		return (A_OK);
+	}
+
+	/* The first sharing of this memory: the share takes the ownership over it */
+	if (NULL != src->data && NULL == src->share) {
+		box_share_t *share = zmalloc(sizeof(box_share_t));
+		TESTP(share, -ENOMEM);
+
+		share->refs = 1;
+		share->room = src->room + src->headroom;
+		share->mem = src->data - src->headroom;
+		share->free_fn = src->free_fn;
+		share->flags = src->flags & BOX_FLAG_FOREIGN;
+
+		src->share = share;
+		src->free_fn = NULL;
+		src->flags &= ~BOX_FLAG_FOREIGN;
+	}
+
+	/* Release whatever the 'dst' box holds now */
+	bx_data_release(dst);
+
+	if (src->share) {
+		__atomic_add_fetch(&src->share->refs, 1, __ATOMIC_RELAXED);
+	}
+
+	dst->data = src->data;
+	dst->share = src->share;
+	dst->headroom = src->headroom;
+	dst->room = src->room;
+	dst->used = src->used;
+	dst->members = src->members;
+
+	/* The same data: the same checksum, the same compressibility */
+	dst->cache_flags = __atomic_load_n(&src->cache_flags, __ATOMIC_ACQUIRE);
+	dst->checksum = __atomic_load_n(&src->checksum, __ATOMIC_RELAXED);
+	dst->checksum_alg = __atomic_load_n(&src->checksum_alg, __ATOMIC_RELAXED);
+
+	BOX_TEST(dst);
+	return (A_OK);
+}
+
+__attribute__((warn_unused_result, pure))
+box_s64_t bx_headroom_take(const box_t *box)
+{
+	TESTP_ABORT(box);
+	return (box->headroom);
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_headroom_reserve(box_t *box, const box_s64_t headroom)
+{
+	TESTP_ABORT(box);
+
+	if (YES == bx_is_ring(box)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	if (headroom < 0 || bx_if_size_fits_box_type(headroom)) {
+		DE("Wrong headroom size: %ld\n", headroom);
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	if (bx_headroom_take(box) >= headroom) {
+		return (A_OK);
+	}
+
+	/* Move the data once into a new buffer with larger headroom */
+	if (A_OK != bx_realloc_headroom(box, headroom, bx_room_take(box))) {
+		DE("Can not reallocate box->data\n");
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	BOX_TEST(box);
+	return (A_OK);
+}
+
+__attribute__((warn_unused_result))
+void *bx_push(box_t *box, const box_s64_t size)
+{
+	TESTP_ABORT(box);
+
+	if (YES == bx_is_ring(box)) {
+		ABORT_OR_RETURN(NULL);
+	}
+
+	/* The pushed bytes are added to both the data and the room: the tail slack counts too */
+	if (size < 1 || bx_if_size_fits_box_type(box->used + size) || bx_if_size_fits_box_type(bx_room_take(box) + size)) {
+		DE("Wrong size to push: %ld\n", size);
+		ABORT_OR_RETURN(NULL);
+	}
+
+	if (bx_headroom_take(box) < size) {
+		/* Grow the headroom; the data is moved into a new private buffer */
+		box_s64_t headroom = size + BOX_HEADROOM_SLACK;
+
+		if (bx_if_size_fits_box_type(headroom)) {
+			headroom = size;
+		}
+
+		if (A_OK != bx_headroom_reserve(box, headroom)) {
+			ABORT_OR_RETURN(NULL);
+		}
+	} else if (A_OK != bx_make_writable(box)) {
+		/* The header is written into the same memory as the payload */
+		ABORT_OR_RETURN(NULL);
+	}
+
+	/* Take the bytes from the headroom: O(1), the payload stays in place */
+	box->data -= size;
+	box->headroom -= size;
+	bx_room_inc(box, size);
+	bx_used_inc(box, size);
+
+	if (0 == bx_members_take(box)) {
+		bx_members_set(box, 1);
+	}
+
+	return (box->data);
+}
+
+__attribute__((warn_unused_result))
+void *bx_pull(box_t *box, const box_s64_t size)
+{
+	TESTP_ABORT(box);
+
+	if (YES == bx_is_ring(box)) {
+		ABORT_OR_RETURN(NULL);
+	}
+
+	if (size < 1 || size > bx_used_take(box)) {
+		DE("Wrong size to pull: %ld, box->used %ld\n", size, bx_used_take(box));
+		ABORT_OR_RETURN(NULL);
+	}
+
+	/* Return the bytes to the headroom: the data is not touched */
+	box->data += size;
+	box->headroom += size;
+	bx_room_dec(box, size);
+	bx_used_dec(box, size);
+
+	/* Always: box->members <= box->used */
+	if (bx_members_take(box) > bx_used_take(box)) {
+		bx_members_set(box, bx_used_take(box));
+	}
+
+	return (box->data);
+}
+
+__attribute__((warn_unused_result))
+ret_t bx_prepend(box_t *box, const char *new_data, const box_s64_t size)
+{
+	char *header;
+	TESTP_ABORT(box);
+	TESTP_ABORT(new_data);
+
+	header = bx_push(box, size);
+	if (NULL == header) {
+		DE("Can not push %ld bytes into box\n", size);
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
+	memcpy(header, new_data, size);
+	BOX_TEST(box);
+	return (A_OK);
+}
+
 /* This is an internal function. Here we realloc the internal box_t buffer */
 #if 0 /* SEB */
 static ret_t box_realloc_old(box_t *box, size_t new_size){
@@ -658,11 +1145,8 @@ ret_t bx_clean_and_reset(box_t *box)
 	}
 
 	if (box->data) {
-		/* Security: zero memory before it freed */
 		DDD("Cleaning before free, data %p, size %ld\n", box->data, bx_room_take(box));
-		memset(box->data, 0, bx_room_take(box));
-		free(box->data);
-		box->data = NULL;
+		bx_data_release(box);
 	}
 
 	memset(box, 0, sizeof(box_t));
@@ -682,7 +1166,7 @@ ret_t bx_free(box_t *box)
 
 	/* If there's an internal buffer, release it */
 	if (NULL != box->data) {
-		TFREE_SIZE(box->data, bx_used_take(box));
+		bx_data_release(box);
 	}
 	/* Release the box_t struct */
 	TFREE_SIZE(box, sizeof(box_t));
@@ -698,6 +1182,10 @@ ret_t bx_add(box_t *box /* box_t to add into */,
 	TESTP_ABORT(box);
 	TESTP_ABORT(new_data);
 
+	if (YES == bx_is_ring(box)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
 	if (bx_if_size_fits_box_type(box->room + sz)) {
 		DE("The asked size is too large for the box\n");
 		abort();
@@ -709,6 +1197,13 @@ ret_t bx_add(box_t *box /* box_t to add into */,
 		ABORT_OR_RETURN(-EINVAL);
 	}
 
+	/* We never write into borrowed or shared memory. If the room must grow, the reallocation
+	   below makes a private copy anyway, so we copy here only when it doesn't */
+	if (YES == bx_is_read_only(box) && bx_room_avaialable_take(box) >= sz &&
+		A_OK != bx_make_writable(box)) {
+		ABORT_OR_RETURN(-ENOMEM);
+	}
+
 	/* Assure that we have enough room to add this buffer */
 	if (A_OK != bx_room_assure(box, sz)) {
 		DE("Can't add room into box_t\n");
@@ -754,6 +1249,76 @@ ret_t bx_merge(box_t *dst, box_t *src)
 	return rc;
 }
 
+__attribute__((warn_unused_result))
+ret_t bx_merge_many(box_t *dst, box_t **src, const size_t num)
+{
+	box_s64_t add   = 0;
+	size_t    index;
+
+	TESTP_ABORT(dst);
+	TESTP_ABORT(src);
+
+	if (YES == bx_is_ring(dst)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	/* Test all boxes and count the final size before anything is changed */
+	for (index = 0; index < num; index++) {
+		if (NULL == src[index]) {
+			continue;
+		}
+
+		if (YES == bx_is_ring(src[index])) {
+			DE("The box %zu is a ring, it can not be merged\n", index);
+			ABORT_OR_RETURN(-EINVAL);
+		}
+
+		add += bx_used_take(src[index]);
+	}
+
+	if (bx_if_size_fits_box_type(bx_used_take(dst) + add)) {
+		DE("The merged size %ld is too large for the box\n", bx_used_take(dst) + add);
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
+	if (add > 0) {
+		/* We never write into borrowed or shared memory, the same way bx_add() does */
+		if (YES == bx_is_read_only(dst) && bx_room_avaialable_take(dst) >= add &&
+			A_OK != bx_make_writable(dst)) {
+			ABORT_OR_RETURN(-ENOMEM);
+		}
+
+		/* The only reallocation */
+		if (A_OK != bx_room_assure(dst, add)) {
+			DE("Can't add room into box_t\n");
+			ABORT_OR_RETURN(-ENOMEM);
+		}
+	}
+
+	for (index = 0; index < num; index++) {
+		if (NULL == src[index]) {
+			continue;
+		}
+
+		if (bx_used_take(src[index]) > 0) {
+			memcpy(dst->data + bx_used_take(dst), src[index]->data, bx_used_take(src[index]));
+			bx_used_inc(dst, bx_used_take(src[index]));
+		}
+
+		if (A_OK != bx_clean_and_reset(src[index])) {
+			DE("Could not clean 'src' box\n");
+			ABORT_OR_RETURN(-ECANCELED);
+		}
+	}
+
+	if (bx_used_take(dst) > 0 && 0 == bx_members_take(dst)) {
+		bx_members_set(dst, 1);
+	}
+
+	BOX_TEST(dst);
+	return (A_OK);
+}
+
 /* Replace the internal box buffer with the buffer "new_data" */
 __attribute__((warn_unused_result))
 ret_t bx_replace_data(box_t *box /* box_t to replace data in */,
@@ -768,6 +1333,10 @@ ret_t bx_replace_data(box_t *box /* box_t to replace data in */,
 	TESTP_ABORT(box);
 	TESTP_ABORT(new_data);
 
+	if (YES == bx_is_ring(box)) {
+		ABORT_OR_RETURN(-EINVAL);
+	}
+
 	if (bx_if_size_fits_box_type(size)) {
 		DE("The asked size is too large for the box\n");
 		abort();
@@ -780,6 +1349,12 @@ ret_t bx_replace_data(box_t *box /* box_t to replace data in */,
 		return (-EINVAL);
 	}
 
+	/* We never write into borrowed or shared memory */
+	if (A_OK != bx_make_writable(box)) {
+		TRY_ABORT();
+		return (-ENOMEM);
+	}
+
 	/* We use this variable to minimize number of calls of box_room_take(box) */
 	current_room_size = bx_room_take(box);
 
@@ -797,6 +1372,11 @@ ret_t bx_replace_data(box_t *box /* box_t to replace data in */,
 	/* Set the new box->used */
 	bx_used_set(box, size);
 
+	/* If the box was empty, it holds one member now */
+	if (0 == bx_members_take(box)) {
+		bx_members_set(box, 1);
+	}
+
 	BOX_TEST(box);
 	return (A_OK);
 }
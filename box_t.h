@@ -39,15 +39,10 @@ typedef int ret_t;
  *
  * Large enough to keep whatever you want, at least for the next 10 years )
  *
- * 2. In case of CIRCULAR buffer we use half of the 'used' field to keep head of the buffer,
- * another half to keep the tail. In this case max value of the head tail is:
- *
- * 4294967295 bytes,
- * or 4294967.295 Kb
- * or 4294.967295 Mb
- * or 4.294967295 Gb
- *
- * Not as impressive as uint64. In case we need more, the type should be increased to uint128
+ * 2. In case of CIRCULAR (ring) buffer, see box_ring.h, the 'head' field keeps the offset of
+ * the first unread byte, and the 'used' field keeps the number of unread bytes;
+ * the tail is (head + used) modulo room. The 'used' field is not splitted,
+ * so the max size of a ring buffer is the same as the max size of a box.
  * 
  * 2. If this size redefined to uint16, the max size of data buffer is:
  * 65535 bytes, or 65 Kilobyte
@@ -61,6 +56,69 @@ typedef int ret_t;
 typedef int64_t box_s64_t;
 typedef uint32_t box_u32_t;
 
+/**
+ * @brief Destructor of an adopted memory buffer, see ::bx_adopt()
+ * @details For a buffer allocated with malloc() just pass free()
+ */
+typedef void (*box_free_fn_t)(void *mem);
+
+/*** box_t->flags ***/
+
+/**
+ * @def BOX_FLAG_FOREIGN
+ * @details The box->data is not allocated by box_t, it was adopted
+ *  		from the caller (see ::bx_adopt()).
+ *  		If box->free_fn is set, the box owns the memory and
+ *  		releases it with box->free_fn.
+ *  		If box->free_fn is NULL, the memory is borrowed: the box
+ *  		never writes into it and never releases it.
+ */
+#define BOX_FLAG_FOREIGN (1 << 0)
+
+/**
+ * @def BOX_FLAG_RING
+ * @details The box is a circular buffer (see box_ring.h): the
+ *  		data starts at box->head and wraps around the end of
+ *  		box->data. The linear box operations (bx_add() etc.)
+ *  		refuse such a box.
+ */
+#define BOX_FLAG_RING (1 << 1)
+
+/**
+ * @def BOX_FLAG_CHECKSUM
+ * @details box->checksum holds the checksum of the current
+ *  		data, calculated with box->checksum_alg (see
+ *  		::bx_checksum_get()). Every change of the data drops
+ *  		this flag. Kept in box->cache_flags, not in box->flags.
+ */
+#define BOX_FLAG_CHECKSUM (1 << 2)
+
+/**
+ * @def BOX_FLAG_INCOMPRESSIBLE
+ * @details The current data did not compress when the box was
+ *  		dumped into a flat buffer (see ::basket_compress_set()),
+ *  		it is stored as is without another try. Every change of
+ *  		the data drops this flag. Kept in box->cache_flags, not
+ *  		in box->flags.
+ */
+#define BOX_FLAG_INCOMPRESSIBLE (1 << 3)
+
+/**
+ * @brief Reference counted payload shared between boxes, see
+ *  	  ::bx_share()
+ * @details The share owns the memory: it keeps the ownership
+ *  		attributes the memory had in the box which shared
+ *  		it first. The memory released when the last box
+ *  		referencing it drops the reference.
+ */
+typedef struct {
+	uint32_t refs;          /**< Number of boxes referencing the memory; changed atomically */
+	box_type_t room;        /**< Size of the shared memory, including headroom */
+	char *mem;              /**< The shared memory */
+	box_free_fn_t free_fn;  /**< Destructor of adopted memory, see ::bx_adopt() */
+	uint8_t flags;          /**< BOX_FLAG_FOREIGN if the memory is adopted */
+} box_share_t;
+
 /**
  * Simple structure to hold a buffer / string and its size /
  * lenght
@@ -70,14 +128,119 @@ typedef struct {
 	box_type_t room;        /**< Allocated size */
 	box_type_t used;        /**< Used size */
 	box_type_t members;     /**< Used size */
+	box_type_t headroom;    /**< Free space reserved in front of data, see ::bx_push() */
+	box_type_t head;        /**< Ring buffer only: offset of the first unread byte */
+	box_type_t stride;      /**< Record mode only: size of one record, see box_rec.h */
 	ticket_t   ticket;     	/**< Used size */
 	char *data;             /**< Pointer to data */
+	box_free_fn_t free_fn;  /**< Destructor of adopted data; NULL for borrowed or own data */
+	uint8_t flags;          /**< BOX_FLAG_* bits */
+	box_share_t *share;     /**< Not NULL if the data is shared with other boxes */
+	checksum_t checksum;    /**< Cached checksum of the data, valid if BOX_FLAG_CHECKSUM is set */
+	uint8_t checksum_alg;   /**< The algorithm of the cached checksum, checksum_alg_t */
+	uint8_t cache_flags;    /**< BOX_FLAG_CHECKSUM and BOX_FLAG_INCOMPRESSIBLE; filled while the box is only read, so changed atomically */
 } box_t;
 
 /** If there is 'abort on error' is set, this macro stops
  *  execution and generates core file */
 // #define TRY_ABORT() do{ if(0 != bug_get_abort_flag()) {DE("Abort in %s +%d\n", __FILE__, __LINE__);abort();} } while(0)
 
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Test that the size fits the box_type_t
+ * @param ssize_t size  The size to test
+ * @return int 0 if the size fits, 1 if it is too large, -1 if
+ *  	   it is negative
+ */
+__attribute__((warn_unused_result, const))
+extern int bx_if_size_fits_box_type(ssize_t size);
+
+/**
+ * @author Sebastian Mountaniol (9/3/22)
+ * @brief Drop the cached checksum of the box data
+ * @param box_t* box   The box
+ * @details Drops BOX_FLAG_INCOMPRESSIBLE as well: the new data
+ *  		may compress. Called by every function changing the
+ *  		data. Call it after writing into the box memory
+ *  		directly, through a pointer taken from the box.
+ */
+extern void bx_checksum_invalidate(box_t *box);
+
+/**
+ * @author Sebastian Mountaniol (9/3/22)
+ * @brief Get the checksum of the box data; calculated only if
+ *  	  the data changed since the last call
+ * @param box_t* box   The box
+ * @param const uint8_t alg   The algorithm, checksum_alg_t
+ * @param checksum_t* checksum The checksum returned here
+ * @return ret_t A_OK on success, -EINVAL if the algorithm is
+ *  	   unknown
+ * @details The data is not changed, only the cached checksum:
+ *  		many threads may call it for the same box at the same
+ *  		time, as the serializers of one Basket do, if they ask
+ *  		the same algorithm.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_checksum_get(box_t *box, const uint8_t alg, checksum_t *checksum);
+
+/**
+ * @author Sebastian Mountaniol (9/8/22)
+ * @brief Get the cached checksum of the box data, never
+ *  	  calculate it
+ * @param const box_t* box   The box
+ * @param const uint8_t alg   The algorithm, checksum_alg_t
+ * @param checksum_t* checksum The checksum returned here, if
+ *  			cached
+ * @return int YES if the checksum of this algorithm is cached,
+ *  	   NO otherwise
+ */
+__attribute__((warn_unused_result))
+extern int bx_checksum_cached(const box_t *box, const uint8_t alg, checksum_t *checksum);
+
+/**
+ * @author Sebastian Mountaniol (9/3/22)
+ * @brief Remember the checksum of the box data, known from
+ *  	  elsewhere
+ * @param box_t* box   The box
+ * @param const uint8_t alg   The algorithm, checksum_alg_t
+ * @param const checksum_t checksum The checksum of the current
+ *  			data
+ * @details Used when the checksum is calculated while the data
+ *  		is copied into the box, so the next ::bx_checksum_get()
+ *  		does not read the data again.
+ */
+extern void bx_checksum_set(box_t *box, const uint8_t alg, const checksum_t checksum);
+
+/**
+ * @author Sebastian Mountaniol (9/3/22)
+ * @brief Test whether the box holds the checksum of its current
+ *  	  data
+ * @param const box_t* box   The box
+ * @param const uint8_t alg   The algorithm, checksum_alg_t
+ * @return int YES if ::bx_checksum_get() returns without reading
+ *  	   the data, NO otherwise
+ */
+__attribute__((warn_unused_result))
+extern int bx_checksum_is_valid(const box_t *box, const uint8_t alg);
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Remember that the current data does not compress
+ * @param box_t* box   The box
+ */
+extern void bx_incompressible_set(box_t *box);
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Test whether the current data is known as
+ *  	  incompressible
+ * @param const box_t* box   The box
+ * @return int YES if ::bx_incompressible_set() was called since
+ *  	   the last change of the data, NO otherwise
+ */
+__attribute__((warn_unused_result, pure))
+extern int bx_is_incompressible(const box_t *box);
+
 /**
  * @author Sebastian Mountaniol (7/21/22)
  * @brief Print out a buf internals - used, room, pointers
@@ -164,10 +327,182 @@ extern box_t *bx_new(const box_s64_t size);
  * @param buf_t * buf Buffer to extract data buffer
  * @return void* Data buffer pointer on success, NULL on error. Warning: if the but_t did not have a
  * 	buffer (i.e. buf->data was NULL) the NULL will be returned.
+ * @details A ring box is refused, its data can wrap around the buffer end; see ::bx_ring_linearize().
  */
 __attribute__((warn_unused_result))
 extern void *bx_data_steal(box_t *buf);
 
+/**
+ * @author Sebastian Mountaniol (8/20/22)
+ * @brief Place caller's memory buffer into the box without
+ *  	  copying it
+ * @param box_t* box   Box to set the memory into; the current
+ *  		   content of the box (if any) is released
+ * @param void* mem   Memory buffer to adopt, must not be NULL
+ * @param const box_s64_t size  Size of the buffer, must be > 0
+ * @param box_free_fn_t free_fn Destructor of the buffer, can be
+ *  			NULL
+ * @return ret_t A_OK on success, -EINVAL on wrong arguments
+ * @details Ownership contract:<br>
+ *  		If 'free_fn' is not NULL, the box owns the memory
+ *  		from now on: it may write into it, and calls
+ *  		free_fn(mem) when the memory is not needed anymore
+ *  		(the box is freed / cleaned or the data is
+ *  		reallocated). The caller must not release the
+ *  		memory.<br>
+ *  		If 'free_fn' is NULL, the memory is borrowed: the
+ *  		box never writes into it and never releases it. The
+ *  		first operation modifying the box data makes a
+ *  		private copy. The caller must keep the memory alive
+ *  		until the box is released or its data is replaced.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_adopt(box_t *box, void *mem, const box_s64_t size, box_free_fn_t free_fn);
+
+/**
+ * @author Sebastian Mountaniol (8/20/22)
+ * @brief Make sure the box data is a private memory buffer
+ *  	  which is safe to modify
+ * @param box_t* box   Box to test
+ * @return ret_t A_OK on success, -ENOMEM if the private copy
+ *  	   could not be allocated
+ * @details If the box holds borrowed memory (see ::bx_adopt()),
+ *  		or memory shared with other boxes (see ::bx_share()),
+ *  		the data is copied into a new private buffer. For all
+ *  		other boxes this function does nothing.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_make_writable(box_t *box);
+
+/**
+ * @def BOX_HEADROOM_SLACK
+ * @details When ::bx_push() must grow the headroom, it reserves
+ *  		this number of bytes in addition to the asked size,
+ *  		so the next headers are prepended without
+ *  		reallocation
+ */
+#define BOX_HEADROOM_SLACK (32)
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Allocate a box with reserved headroom: free space in
+ *  	  front of the data, for prepending headers
+ * @param const box_s64_t size  Data buffer size, may be 0
+ * @param const box_s64_t headroom Size of headroom, may be 0
+ * @return box_t* New box on success, NULL on an error
+ * @details The headroom is not included into box->room; see
+ *  		::bx_push(), ::bx_prepend()
+ */
+__attribute__((warn_unused_result))
+extern box_t *bx_new_with_headroom(const box_s64_t size, const box_s64_t headroom);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Return the size of the headroom of the box
+ * @param const box_t* box   Box to measure
+ * @return box_s64_t Number of bytes which can be prepended to
+ *  	   the box data without reallocation
+ */
+__attribute__((warn_unused_result, pure))
+extern box_s64_t bx_headroom_take(const box_t *box);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Make sure the box has at least 'headroom' bytes of
+ *  	  headroom
+ * @param box_t* box   Box to reserve headroom in
+ * @param const box_s64_t headroom The minimal headroom size
+ * @return ret_t A_OK on success, -EINVAL on wrong argument,
+ *  	   -ENOMEM if memory could not be allocated
+ * @details If the headroom is too small, the data is moved into
+ *  		a new buffer once; after this all prepends up to
+ *  		'headroom' bytes are done without moving the data.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_headroom_reserve(box_t *box, const box_s64_t headroom);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Extend the box data to the front by 'size' bytes,
+ *  	  like skb_push()
+ * @param box_t* box   Box to extend
+ * @param const box_s64_t size  Number of bytes to add in front
+ *  		   of the data, must be > 0
+ * @return void* Pointer to the new beginning of the data, where
+ *  	   the caller writes 'size' bytes of the header; NULL on
+ *  	   an error
+ * @details The new bytes are taken from the headroom, it costs
+ *  		O(1) and the data is not moved. If the headroom is too
+ *  		small, it grows by 'size' + ::BOX_HEADROOM_SLACK bytes
+ *  		(the data is moved once). Borrowed or shared data is
+ *  		copied first, see ::bx_make_writable(). Refused if
+ *  		box->room, the tail slack included, grows out of
+ *  		box_type_t.
+ */
+__attribute__((warn_unused_result))
+extern void *bx_push(box_t *box, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Remove 'size' bytes from the front of the box data,
+ *  	  like skb_pull(); the bytes become headroom
+ * @param box_t* box   Box to shrink
+ * @param const box_s64_t size  Number of bytes to remove, must
+ *  		   be <= box->used
+ * @return void* Pointer to the new beginning of the data; NULL
+ *  	   on an error
+ * @details The data is not moved and not copied, even if it is
+ *  		shared or borrowed: only the data pointer advances.
+ */
+__attribute__((warn_unused_result))
+extern void *bx_pull(box_t *box, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/22/22)
+ * @brief Copy a header in front of the box data
+ * @param box_t* box   Box to prepend the header to
+ * @param const char* new_data The header to copy
+ * @param const box_s64_t size  Size of the header
+ * @return ret_t A_OK on success, -EINVAL on wrong arguments,
+ *  	   -ENOMEM if memory could not be allocated
+ * @details See ::bx_push(); the payload is never moved as long
+ *  		as there is enough headroom.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_prepend(box_t *box, const char *new_data, const box_s64_t size);
+
+/**
+ * @author Sebastian Mountaniol (8/21/22)
+ * @brief Make the 'dst' box reference the data of the 'src'
+ *  	  box, without copying the data
+ * @param box_t* dst   Box to set the shared data into; the
+ *  		   current content of the box (if any) is released
+ * @param box_t* src   Box to share the data of
+ * @return ret_t A_OK on success, -ENOMEM if the share could not
+ *  	   be allocated
+ * @details After this call both boxes point to the same memory
+ *  		which is reference counted. The memory is copied on
+ *  		the first modification of any of these boxes (copy
+ *  		on write), see ::bx_make_writable(). The memory
+ *  		released when the last box referencing it released.
+ *  		The reference counter is atomic, so boxes sharing
+ *  		the same memory can be released in different
+ *  		threads. The boxes themselves are not thread safe.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_share(box_t *dst, box_t *src);
+
+/**
+ * @author Sebastian Mountaniol (8/21/22)
+ * @brief Test whether the box data is shared with other boxes
+ * @param const box_t* box   Box to test
+ * @return ret_t YES if the data referenced by other boxes, NO
+ *  	   if not
+ * @details 
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_is_shared(const box_t *box);
+
 #if 0 /* SEB */
 /**
  * @author Sebastian Mountaniol (01/06/2020)
@@ -290,6 +625,24 @@ extern ret_t bx_add(box_t *buf, const char *new_data, const box_s64_t size);
  */
 __attribute__((warn_unused_result))
 extern ret_t bx_merge(box_t *dst, box_t *src);
+
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Merge the data of several boxes into 'dst', in order
+ * @param box_t* dst   The box to add the data to
+ * @param box_t** src   Array of the boxes to merge; NULL
+ *  			entries are skipped
+ * @param const size_t num   Number of entries in 'src'
+ * @return ret_t A_OK on success; -EINVAL if a box is a ring
+ *  	   or the result is too large for a box, nothing is
+ *  	   changed then; -ENOMEM on a memory error
+ * @details Unlike ::bx_merge() called in a loop, the final size
+ *  		is calculated first: 'dst' grows once, and every
+ *  		'src' box is copied once. The 'src' boxes are
+ *  		cleaned after the merge.
+ */
+__attribute__((warn_unused_result))
+extern ret_t bx_merge_many(box_t *dst, box_t **src, const size_t num);
 /**
  * @author Sebastian Mountaniol (7/17/22)
  * @brief Replace current data in the Buf_t to a new buffer
@@ -365,10 +718,38 @@ extern void bx_members_set(box_t *box, const box_s64_t members);
 void bx_members_inc(box_t *box, const box_s64_t inc);
 void bx_members_dec(box_t *box, const box_s64_t dec);
 
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Return size of one member (record) of the box
+ * @param box_t* box   Box to measure
+ * @return size_t The record size: box->stride for a box in the
+ *  	   record mode (see box_rec.h), else box->used /
+ *  	   box->members; 0 if the box is empty
+ */
 __attribute__((warn_unused_result, pure))
 size_t bx_member_size(box_t *box);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Return pointer to the member (record) of the box
+ * @param box_t* box   Box containing the members
+ * @param size_t member The member index, the first member is 0
+ * @return void* Pointer to the member, NULL if the member
+ *  	   index is out of range
+ */
 __attribute__((warn_unused_result))
 void *bx_member_ptr(box_t *box, size_t member);
+
+/**
+ * @author Sebastian Mountaniol (8/24/22)
+ * @brief Copy the member (record) of the box into the buffer
+ * @param box_t* box   Box containing the members
+ * @param size_t member The member index, the first member is 0
+ * @param void* buf   Buffer to copy the member into
+ * @param size_t buf_size Size of the buffer, must be >= size of
+ *  			 the member
+ * @return ret_t 0 on success, -1 on an error
+ */
 __attribute__((warn_unused_result))
 ret_t bx_member_copy(box_t *box, size_t member, void *buf, size_t buf_size);
 
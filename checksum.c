@@ -1,3 +1,8 @@
+#include <string.h>
+#if defined (__x86_64__)
+#include <nmmintrin.h>
+#endif
+
 #include "checksum.h"
 #include "murmur3.h"
 #include "tests.h"
@@ -51,8 +56,6 @@ int8_t checksum_buf_to_32_bit(const char *buf_input, const size_t buf_input_size
 	}
 
 	DDD("Going to calculate checksum: buf %p, size %zu, output %p\n", buf_input, buf_input_size, output_32);
-	MurmurHash3_x86_32(buf_input, buf_input_size, ZHASH_MURMUR_SEED, output_32);
-	// SuperFastHash(buf_input, buf_input_size);
 	result = fnv_32a_buf(buf_input, buf_input_size, FNV1_32_INIT);
 	*((uint32_t *)output_32) = result;
 	DDD("Calculated checksum: %X\n", *((uint32_t *)output_32));
@@ -105,3 +108,203 @@ int8_t checksum_buf_configured(const char *buf_input, const size_t buf_input_siz
 #endif /* TICKET_8/16/32/64_BITS */
 }
 
+
+/*** CRC32C ***/
+
+/* The reflected Castagnoli polynomial */
+#define CRC32C_POLY (0x82F63B78)
+
+/* Slicing-by-8 tables for the CPUs without the 'crc32' instruction */
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const char *buf_input, size_t size);
+
+/* The implementation chosen on start */
+static uint32_t (*crc32c_impl)(uint32_t crc, const char *buf_input, size_t size) = crc32c_sw;
+
+static uint32_t crc32c_sw(uint32_t crc, const char *buf_input, size_t size)
+{
+	const uint8_t *buf = (const uint8_t *)buf_input;
+
+	while (size >= 8) {
+		uint64_t word;
+
+		memcpy(&word, buf, sizeof(word));
+		word ^= crc;
+		crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^
+			crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+			crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+			crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+		buf += 8;
+		size -= 8;
+	}
+
+	while (size--) {
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+#if defined (__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const char *buf_input, size_t size)
+{
+	const uint8_t *buf   = (const uint8_t *)buf_input;
+	uint64_t      crc64  = crc;
+
+	while (size >= 8) {
+		uint64_t word;
+
+		memcpy(&word, buf, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		buf += 8;
+		size -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+	while (size--) {
+		crc = _mm_crc32_u8(crc, *buf++);
+	}
+
+	return crc;
+}
+#endif /* __x86_64__ */
+
+/* Fill the tables and choose the implementation once, before main() */
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	uint32_t index;
+	uint32_t slice;
+
+	for (index = 0; index < 256; index++) {
+		uint32_t crc = index;
+		uint32_t bit;
+
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		}
+		crc32c_table[0][index] = crc;
+	}
+
+	for (index = 0; index < 256; index++) {
+		for (slice = 1; slice < 8; slice++) {
+			const uint32_t prev = crc32c_table[slice - 1][index];
+			crc32c_table[slice][index] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+		}
+	}
+
+#if defined (__x86_64__)
+	/* This constructor may run before the one of libgcc: the CPU data must be filled first */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = crc32c_hw;
+	}
+#endif
+}
+
+uint32_t checksum_crc32c(uint32_t crc, const char *buf_input, const size_t buf_input_size)
+{
+	return ~crc32c_impl(~crc, buf_input, buf_input_size);
+}
+
+/*** Streaming checksum ***/
+
+/* The configured checksum is the FNV-1a hash, folded to the checksum size:
+   the hash can be calculated chunk by chunk, the hash of a chunk is the initial value for the next one */
+
+void checksum_stream_init(checksum_stream_t *stream)
+{
+	stream->alg = CHECKSUM_ALG_FNV1A;
+#if defined (CHECKSUM_64_BITS)
+	stream->state = FNV1_64_INIT;
+#else
+	stream->state = FNV1_32_INIT;
+#endif
+}
+
+int8_t checksum_stream_init_alg(checksum_stream_t *stream, const uint8_t alg)
+{
+	switch (alg) {
+	case CHECKSUM_ALG_FNV1A:
+		checksum_stream_init(stream);
+		return 0;
+	case CHECKSUM_ALG_CRC32C:
+		/* The state is kept inverted between the updates */
+		stream->alg = CHECKSUM_ALG_CRC32C;
+		stream->state = 0xFFFFFFFF;
+		return 0;
+	default:
+		DE("Unknown checksum algorithm: %u\n", alg);
+		return -1;
+	}
+}
+
+void checksum_stream_update(checksum_stream_t *stream, const char *buf_input, const size_t buf_input_size)
+{
+	if (0 == buf_input_size) {
+		return;
+	}
+
+	if (CHECKSUM_ALG_CRC32C == stream->alg) {
+		stream->state = crc32c_impl((uint32_t)stream->state, buf_input, buf_input_size);
+		return;
+	}
+
+#if defined (CHECKSUM_64_BITS)
+	stream->state = fnv_64a_buf(buf_input, buf_input_size, stream->state);
+#else
+	stream->state = fnv_32a_buf(buf_input, buf_input_size, (Fnv32_t)stream->state);
+#endif
+}
+
+/* The copy goes by blocks small enough to stay in L1: the checksum reads the block just copied from the cache */
+#define CHECKSUM_COPY_BLOCK (4096)
+
+void checksum_stream_copy(checksum_stream_t *stream, char *dst, const char *src, const size_t size)
+{
+	size_t offset = 0;
+
+	while (offset < size) {
+		const size_t block = MIN(CHECKSUM_COPY_BLOCK, size - offset);
+
+		memcpy(dst + offset, src + offset, block);
+		checksum_stream_update(stream, dst + offset, block);
+		offset += block;
+	}
+}
+
+int8_t checksum_stream_final(const checksum_stream_t *stream, void *output)
+{
+	/* CRC32C is 32 bit: it is folded as the 32 bit FNV-1a */
+	const uint64_t state = (CHECKSUM_ALG_CRC32C == stream->alg) ? (uint32_t)~stream->state : stream->state;
+	TESTP(output, -1);
+
+#if defined (CHECKSUM_8_BITS)
+	uint32_t output_32  = (uint32_t)state;
+	uint8_t  *output_8_p = (uint8_t  *)&output_32;
+	*((uint8_t *)output) = output_8_p[0] ^ output_8_p[1] ^ output_8_p[2] ^ output_8_p[3];
+#elif defined (CHECKSUM_16_BITS)
+	uint32_t output_32   = (uint32_t)state;
+	uint16_t *output_16_p = (uint16_t *)&output_32;
+	*((uint16_t *)output) = output_16_p[0] ^ output_16_p[1];
+#elif defined (CHECKSUM_32_BITS)
+	*((uint32_t *)output) = (uint32_t)state;
+#elif defined (CHECKSUM_64_BITS)
+	*((uint64_t *)output) = state;
+#else
+	#error You must define size of checksum_t type
+#endif
+	return 0;
+}
+
+uint32_t checksum_stream_final_32(const checksum_stream_t *stream)
+{
+	if (CHECKSUM_ALG_CRC32C == stream->alg) {
+		return (uint32_t)~stream->state;
+	}
+
+	/* The 64 bit FNV-1a is folded; the 32 bit one has no upper bits */
+	return (uint32_t)stream->state ^ (uint32_t)(stream->state >> 32);
+}
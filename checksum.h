@@ -2,6 +2,7 @@
 #define CHECKSUM_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 #include "optimization.h"
 
 /* Used for Murmur calculation */
@@ -17,4 +18,59 @@ int8_t checksum_buf_to_32_bit(const char *buf_input, const size_t buf_input_size
 int8_t checksum_buf_to_16_bit(const char *buf_input, const size_t buf_input_size, void *output_16);
 
 int8_t checksum_buf_to_8_bit(const char *buf_input, const size_t buf_input_size, void *output_8);
+
+/**
+ * The checksum algorithms; the id is saved in the flat buffer
+ * header, so a buffer is validated with the algorithm it was
+ * created with.
+ */
+typedef enum {
+	CHECKSUM_ALG_FNV1A = 0, /**< FNV-1a, byte at a time; the default */
+	CHECKSUM_ALG_CRC32C, /**< CRC32C (Castagnoli); SSE4.2 'crc32' instruction if the CPU has it */
+	CHECKSUM_ALG_MAX, /**< Not an algorithm: the number of the algorithms */
+} checksum_alg_t;
+
+/**
+ * Calculate CRC32C of the buffer, continuing 'crc'. Start with
+ * 0; the result of a buffer is the 'crc' of the next one.
+ * The implementation is chosen on start: the SSE4.2 instruction
+ * if the CPU supports it, a table otherwise.
+ */
+uint32_t checksum_crc32c(uint32_t crc, const char *buf_input, const size_t buf_input_size);
+
+/**
+ * A streaming checksum: the same result as
+ * checksum_buf_configured() for the concatenation of all the
+ * buffers passed to checksum_stream_update(), without
+ * concatenating them.
+ */
+typedef struct {
+	uint64_t state; /**< The running hash */
+	uint8_t alg; /**< The algorithm, checksum_alg_t */
+} checksum_stream_t;
+
+void checksum_stream_init(checksum_stream_t *stream);
+
+/**
+ * Start the streaming checksum with the given algorithm; the
+ * result is folded to checksum_t the same way for all the
+ * algorithms. Returns -1 if the algorithm is unknown.
+ */
+int8_t checksum_stream_init_alg(checksum_stream_t *stream, const uint8_t alg);
+
+void checksum_stream_update(checksum_stream_t *stream, const char *buf_input, const size_t buf_input_size);
+
+/**
+ * Copy 'size' bytes from 'src' to 'dst' and add them to the
+ * checksum in one pass: the bytes are read from the memory once.
+ */
+void checksum_stream_copy(checksum_stream_t *stream, char *dst, const char *src, const size_t size);
+
+int8_t checksum_stream_final(const checksum_stream_t *stream, void *output);
+
+/**
+ * The result as 32 bits, not folded to checksum_t: for the 32
+ * bit checksum fields of the zhash dump.
+ */
+uint32_t checksum_stream_final_32(const checksum_stream_t *stream);
 #endif /* CHECKSUM_H_ */
@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lz_block.h"
+
+/* Number of bits of the hash table index */
+#define LZ_BLOCK_HASH_LOG (12)
+
+/* The farthest match, the offset is 2 bytes */
+#define LZ_BLOCK_MAX_OFFSET (65535)
+
+/* The last bytes are always literals: the decoder ends with a literals only sequence */
+#define LZ_BLOCK_LAST_LITERALS (5)
+
+/* No match starts closer than this to the end of the input */
+#define LZ_BLOCK_MF_LIMIT (12)
+
+/* The length value in the token which means more length bytes follow */
+#define LZ_BLOCK_LEN_MASK (15)
+
+/* The length as it is kept in the token */
+#define LZ_BLOCK_TOKEN_LEN(len) (((len) < LZ_BLOCK_LEN_MASK) ? (len) : LZ_BLOCK_LEN_MASK)
+
+/* Every 2^N positions without a match, the search step grows by 1 */
+#define LZ_BLOCK_SKIP_LOG (6)
+
+/* This is an internal function: read 4 bytes, any alignment */
+__attribute__((warn_unused_result, pure))
+static uint32_t lz_block_read32(const uint8_t *ptr)
+{
+	uint32_t val;
+	memcpy(&val, ptr, sizeof(uint32_t));
+	return val;
+}
+
+/* This is an internal function: the hash table index of 4 bytes */
+__attribute__((warn_unused_result, const))
+static uint32_t lz_block_hash(const uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ_BLOCK_HASH_LOG);
+}
+
+/* This is an internal function: number of bytes the length takes after the token */
+__attribute__((warn_unused_result, const))
+static size_t lz_block_len_size(const size_t len)
+{
+	return (len < LZ_BLOCK_LEN_MASK) ? 0 : (len - LZ_BLOCK_LEN_MASK) / 255 + 1;
+}
+
+/* This is an internal function: write the length bytes after the token; return the new output position */
+static size_t lz_block_put_len(uint8_t *out, size_t op, size_t len)
+{
+	if (len < LZ_BLOCK_LEN_MASK) {
+		return op;
+	}
+
+	len -= LZ_BLOCK_LEN_MASK;
+	while (len >= 255) {
+		out[op++] = 255;
+		len -= 255;
+	}
+
+	out[op++] = (uint8_t)len;
+	return op;
+}
+
+/* This is an internal function: write one sequence, the match is optional (match_len 0); return the new output position, 0 if it does not fit */
+__attribute__((warn_unused_result))
+static size_t lz_block_put_sequence(uint8_t *out, size_t op, const size_t dst_size,
+									const uint8_t *literals, const size_t lit_len, const size_t offset, const size_t match_len)
+{
+	const size_t match_code = match_len ? match_len - LZ_BLOCK_MIN_MATCH : 0;
+	size_t       need       = 1 + lz_block_len_size(lit_len) + lit_len;
+
+	if (match_len) {
+		need += 2 + lz_block_len_size(match_code);
+	}
+
+	if (op + need > dst_size) {
+		return 0;
+	}
+
+	out[op++] = (uint8_t)((LZ_BLOCK_TOKEN_LEN(lit_len) << 4) | (match_len ? LZ_BLOCK_TOKEN_LEN(match_code) : 0));
+	op = lz_block_put_len(out, op, lit_len);
+	memcpy(out + op, literals, lit_len);
+	op += lit_len;
+
+	if (match_len) {
+		out[op++] = (uint8_t)offset;
+		out[op++] = (uint8_t)(offset >> 8);
+		op = lz_block_put_len(out, op, match_code);
+	}
+
+	return op;
+}
+
+__attribute__((warn_unused_result))
+size_t lz_block_compress(const void *src, const size_t src_size, void *dst, const size_t dst_size)
+{
+	const uint8_t *in                             = src;
+	uint8_t       *out                            = dst;
+	uint32_t      table[1 << LZ_BLOCK_HASH_LOG];
+	size_t        ip                              = 0;
+	size_t        anchor                          = 0;
+	size_t        op                              = 0;
+
+	if (src_size >= LZ_BLOCK_MF_LIMIT) {
+		const size_t ip_limit    = src_size - LZ_BLOCK_MF_LIMIT;
+		const size_t match_limit = src_size - LZ_BLOCK_LAST_LITERALS;
+
+		memset(table, 0, sizeof(table));
+
+		while (ip <= ip_limit) {
+			const uint32_t seq = lz_block_read32(in + ip);
+			const uint32_t h   = lz_block_hash(seq);
+			const size_t   ref = table[h];
+			size_t         len;
+
+			table[h] = (uint32_t)ip;
+
+			/* No match: the longer no match found, the bigger the step */
+			if (ref >= ip || ip - ref > LZ_BLOCK_MAX_OFFSET || lz_block_read32(in + ref) != seq) {
+				ip += 1 + ((ip - anchor) >> LZ_BLOCK_SKIP_LOG);
+				continue;
+			}
+
+			len = LZ_BLOCK_MIN_MATCH;
+			while (ip + len < match_limit && in[ref + len] == in[ip + len]) {
+				len++;
+			}
+
+			op = lz_block_put_sequence(out, op, dst_size, in + anchor, ip - anchor, ip - ref, len);
+			if (0 == op) {
+				return 0;
+			}
+
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	/* The rest is literals */
+	return lz_block_put_sequence(out, op, dst_size, in + anchor, src_size - anchor, 0, 0);
+}
+
+/* This is an internal function: read the length bytes after the token; return -1 if the input ends */
+__attribute__((warn_unused_result))
+static int lz_block_get_len(const uint8_t *in, size_t *ip, const size_t src_size, size_t *len)
+{
+	uint8_t byte;
+
+	if (*len < LZ_BLOCK_LEN_MASK) {
+		return 0;
+	}
+
+	do {
+		if (*ip >= src_size) {
+			return -1;
+		}
+		byte = in[(*ip)++];
+		*len += byte;
+	} while (255 == byte);
+
+	return 0;
+}
+
+__attribute__((warn_unused_result))
+ssize_t lz_block_decompress(const void *src, const size_t src_size, void *dst, const size_t dst_size)
+{
+	const uint8_t *in  = src;
+	uint8_t       *out = dst;
+	size_t        ip   = 0;
+	size_t        op   = 0;
+
+	while (ip < src_size) {
+		const uint8_t token = in[ip++];
+		size_t        len   = token >> 4;
+		size_t        offset;
+
+		/* Literals */
+		if (0 != lz_block_get_len(in, &ip, src_size, &len) || len > src_size - ip || len > dst_size - op) {
+			return -EINVAL;
+		}
+
+		memcpy(out + op, in + ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence: literals only */
+		if (ip == src_size) {
+			break;
+		}
+
+		/* The match */
+		if (src_size - ip < 2) {
+			return -EINVAL;
+		}
+
+		offset = in[ip] | ((size_t)in[ip + 1] << 8);
+		ip += 2;
+
+		len = token & LZ_BLOCK_LEN_MASK;
+		if (0 == offset || offset > op || 0 != lz_block_get_len(in, &ip, src_size, &len)) {
+			return -EINVAL;
+		}
+
+		len += LZ_BLOCK_MIN_MATCH;
+		if (len > dst_size - op) {
+			return -EINVAL;
+		}
+
+		/* The match can overlap the output: a short offset repeats a pattern */
+		if (offset >= len) {
+			memcpy(out + op, out + op - offset, len);
+			op += len;
+		} else {
+			const size_t end = op + len;
+
+			for (; op < end; op++) {
+				out[op] = out[op - offset];
+			}
+		}
+	}
+
+	return op;
+}
@@ -0,0 +1,62 @@
+#ifndef _LZ_BLOCK_H_
+#define _LZ_BLOCK_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A fast LZ77 block codec, in the spirit of LZ4: byte oriented,
+ * no entropy coding, one hash table lookup per position.
+ *
+ * The block is a sequence of:
+ *
+ *  [ token ][ literal length ext ][ literals ][ offset, 2 bytes LE ][ match length ext ]
+ *
+ * The token holds the literal length (high 4 bits) and the match length
+ * minus LZ_BLOCK_MIN_MATCH (low 4 bits); the value 15 means more length
+ * bytes follow, every byte is added, a byte < 255 is the last one.
+ * The last sequence has literals only, no offset.
+ *
+ * The compressor gives up as soon as the output is not smaller than
+ * the input, and skips faster and faster over the data without matches:
+ * an incompressible buffer costs a fraction of a pass.
+ */
+
+/**
+ * @def LZ_BLOCK_MIN_MATCH
+ * @details The shortest match; shorter repeats are literals
+ */
+#define LZ_BLOCK_MIN_MATCH (4)
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Compress the buffer
+ * @param const void* src   The data to compress
+ * @param const size_t src_size Size of the data
+ * @param void* dst   The output buffer
+ * @param const size_t dst_size Size of the output buffer;
+ *  			 usually src_size - 1, to get the compressed
+ *  			 data only if it is smaller
+ * @return size_t Size of the compressed data; 0 if it does not
+ *  	   fit into dst_size bytes, then the data should be kept
+ *  	   as is
+ */
+__attribute__((warn_unused_result))
+extern size_t lz_block_compress(const void *src, const size_t src_size, void *dst, const size_t dst_size);
+
+/**
+ * @author Sebastian Mountaniol (9/5/22)
+ * @brief Decompress the block
+ * @param const void* src   The compressed block
+ * @param const size_t src_size Size of the block
+ * @param void* dst   The output buffer
+ * @param const size_t dst_size Size of the output buffer
+ * @return ssize_t Size of the decompressed data; -EINVAL if the
+ *  	   block is broken or the data does not fit into
+ *  	   dst_size bytes. Never reads or writes out of the
+ *  	   buffers.
+ */
+__attribute__((warn_unused_result))
+extern ssize_t lz_block_decompress(const void *src, const size_t src_size, void *dst, const size_t dst_size);
+
+#endif /* _LZ_BLOCK_H_ */
@@ -2,12 +2,29 @@
 #include <stdlib.h>
 #include <locale.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <dirent.h>
 
 #include "zhash3.h"
 #include "tests.h"
 #include "basket.h"
 #include "box_t.h"
+#include "box_ring.h"
+#include "box_rec.h"
+#include "basket_decoder.h"
+#include "basket_encoder.h"
+#include "basket_v2.h"
+#include "basket_diff.h"
+#include "basket_batch.h"
+#include "basket_log.h"
+#include "basket_par.h"
+#include "checksum.h"
 #include "debug.h"
+#include "fnv/fnv.h"
 
 #define STRING_ALICE_ALL_LEN (660)
 const char *string_alice_all = "It was the White Rabbit, trotting slowly back again, and looking anxiously about as it went, as if it had lost something; and she heard it muttering to itself 'The Duchess! The Duchess! Oh my dear paws! Oh my fur and whiskers! She’ll get me executed, as sure as ferrets are ferrets! Where can I have dropped them, I wonder?' Alice guessed in a moment that it was looking for the fan and the pair of white kid gloves, and she very good-naturedly began hunting about for them, but they were nowhere to be seen—everything seemed to have changed since her swim in the pool, and the great hall, with the glass table and the little door, had vanished completely.";
@@ -1000,6 +1017,3054 @@ void basket_test_keyval(void)
 	PR("[TEST] Success: Key/Value test\n");
 }
 
+/* Counts calls of the destructor of adopted buffers */
+static uint32_t adopted_free_calls = 0;
+static void adopted_free_counting(void *mem)
+{
+	adopted_free_calls++;
+	free(mem);
+}
+
+/* Test zero-copy adoption of user buffers: box_new_ref() and box_adopt() */
+static void box_adopt_test(void)
+{
+	basket_t *basket;
+	basket_t *basket_2;
+	char     *owned;
+	char     *counted;
+	char     *stolen;
+	char     *flat_buf;
+	size_t   flat_buf_size;
+	ssize_t  box_index;
+	size_t   lorem_ipsum_size   = strnlen(lorem_ipsum, LOREM_IPSUM_SIZE);
+	/* A borrowed buffer: the basket must never write into it nor release it */
+	char     borrowed[]         = "A borrowed buffer";
+
+	adopted_free_calls = 0;
+
+	basket = basket_new();
+	if (NULL == basket) {
+		DE("[TEST] Failed a basket creation\n");
+		abort();
+	}
+
+	/* 1. Owned buffer: the basket releases it with free() */
+	owned = strndup(lorem_ipsum, lorem_ipsum_size);
+	box_index = box_new_ref(basket, owned, lorem_ipsum_size, free);
+	if (0 != box_index) {
+		DE("[TEST] box_new_ref() returned wrong index: %zd\n", box_index);
+		abort();
+	}
+
+	if (box_data_ptr(basket, 0) != owned) {
+		DE("[TEST] The adopted buffer was copied, but it should not\n");
+		abort();
+	}
+
+	/* 2. Borrowed buffer: the first modification must make a private copy */
+	box_index = box_new_ref(basket, borrowed, sizeof(borrowed), NULL);
+	if (1 != box_index) {
+		DE("[TEST] box_new_ref() returned wrong index: %zd\n", box_index);
+		abort();
+	}
+
+	if (box_data_ptr(basket, 1) != borrowed) {
+		DE("[TEST] The borrowed buffer was copied, but it should not\n");
+		abort();
+	}
+
+	if (A_OK != box_add(basket, 1, string_alice_1, strnlen(string_alice_1, STRING_ALICE_ALL_LEN))) {
+		DE("[TEST] Could not add data to a box with a borrowed buffer\n");
+		abort();
+	}
+
+	if (box_data_ptr(basket, 1) == borrowed || 0 != strcmp(borrowed, "A borrowed buffer")) {
+		DE("[TEST] The borrowed buffer was modified\n");
+		abort();
+	}
+
+	if (0 != memcmp(box_data_ptr(basket, 1), borrowed, sizeof(borrowed))) {
+		DE("[TEST] The private copy of the borrowed buffer is wrong\n");
+		abort();
+	}
+
+	/* 3. Adopt into an existing box, with a user destructor */
+	box_index = box_new(basket, string_alice_2, strnlen(string_alice_2, STRING_ALICE_ALL_LEN));
+	if (box_index < 0) {
+		DE("[TEST] Could not add a box\n");
+		abort();
+	}
+
+	counted = strndup(string_alice_3, STRING_ALICE_ALL_LEN);
+	if (A_OK != box_adopt(basket, box_index, counted, strlen(counted), adopted_free_counting)) {
+		DE("[TEST] box_adopt() failed\n");
+		abort();
+	}
+
+	if (box_data_ptr(basket, box_index) != counted || box_data_size(basket, box_index) != (ssize_t)strlen(string_alice_3)) {
+		DE("[TEST] box_adopt() did not place the buffer into the box\n");
+		abort();
+	}
+
+	/* The adopted boxes must survive the flat buffer round trip */
+	flat_buf = basket_to_buf(basket, &flat_buf_size);
+	if (NULL == flat_buf) {
+		DE("[TEST] Can not create a flat memory buffer from basket\n");
+		abort();
+	}
+
+	basket_2 = basket_from_buf(flat_buf, flat_buf_size);
+	free(flat_buf);
+	if (NULL == basket_2 || basket_compare_basket(basket, basket_2)) {
+		DE("[TEST] Original basket and the restored basket are not the same\n");
+		abort();
+	}
+
+	/* 4. Steal the adopted buffer: the caller gets a free()-able copy, the destructor is called */
+	stolen = box_steal_data(basket, box_index);
+	if (NULL == stolen || 0 != strncmp(stolen, string_alice_3, strlen(string_alice_3)) || 1 != adopted_free_calls) {
+		DE("[TEST] box_steal_data() of an adopted buffer is wrong, destructor calls: %u\n", adopted_free_calls);
+		abort();
+	}
+	free(stolen);
+
+	/* 5. Adopt again and let basket_release() call the destructor */
+	counted = strndup(string_alice_4, STRING_ALICE_ALL_LEN);
+	if (A_OK != box_adopt(basket, box_index, counted, strlen(counted), adopted_free_counting)) {
+		DE("[TEST] box_adopt() failed\n");
+		abort();
+	}
+
+	if (A_OK != basket_release(basket) || A_OK != basket_release(basket_2)) {
+		DE("[TEST] Can not release baskets\n");
+		abort();
+	}
+
+	if (2 != adopted_free_calls) {
+		DE("[TEST] The destructor of adopted buffers called %u times, expected 2\n", adopted_free_calls);
+		abort();
+	}
+
+	PR("[TEST] Success: Adopt user buffers into boxes without copying\n");
+}
+
+#define CLONE_TEST_RECIPIENTS (16)
+/* Test shared box data: basket_clone(), box_new_shared() and copy on write */
+static void basket_clone_test(void)
+{
+	basket_t  *basket;
+	basket_t  *clones[CLONE_TEST_RECIPIENTS];
+	basket_t  *copy;
+	char      *found;
+	char      *val;
+	ssize_t   val_size;
+	ssize_t   box_index;
+	box_u32_t index;
+	uint32_t  clone_index;
+	char      *key_str          = "Shared key";
+	size_t    key_str_len       = strlen(key_str);
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	val = strdup("Shared value");
+	if (0 != basket_keyval_add_by_str(basket, key_str, key_str_len, val, strlen(val) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	/* A reference copy: a regular basket, not sharing data */
+	copy = create_alice_basket();
+	if (NULL == copy) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	/* 1. Fan out: every clone references the same memory, nothing is copied */
+	for (clone_index = 0; clone_index < CLONE_TEST_RECIPIENTS; clone_index++) {
+		clones[clone_index] = basket_clone(basket);
+		if (NULL == clones[clone_index]) {
+			DE("[TEST] Can not clone the basket\n");
+			abort();
+		}
+
+		for (index = 0; index < basket->boxes_used; index++) {
+			if (box_data_ptr(basket, index) != box_data_ptr(clones[clone_index], index)) {
+				DE("[TEST] The box[%u] data was copied, but it should be shared\n", index);
+				abort();
+			}
+		}
+
+		if (basket_compare_basket(basket, clones[clone_index])) {
+			DE("[TEST] The clone and the original basket are not the same\n");
+			abort();
+		}
+
+		found = basket_keyval_find_by_str(clones[clone_index], key_str, key_str_len, &val_size);
+		if (NULL == found || found == val || 0 != strcmp(found, val)) {
+			DE("[TEST] The key/value table of the clone is wrong\n");
+			abort();
+		}
+	}
+
+	/* 2. Copy on write: box_add() into a clone does not change the original */
+	if (A_OK != box_add(clones[0], 0, string_alice_2, strnlen(string_alice_2, STRING_ALICE_ALL_LEN))) {
+		DE("[TEST] Can not add data to a shared box\n");
+		abort();
+	}
+
+	if (box_data_ptr(clones[0], 0) == box_data_ptr(basket, 0) || basket_compare_basket(basket, copy)) {
+		DE("[TEST] box_add() on a shared box changed the original basket\n");
+		abort();
+	}
+
+	/* 3. Copy on write: box_data_replace() in the original does not change the clones */
+	if (A_OK != box_data_replace(basket, 1, string_alice_3, strnlen(string_alice_3, STRING_ALICE_ALL_LEN))) {
+		DE("[TEST] Can not replace data in a shared box\n");
+		abort();
+	}
+
+	if (basket_compare_basket(clones[1], copy)) {
+		DE("[TEST] box_data_replace() on a shared box changed the clone\n");
+		abort();
+	}
+
+	/* 4. Copy on write: merging boxes of a clone does not change other clones */
+	if (A_OK != box_merge_box(clones[2], 3, 2)) {
+		DE("[TEST] Can not merge shared boxes\n");
+		abort();
+	}
+
+	if (basket_compare_basket(clones[3], copy)) {
+		DE("[TEST] box_merge_box() on a shared box changed another clone\n");
+		abort();
+	}
+
+	/* 5. Share a box inside of the same basket */
+	box_index = box_new_shared(clones[3], clones[3], 4);
+	if (box_index < 0 || box_data_ptr(clones[3], box_index) != box_data_ptr(clones[3], 4)) {
+		DE("[TEST] Can not share a box inside of the same basket\n");
+		abort();
+	}
+
+	/* 6. The original basket released first; the clones keep the data */
+	if (A_OK != basket_release(basket)) {
+		DE("[TEST] Can not release the original basket\n");
+		abort();
+	}
+
+	for (clone_index = 4; clone_index < CLONE_TEST_RECIPIENTS; clone_index++) {
+		if (basket_compare_basket(clones[clone_index], copy)) {
+			DE("[TEST] The clone is corrupted after the original basket released\n");
+			abort();
+		}
+	}
+
+	for (clone_index = 0; clone_index < CLONE_TEST_RECIPIENTS; clone_index++) {
+		if (A_OK != basket_release(clones[clone_index])) {
+			DE("[TEST] Can not release a clone\n");
+			abort();
+		}
+	}
+
+	if (A_OK != basket_release(copy)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Clone a basket sharing data, copy on write\n");
+}
+
+/* Test headroom: prepend headers without moving the payload */
+static void box_prepend_test(void)
+{
+	basket_t   *basket;
+	basket_t   *clone;
+	basket_t   *basket_2;
+	box_t      *box;
+	char       *payload_p;
+	char       *stolen;
+	char       *flat_buf;
+	size_t     flat_buf_size;
+	char       big_header[BOX_HEADROOM_SLACK * 3];
+	const char *payload          = "payload";
+	const char *header_1         = "HDR1:";
+	const char *header_2         = "HDR2:";
+	const char *expected         = "HDR1:HDR2:payload";
+
+	basket = basket_new();
+	if (NULL == basket || box_new(basket, NULL, 0) < 0) {
+		DE("[TEST] Failed a basket creation\n");
+		abort();
+	}
+
+	/* 1. Reserve headroom in an empty box, then add the payload */
+	if (A_OK != box_headroom_reserve(basket, 0, 64) ||
+		A_OK != box_add(basket, 0, payload, strlen(payload))) {
+		DE("[TEST] Can not reserve headroom and add the payload\n");
+		abort();
+	}
+
+	payload_p = box_data_ptr(basket, 0);
+
+	/* 2. Prepend headers: the payload must stay in place */
+	if (A_OK != box_prepend(basket, 0, header_2, strlen(header_2)) ||
+		A_OK != box_prepend(basket, 0, header_1, strlen(header_1))) {
+		DE("[TEST] Can not prepend a header\n");
+		abort();
+	}
+
+	if (box_data_size(basket, 0) != (ssize_t)strlen(expected) ||
+		0 != memcmp(box_data_ptr(basket, 0), expected, strlen(expected))) {
+		DE("[TEST] The box content is wrong after prepend\n");
+		abort();
+	}
+
+	if ((char *)box_data_ptr(basket, 0) + strlen(header_1) + strlen(header_2) != payload_p) {
+		DE("[TEST] The payload was moved by prepend\n");
+		abort();
+	}
+
+	/* 3. Strip the first header back, without moving anything */
+	box = basket_get_box(basket, 0);
+	if (bx_pull(box, strlen(header_1)) != payload_p - strlen(header_2)) {
+		DE("[TEST] bx_pull() returned wrong pointer\n");
+		abort();
+	}
+
+	if (A_OK != box_prepend(basket, 0, header_1, strlen(header_1))) {
+		DE("[TEST] Can not prepend a header\n");
+		abort();
+	}
+
+	/* 4. Prepend into a shared box: the other basket is not changed */
+	clone = basket_clone(basket);
+	if (NULL == clone) {
+		DE("[TEST] Can not clone the basket\n");
+		abort();
+	}
+
+	if (A_OK != box_prepend(clone, 0, header_2, strlen(header_2))) {
+		DE("[TEST] Can not prepend a header to a shared box\n");
+		abort();
+	}
+
+	if (0 != memcmp(box_data_ptr(basket, 0), expected, strlen(expected)) ||
+		0 != memcmp((char *)box_data_ptr(clone, 0) + strlen(header_2), expected, strlen(expected))) {
+		DE("[TEST] Prepend to a shared box is wrong\n");
+		abort();
+	}
+
+	/* 5. A header larger than the headroom: the headroom grows */
+	memset(big_header, 'H', sizeof(big_header));
+	if (A_OK != box_prepend(basket, 0, big_header, sizeof(big_header))) {
+		DE("[TEST] Can not prepend a header larger than the headroom\n");
+		abort();
+	}
+
+	if (0 != memcmp(box_data_ptr(basket, 0), big_header, sizeof(big_header)) ||
+		0 != memcmp((char *)box_data_ptr(basket, 0) + sizeof(big_header), expected, strlen(expected))) {
+		DE("[TEST] The box content is wrong after the headroom grow\n");
+		abort();
+	}
+
+	/* 6. Flat buffer round trip */
+	flat_buf = basket_to_buf(basket, &flat_buf_size);
+	if (NULL == flat_buf) {
+		DE("[TEST] Can not create a flat memory buffer from basket\n");
+		abort();
+	}
+
+	basket_2 = basket_from_buf(flat_buf, flat_buf_size);
+	free(flat_buf);
+	if (NULL == basket_2 || basket_compare_basket(basket, basket_2)) {
+		DE("[TEST] Original basket and the restored basket are not the same\n");
+		abort();
+	}
+
+	/* 7. The stolen data is a regular free()-able buffer */
+	stolen = box_steal_data(clone, 0);
+	if (NULL == stolen || 0 != memcmp(stolen + strlen(header_2), expected, strlen(expected))) {
+		DE("[TEST] Stolen data is wrong\n");
+		abort();
+	}
+	free(stolen);
+
+	if (A_OK != basket_release(basket) || A_OK != basket_release(basket_2) || A_OK != basket_release(clone)) {
+		DE("[TEST] Can not release baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Prepend headers into the box headroom\n");
+}
+
+#define RING_TEST_CAPACITY (16)
+/* Test the ring buffer box: write / read / peek, wrap around, and iovec export with readv() / writev() */
+static void box_ring_test(void)
+{
+	box_t        *ring;
+	box_t        *ring_2;
+	struct iovec iov[BOX_RING_IOV_MAX];
+	int          iov_num;
+	int          pipe_fd[2];
+	ssize_t      io_bytes;
+	char         buf[RING_TEST_CAPACITY * 2];
+	char         *linear;
+
+	ring = bx_ring_new(RING_TEST_CAPACITY);
+	ring_2 = bx_ring_new(RING_TEST_CAPACITY);
+	if (NULL == ring || NULL == ring_2) {
+		DE("[TEST] Can not create a ring box\n");
+		abort();
+	}
+
+	/* 1. Write, then read a part: the head advances */
+	if (10 != bx_ring_write(ring, "0123456789", 10) || 6 != bx_ring_read(ring, buf, 6) ||
+		0 != memcmp(buf, "012345", 6)) {
+		DE("[TEST] Ring write / read is wrong\n");
+		abort();
+	}
+
+	/* 2. Wrap around: the data is two segments now */
+	if (10 != bx_ring_write(ring, "abcdefghij", 10)) {
+		DE("[TEST] Ring write with wrap around is wrong\n");
+		abort();
+	}
+
+	iov_num = bx_ring_data_iovec(ring, iov);
+	if (2 != iov_num || 14 != iov[0].iov_len + iov[1].iov_len) {
+		DE("[TEST] Ring data iovec is wrong: %d segments\n", iov_num);
+		abort();
+	}
+
+	/* Peek does not consume */
+	if (14 != bx_ring_peek(ring, buf, sizeof(buf)) || 0 != memcmp(buf, "6789abcdefghij", 14) ||
+		14 != bx_used_take(ring)) {
+		DE("[TEST] Ring peek is wrong\n");
+		abort();
+	}
+
+	/* 3. A write into the almost full ring writes only what fits */
+	if (2 != bx_ring_write(ring, "ABCDE", 5) || 0 != bx_ring_space_take(ring) || 0 != bx_ring_write(ring, "X", 1)) {
+		DE("[TEST] Write into a full ring is wrong\n");
+		abort();
+	}
+
+	/* 4. writev() from one ring, readv() into another ring, directly from / to the ring memory */
+	if (0 != pipe(pipe_fd)) {
+		DE("[TEST] Can not create a pipe\n");
+		abort();
+	}
+
+	iov_num = bx_ring_data_iovec(ring, iov);
+	io_bytes = writev(pipe_fd[1], iov, iov_num);
+	if (RING_TEST_CAPACITY != io_bytes || A_OK != bx_ring_consume(ring, io_bytes)) {
+		DE("[TEST] writev() from the ring failed: %zd\n", io_bytes);
+		abort();
+	}
+
+	/* Make the free space of the second ring wrap as well */
+	if (13 != bx_ring_write(ring_2, "------------*", 13) || 12 != bx_ring_read(ring_2, buf, 12)) {
+		DE("[TEST] Ring write / read is wrong\n");
+		abort();
+	}
+
+	iov_num = bx_ring_space_iovec(ring_2, iov);
+	io_bytes = readv(pipe_fd[0], iov, iov_num);
+	if (RING_TEST_CAPACITY - 1 != io_bytes || A_OK != bx_ring_commit(ring_2, io_bytes)) {
+		DE("[TEST] readv() into the ring failed: %zd\n", io_bytes);
+		abort();
+	}
+	close(pipe_fd[0]);
+	close(pipe_fd[1]);
+
+	/* 5. Linearize: the data is contiguous and starts at the buffer beginning */
+	linear = bx_ring_linearize(ring_2);
+	if (linear != bx_data_take(ring_2) || RING_TEST_CAPACITY != bx_used_take(ring_2) ||
+		0 != memcmp(linear, "*6789abcdefghijA", RING_TEST_CAPACITY)) {
+		DE("[TEST] Ring linearize is wrong\n");
+		abort();
+	}
+
+	/* 6. The ring is released as a regular box */
+	if (0 != bx_used_take(ring) || A_OK != bx_free(ring) || A_OK != bx_free(ring_2)) {
+		DE("[TEST] Can not release a ring box\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Ring buffer box\n");
+}
+
+typedef struct {
+	uint32_t id;
+	uint16_t group;
+	uint16_t order;
+	char     tag[8];
+} test_rec_t;
+
+#define REC_TEST_NUM (100)
+#define REC_TEST_KEYS_NUM (1000)
+/* Test the record mode: append / get / set, stable sort, linear and binary search */
+static void box_rec_test(void)
+{
+	box_t      *box;
+	box_t      *keys_box;
+	test_rec_t rec;
+	test_rec_t *rec_p;
+	test_rec_t *prev_p;
+	uint32_t   index;
+	ssize_t    found;
+	uint32_t   keys_32[REC_TEST_KEYS_NUM];
+	uint64_t   keys_64[REC_TEST_KEYS_NUM];
+	uint8_t    keys_8[REC_TEST_KEYS_NUM];
+
+	box = bx_rec_new(sizeof(test_rec_t), 8);
+	if (NULL == box) {
+		DE("[TEST] Can not create a record box\n");
+		abort();
+	}
+
+	/* 1. Append; the ids are unique and not sorted, the groups repeat */
+	for (index = 0; index < REC_TEST_NUM; index++) {
+		memset(&rec, 0, sizeof(rec));
+		rec.id = (index * 37) % 101;
+		rec.group = index % 5;
+		rec.order = index;
+		snprintf(rec.tag, sizeof(rec.tag), "r%u", index);
+		if (A_OK != bx_rec_append(box, &rec, 1)) {
+			DE("[TEST] Can not append a record\n");
+			abort();
+		}
+	}
+
+	rec_p = bx_rec_get(box, 10);
+	if (REC_TEST_NUM != bx_rec_count(box) || NULL == rec_p || 10 != rec_p->order ||
+		(char *)rec_p != (char *)bx_data_take(box) + 10 * sizeof(test_rec_t) ||
+		rec_p != bx_member_ptr(box, 10) || NULL != bx_rec_get(box, REC_TEST_NUM)) {
+		DE("[TEST] Record get is wrong\n");
+		abort();
+	}
+
+	/* 2. Set */
+	rec = *rec_p;
+	strcpy(rec.tag, "set");
+	if (A_OK != bx_rec_set(box, 10, &rec) || 0 != strcmp(((test_rec_t *)bx_rec_get(box, 10))->tag, "set")) {
+		DE("[TEST] Record set is wrong\n");
+		abort();
+	}
+
+	/* 3. Linear search by id */
+	found = bx_rec_find(box, offsetof(test_rec_t, id), sizeof(uint32_t), (37 * 42) % 101);
+	if (42 != found || -1 != bx_rec_find(box, offsetof(test_rec_t, id), sizeof(uint32_t), 5000)) {
+		DE("[TEST] Record linear search is wrong: %zd\n", found);
+		abort();
+	}
+
+	/* 4. Stable sort by group: inside of a group the records keep the original order */
+	if (A_OK != bx_rec_sort(box, offsetof(test_rec_t, group), sizeof(uint16_t))) {
+		DE("[TEST] Can not sort records\n");
+		abort();
+	}
+
+	for (index = 1; index < REC_TEST_NUM; index++) {
+		prev_p = bx_rec_get(box, index - 1);
+		rec_p = bx_rec_get(box, index);
+		if (prev_p->group > rec_p->group || (prev_p->group == rec_p->group && prev_p->order > rec_p->order)) {
+			DE("[TEST] Records sort is wrong or not stable at %u\n", index);
+			abort();
+		}
+	}
+
+	/* 5. Sort by id, then binary search */
+	if (A_OK != bx_rec_sort(box, offsetof(test_rec_t, id), sizeof(uint32_t))) {
+		DE("[TEST] Can not sort records\n");
+		abort();
+	}
+
+	for (index = 0; index < REC_TEST_NUM; index++) {
+		uint32_t id = (index * 37) % 101;
+		found = bx_rec_bsearch(box, offsetof(test_rec_t, id), sizeof(uint32_t), id);
+		if (found < 0 || id != ((test_rec_t *)bx_rec_get(box, found))->id || index != ((test_rec_t *)bx_rec_get(box, found))->order) {
+			DE("[TEST] Records binary search is wrong for id %u\n", id);
+			abort();
+		}
+	}
+
+	if (-1 != bx_rec_bsearch(box, offsetof(test_rec_t, id), sizeof(uint32_t), 5000)) {
+		DE("[TEST] Records binary search found a not existing key\n");
+		abort();
+	}
+
+	if (A_OK != bx_free(box)) {
+		DE("[TEST] Can not release a record box\n");
+		abort();
+	}
+
+	/* 6. Bare keys: the vectorized linear search, for every key width */
+	for (index = 0; index < REC_TEST_KEYS_NUM; index++) {
+		keys_32[index] = index * 3;
+		keys_64[index] = ((uint64_t)index << 32) | 7;
+		keys_8[index] = index % 200;
+	}
+
+	keys_box = bx_rec_new(sizeof(uint32_t), 0);
+	if (NULL == keys_box || A_OK != bx_rec_append(keys_box, keys_32, REC_TEST_KEYS_NUM) ||
+		777 != bx_rec_find(keys_box, 0, sizeof(uint32_t), 777 * 3) ||
+		REC_TEST_KEYS_NUM - 1 != bx_rec_find(keys_box, 0, sizeof(uint32_t), (REC_TEST_KEYS_NUM - 1) * 3) ||
+		-1 != bx_rec_find(keys_box, 0, sizeof(uint32_t), 778 * 3 + 1) ||
+		A_OK != bx_free(keys_box)) {
+		DE("[TEST] Linear search of 32 bit keys is wrong\n");
+		abort();
+	}
+
+	keys_box = bx_rec_new(sizeof(uint64_t), 0);
+	if (NULL == keys_box || A_OK != bx_rec_append(keys_box, keys_64, REC_TEST_KEYS_NUM) ||
+		513 != bx_rec_find(keys_box, 0, sizeof(uint64_t), ((uint64_t)513 << 32) | 7) ||
+		-1 != bx_rec_find(keys_box, 0, sizeof(uint64_t), ((uint64_t)513 << 32) | 8) ||
+		A_OK != bx_free(keys_box)) {
+		DE("[TEST] Linear search of 64 bit keys is wrong\n");
+		abort();
+	}
+
+	keys_box = bx_rec_new(sizeof(uint8_t), 0);
+	if (NULL == keys_box || A_OK != bx_rec_append(keys_box, keys_8, REC_TEST_KEYS_NUM) ||
+		199 != bx_rec_find(keys_box, 0, sizeof(uint8_t), 199) ||
+		-1 != bx_rec_find(keys_box, 0, sizeof(uint8_t), 201) ||
+		-1 != bx_rec_find(keys_box, 0, sizeof(uint8_t), 199 + 256) ||
+		A_OK != bx_free(keys_box)) {
+		DE("[TEST] Linear search of 8 bit keys is wrong\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Record box: get / set, stable sort, linear and binary search\n");
+}
+
+/* Serialize a basket into a caller's buffer; the result must be the same as of basket_to_buf() */
+static void basket_to_buf_into_test(void)
+{
+	basket_t *basket;
+	basket_t *restored;
+	char     *buf;
+	char     *into_buf;
+	size_t   buf_size;
+	size_t   written    = 0;
+	char     *key_str   = "Into key";
+	char     *val_str   = "Into value";
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	/* 1. The buffer is too small: the required size is returned */
+	into_buf = malloc(buf_size + 16);
+	if (NULL == into_buf) {
+		DE("[TEST] Can not allocate memory\n");
+		abort();
+	}
+
+	if (-ENOSPC != basket_to_buf_into(basket, into_buf, buf_size - 1, &written) || written != buf_size) {
+		DE("[TEST] Too small buffer must fail, and the required size (%zu) returned: %zu\n", buf_size, written);
+		abort();
+	}
+
+	if (-ENOSPC != basket_to_buf_into(basket, into_buf, 4, &written) || written != buf_size) {
+		DE("[TEST] Too small buffer must fail, and the required size (%zu) returned: %zu\n", buf_size, written);
+		abort();
+	}
+
+	/* 2. A dirty, bigger buffer: the result must be byte to byte the same */
+	memset(into_buf, 0xA5, buf_size + 16);
+	if (A_OK != basket_to_buf_into(basket, into_buf, buf_size + 16, &written) || written != buf_size) {
+		DE("[TEST] Can not dump the basket into the buffer\n");
+		abort();
+	}
+
+	if (0 != memcmp(buf, into_buf, buf_size)) {
+		DE("[TEST] basket_to_buf_into() and basket_to_buf() produced different buffers\n");
+		abort();
+	}
+
+	/* 3. And it can be restored */
+	restored = basket_from_buf(into_buf, written);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The restored basket is not the same as the original one\n");
+		abort();
+	}
+
+	free(buf);
+	free(into_buf);
+	if (0 != basket_release(basket) || 0 != basket_release(restored)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Basket serialized into a caller's buffer\n");
+}
+
+/* Open a flat buffer as a read only basket, no copy */
+static void basket_view_test(void)
+{
+	basket_t  *basket;
+	basket_t  *view;
+	basket_t  *copy;
+	char      *buf;
+	char      *found;
+	size_t    buf_size;
+	ssize_t   val_size;
+	ssize_t   empty_index;
+	box_u32_t index;
+	char      *key_str      = "View key";
+	char      *val_str      = "View value";
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	/* An empty box in the middle is not dumped: the view must restore it as empty */
+	empty_index = box_new(basket, NULL, 0);
+	if (empty_index < 0 || box_new(basket, string_alice_1, strlen(string_alice_1)) < 0) {
+		DE("[TEST] Can not add boxes\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	view = basket_view_from_buf(buf, buf_size);
+	if (NULL == view || YES != basket_is_view(view) || NO != basket_is_view(basket)) {
+		DE("[TEST] Can not open the view\n");
+		abort();
+	}
+
+	/* 1. Every box points into the flat buffer, and the content is the same */
+	for (index = 0; index < view->boxes_used; index++) {
+		const char *data = box_data_ptr_const(view, index);
+
+		if (box_data_size(view, index) > 0 && (data < buf || data >= buf + buf_size)) {
+			DE("[TEST] The box[%u] data is not in the flat buffer\n", index);
+			abort();
+		}
+	}
+
+	if (0 != box_data_size(view, empty_index) || basket_compare_basket(basket, view)) {
+		DE("[TEST] The view is not the same as the original basket\n");
+		abort();
+	}
+
+	/* 2. The key/value finds return pointers into the flat buffer */
+	found = basket_keyval_find_by_str(view, key_str, strlen(key_str), &val_size);
+	if (NULL == found || found < buf || found >= buf + buf_size ||
+		val_size != (ssize_t)strlen(val_str) + 1 || 0 != strcmp(found, val_str)) {
+		DE("[TEST] Can not find the string key in the view\n");
+		abort();
+	}
+
+	found = basket_keyval_find_by_int64(view, basket_keyval_str_to_int64(key_str, strlen(key_str)), &val_size);
+	if (NULL == found || 0 != strcmp(found, val_str)) {
+		DE("[TEST] Can not find the int key in the view\n");
+		abort();
+	}
+
+	if (NULL != basket_keyval_find_by_str(view, "No such key", strlen("No such key"), &val_size)) {
+		DE("[TEST] Found a key that does not exist\n");
+		abort();
+	}
+
+	/* 3. Materialize: a regular basket, can be changed */
+	copy = basket_view_materialize(view);
+	if (NULL == copy || NO != basket_is_view(copy) || basket_compare_basket(basket, copy) ||
+		box_data_ptr(copy, 0) == box_data_ptr_const(view, 0) ||
+		A_OK != box_add(copy, 0, string_alice_2, strlen(string_alice_2)) ||
+		box_data_size(copy, 0) == box_data_size(view, 0)) {
+		DE("[TEST] Can not materialize the view\n");
+		abort();
+	}
+
+	/* 4. A broken buffer can not be opened */
+	buf[sizeof(basket_send_header_t) + sizeof(box_dump_t)] ^= 0xFF;
+	if (NULL != basket_view_from_buf(buf, buf_size)) {
+		DE("[TEST] Opened a view over a buffer with a wrong checksum\n");
+		abort();
+	}
+
+	if (0 != basket_release(view) || 0 != basket_release(copy) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	free(buf);
+	PR("[TEST] Success: Read only view over a flat buffer\n");
+}
+
+#define IOVEC_TEST_BOXES (12)
+#define IOVEC_TEST_BOX_SIZE (4000)
+
+/* Serialize a basket as iovec segments and write it into a socket, no flat buffer */
+static void basket_iovec_test(void)
+{
+	basket_t     *basket;
+	basket_t     *restored;
+	struct iovec *iov;
+	void         *headers;
+	char         *buf;
+	char         *received;
+	char         *box_buf;
+	size_t       buf_size;
+	size_t       offset       = 0;
+	ssize_t      rc;
+	int          iov_num;
+	int          index;
+	int          status;
+	int          sv[2];
+	int          sndbuf       = 4096;
+	pid_t        pid;
+	char         *key_str     = "Iovec key";
+	char         *val_str     = "Iovec value";
+
+	basket = create_alice_basket();
+	box_buf = malloc(IOVEC_TEST_BOX_SIZE);
+	if (NULL == basket || NULL == box_buf) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	/* A basket much bigger than the socket buffer: the writes are partial */
+	for (index = 0; index < IOVEC_TEST_BOXES; index++) {
+		memset(box_buf, 'a' + index, IOVEC_TEST_BOX_SIZE);
+		if (box_new(basket, box_buf, IOVEC_TEST_BOX_SIZE) < 0) {
+			DE("[TEST] Can not add a box\n");
+			abort();
+		}
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	received = malloc(buf_size);
+	iov_num = basket_iovec_num(basket);
+	iov = malloc(iov_num * sizeof(struct iovec));
+	if (NULL == buf || NULL == received || NULL == iov) {
+		DE("[TEST] Can not allocate memory\n");
+		abort();
+	}
+
+	/* 1. The segments point to the box memory, and together they are the flat buffer */
+	if (-ENOSPC != basket_to_iovec(basket, iov, iov_num - 1, &headers) ||
+		iov_num != basket_to_iovec(basket, iov, iov_num, &headers)) {
+		DE("[TEST] Wrong number of segments\n");
+		abort();
+	}
+
+	for (index = 0; index < iov_num; index++) {
+		if (offset + iov[index].iov_len > buf_size || 0 != memcmp(buf + offset, iov[index].iov_base, iov[index].iov_len)) {
+			DE("[TEST] The segment %d is not the same as the flat buffer at %zu\n", index, offset);
+			abort();
+		}
+		offset += iov[index].iov_len;
+	}
+
+	if (offset != buf_size || iov[2].iov_base != box_data_ptr(basket, 0)) {
+		DE("[TEST] The segments are wrong: size %zu, expected %zu\n", offset, buf_size);
+		abort();
+	}
+
+	free(headers);
+
+	/* 2. Write into a non blocking socket with a small buffer; the child process writes */
+	if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ||
+		0 != setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) ||
+		0 != fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK)) {
+		DE("[TEST] Can not create a socket pair\n");
+		abort();
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		DE("[TEST] Can not fork\n");
+		abort();
+	}
+
+	if (0 == pid) {
+		close(sv[1]);
+		rc = basket_writev(sv[0], basket);
+		close(sv[0]);
+		_exit(rc == (ssize_t)buf_size ? 0 : 1);
+	}
+
+	close(sv[0]);
+	offset = 0;
+	do {
+		rc = read(sv[1], received + offset, MIN(buf_size - offset, 1000));
+		if (rc > 0) {
+			offset += rc;
+		}
+	} while (rc > 0 && offset < buf_size);
+
+	close(sv[1]);
+	if (pid != waitpid(pid, &status, 0) || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+		DE("[TEST] The writer process failed\n");
+		abort();
+	}
+
+	if (offset != buf_size || 0 != memcmp(buf, received, buf_size)) {
+		DE("[TEST] Received %zu bytes, expected %zu, or the content is different\n", offset, buf_size);
+		abort();
+	}
+
+	restored = basket_from_buf(received, offset);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The received basket is not the same as the original one\n");
+		abort();
+	}
+
+	if (0 != basket_release(basket) || 0 != basket_release(restored)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	free(buf);
+	free(received);
+	free(iov);
+	free(box_buf);
+	PR("[TEST] Success: Basket written as iovec segments, no flat buffer\n");
+}
+
+/* Restore a basket from a stream, chunk by chunk, for different chunk sizes */
+static void basket_decoder_test(void)
+{
+	basket_t         *basket;
+	basket_t         *restored;
+	basket_decoder_t *dec;
+	char             *buf;
+	char             *stream;
+	size_t           buf_size;
+	size_t           offset;
+	size_t           chunk_sizes[] = {1, 3, 7, 64, 1000};
+	size_t           chunk_index;
+	uint32_t         baskets_restored;
+	ssize_t          consumed;
+	char             *key_str      = "Decoder key";
+	char             *val_str      = "Decoder value";
+
+	basket = create_alice_basket();
+	if (NULL == basket || box_new(basket, NULL, 0) < 0 || box_new(basket, string_alice_2, strlen(string_alice_2)) < 0) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+
+	/* The stream: two baskets, one after another */
+	stream = malloc(buf_size * 2);
+	if (NULL == buf || NULL == stream) {
+		DE("[TEST] Can not allocate memory\n");
+		abort();
+	}
+
+	memcpy(stream, buf, buf_size);
+	memcpy(stream + buf_size, buf, buf_size);
+
+	/* 1. Feed the stream by chunks; a chunk can hold the end of one basket and the beginning of the next one */
+	for (chunk_index = 0; chunk_index < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); chunk_index++) {
+		dec = basket_decoder_new();
+		if (NULL == dec) {
+			DE("[TEST] Can not allocate the decoder\n");
+			abort();
+		}
+
+		offset = 0;
+		baskets_restored = 0;
+		while (offset < buf_size * 2) {
+			size_t chunk_end = MIN(offset + chunk_sizes[chunk_index], buf_size * 2);
+
+			while (offset < chunk_end) {
+				consumed = basket_decoder_feed(dec, stream + offset, chunk_end - offset);
+				if (consumed < 0) {
+					DE("[TEST] The decoder failed, chunk size %zu, offset %zu\n", chunk_sizes[chunk_index], offset);
+					abort();
+				}
+
+				offset += consumed;
+				if (NO == basket_decoder_is_done(dec)) {
+					continue;
+				}
+
+				restored = basket_decoder_take(dec);
+				if (NULL == restored || basket_compare_basket(basket, restored) ||
+					0 != box_data_size(restored, basket->boxes_used - 2) ||
+					NULL == basket_keyval_find_by_str(restored, key_str, strlen(key_str), &consumed) ||
+					0 != basket_release(restored)) {
+					DE("[TEST] The restored basket is wrong, chunk size %zu\n", chunk_sizes[chunk_index]);
+					abort();
+				}
+				baskets_restored++;
+			}
+		}
+
+		if (2 != baskets_restored || NO != basket_decoder_is_done(dec)) {
+			DE("[TEST] Restored %u baskets instead of 2, chunk size %zu\n", baskets_restored, chunk_sizes[chunk_index]);
+			abort();
+		}
+
+		basket_decoder_release(dec);
+	}
+
+	/* 2. A broken byte in a box data: the checksum does not match */
+	stream[sizeof(basket_send_header_t) + sizeof(box_dump_t) + 1] ^= 0xFF;
+	dec = basket_decoder_new();
+	if (NULL == dec || -EINVAL != basket_decoder_feed(dec, stream, buf_size) ||
+		-EINVAL != basket_decoder_feed(dec, stream, 1)) {
+		DE("[TEST] The decoder accepted a broken buffer\n");
+		abort();
+	}
+
+	/* The partially restored basket is released with the decoder */
+	basket_decoder_release(dec);
+
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	free(buf);
+	free(stream);
+	PR("[TEST] Success: Basket restored from a stream by chunks\n");
+}
+
+/* Encode a basket chunk by chunk, and save it into a file and a pipe, no flat buffer */
+static void basket_encoder_test(void)
+{
+	basket_t         *basket;
+	basket_t         *restored;
+	basket_encoder_t enc;
+	char             *buf;
+	char             *encoded;
+	char             *chunk;
+	size_t           buf_size;
+	size_t           offset;
+	size_t           produced;
+	size_t           chunk_sizes[] = {1, 5, 100, BASKET_ENCODER_CHUNK_SIZE};
+	size_t           chunk_index;
+	int              checksum_first;
+	int              fd;
+	int              pipe_fd[2];
+	char             file_name[]   = "/tmp/basket_encoder_test_XXXXXX";
+	char             *key_str      = "Encoder key";
+	char             *val_str      = "Encoder value";
+	char             *key_str_2    = "Encoder second key";
+
+	basket = create_alice_basket();
+	if (NULL == basket || box_new(basket, NULL, 0) < 0 || box_new(basket, string_alice_2, strlen(string_alice_2)) < 0) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1) ||
+		0 != basket_keyval_add_by_str(basket, key_str_2, strlen(key_str_2), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	encoded = malloc(buf_size + BASKET_ENCODER_CHUNK_SIZE);
+	chunk = malloc(BASKET_ENCODER_CHUNK_SIZE);
+	if (NULL == buf || NULL == encoded || NULL == chunk) {
+		DE("[TEST] Can not allocate memory\n");
+		abort();
+	}
+
+	/* 1. Any chunk size, both checksum modes: the chunks are the flat buffer */
+	for (checksum_first = NO; checksum_first <= YES; checksum_first++) {
+		for (chunk_index = 0; chunk_index < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); chunk_index++) {
+			if (A_OK != basket_encoder_init(&enc, basket, checksum_first)) {
+				DE("[TEST] Can not init the encoder\n");
+				abort();
+			}
+
+			offset = 0;
+			do {
+				produced = basket_encoder_next(&enc, chunk, chunk_sizes[chunk_index]);
+				if (offset + produced > buf_size) {
+					DE("[TEST] The encoder produced too much\n");
+					abort();
+				}
+				memcpy(encoded + offset, chunk, produced);
+				offset += produced;
+			} while (produced > 0);
+
+			/* When the checksum is calculated on the fly, the final header replaces the first one */
+			if (NO == checksum_first) {
+				memcpy(encoded, basket_encoder_header(&enc), sizeof(basket_send_header_t));
+			}
+
+			if (offset != buf_size || 0 != memcmp(buf, encoded, buf_size)) {
+				DE("[TEST] The encoded buffer is not the same as the flat buffer, chunk size %zu\n", chunk_sizes[chunk_index]);
+				abort();
+			}
+		}
+	}
+
+	/* 2. Save into a file: the header is rewritten at the end */
+	fd = mkstemp(file_name);
+	if (fd < 0 || (ssize_t)buf_size != basket_write_fd(fd, basket) ||
+		0 != lseek(fd, 0, SEEK_SET) || (ssize_t)buf_size != read(fd, encoded, buf_size + 1)) {
+		DE("[TEST] Can not save the basket into a file\n");
+		abort();
+	}
+
+	close(fd);
+	unlink(file_name);
+
+	restored = basket_from_buf(encoded, buf_size);
+	if (0 != memcmp(buf, encoded, buf_size) || NULL == restored || basket_compare_basket(basket, restored) ||
+		0 != basket_release(restored)) {
+		DE("[TEST] The basket saved into a file is wrong\n");
+		abort();
+	}
+
+	/* 3. Write into a pipe: not seekable, the checksum is calculated first */
+	if (0 != pipe(pipe_fd) || (ssize_t)buf_size != basket_write_fd(pipe_fd[1], basket) ||
+		(ssize_t)buf_size != read(pipe_fd[0], encoded, buf_size) || 0 != memcmp(buf, encoded, buf_size)) {
+		DE("[TEST] Can not write the basket into a pipe\n");
+		abort();
+	}
+
+	close(pipe_fd[0]);
+	close(pipe_fd[1]);
+
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	free(buf);
+	free(encoded);
+	free(chunk);
+	PR("[TEST] Success: Basket encoded by chunks, saved into a file and a pipe\n");
+}
+
+/* The version 2 flat buffer: varint lengths, restored by the same basket_from_buf() */
+static void basket_v2_test(void)
+{
+	basket_t *basket;
+	basket_t *restored;
+	char     *buf;
+	char     *buf_v2;
+	size_t   buf_size;
+	size_t   buf_v2_size;
+	char     *key_str    = "V2 key";
+	char     *val_str    = "V2 value";
+	uint32_t checksum;
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	buf_v2 = basket_to_buf_v2(basket, &buf_v2_size);
+	if (NULL == buf || NULL == buf_v2) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	/* 1. The small lengths take 1 byte each: the version 2 is smaller */
+	if (buf_v2_size != basket_flat_buf_size_v2(basket) || buf_v2_size >= buf_size) {
+		DE("[TEST] Wrong version 2 size: %zu, calculated %zu, version 1 is %zu\n",
+		   buf_v2_size, basket_flat_buf_size_v2(basket), buf_size);
+		abort();
+	}
+
+	if (YES != basket_buf_is_v2(buf_v2, buf_v2_size) || NO != basket_buf_is_v2(buf, buf_size)) {
+		DE("[TEST] The buffer version is not detected\n");
+		abort();
+	}
+
+	if (buf_v2_size != basket_get_size_from_flat_buffer(buf_v2)) {
+		DE("[TEST] Wrong size of the version 2 buffer: %zu\n", basket_get_size_from_flat_buffer(buf_v2));
+		abort();
+	}
+
+	/* 2. Both versions are restored by basket_from_buf(), with and without the size */
+	restored = basket_from_buf(buf_v2, buf_v2_size);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The version 2 restored basket is not the same as the original one\n");
+		abort();
+	}
+
+	if (0 != basket_release(restored)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	restored = basket_from_buf(buf_v2, 0);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The version 2 basket restored without the size is not the same as the original one\n");
+		abort();
+	}
+
+	if (0 != basket_release(restored)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The version 1 restored basket is not the same as the original one\n");
+		abort();
+	}
+
+	if (0 != basket_release(restored)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	/* 3. A corrupted or truncated buffer is refused */
+	buf_v2[buf_v2_size / 2] ^= 0x5A;
+	if (NULL != basket_from_buf(buf_v2, buf_v2_size)) {
+		DE("[TEST] A corrupted version 2 buffer is restored\n");
+		abort();
+	}
+	buf_v2[buf_v2_size / 2] ^= 0x5A;
+
+	if (NULL != basket_from_buf(buf_v2, buf_v2_size - 1)) {
+		DE("[TEST] A truncated version 2 buffer is restored\n");
+		abort();
+	}
+
+	free(buf);
+	free(buf_v2);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	/* 4. A box index dumped twice is refused, even with a valid checksum */
+	basket = basket_new();
+	if (NULL == basket || box_new(basket, "A", 1) < 0 || box_new(basket, "B", 1) < 0 ||
+		NULL == (buf_v2 = basket_to_buf_v2(basket, &buf_v2_size))) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	/* The last box is [index 1][size 1]['B'] right before the checksum */
+	if (1 != buf_v2[buf_v2_size - 7] || 1 != buf_v2[buf_v2_size - 6] || 'B' != buf_v2[buf_v2_size - 5]) {
+		DE("[TEST] Unexpected version 2 layout\n");
+		abort();
+	}
+
+	buf_v2[buf_v2_size - 7] = 0;
+	checksum = fnv_32a_buf(buf_v2, buf_v2_size - sizeof(uint32_t), FNV1_32A_INIT);
+	buf_v2[buf_v2_size - 4] = (char)(checksum & 0xFF);
+	buf_v2[buf_v2_size - 3] = (char)((checksum >> 8) & 0xFF);
+	buf_v2[buf_v2_size - 2] = (char)((checksum >> 16) & 0xFF);
+	buf_v2[buf_v2_size - 1] = (char)((checksum >> 24) & 0xFF);
+
+	if (NULL != basket_from_buf(buf_v2, buf_v2_size)) {
+		DE("[TEST] A version 2 buffer with a box dumped twice is restored\n");
+		abort();
+	}
+
+	free(buf_v2);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Basket version 2 flat buffer\n");
+}
+
+/* The box index footer: any box of the flat buffer is found without walking the others */
+static void basket_flat_index_test(void)
+{
+	basket_t         *basket;
+	basket_t         *restored;
+	basket_decoder_t *dec;
+	char             *buf;
+	char             *plain_buf;
+	const char       *box_ptr;
+	size_t           buf_size;
+	size_t           plain_buf_size;
+	size_t           fed            = 0;
+	ssize_t          box_size;
+	ssize_t          empty_index;
+	box_u32_t        index;
+	char             *key_str       = "Index key";
+	char             *val_str       = "Index value";
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	empty_index = box_new(basket, NULL, 0);
+	if (empty_index < 0 || box_new(basket, string_alice_1, strlen(string_alice_1)) < 0) {
+		DE("[TEST] Can not add boxes\n");
+		abort();
+	}
+
+	if (0 != basket_keyval_add_by_str(basket, key_str, strlen(key_str), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf_indexed(basket, &buf_size);
+	plain_buf = basket_to_buf(basket, &plain_buf_size);
+	if (NULL == buf || NULL == plain_buf) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	if (buf_size != plain_buf_size + basket->boxes_used * sizeof(box_offset_t) ||
+		buf_size != basket_get_size_from_flat_buffer(buf)) {
+		DE("[TEST] Wrong size of the indexed buffer: %zu, the plain one is %zu\n", buf_size, plain_buf_size);
+		abort();
+	}
+
+	/* 1. Every box is found by its index, the empty one too */
+	for (index = 0; index < basket->boxes_used; index++) {
+		box_ptr = basket_flat_box_ptr(buf, buf_size, index, &box_size);
+
+		if (box_size != box_data_size(basket, index) ||
+			(box_size > 0 && 0 != memcmp(box_ptr, box_data_ptr(basket, index), box_size))) {
+			DE("[TEST] Box[%u] found in the flat buffer is wrong: size %zd\n", index, box_size);
+			abort();
+		}
+	}
+
+	if (NULL != basket_flat_box_ptr(buf, buf_size, empty_index, &box_size) || 0 != box_size) {
+		DE("[TEST] The empty box must be found as empty\n");
+		abort();
+	}
+
+	if (NULL != basket_flat_box_ptr(buf, buf_size, basket->boxes_used, &box_size) || -EINVAL != box_size) {
+		DE("[TEST] A box out of the basket must not be found\n");
+		abort();
+	}
+
+	if (NULL != basket_flat_box_ptr(plain_buf, plain_buf_size, 0, &box_size) || -EINVAL != box_size) {
+		DE("[TEST] A buffer without the index must be refused\n");
+		abort();
+	}
+
+	/* 2. The indexed buffer is restored as usual, with and without the size */
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The basket restored from the indexed buffer is not the same as the original one\n");
+		abort();
+	}
+
+	restored = basket_view_from_buf(buf, 0);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The view of the indexed buffer is not the same as the original one\n");
+		abort();
+	}
+
+	/* 3. The decoder skips the index: the next basket in the stream starts right after it */
+	dec = basket_decoder_new();
+	if (NULL == dec) {
+		DE("[TEST] Can not create the decoder\n");
+		abort();
+	}
+
+	while (fed < buf_size) {
+		const ssize_t consumed = basket_decoder_feed(dec, buf + fed, MIN(7, buf_size - fed));
+
+		if (consumed < 0) {
+			DE("[TEST] The decoder failed on the indexed buffer\n");
+			abort();
+		}
+		fed += consumed;
+	}
+
+	restored = basket_decoder_take(dec);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The decoded indexed basket is not the same as the original one\n");
+		abort();
+	}
+
+	basket_decoder_release(dec);
+	free(buf);
+	free(plain_buf);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Box found by the index of the flat buffer\n");
+}
+
+/* The box data aligned in the flat buffer: a typed array is read in place from the view */
+static void basket_aligned_test(void)
+{
+	basket_t         *basket;
+	basket_t         *view;
+	basket_t         *restored;
+	basket_decoder_t *dec;
+	char             *buf;
+	const double     *values_in_place;
+	size_t           buf_size;
+	size_t           box_size;
+	size_t           fed;
+	size_t           align_index;
+	ssize_t          values_index;
+	box_u32_t        index;
+	double           values[16];
+	const size_t     aligns[]        = {8, 16, 64};
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	for (index = 0; index < 16; index++) {
+		values[index] = index * 1.5;
+	}
+
+	values_index = box_new(basket, values, sizeof(values));
+	if (values_index < 0 || 0 != basket_keyval_add_by_str(basket, "Aligned", strlen("Aligned"), strdup("value"), strlen("value") + 1)) {
+		DE("[TEST] Can not fill the basket\n");
+		abort();
+	}
+
+	if (NULL != basket_to_buf_aligned(basket, 24, &buf_size)) {
+		DE("[TEST] Alignment 24 must be refused\n");
+		abort();
+	}
+
+	for (align_index = 0; align_index < sizeof(aligns) / sizeof(aligns[0]); align_index++) {
+		const size_t align = aligns[align_index];
+
+		buf = basket_to_buf_aligned(basket, align, &buf_size);
+		if (NULL == buf || 0 != ((uintptr_t)buf & (align - 1))) {
+			DE("[TEST] Can not dump the basket aligned to %zu\n", align);
+			abort();
+		}
+
+		/* 1. Every box of the view is aligned, and the same as in the basket */
+		view = basket_view_from_buf(buf, buf_size);
+		if (NULL == view) {
+			DE("[TEST] Can not open the view of the buffer aligned to %zu\n", align);
+			abort();
+		}
+
+		for (index = 0; index < basket->boxes_used; index++) {
+			const void *data = basket_view_box_aligned(view, index, align, &box_size);
+
+			if (NULL == data || box_size != (size_t)box_data_size(basket, index) ||
+				0 != memcmp(data, box_data_ptr(basket, index), box_size)) {
+				DE("[TEST] Box[%u] of the view is wrong or not aligned to %zu\n", index, align);
+				abort();
+			}
+		}
+
+		/* 2. The array is used in place, no copy */
+		values_in_place = basket_view_box_aligned(view, values_index, sizeof(double), &box_size);
+		if (NULL == values_in_place || sizeof(values) != box_size || values[15] != values_in_place[15]) {
+			DE("[TEST] The array can not be used in place\n");
+			abort();
+		}
+
+		if (0 != basket_release(view)) {
+			DE("[TEST] Can not release the view\n");
+			abort();
+		}
+
+		/* 3. Restored as usual, by the whole buffer and by chunks */
+		restored = basket_from_buf(buf, buf_size);
+		if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+			DE("[TEST] The basket restored from the buffer aligned to %zu is not the same as the original one\n", align);
+			abort();
+		}
+
+		dec = basket_decoder_new();
+		if (NULL == dec) {
+			DE("[TEST] Can not create the decoder\n");
+			abort();
+		}
+
+		for (fed = 0; fed < buf_size;) {
+			const ssize_t consumed = basket_decoder_feed(dec, buf + fed, MIN(5, buf_size - fed));
+
+			if (consumed < 0) {
+				DE("[TEST] The decoder failed on the buffer aligned to %zu\n", align);
+				abort();
+			}
+			fed += consumed;
+		}
+
+		restored = basket_decoder_take(dec);
+		if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+			DE("[TEST] The decoded basket aligned to %zu is not the same as the original one\n", align);
+			abort();
+		}
+
+		basket_decoder_release(dec);
+		free(buf);
+	}
+
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Box data aligned in the flat buffer\n");
+}
+
+/* A broken key/value dump of a flat buffer is refused by every decoder, never aborted on */
+static void basket_broken_zhash_test(void)
+{
+	basket_t                   *basket;
+	basket_t                   *restored;
+	basket_decoder_t           *dec;
+	const basket_send_header_t *header;
+	char                       *buf;
+	char                       *zbuf;
+	size_t                     buf_size;
+	size_t                     index;
+	/* The zhash header: its watermark, its entry count; then the first entry: its watermark, its 'val_size', its value */
+	const size_t               broken[] = {0, offsetof(zhash_header_t, entry_count), sizeof(zhash_header_t),
+		sizeof(zhash_header_t) + offsetof(zhash_entry_t, val_size) + 3, sizeof(zhash_header_t) + sizeof(zhash_entry_t) + 3};
+	basket_t                   *view;
+	ssize_t                    val_size;
+
+	basket = basket_new();
+	if (NULL == basket || box_new(basket, lorem_ipsum, LOREM_IPSUM_SIZE) < 0 ||
+		A_OK != basket_keyval_add_by_str(basket, "key", 3, strdup("value"), 6)) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf) {
+		DE("[TEST] Can not create the flat buffer\n");
+		abort();
+	}
+
+	header = (const basket_send_header_t *)buf;
+	zbuf = buf + header->total_len;
+
+	/* 1. The key/value dump is out of the given size */
+	if (NULL != basket_from_buf(buf, header->total_len + 4)) {
+		DE("[TEST] A basket is restored from a truncated key/value dump\n");
+		abort();
+	}
+
+	/* 2. A broken watermark or entry size */
+	for (index = 0; index < sizeof(broken) / sizeof(broken[0]); index++) {
+		zbuf[broken[index]] ^= 0x7F;
+
+		restored = basket_from_buf(buf, buf_size);
+		dec = basket_decoder_new();
+		if (NULL != restored || NULL == dec || -EINVAL != basket_decoder_feed(dec, buf, buf_size)) {
+			DE("[TEST] A basket is restored from a broken key/value dump, byte %zu\n", broken[index]);
+			abort();
+		}
+
+		basket_decoder_release(dec);
+		zbuf[broken[index]] ^= 0x7F;
+	}
+
+	/* 3. A broken value is not found in a view either */
+	zbuf[header->ztable_buf_size - 2] ^= 0x7F;
+	view = basket_view_from_buf(buf, buf_size);
+	if (NULL == view || NULL != basket_keyval_find_by_str(view, "key", 3, &val_size)) {
+		DE("[TEST] A broken value is found in the view\n");
+		abort();
+	}
+
+	zbuf[header->ztable_buf_size - 2] ^= 0x7F;
+	if (NULL == basket_keyval_find_by_str(view, "key", 3, &val_size) || 6 != val_size || 0 != basket_release(view)) {
+		DE("[TEST] The value is not found in the view\n");
+		abort();
+	}
+
+	/* 4. The same buffer, not broken */
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The restored basket is wrong\n");
+		abort();
+	}
+
+	free(buf);
+	if (0 != basket_release(restored) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: A broken or truncated key/value dump of the flat buffer is refused\n");
+}
+
+/* The checksum is calculated while the data copied, on both sides */
+static void basket_copy_checksum_test(void)
+{
+	basket_t          *basket;
+	basket_t          *restored;
+	char              *buf;
+	char              copy[1024];
+	size_t            buf_size;
+	checksum_stream_t checksum;
+	checksum_t        sum_copied;
+	checksum_t        sum_whole;
+
+	/* 1. The copy with the checksum gives the same checksum as the whole buffer, and the same bytes */
+	checksum_stream_init(&checksum);
+	checksum_stream_copy(&checksum, copy, string_alice_1, strlen(string_alice_1));
+	if (0 != checksum_stream_final(&checksum, &sum_copied) ||
+		0 != checksum_buf_configured(string_alice_1, strlen(string_alice_1), &sum_whole) ||
+		sum_copied != sum_whole || 0 != memcmp(copy, string_alice_1, strlen(string_alice_1))) {
+		DE("[TEST] The copy with the checksum is wrong: %X, expected %X\n", sum_copied, sum_whole);
+		abort();
+	}
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	/* 2. The checksum set while the buffer filled is the checksum of the whole buffer */
+	if (0 != basket_validate_flat_buffer(buf)) {
+		DE("[TEST] The checksum of the flat buffer is wrong\n");
+		abort();
+	}
+
+	/* 3. A corrupted box data is found while it is copied */
+	buf[buf_size - 3] ^= 0x11;
+	if (NULL != basket_from_buf(buf, buf_size)) {
+		DE("[TEST] A corrupted buffer is restored\n");
+		abort();
+	}
+	buf[buf_size - 3] ^= 0x11;
+
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The restored basket is not the same as the original one\n");
+		abort();
+	}
+
+	free(buf);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Basket checksum calculated while copied\n");
+}
+
+/* CRC32C checksum of the flat buffer, chosen per basket and saved in the header */
+static void basket_crc32c_test(void)
+{
+	basket_t             *basket;
+	basket_t             *restored;
+	basket_decoder_t     *dec;
+	char                 *buf;
+	size_t               buf_size;
+	const char           *check_str  = "123456789";
+	basket_send_header_t *header;
+
+	/* 1. The standard check value, and the same result by parts */
+	if (0xE3069283 != checksum_crc32c(0, check_str, strlen(check_str)) ||
+		0xE3069283 != checksum_crc32c(checksum_crc32c(0, check_str, 4), check_str + 4, strlen(check_str) - 4)) {
+		DE("[TEST] Wrong CRC32C: %X\n", checksum_crc32c(0, check_str, strlen(check_str)));
+		abort();
+	}
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	if (-EINVAL != basket_checksum_alg_set(basket, CHECKSUM_ALG_MAX) ||
+		A_OK != basket_checksum_alg_set(basket, CHECKSUM_ALG_CRC32C)) {
+		DE("[TEST] Wrong result of setting the checksum algorithm\n");
+		abort();
+	}
+
+	/* The key/value dump is checksummed with the same algorithm */
+	if (A_OK != basket_keyval_add_by_str(basket, "crc", 3, strdup("32c"), 4)) {
+		DE("[TEST] Can not add key/val\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+
+	header = (basket_send_header_t *)buf;
+	if (CHECKSUM_ALG_CRC32C != header->checksum_alg || 0 != basket_validate_flat_buffer(buf) ||
+		CHECKSUM_ALG_CRC32C != ((const zhash_header_t *)(buf + header->total_len))->checksum_alg) {
+		DE("[TEST] The buffer is not checksummed with CRC32C\n");
+		abort();
+	}
+
+	/* 2. The receiver uses the algorithm of the buffer */
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) || CHECKSUM_ALG_CRC32C != restored->checksum_alg ||
+		0 != basket_release(restored)) {
+		DE("[TEST] The basket restored from the CRC32C buffer is wrong\n");
+		abort();
+	}
+
+	dec = basket_decoder_new();
+	if (NULL == dec || (ssize_t)buf_size != basket_decoder_feed(dec, buf, buf_size)) {
+		DE("[TEST] The decoder failed on the CRC32C buffer\n");
+		abort();
+	}
+
+	restored = basket_decoder_take(dec);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The decoded CRC32C basket is wrong\n");
+		abort();
+	}
+	basket_decoder_release(dec);
+
+	/* 3. A corrupted buffer is found: the last byte of the boxes, then of the key/value dump */
+	buf[header->total_len - 1] ^= 0x01;
+	if (NULL != basket_from_buf(buf, buf_size) || 0 == basket_validate_flat_buffer(buf)) {
+		DE("[TEST] A corrupted CRC32C buffer is restored\n");
+		abort();
+	}
+
+	buf[header->total_len - 1] ^= 0x01;
+	buf[buf_size - 1] ^= 0x01;
+	if (NULL != basket_from_buf(buf, buf_size)) {
+		DE("[TEST] A corrupted CRC32C key/value dump is restored\n");
+		abort();
+	}
+
+	free(buf);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Basket CRC32C checksum\n");
+}
+
+typedef struct {
+	const basket_t *basket;
+	char           *buf;
+	size_t         size;
+} basket_shared_to_buf_arg_t;
+
+/* One serializer thread: the flat buffer of the shared basket */
+static void *basket_shared_to_buf_thread(void *arg)
+{
+	basket_shared_to_buf_arg_t *_arg = arg;
+
+	_arg->buf = basket_to_buf(_arg->basket, &_arg->size);
+	return NULL;
+}
+
+/* Threads serialize the same basket at once: they fill the same box checksum caches, and get the same buffer */
+static void basket_shared_to_buf_test(void)
+{
+	pthread_t                  threads[4];
+	basket_shared_to_buf_arg_t args[4];
+	basket_t                   *basket;
+	basket_t                   *restored;
+	uint32_t                   index;
+
+	basket = basket_new();
+	if (NULL == basket || A_OK != basket_checksum_alg_set(basket, CHECKSUM_ALG_CRC32C)) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	for (index = 0; index < 16; index++) {
+		if (box_new(basket, lorem_ipsum, LOREM_IPSUM_SIZE - index) < 0) {
+			DE("[TEST] Can not add a box\n");
+			abort();
+		}
+	}
+
+	for (index = 0; index < 4; index++) {
+		args[index].basket = basket;
+		if (0 != pthread_create(&threads[index], NULL, basket_shared_to_buf_thread, &args[index])) {
+			DE("[TEST] Can not create the thread\n");
+			abort();
+		}
+	}
+
+	for (index = 0; index < 4; index++) {
+		pthread_join(threads[index], NULL);
+	}
+
+	for (index = 0; index < 4; index++) {
+		if (NULL == args[index].buf || args[index].size != args[0].size ||
+			0 != memcmp(args[index].buf, args[0].buf, args[0].size)) {
+			DE("[TEST] The buffer of the thread %u is wrong\n", index);
+			abort();
+		}
+	}
+
+	/* Every box checksum is cached now */
+	for (index = 0; index < basket->boxes_used; index++) {
+		if (NO == bx_checksum_is_valid(basket_get_box(basket, index), CHECKSUM_ALG_CRC32C)) {
+			DE("[TEST] The checksum of the box %u is not cached\n", index);
+			abort();
+		}
+	}
+
+	restored = basket_from_buf(args[0].buf, args[0].size);
+	if (NULL == restored || 0 != basket_compare_basket(basket, restored)) {
+		DE("[TEST] The restored basket is not the same\n");
+		abort();
+	}
+
+	for (index = 0; index < 4; index++) {
+		free(args[index].buf);
+	}
+
+	if (0 != basket_release(restored) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: many threads serialize the same basket\n");
+}
+
+/* Every box keeps the checksum of its data: only the changed boxes are hashed again */
+static void basket_box_checksum_test(void)
+{
+	basket_t  *basket;
+	basket_t  *restored;
+	char      *buf;
+	char      *data;
+	size_t    buf_size;
+	ssize_t   box_size;
+	box_u32_t box_index;
+
+	basket = create_alice_basket();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	/* 1. A new box has no checksum yet; the dump calculates and keeps it */
+	if (YES == bx_checksum_is_valid(basket_get_box(basket, 0), basket->checksum_alg)) {
+		DE("[TEST] A new box has a checksum\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf || 0 != basket_validate_flat_buffer(buf)) {
+		DE("[TEST] Can not dump the basket\n");
+		abort();
+	}
+	free(buf);
+
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		if (NO == bx_checksum_is_valid(basket_get_box(basket, box_index), basket->checksum_alg)) {
+			DE("[TEST] Box[%u] checksum is not kept after the dump\n", box_index);
+			abort();
+		}
+	}
+
+	/* 2. A change drops the checksum of the changed box only, for a data pointer as well */
+	if (A_OK != box_add(basket, 1, string_alice_2, strlen(string_alice_2)) ||
+		YES == bx_checksum_is_valid(basket_get_box(basket, 1), basket->checksum_alg) ||
+		NO == bx_checksum_is_valid(basket_get_box(basket, 2), basket->checksum_alg)) {
+		DE("[TEST] Box checksum is not dropped by box_add()\n");
+		abort();
+	}
+
+	data = box_data_ptr(basket, 2);
+	if (NULL == data || YES == bx_checksum_is_valid(basket_get_box(basket, 2), basket->checksum_alg)) {
+		DE("[TEST] Box checksum is not dropped by box_data_ptr()\n");
+		abort();
+	}
+	data[0] ^= 0x01;
+
+	/* 3. The changed boxes are hashed again: the buffer is valid and restored the same */
+	buf = basket_to_buf_indexed(basket, &buf_size);
+	if (NULL == buf || 0 != basket_validate_flat_buffer(buf)) {
+		DE("[TEST] The buffer of the changed basket is wrong\n");
+		abort();
+	}
+
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored)) {
+		DE("[TEST] The restored basket is wrong\n");
+		abort();
+	}
+
+	/* 4. The receiver keeps the received checksums */
+	for (box_index = 0; box_index < restored->boxes_used; box_index++) {
+		if (box_data_size(restored, box_index) > 0 &&
+			NO == bx_checksum_is_valid(basket_get_box(restored, box_index), restored->checksum_alg)) {
+			DE("[TEST] Box[%u] checksum is not kept after the restore\n", box_index);
+			abort();
+		}
+	}
+
+	if (0 != basket_release(restored)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	/* 5. Every box is tested alone: a broken box is found, the others are good */
+	data = (char *)basket_flat_box_ptr(buf, buf_size, 3, &box_size);
+	if (NULL == data || box_size <= 0 || A_OK != basket_flat_box_verify(buf, buf_size, 3)) {
+		DE("[TEST] Can not test box[3] of the indexed buffer\n");
+		abort();
+	}
+
+	data[box_size - 1] ^= 0x01;
+	if (-EINVAL != basket_flat_box_verify(buf, buf_size, 3) || A_OK != basket_flat_box_verify(buf, buf_size, 0) ||
+		0 == basket_validate_flat_buffer(buf) || NULL != basket_from_buf(buf, buf_size)) {
+		DE("[TEST] A broken box is not found\n");
+		abort();
+	}
+
+	/* 6. Without the buffer checksum the box checksums are tested anyway */
+	((basket_send_header_t *)buf)->checksum = 0;
+	((basket_send_header_t *)buf)->flags |= BASKET_HEADER_NO_CHECKSUM;
+	if (-EINVAL != basket_flat_box_verify(buf, buf_size, 3) || 0 == basket_validate_flat_buffer(buf) ||
+		NULL != basket_from_buf(buf, buf_size) || NULL != basket_view_from_buf(buf, buf_size)) {
+		DE("[TEST] A broken box is not found without the buffer checksum\n");
+		abort();
+	}
+
+	data[box_size - 1] ^= 0x01;
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] Can not restore the buffer without the checksum\n");
+		abort();
+	}
+
+	free(buf);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Box checksums kept between dumps\n");
+}
+
+/* Only the changed boxes and key/value entries are sent to the receiver which has the previous version */
+static void basket_diff_test(void)
+{
+	basket_t *old_basket;
+	basket_t *new_basket;
+	basket_t *received;
+	char     *buf;
+	char     *diff;
+	char     *diff_back;
+	size_t   buf_size;
+	size_t   diff_size;
+	size_t   diff_back_size;
+	ssize_t  val_size;
+	char     *key_1      = "Key 1";
+	char     *key_2      = "Key 2";
+	char     *key_3      = "Key 3";
+	char     *val_str    = "Value";
+
+	old_basket = create_alice_basket();
+	if (NULL == old_basket ||
+		0 != basket_keyval_add_by_str(old_basket, key_1, strlen(key_1), strdup(val_str), strlen(val_str) + 1) ||
+		0 != basket_keyval_add_by_str(old_basket, key_2, strlen(key_2), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not create the 'Alice' basket\n");
+		abort();
+	}
+
+	/* The receiver has the previous version */
+	buf = basket_to_buf(old_basket, &buf_size);
+	received = (NULL == buf) ? NULL : basket_from_buf(buf, buf_size);
+	if (NULL == received) {
+		DE("[TEST] Can not send the basket\n");
+		abort();
+	}
+	free(buf);
+
+	/* 1. The new version: a box changed, a box emptied, a box added; a value changed, a key removed, a key added */
+	new_basket = basket_clone(old_basket);
+	if (NULL == new_basket ||
+		A_OK != box_add(new_basket, 2, string_alice_1, strlen(string_alice_1)) ||
+		A_OK != box_clean(new_basket, 4) ||
+		box_new(new_basket, string_alice_3, strlen(string_alice_3)) < 0) {
+		DE("[TEST] Can not change the basket\n");
+		abort();
+	}
+
+	free(basket_keyval_extract_by_str(new_basket, key_1, strlen(key_1), &val_size));
+	free(basket_keyval_extract_by_str(new_basket, key_2, strlen(key_2), &val_size));
+	if (0 != basket_keyval_add_by_str(new_basket, key_1, strlen(key_1), strdup(string_alice_2), strlen(string_alice_2) + 1) ||
+		0 != basket_keyval_add_by_str(new_basket, key_3, strlen(key_3), strdup(val_str), strlen(val_str) + 1)) {
+		DE("[TEST] Can not change the key/value entries\n");
+		abort();
+	}
+	basket_set_ticket(new_basket, 0x1234);
+
+	/* 2. The diff is much smaller than the basket */
+	diff = basket_diff_to_buf(old_basket, new_basket, &diff_size);
+	if (NULL == diff || diff_size >= basket_flat_buf_size(new_basket)) {
+		DE("[TEST] Can not make the diff, or it is too big: %zu\n", diff_size);
+		abort();
+	}
+
+	/* 3. The receiver gets the new version */
+	if (A_OK != basket_apply_diff(received, diff, diff_size) ||
+		basket_compare_basket(received, new_basket) || 0 != zhash_cmp_zhash(received->zhash, new_basket->zhash) ||
+		0x1234 != basket_get_ticket(received)) {
+		DE("[TEST] The diff is not applied right\n");
+		abort();
+	}
+
+	/* 4. The diff is for the previous version only */
+	if (-EINVAL != basket_apply_diff(received, diff, diff_size)) {
+		DE("[TEST] The diff is applied to a wrong version\n");
+		abort();
+	}
+
+	/* 5. The way back: the added box is removed, the keys restored */
+	diff_back = basket_diff_to_buf(new_basket, old_basket, &diff_back_size);
+	if (NULL == diff_back || A_OK != basket_apply_diff(received, diff_back, diff_back_size) ||
+		basket_compare_basket(received, old_basket) || 0 != zhash_cmp_zhash(received->zhash, old_basket->zhash)) {
+		DE("[TEST] The diff back is not applied right\n");
+		abort();
+	}
+
+	/* 6. A broken diff is refused, and the basket is not changed */
+	diff[diff_size - 1] ^= 0x01;
+	if (-EINVAL != basket_apply_diff(received, diff, diff_size) || basket_compare_basket(received, old_basket)) {
+		DE("[TEST] A broken diff is applied\n");
+		abort();
+	}
+
+	free(diff);
+	free(diff_back);
+	if (0 != basket_release(received) || 0 != basket_release(new_basket) || 0 != basket_release(old_basket)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Basket diff against the previous version\n");
+}
+
+/* The boxes compressed in the flat buffer; the incompressible and the small boxes are stored as is */
+static void basket_compress_test(void)
+{
+	basket_t             *basket;
+	basket_t             *restored;
+	basket_decoder_t     *dec;
+	basket_send_header_t *header;
+	box_dump_t           *box_header;
+	box_compress_t       *box_compress[3];
+	char                 *plain_buf;
+	char                 *buf;
+	char                 text[4000];
+	char                 noise[1000];
+	size_t               plain_size;
+	size_t               buf_size;
+	size_t               buf_offset;
+	size_t               fed        = 0;
+	uint32_t             seed       = 0x12345678;
+	uint32_t             i;
+
+	/* A text repeats itself, a noise does not */
+	for (i = 0; i < sizeof(text); i++) {
+		text[i] = string_alice_2[i % strlen(string_alice_2)];
+	}
+
+	for (i = 0; i < sizeof(noise); i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		noise[i] = (char)seed;
+	}
+
+	basket = basket_new();
+	if (NULL == basket || box_new(basket, text, sizeof(text)) < 0 || box_new(basket, noise, sizeof(noise)) < 0 ||
+		box_new(basket, "tiny tiny tiny tiny", 20) < 0 ||
+		A_OK != basket_keyval_add_by_str(basket, "compressed", 10, strdup("value"), 6)) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	plain_buf = basket_to_buf(basket, &plain_size);
+	if (NULL == plain_buf || -EINVAL != basket_compress_set(basket, (size_t)UINT32_MAX + 1) ||
+		A_OK != basket_compress_set(basket, 64)) {
+		DE("[TEST] Can not set the compression\n");
+		abort();
+	}
+
+	/* 1. The text is compressed: the buffer is much smaller, and valid */
+	buf = basket_to_buf(basket, &buf_size);
+	header = (basket_send_header_t *)buf;
+	if (NULL == buf || buf_size + sizeof(text) / 2 > plain_size || BOX_COMPRESS_LZ != header->compress ||
+		0 != basket_validate_flat_buffer(buf) || basket_get_size_from_flat_buffer(buf) != buf_size) {
+		DE("[TEST] The compressed buffer is wrong: %zu bytes, the plain one is %zu bytes\n", buf_size, plain_size);
+		abort();
+	}
+
+	/* 2. The noise did not compress and is stored as is, the small box is not even tried */
+	buf_offset = sizeof(basket_send_header_t);
+	for (i = 0; i < 3; i++) {
+		box_header = (box_dump_t *)(buf + buf_offset);
+		box_compress[i] = (box_compress_t *)(buf + buf_offset + sizeof(box_dump_t));
+		buf_offset += sizeof(box_dump_t) + box_header->box_size;
+	}
+
+	if (BOX_COMPRESS_LZ != box_compress[0]->method || BOX_COMPRESS_RAW != box_compress[1]->method ||
+		BOX_COMPRESS_RAW != box_compress[2]->method || NO == bx_is_incompressible(basket_get_box(basket, 1)) ||
+		YES == bx_is_incompressible(basket_get_box(basket, 2))) {
+		DE("[TEST] The boxes are stored with a wrong method\n");
+		abort();
+	}
+
+	/* 3. Restored the same, from the buffer and from the stream */
+	restored = basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) ||
+		NO == bx_checksum_is_valid(basket_get_box(restored, 0), restored->checksum_alg) || 0 != basket_release(restored)) {
+		DE("[TEST] The basket restored from the compressed buffer is wrong\n");
+		abort();
+	}
+
+	dec = basket_decoder_new();
+	if (NULL == dec) {
+		DE("[TEST] Can not create the decoder\n");
+		abort();
+	}
+
+	while (fed < buf_size) {
+		const ssize_t consumed = basket_decoder_feed(dec, buf + fed, MIN(7, buf_size - fed));
+
+		if (consumed < 0) {
+			DE("[TEST] The decoder failed on the compressed buffer\n");
+			abort();
+		}
+		fed += consumed;
+	}
+
+	restored = basket_decoder_take(dec);
+	if (NULL == restored || basket_compare_basket(basket, restored) || 0 != basket_release(restored)) {
+		DE("[TEST] The decoded compressed basket is wrong\n");
+		abort();
+	}
+	basket_decoder_release(dec);
+
+	/* 4. The view needs the data as is */
+	if (NULL != basket_view_from_buf(buf, buf_size)) {
+		DE("[TEST] A view is created over the compressed buffer\n");
+		abort();
+	}
+
+	/* 5. A change of the data makes it worth to try again */
+	if (A_OK != box_add(basket, 1, text, 100) || YES == bx_is_incompressible(basket_get_box(basket, 1))) {
+		DE("[TEST] The box is still incompressible after a change\n");
+		abort();
+	}
+
+	/* 6. A broken compressed box is found */
+	buf[sizeof(basket_send_header_t) + sizeof(box_dump_t) + ((box_dump_t *)(buf + sizeof(basket_send_header_t)))->box_size - 1] ^= 0x01;
+	if (0 == basket_validate_flat_buffer(buf) || NULL != basket_from_buf(buf, buf_size)) {
+		DE("[TEST] A broken compressed box is not found\n");
+		abort();
+	}
+
+	free(buf);
+	free(plain_buf);
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Boxes compressed in the flat buffer\n");
+}
+
+/* Many fragments flattened: the range is merged into one box and the following boxes move down */
+static void basket_collapse_range_test(void)
+{
+	basket_t  *basket;
+	char      fragment[32];
+	char      all[100 * 16];
+	size_t    all_len    = 0;
+	size_t    range_len  = 0;
+	box_u32_t box_index;
+
+	basket = basket_new();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	for (box_index = 0; box_index < 100; box_index++) {
+		const int len = snprintf(fragment, sizeof(fragment), "fragment %03u;", box_index);
+
+		if (box_new(basket, fragment, len) < 0) {
+			DE("[TEST] Can not add box[%u]\n", box_index);
+			abort();
+		}
+
+		memcpy(all + all_len, fragment, len);
+		all_len += len;
+		if (box_index >= 10 && box_index <= 59) {
+			range_len += len;
+		}
+	}
+
+	/* 1. A wrong range is refused */
+	if (-EINVAL != basket_collapse_range(basket, 20, 10) || -EINVAL != basket_collapse_range(basket, 10, 100)) {
+		DE("[TEST] A wrong range is not refused\n");
+		abort();
+	}
+
+	/* 2. The boxes 10..59 become the box 10, the box 60 becomes the box 11 */
+	if (A_OK != basket_collapse_range(basket, 10, 59) || 51 != basket->boxes_used ||
+		(ssize_t)range_len != box_data_size(basket, 10) || 0 != memcmp(box_data_ptr(basket, 10), "fragment 010;fragment 011;", 26) ||
+		0 != memcmp(box_data_ptr(basket, 11), "fragment 060;", 13) || 0 != memcmp(box_data_ptr(basket, 9), "fragment 009;", 13)) {
+		DE("[TEST] The range is collapsed wrong\n");
+		abort();
+	}
+
+	/* 3. The whole basket collapsed: the data is in order */
+	if (A_OK != basket_collapse(basket) || (ssize_t)all_len != box_data_size(basket, 0) ||
+		0 != memcmp(box_data_ptr(basket, 0), all, all_len) || 0 != box_data_size(basket, 1)) {
+		DE("[TEST] The basket is collapsed wrong\n");
+		abort();
+	}
+
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	PR("[TEST] Success: A range of boxes collapsed with one allocation\n");
+}
+
+/* Boxes and key/value entries moved between baskets by pointer, without a data copy */
+static void basket_box_move_test(void)
+{
+	basket_t *first;
+	basket_t *second;
+	box_t    *box;
+	char     *val;
+	ssize_t  val_size;
+
+	first = basket_new();
+	second = basket_new();
+	if (NULL == first || NULL == second ||
+		box_new(first, "first 0", 7) < 0 || box_new(first, "first 1", 7) < 0 ||
+		box_new(second, "second 0", 8) < 0 || box_new(second, "second 1", 8) < 0 || box_new(second, "second 2", 8) < 0 ||
+		A_OK != basket_keyval_add_by_str(first, "common", 6, strdup("old"), 4) ||
+		A_OK != basket_keyval_add_by_str(second, "common", 6, strdup("new"), 4) ||
+		A_OK != basket_keyval_add_by_str(second, "second", 6, strdup("only"), 5)) {
+		DE("[TEST] Can not create the baskets\n");
+		abort();
+	}
+
+	/* 1. The same box object changes the basket: first = {first 0, second 1, first 1} */
+	box = basket_get_box(second, 1);
+	if (-EINVAL != box_move(second, 3, first, 0) || -EINVAL != box_move(second, 0, first, 3) ||
+		A_OK != box_move(second, 1, first, 1) || box != basket_get_box(first, 1) ||
+		3 != first->boxes_used || 2 != second->boxes_used || 0 != memcmp(box_data_ptr(second, 1), "second 2", 8)) {
+		DE("[TEST] The box is moved wrong\n");
+		abort();
+	}
+
+	/* 2. Inside of the same basket: first = {second 1, first 1, first 0} */
+	if (A_OK != box_move(first, 0, first, 2) || box != basket_get_box(first, 0) ||
+		0 != memcmp(box_data_ptr(first, 2), "first 0", 7)) {
+		DE("[TEST] The box is moved wrong inside of the basket\n");
+		abort();
+	}
+
+	/* 3. The range goes to the tail: second = {second 0, second 1, first 1} */
+	if (A_OK != basket_splice(second, first, 0, 1) || 1 != first->boxes_used || 4 != second->boxes_used ||
+		box != basket_get_box(second, 2) || 0 != memcmp(box_data_ptr(second, 3), "first 1", 7)) {
+		DE("[TEST] The range is spliced wrong\n");
+		abort();
+	}
+
+	/* 4. All of 'second' goes to 'first', the key of 'second' wins */
+	if (A_OK != basket_concat(first, second) || 5 != first->boxes_used || 0 != second->boxes_used || NULL != second->zhash ||
+		box != basket_get_box(first, 3)) {
+		DE("[TEST] The baskets are concatenated wrong\n");
+		abort();
+	}
+
+	val = basket_keyval_find_by_str(first, "common", 6, &val_size);
+	if (NULL == val || 0 != strcmp(val, "new")) {
+		DE("[TEST] The key of the second basket is lost\n");
+		abort();
+	}
+
+	val = basket_keyval_find_by_str(first, "second", 6, &val_size);
+	if (NULL == val || 0 != strcmp(val, "only")) {
+		DE("[TEST] The key of the second basket is not moved\n");
+		abort();
+	}
+
+	if (0 != basket_release(second) || 0 != basket_release(first)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Boxes moved between baskets without a copy\n");
+}
+
+/* The box pointers array grows geometrically, or once when reserved */
+static void basket_reserve_boxes_test(void)
+{
+	basket_t    *basket;
+	basket_t    *restored;
+	char        *buf;
+	size_t      buf_size;
+	num_boxes_t allocated;
+	uint32_t    grows     = 0;
+	box_u32_t   box_index;
+
+	/* 1. Adding 200 boxes one by one: a few reallocations, not one per box */
+	basket = basket_new();
+	if (NULL == basket) {
+		DE("[TEST] Can not create the basket\n");
+		abort();
+	}
+
+	for (box_index = 0; box_index < 200; box_index++) {
+		allocated = basket->boxes_allocated;
+		if (box_new(basket, "box", 3) < 0) {
+			DE("[TEST] Can not add box[%u]\n", box_index);
+			abort();
+		}
+
+		if (allocated != basket->boxes_allocated) {
+			grows++;
+		}
+	}
+
+	if (grows > 6) {
+		DE("[TEST] The box pointers are reallocated %u times for 200 boxes\n", grows);
+		abort();
+	}
+
+	/* 2. The restored basket allocates exactly as many as it has */
+	buf = basket_to_buf(basket, &buf_size);
+	restored = (NULL == buf) ? NULL : basket_from_buf(buf, buf_size);
+	if (NULL == restored || basket_compare_basket(basket, restored) || restored->boxes_allocated != restored->boxes_used) {
+		DE("[TEST] The box pointers of the restored basket are wrong\n");
+		abort();
+	}
+
+	free(buf);
+	if (0 != basket_release(restored) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	/* 3. Reserved: no reallocation at all; too many is refused */
+	basket = basket_new();
+	if (NULL == basket || A_OK != basket_reserve_boxes(basket, 100) || 100 != basket->boxes_allocated ||
+		-EINVAL != basket_reserve_boxes(basket, (size_t)MAX_VAL_NUM_BOXES_TYPE + 1)) {
+		DE("[TEST] Can not reserve the boxes\n");
+		abort();
+	}
+
+	for (box_index = 0; box_index < 100; box_index++) {
+		if (box_new(basket, "box", 3) < 0 || 100 != basket->boxes_allocated) {
+			DE("[TEST] The reserved box pointers are reallocated\n");
+			abort();
+		}
+	}
+
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	/* 4. Reserved, no box added, cleaned: basket_clean() frees the basket too */
+	basket = basket_new();
+	if (NULL == basket || A_OK != basket_reserve_boxes(basket, 4) || 0 != basket->boxes_used || 0 != basket_clean(basket)) {
+		DE("[TEST] Can not clean the basket with reserved boxes\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Box pointers grow geometrically and can be reserved\n");
+}
+
+/* This is an internal function: compare the cached sizes of the basket with the sizes counted box by box */
+static void basket_sizes_check(const basket_t *basket, const char *step)
+{
+	size_t      data_used = 0;
+	size_t      data_room = 0;
+	num_boxes_t nonempty  = 0;
+	box_u32_t   box_index;
+	char        *buf;
+	size_t      buf_size;
+
+	for (box_index = 0; box_index < basket->boxes_used; box_index++) {
+		const box_t *box = basket_get_box(basket, box_index);
+
+		data_used += bx_used_take(box);
+		data_room += bx_room_take(box) + bx_headroom_take(box);
+		if (bx_used_take(box) > 0) {
+			nonempty++;
+		}
+	}
+
+	if (data_used != basket_data_size(basket) || nonempty != basket->boxes_nonempty ||
+		sizeof(basket_t) + basket->boxes_allocated * sizeof(void *) + basket->boxes_used * sizeof(box_t) + data_room !=
+		basket_memory_size(basket)) {
+		DE("[TEST] %s: wrong sizes: data %zu / %zu, not empty boxes %u / %u\n", step,
+		   basket_data_size(basket), data_used, (uint32_t)basket->boxes_nonempty, (uint32_t)nonempty);
+		abort();
+	}
+
+	/* Without the compression the size is exact */
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf || buf_size != basket_flat_buf_size(basket)) {
+		DE("[TEST] %s: wrong flat buffer size: %zu, calculated %zu\n", step, buf_size, basket_flat_buf_size(basket));
+		abort();
+	}
+
+	free(buf);
+}
+
+/* The basket sizes are counted on every change, not box by box */
+static void basket_sizes_test(void)
+{
+	basket_t  *basket;
+	basket_t  *other;
+	basket_t  *restored;
+	char      *buf;
+	size_t    buf_size;
+	ssize_t   val_size;
+	box_u32_t box_index;
+
+	basket = basket_new();
+	other = basket_new();
+	if (NULL == basket || NULL == other) {
+		DE("[TEST] Can not create the baskets\n");
+		abort();
+	}
+
+	/* 1. New boxes, some of them empty */
+	for (box_index = 0; box_index < 20; box_index++) {
+		if (box_new(basket, (box_index % 3) ? lorem_ipsum : NULL, (box_index % 3) ? box_index * 10 : 0) < 0) {
+			DE("[TEST] Can not add box[%u]\n", box_index);
+			abort();
+		}
+	}
+	basket_sizes_check(basket, "box_new");
+
+	/* 2. The boxes changed */
+	if (A_OK != box_add(basket, 0, "added", 5) || A_OK != box_data_replace(basket, 1, "replaced", 8) ||
+		A_OK != box_headroom_reserve(basket, 3, 32) || A_OK != box_prepend(basket, 3, "head", 4) ||
+		A_OK != box_clean(basket, 4) || A_OK != box_data_free(basket, 5) || A_OK != box_merge_box(basket, 7, 8)) {
+		DE("[TEST] Can not change the boxes\n");
+		abort();
+	}
+	free(box_steal_data(basket, 10));
+	basket_sizes_check(basket, "box change");
+
+	/* 3. The key/value entries */
+	if (A_OK != basket_keyval_add_by_str(basket, "first", 5, strdup("value 1"), 8) ||
+		A_OK != basket_keyval_add_by_str(basket, "second", 6, strdup("value 22"), 9) ||
+		A_OK != basket_keyval_add_by_str(other, "third", 5, strdup("value 333"), 10)) {
+		DE("[TEST] Can not add the key/value entries\n");
+		abort();
+	}
+	free(basket_keyval_extract_by_str(basket, "first", 5, &val_size));
+	basket_sizes_check(basket, "key/value");
+
+	/* 4. Boxes moved between baskets */
+	if (box_new(other, "other 0", 7) < 0 || box_new(other, "other 1", 7) < 0 || box_new(other, NULL, 0) < 0 ||
+		A_OK != box_move(basket, 2, other, 1) || A_OK != basket_splice(other, basket, 11, 13)) {
+		DE("[TEST] Can not move the boxes\n");
+		abort();
+	}
+	basket_sizes_check(basket, "box move, source");
+	basket_sizes_check(other, "box move, destination");
+
+	if (A_OK != basket_concat(basket, other)) {
+		DE("[TEST] Can not concatenate the baskets\n");
+		abort();
+	}
+	basket_sizes_check(basket, "concat");
+	basket_sizes_check(other, "concat, source");
+
+	/* 5. Collapsed */
+	if (A_OK != basket_collapse_range(basket, 2, 6)) {
+		DE("[TEST] Can not collapse the range\n");
+		abort();
+	}
+	basket_sizes_check(basket, "collapse range");
+
+	/* 6. Restored from the flat buffer */
+	buf = basket_to_buf(basket, &buf_size);
+	restored = (NULL == buf) ? NULL : basket_from_buf(buf, buf_size);
+	if (NULL == restored) {
+		DE("[TEST] Can not restore the basket\n");
+		abort();
+	}
+	basket_sizes_check(restored, "from buf");
+	free(buf);
+
+	if (A_OK != basket_collapse(basket)) {
+		DE("[TEST] Can not collapse the basket\n");
+		abort();
+	}
+	basket_sizes_check(basket, "collapse");
+
+	if (0 != basket_release(restored) || 0 != basket_release(other) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not release the baskets\n");
+		abort();
+	}
+
+	PR("[TEST] Success: The basket sizes are counted on every change\n");
+}
+
+/* Many small baskets packed into one frame, opened as views */
+static void basket_batch_test(void)
+{
+	basket_t       *baskets[40];
+	basket_t       *basket;
+	basket_batch_t *batch;
+	char           *buf;
+	size_t         buf_size;
+	size_t         offset   = 0;
+	size_t         second;
+	uint32_t       entry_size;
+	uint32_t       index;
+	ret_t          rc;
+
+	batch = basket_batch_new();
+	if (NULL == batch) {
+		DE("[TEST] Can not create the batch\n");
+		abort();
+	}
+
+	/* 1. Small baskets, some with key/value entries, one compressed */
+	for (index = 0; index < 40; index++) {
+		baskets[index] = basket_new();
+		if (NULL == baskets[index] || box_new(baskets[index], lorem_ipsum, 10 + index) < 0 ||
+			box_new(baskets[index], lorem_ipsum + index, 20) < 0 ||
+			(0 == index % 5 && A_OK != basket_keyval_add_by_str(baskets[index], "index", 5, strdup("value"), 6)) ||
+			A_OK != basket_batch_add(batch, baskets[index])) {
+			DE("[TEST] Can not create basket[%u]\n", index);
+			abort();
+		}
+		basket_set_ticket(baskets[index], index);
+	}
+
+	if (A_OK != basket_compress_set(baskets[7], 16) || box_new(baskets[7], lorem_ipsum, LOREM_IPSUM_SIZE) < 0) {
+		DE("[TEST] Can not compress the basket\n");
+		abort();
+	}
+
+	buf = basket_batch_to_buf(batch, &buf_size);
+	if (NULL == buf || A_OK != basket_batch_validate(buf, buf_size)) {
+		DE("[TEST] Can not pack the batch\n");
+		abort();
+	}
+
+	/* 2. Every basket is restored in order */
+	for (index = 0; NULL != (basket = basket_batch_iter(buf, buf_size, &offset, &rc)); index++) {
+		if (index >= 40 || basket_compare_basket(baskets[index], basket) || index != basket_get_ticket(basket) ||
+			(7 != index && YES != basket_is_view(basket))) {
+			DE("[TEST] Basket[%u] of the batch is wrong\n", index);
+			abort();
+		}
+
+		if (0 != basket_release(basket)) {
+			DE("[TEST] Can not release the basket\n");
+			abort();
+		}
+	}
+
+	if (40 != index || offset != buf_size || A_OK != rc) {
+		DE("[TEST] Got %u baskets from the batch\n", index);
+		abort();
+	}
+
+	/* 3. A malformed basket is an error, not the end of the frame; the offset stays on it */
+	offset = 0;
+	basket = basket_batch_iter(buf, buf_size, &offset, &rc);
+	if (NULL == basket || A_OK != rc || 0 != basket_release(basket)) {
+		DE("[TEST] Can not open the first basket\n");
+		abort();
+	}
+
+	second = offset;
+	memcpy(&entry_size, buf + second, sizeof(uint32_t));
+	buf[second + sizeof(uint32_t)] ^= 0xFF;
+	if (NULL != basket_batch_iter(buf, buf_size, &offset, &rc) || -EINVAL != rc || second != offset) {
+		DE("[TEST] A basket with a broken header is opened\n");
+		abort();
+	}
+
+	buf[second + sizeof(uint32_t)] ^= 0xFF;
+	memset(buf + second, 0xFF, sizeof(uint32_t));
+	if (NULL != basket_batch_iter(buf, buf_size, &offset, &rc) || -EINVAL != rc || second != offset) {
+		DE("[TEST] A basket with a broken size is opened\n");
+		abort();
+	}
+
+	memcpy(buf + second, &entry_size, sizeof(uint32_t));
+	if (A_OK != basket_batch_validate(buf, buf_size)) {
+		DE("[TEST] The restored batch is refused\n");
+		abort();
+	}
+
+	/* 4. A broken basket header is found by the frame checksum */
+	buf[sizeof(basket_batch_header_t) + sizeof(uint32_t) + offsetof(basket_send_header_t, ticket)] ^= 1;
+	if (-EINVAL != basket_batch_validate(buf, buf_size) || -EINVAL != basket_batch_validate(buf, buf_size - 1)) {
+		DE("[TEST] The broken batch is accepted\n");
+		abort();
+	}
+
+	/* 5. The box data is out of the frame checksum: a broken box is found by its own checksum */
+	buf[sizeof(basket_batch_header_t) + sizeof(uint32_t) + offsetof(basket_send_header_t, ticket)] ^= 1;
+	for (offset = second + sizeof(uint32_t); offset + 20 <= second + sizeof(uint32_t) + entry_size; offset++) {
+		if (0 == memcmp(buf + offset, lorem_ipsum + 1, 20)) {
+			break;
+		}
+	}
+
+	buf[offset] ^= 1;
+	if (offset + 20 > second + sizeof(uint32_t) + entry_size || -EINVAL != basket_batch_validate(buf, buf_size)) {
+		DE("[TEST] The batch with a broken box is accepted\n");
+		abort();
+	}
+
+	buf[offset] ^= 1;
+	if (A_OK != basket_batch_validate(buf, buf_size)) {
+		DE("[TEST] The restored batch is refused\n");
+		abort();
+	}
+
+	free(buf);
+	for (index = 0; index < 40; index++) {
+		if (0 != basket_release(baskets[index])) {
+			DE("[TEST] Can not release the basket\n");
+			abort();
+		}
+	}
+
+	if (A_OK != basket_batch_release(batch)) {
+		DE("[TEST] Can not release the batch\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Many baskets packed into one frame\n");
+}
+
+/* This is an internal function: a basket with the ticket, the data depends on the ticket */
+static basket_t *basket_log_test_basket(const ticket_t ticket)
+{
+	basket_t *basket = basket_new();
+
+	if (NULL == basket || box_new(basket, lorem_ipsum + ticket % 100, 10 + ticket % 300) < 0 ||
+		box_new(basket, &ticket, sizeof(ticket_t)) < 0) {
+		DE("[TEST] Can not create the basket %u\n", (uint32_t)ticket);
+		abort();
+	}
+
+	basket_set_ticket(basket, ticket);
+	return basket;
+}
+
+/* This is an internal function: test the basket of the log */
+static void basket_log_test_check(const basket_t *basket, ticket_t ticket)
+{
+	if (NULL == basket || (ticket_t)basket_get_ticket((void *)basket) != ticket ||
+		(size_t)box_data_size(basket, 0) != 10 + ticket % 300 ||
+		0 != memcmp(box_data_ptr_const(basket, 0), lorem_ipsum + ticket % 100, 10 + ticket % 300) ||
+		0 != memcmp(box_data_ptr_const(basket, 1), &ticket, sizeof(ticket_t))) {
+		DE("[TEST] The basket %u of the log is wrong\n", (uint32_t)ticket);
+		abort();
+	}
+}
+
+typedef struct {
+	basket_log_t *log;
+	ticket_t     first;
+} basket_log_test_arg_t;
+
+/* One appender thread: 200 baskets with tickets first, first + 1, ... */
+static void *basket_log_test_appender(void *arg)
+{
+	const basket_log_test_arg_t *_arg = arg;
+	ticket_t                    ticket;
+
+	for (ticket = _arg->first; ticket < _arg->first + 200; ticket++) {
+		basket_t *basket = basket_log_test_basket(ticket);
+
+		if (A_OK != basket_log_append(_arg->log, basket) || 0 != basket_release(basket)) {
+			DE("[TEST] Can not append the basket %u\n", (uint32_t)ticket);
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+/* Baskets appended by threads into the segmented log, read back as views, sought by ticket */
+static void basket_log_test(void)
+{
+	char                        dir[]         = "/tmp/basket_log_test_XXXXXX";
+	pthread_t                   threads[4];
+	basket_log_test_arg_t       args[4];
+	ticket_t                    next[4]       = {0};
+	basket_log_t                *log;
+	basket_log_t                *log_reader;
+	basket_log_reader_t         *reader;
+	basket_t                    *basket;
+	DIR                         *dir_p;
+	struct dirent               *entry;
+	basket_log_segment_header_t *header;
+	uint32_t                    segments_num;
+	uint32_t                    index;
+	uint32_t                    count         = 0;
+
+	if (NULL == mkdtemp(dir)) {
+		DE("[TEST] Can not create the log directory\n");
+		abort();
+	}
+
+	/* Small segments: the log goes over many of them */
+	log = basket_log_open(dir, 16 * 1024, BASKET_LOG_WRITE);
+	if (NULL == log || NULL != basket_log_open(dir, 16 * 1024, BASKET_LOG_WRITE)) {
+		DE("[TEST] Can not open the log, or it is opened twice\n");
+		abort();
+	}
+
+	/* 1. Four appenders at once, the tickets of every one go up */
+	for (index = 0; index < 4; index++) {
+		args[index].log = log;
+		args[index].first = 1000 * (index + 1);
+		if (0 != pthread_create(&threads[index], NULL, basket_log_test_appender, &args[index])) {
+			DE("[TEST] Can not create the thread\n");
+			abort();
+		}
+	}
+
+	for (index = 0; index < 4; index++) {
+		pthread_join(threads[index], NULL);
+	}
+
+	if (log->segments_num < 4) {
+		DE("[TEST] The log has %u segments only\n", log->segments_num);
+		abort();
+	}
+
+	/* 2. Every basket is there, in the order of its appender */
+	reader = basket_log_reader_new(log);
+	while (NULL != (basket = basket_log_next(reader))) {
+		const ticket_t ticket = basket_get_ticket(basket);
+		const uint32_t thread = ticket / 1000 - 1;
+
+		if (YES != basket_is_view(basket) || thread >= 4 || ticket != args[thread].first + next[thread]) {
+			DE("[TEST] Wrong basket %u in the log\n", (uint32_t)ticket);
+			abort();
+		}
+
+		basket_log_test_check(basket, ticket);
+		next[thread]++;
+		count++;
+		if (0 != basket_release(basket)) {
+			DE("[TEST] Can not release the basket\n");
+			abort();
+		}
+	}
+
+	if (800 != count) {
+		DE("[TEST] Got %u baskets from the log\n", count);
+		abort();
+	}
+
+	/* 3. The tailing reader gets a new basket */
+	basket = basket_log_test_basket(7);
+	if (A_OK != basket_log_append(log, basket) || 0 != basket_release(basket)) {
+		DE("[TEST] Can not append the basket\n");
+		abort();
+	}
+
+	basket = basket_log_next(reader);
+	basket_log_test_check(basket, 7);
+	if (0 != basket_release(basket) || NULL != basket_log_next(reader)) {
+		DE("[TEST] The tailing reader is wrong\n");
+		abort();
+	}
+	basket_log_reader_release(reader);
+
+	/* 4. Another handle, as another process would open it: the seek by ticket */
+	log_reader = basket_log_open(dir, 0, 0);
+	reader = (NULL == log_reader) ? NULL : basket_log_reader_new(log_reader);
+	if (NULL == reader) {
+		DE("[TEST] Can not open the log to read\n");
+		abort();
+	}
+
+	for (index = 0; index < 4; index++) {
+		const ticket_t ticket = args[index].first + 150;
+
+		if (A_OK != basket_log_seek(reader, ticket)) {
+			DE("[TEST] Can not seek ticket %u\n", (uint32_t)ticket);
+			abort();
+		}
+
+		/* The first basket with the ticket >= asked in the log order */
+		basket = basket_log_next(reader);
+		if (NULL == basket || basket_get_ticket(basket) < ticket) {
+			DE("[TEST] The seek of ticket %u is wrong\n", (uint32_t)ticket);
+			abort();
+		}
+
+		if (0 != basket_release(basket)) {
+			DE("[TEST] Can not release the basket\n");
+			abort();
+		}
+	}
+
+	/* Ticket 4199 goes after all others of the fourth appender; 5000 is not there */
+	if (A_OK != basket_log_seek(reader, 4199)) {
+		DE("[TEST] Can not seek\n");
+		abort();
+	}
+
+	basket = basket_log_next(reader);
+	basket_log_test_check(basket, 4199);
+	if (0 != basket_release(basket) || A_OK != basket_log_seek(reader, 5000) || NULL != basket_log_next(reader)) {
+		DE("[TEST] The seek is wrong\n");
+		abort();
+	}
+
+	basket_log_reader_release(reader);
+	if (A_OK != basket_log_close(log_reader) || A_OK != basket_log_sync(log) || A_OK != basket_log_close(log)) {
+		DE("[TEST] Can not close the log\n");
+		abort();
+	}
+
+	/* 5. A crashed writer: a full segment left not sealed, the last one sealed before the next segment appeared */
+	log = basket_log_open(dir, 16 * 1024, BASKET_LOG_WRITE);
+	if (NULL == log || log->segments_num < 4) {
+		DE("[TEST] Can not open the log again\n");
+		abort();
+	}
+
+	((basket_log_segment_header_t *)log->segments[1]->mem)->sealed_len = 0;
+	header = (basket_log_segment_header_t *)log->segments[log->segments_num - 1]->mem;
+	header->sealed_len = header->committed;
+	segments_num = log->segments_num;
+
+	/* Reopened: the segment is sealed again, the next append goes to a new segment */
+	basket = basket_log_test_basket(9);
+	if (A_OK != basket_log_close(log) || NULL == (log = basket_log_open(dir, 16 * 1024, BASKET_LOG_WRITE)) ||
+		A_OK != basket_log_append(log, basket) || 0 != basket_release(basket) || segments_num + 1 != log->segments_num) {
+		DE("[TEST] Can not append after the crash\n");
+		abort();
+	}
+
+	reader = basket_log_reader_new(log);
+	if (NULL == reader) {
+		DE("[TEST] Can not create the reader\n");
+		abort();
+	}
+
+	for (count = 0; NULL != (basket = basket_log_next(reader)); count++) {
+		if (802 == count + 1) {
+			basket_log_test_check(basket, 9);
+		}
+
+		if (0 != basket_release(basket)) {
+			DE("[TEST] Can not release the basket\n");
+			abort();
+		}
+	}
+
+	basket_log_reader_release(reader);
+	if (802 != count || A_OK != basket_log_close(log)) {
+		DE("[TEST] Got %u baskets from the repaired log\n", count);
+		abort();
+	}
+
+	dir_p = opendir(dir);
+	while (dir_p && NULL != (entry = readdir(dir_p))) {
+		char path[sizeof(dir) + 256];
+
+		if ('.' != entry->d_name[0]) {
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+	}
+
+	if (dir_p) {
+		closedir(dir_p);
+	}
+	rmdir(dir);
+
+	PR("[TEST] Success: Baskets appended by threads into the log and read back as views\n");
+}
+
+/* Restore and verify a big flat buffer on the pool: the same as the serial restore */
+static void basket_par_test_one(basket_t *basket, basket_pool_t *pool)
+{
+	basket_t *restored;
+	char     *buf;
+	size_t   buf_size;
+
+	buf = basket_to_buf(basket, &buf_size);
+	if (NULL == buf || buf_size < BASKET_PAR_MIN_SIZE) {
+		DE("[TEST] Can not create the flat buffer\n");
+		abort();
+	}
+
+	restored = basket_from_buf_par(buf, buf_size, pool);
+	if (NULL == restored || basket_compare_basket(basket, restored) ||
+		basket_get_ticket(basket) != basket_get_ticket(restored) ||
+		basket_data_size(basket) != basket_data_size(restored)) {
+		DE("[TEST] The basket restored on the pool is wrong\n");
+		abort();
+	}
+
+	if (0 != basket_release(restored) || A_OK != basket_flat_verify_par(buf, buf_size, pool) ||
+		A_OK != basket_flat_verify_par(buf, 0, NULL)) {
+		DE("[TEST] The valid flat buffer is not verified\n");
+		abort();
+	}
+
+	/* A broken byte of the box data is found by the box checksum */
+	buf[buf_size / 2] ^= 0x5A;
+	if (NULL != basket_from_buf_par(buf, buf_size, pool) || -EINVAL != basket_flat_verify_par(buf, buf_size, pool)) {
+		DE("[TEST] The broken flat buffer is not found\n");
+		abort();
+	}
+
+	free(buf);
+}
+
+static void basket_par_test(void)
+{
+	basket_pool_t *pool;
+	basket_t      *basket;
+	basket_t      *restored;
+	char          *data;
+	char          *buf;
+	size_t        buf_size;
+	uint32_t      index;
+
+	pool = basket_pool_new(4);
+	data = malloc(MAX_VAL_BOX_TYPE);
+	basket = basket_new();
+	if (NULL == pool || NULL == data || NULL == basket) {
+		DE("[TEST] Can not create the pool\n");
+		abort();
+	}
+
+	/* 1. Boxes of different sizes, some empty, with key/value entries; the flat buffer must fit into its 'total_len' */
+	for (index = 0; index < 200; index++) {
+		const size_t size = (0 == index % 17) ? 0 : 10 + (index * 97) % (MAX_VAL_BOX_TYPE / 400);
+		size_t       offset;
+
+		for (offset = 0; offset < size; offset++) {
+			data[offset] = lorem_ipsum[(offset + index) % LOREM_IPSUM_SIZE];
+		}
+
+		if (box_new(basket, (0 == size) ? NULL : data, size) < 0) {
+			DE("[TEST] Can not add box[%u]\n", index);
+			abort();
+		}
+	}
+
+	if (A_OK != basket_keyval_add_by_str(basket, "pool", 4, strdup("threads"), 8)) {
+		DE("[TEST] Can not add the key/value entry\n");
+		abort();
+	}
+
+	basket_set_ticket(basket, 50);
+	basket_par_test_one(basket, pool);
+
+	/* 2. The same, compressed */
+	if (A_OK != basket_compress_set(basket, 16)) {
+		DE("[TEST] Can not compress the basket\n");
+		abort();
+	}
+
+	basket_par_test_one(basket, pool);
+
+	/* 3. A small buffer is restored on the calling thread */
+	if (0 != basket_release(basket)) {
+		DE("[TEST] Can not release the basket\n");
+		abort();
+	}
+
+	basket = basket_new();
+	if (NULL == basket || box_new(basket, lorem_ipsum, LOREM_IPSUM_SIZE) < 0) {
+		DE("[TEST] Can not create the small basket\n");
+		abort();
+	}
+
+	buf = basket_to_buf(basket, &buf_size);
+	restored = (NULL == buf) ? NULL : basket_from_buf_par(buf, 0, pool);
+	if (NULL == restored || basket_compare_basket(basket, restored) || A_OK != basket_flat_verify_par(buf, buf_size, pool)) {
+		DE("[TEST] The small basket is wrong\n");
+		abort();
+	}
+
+	free(buf);
+	free(data);
+	if (0 != basket_release(restored) || 0 != basket_release(basket) || A_OK != basket_pool_release(pool)) {
+		DE("[TEST] Can not release\n");
+		abort();
+	}
+
+	PR("[TEST] Success: Baskets restored and verified on the thread pool\n");
+}
+
 int main(void)
 {
 	PR("\nSECTION 1: ZHASH\n");
@@ -1027,5 +4092,36 @@ int main(void)
 	PR("\nSECTION 5: BASKET, KEY/VALUE\n");
 	basket_test_keyval();
 
+	PR("\nSECTION 6: BOX, ZERO COPY\n");
+	box_adopt_test();
+	basket_clone_test();
+	box_prepend_test();
+	box_ring_test();
+	box_rec_test();
+
+	PR("\nSECTION 7: BASKET, FLAT BUFFER\n");
+	basket_to_buf_into_test();
+	basket_view_test();
+	basket_iovec_test();
+	basket_decoder_test();
+	basket_encoder_test();
+	basket_v2_test();
+	basket_flat_index_test();
+	basket_aligned_test();
+	basket_broken_zhash_test();
+	basket_copy_checksum_test();
+	basket_crc32c_test();
+	basket_shared_to_buf_test();
+	basket_box_checksum_test();
+	basket_diff_test();
+	basket_compress_test();
+	basket_collapse_range_test();
+	basket_box_move_test();
+	basket_reserve_boxes_test();
+	basket_sizes_test();
+	basket_batch_test();
+	basket_log_test();
+	basket_par_test();
+
 	return 0;
 }
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <errno.h>
 
 #include "debug.h"
 #include "tests.h"
@@ -67,6 +68,7 @@ static ztable_t *zcreate_hash_table_with_size(const size_t size_index)
 
 	hash_table->size_index = size_index;
 	hash_table->entry_count = 0;
+	hash_table->dump_size = 0;
 	hash_table->entries = zcalloc(hash_sizes[size_index], sizeof(void *));
 	if (NULL == hash_table->entries) {
 		DE("Could not allocate %zu entries\n", hash_sizes[size_index]);
@@ -238,6 +240,13 @@ static void zentry_t_release(zentry_t *entry, const bool recursive, const int8_t
 	zfree(entry);
 }
 
+/* This is an internal function: the size of the entry in the flat buffer */
+__attribute__((warn_unused_result, pure, nonnull(1)))
+static size_t zentry_dump_size(const zentry_t *entry)
+{
+	return sizeof(zhash_entry_t) + entry->Key.key_str_len + entry->Val.val_size;
+}
+
 /* Internal generic insert. Except all values for an entry. ALways insert by ineger key */
 /**
  * @author Sebastian Mountaniol (8/1/22)
@@ -284,6 +293,7 @@ static int8_t zhash_insert(ztable_t *hash_table,
 	entry->next = hash_table->entries[hash];
 	hash_table->entries[hash] = entry;
 	hash_table->entry_count++;
+	hash_table->dump_size += zentry_dump_size(entry);
 
 	size = hash_sizes[hash_table->size_index];
 
@@ -473,6 +483,7 @@ void *zhash_extract_by_int(ztable_t *hash_table, const uint64_t key_int64, ssize
 
 	val = entry->Val.val;
 	*out_size = entry->Val.val_size;
+	hash_table->dump_size -= zentry_dump_size(entry);
 	zentry_t_release(entry, false, 0);
 	hash_table->entry_count--;
 
@@ -530,8 +541,10 @@ zentry_t *zhash_list(const ztable_t *hash_table, size_t *index, const zentry_t *
 		return entry->next;
 	}
 
-	/* No more entried in the linked list, advance index */
-	(*index)++;
+	/* No more entried in the linked list, advance index; the first call (no entry yet) starts from the index itself */
+	if (NULL != entry) {
+		(*index)++;
+	}
 
 	/* Test all entries, until a filled index found in the array */
 	while (*index < size) {
@@ -547,72 +560,109 @@ zentry_t *zhash_list(const ztable_t *hash_table, size_t *index, const zentry_t *
 }
 
 /*** ADDITION: ZHASH TO BUF / BUF TO ZHASH ***/
-__attribute__((warn_unused_result, pure, nonnull(1)))
-size_t zhash_to_buf_allocation_size(const ztable_t *hash_table)
+
+/* This is an internal function: the checksum of the dump header, the fields after 'checksum'; -1 if the algorithm is unknown */
+__attribute__((warn_unused_result, nonnull(1, 2)))
+static int8_t zhash_header_checksum(const zhash_header_t *zheader, uint32_t *sum)
 {
-	/* We need one header for the whole buffer */
-	size_t       size           = sizeof(zhash_header_t);
-	size_t       index;
-	const size_t num_of_entryes = hash_sizes[hash_table->size_index];
+	checksum_stream_t checksum;
 
-	/* Per entry we need entry header */
+	if (0 != checksum_stream_init_alg(&checksum, zheader->checksum_alg)) {
+		return -1;
+	}
 
-	/* Now run on all entries and count data size */
-	for (index = 0; index < num_of_entryes; index++) {
-		zentry_t *entry = hash_table->entries[index];
-		/* Is there an entry? Return it */
-		while (entry) {
-			size += sizeof(zhash_entry_t);
-			size += entry->Key.key_str_len;
-			size += entry->Val.val_size;
-			entry = entry->next;
-		}
+	checksum_stream_update(&checksum, (const char *)zheader + offsetof(zhash_header_t, entry_count),
+						   sizeof(zhash_header_t) - offsetof(zhash_header_t, entry_count));
+	*sum = checksum_stream_final_32(&checksum);
+	return 0;
+}
+
+/* This is an internal function: the checksum of the dumped entry: the fields after 'checksum', the string key and the value; the algorithm is tested by the caller */
+__attribute__((warn_unused_result, nonnull(1)))
+static uint32_t zhash_entry_checksum(const zhash_entry_t *zentry, const uint8_t checksum_alg, const char *key_str, const void *val)
+{
+	checksum_stream_t checksum;
+
+	if (0 != checksum_stream_init_alg(&checksum, checksum_alg)) {
+		abort();
+	}
+
+	checksum_stream_update(&checksum, (const char *)zentry + offsetof(zhash_entry_t, key_int64),
+						   sizeof(zhash_entry_t) - offsetof(zhash_entry_t, key_int64));
+	if (key_str) {
+		checksum_stream_update(&checksum, key_str, zentry->key_str_len);
+	}
+	if (val) {
+		checksum_stream_update(&checksum, val, zentry->val_size);
 	}
 
-	return size;
+	return checksum_stream_final_32(&checksum);
+}
+__attribute__((warn_unused_result, pure, nonnull(1)))
+size_t zhash_to_buf_allocation_size(const ztable_t *hash_table)
+{
+	/* We need one header for the whole buffer; the entry sizes are counted on insert / extract */
+	return sizeof(zhash_header_t) + hash_table->dump_size;
 }
 
 __attribute__((warn_unused_result))
 void *zhash_to_buf(const ztable_t *hash_table, size_t *size)
 {
-	size_t         index;
-	size_t         num_of_entryes;
-	size_t         offset         = 0;
-	zhash_header_t *zheader;
+	char   *buf;
+	size_t written = 0;
 
-	char           *buf;
 	DDD("Start\n");
 	*size = zhash_to_buf_allocation_size(hash_table);
 	DDD("Calculated size: %zu\n", *size);
 
+	/* No need to clean the buffer: every byte of it is written */
 	buf = malloc(*size);
-	memset(buf, 0, *size);
+	TESTP(buf, NULL);
+
+	if (0 != zhash_to_buf_into(hash_table, buf, *size, &written, CHECKSUM_ALG_FNV1A)) {
+		DE("Could not dump zhash into the buffer\n");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+__attribute__((warn_unused_result, nonnull(1, 2, 4)))
+int8_t zhash_to_buf_into(const ztable_t *hash_table, char *buf, const size_t buf_size, size_t *written, const uint8_t checksum_alg)
+{
+	size_t         index;
+	size_t         num_of_entryes;
+	size_t         offset         = 0;
+	zhash_header_t *zheader;
+	uint32_t       sum;
+
+	if (buf_size < sizeof(zhash_header_t)) {
+		*written = zhash_to_buf_allocation_size(hash_table);
+		return -ENOSPC;
+	}
+
 	zheader = (zhash_header_t *)buf;
 	zheader->entry_count = hash_table->entry_count;
 	zheader->watemark = ZHASH_WATERMARK;
-	zheader->checksum = 0;
+	zheader->checksum_alg = checksum_alg;
+	if (0 != zhash_header_checksum(zheader, &sum)) {
+		DE("Unknown checksum algorithm %u\n", checksum_alg);
+		return -EINVAL;
+	}
+	zheader->checksum = sum;
 
 	offset += sizeof(zhash_header_t);
 
 	num_of_entryes = hash_sizes[hash_table->size_index];
 
-	/* Now run on all entries and count data size */
-	//for (index = 0; index < *size; index++) {
+	/* Now run on all entries and dump them, one pass */
 	for (index = 0; index < num_of_entryes; index++) {
 		zentry_t *entry = hash_table->entries[index];
 		DDD("Entry by index %zu of %zu\n", index, num_of_entryes);
 		/* Is there an entry? Return it */
 		while (entry) {
-			/* Advance the pointer */
-			zhash_entry_t  *zentry = (zhash_entry_t *)(buf + offset);
-			zentry->watemark = ZENTRY_WATERMARK;
-			zentry->checksum = 0;
-			zentry->key_str_len = entry->Key.key_str_len;
-			zentry->key_int64 = entry->Key.key_int64;
-			zentry->val_size = entry->Val.val_size;
-
-			/* Now, dump the string key (if any) and val (if any) */
-			offset += sizeof(zhash_entry_t);
+			zhash_entry_t  *zentry;
 
 			if (entry->Key.key_str && (0 == entry->Key.key_str_len)) {
 				DE("Wrong: entry->Key.key_str != NULL but entry->Key.key_str_len = 0\n");
@@ -624,6 +674,23 @@ void *zhash_to_buf(const ztable_t *hash_table, size_t *size)
 				abort();
 			}
 
+			/* The buffer is too small: tell the caller how much is needed */
+			if (offset + sizeof(zhash_entry_t) + entry->Key.key_str_len + entry->Val.val_size > buf_size) {
+				*written = zhash_to_buf_allocation_size(hash_table);
+				return -ENOSPC;
+			}
+
+			/* Advance the pointer */
+			zentry = (zhash_entry_t *)(buf + offset);
+			zentry->watemark = ZENTRY_WATERMARK;
+			zentry->key_str_len = entry->Key.key_str_len;
+			zentry->key_int64 = entry->Key.key_int64;
+			zentry->val_size = entry->Val.val_size;
+			zentry->checksum = zhash_entry_checksum(zentry, checksum_alg, entry->Key.key_str, entry->Val.val);
+
+			/* Now, dump the string key (if any) and val (if any) */
+			offset += sizeof(zhash_entry_t);
+
 			if (entry->Key.key_str) {
 				memcpy(buf + offset, entry->Key.key_str, entry->Key.key_str_len);
 				offset += entry->Key.key_str_len;
@@ -638,14 +705,129 @@ void *zhash_to_buf(const ztable_t *hash_table, size_t *size)
 		}
 	}
 
-	DDD("Offset: %zu, size : %zu\n", offset, *size);
-	return buf;
+	DDD("Offset: %zu, size : %zu\n", offset, buf_size);
+	*written = offset;
+	return 0;
+}
+
+/* This is an internal function: copy the part of 'item' from 'item_offset', up to 'size' bytes;
+   'pos' is the offset of the item in the dumped entry; return number of bytes copied */
+static size_t zhash_stream_copy(char *buf, const size_t size, const void *item, const size_t item_size,
+								const size_t pos, const size_t offset)
+{
+	size_t to_copy;
+
+	/* The item is already dumped, or not reached yet */
+	if (offset >= pos + item_size || offset < pos) {
+		return 0;
+	}
+
+	to_copy = MIN(pos + item_size - offset, size);
+	memcpy(buf, (const char *)item + (offset - pos), to_copy);
+	return to_copy;
+}
+
+__attribute__((warn_unused_result, nonnull(1, 2, 3)))
+size_t zhash_to_buf_stream(const ztable_t *hash_table, zhash_stream_t *zs, char *buf, const size_t buf_size, const uint8_t checksum_alg)
+{
+	const size_t num_of_entryes = hash_sizes[hash_table->size_index];
+	size_t       written        = 0;
+
+	if (zs->done) {
+		return 0;
+	}
+
+	if (!zs->header_done) {
+		zhash_header_t zheader;
+		uint32_t       sum;
+
+		zheader.entry_count = hash_table->entry_count;
+		zheader.watemark = ZHASH_WATERMARK;
+		zheader.checksum_alg = checksum_alg;
+
+		/* The algorithm is validated by the caller: this call can not fail */
+		if (0 != zhash_header_checksum(&zheader, &sum)) {
+			abort();
+		}
+		zheader.checksum = sum;
+
+		written = zhash_stream_copy(buf, buf_size, &zheader, sizeof(zhash_header_t), 0, zs->offset);
+		zs->offset += written;
+		if (zs->offset < sizeof(zhash_header_t)) {
+			return written;
+		}
+
+		zs->header_done = 1;
+		zs->offset = 0;
+		zs->bucket = 0;
+		zs->entry = hash_table->entries[0];
+	}
+
+	while (written < buf_size) {
+		zhash_entry_t  zentry;
+		const zentry_t *entry;
+		size_t         entry_size;
+		size_t         copied;
+
+		/* Find the next entry: the rest of the chain, then the next not empty bucket */
+		while (NULL == zs->entry && zs->bucket + 1 < num_of_entryes) {
+			zs->bucket++;
+			zs->entry = hash_table->entries[zs->bucket];
+		}
+
+		if (NULL == zs->entry) {
+			zs->done = 1;
+			break;
+		}
+
+		entry = zs->entry;
+		zentry.watemark = ZENTRY_WATERMARK;
+		zentry.key_str_len = entry->Key.key_str_len;
+		zentry.key_int64 = entry->Key.key_int64;
+		zentry.val_size = entry->Val.val_size;
+
+		/* The entry may take many calls: its checksum is calculated once, when it starts */
+		if (0 == zs->offset) {
+			zs->entry_checksum = zhash_entry_checksum(&zentry, checksum_alg, entry->Key.key_str, entry->Val.val);
+		}
+		zentry.checksum = zs->entry_checksum;
+		entry_size = sizeof(zhash_entry_t) + entry->Key.key_str_len + (entry->Val.val ? entry->Val.val_size : 0);
+
+		/* The entry is three items one after another: the header, the string key, the value */
+		copied = zhash_stream_copy(buf + written, buf_size - written, &zentry, sizeof(zhash_entry_t), 0, zs->offset);
+		zs->offset += copied;
+		written += copied;
+
+		if (entry->Key.key_str) {
+			copied = zhash_stream_copy(buf + written, buf_size - written, entry->Key.key_str,
+									   entry->Key.key_str_len, sizeof(zhash_entry_t), zs->offset);
+			zs->offset += copied;
+			written += copied;
+		}
+
+		if (entry->Val.val) {
+			copied = zhash_stream_copy(buf + written, buf_size - written, entry->Val.val, entry->Val.val_size,
+									   sizeof(zhash_entry_t) + entry->Key.key_str_len, zs->offset);
+			zs->offset += copied;
+			written += copied;
+		}
+
+		if (zs->offset < entry_size) {
+			break;
+		}
+
+		zs->entry = entry->next;
+		zs->offset = 0;
+	}
+
+	return written;
 }
 
 __attribute__((warn_unused_result, pure))
 static int8_t zhash_is_valid(const char *buf, const size_t size)
 {
 	const zhash_header_t *zhead = (zhash_header_t *)buf;
+	uint32_t             sum    = 0;
 	TESTP(buf, -1);
 
 	if (size < sizeof(zhash_header_t)) {
@@ -657,6 +839,11 @@ static int8_t zhash_is_valid(const char *buf, const size_t size)
 		DE("Bad watermark in zhash_header_t: expected %X but it is %X\n", ZHASH_WATERMARK, zhead->watemark);
 		return -1;
 	}
+
+	if (0 != zhash_header_checksum(zhead, &sum) || zhead->checksum != sum) {
+		DE("Wrong zhash_header_t checksum: expected %X but it is %X\n", zhead->checksum, sum);
+		return -1;
+	}
 	return 0;
 }
 
@@ -666,14 +853,16 @@ ztable_t *zhash_from_buf(const char *buf, const size_t size)
 	size_t               index;
 	size_t               offset = 0;
 	const zhash_header_t *zhead = (zhash_header_t *)buf;
+	ztable_t             *zt;
 
+	/* The buffer comes from outside: a broken one is refused, not aborted on */
 	if (zhash_is_valid(buf, size)) {
 		DE("Zhash flat buffer is invalid\n");
-		abort();
+		return NULL;
 	}
 
 	/* From the header we know the count of entries in the zhash table */
-	ztable_t *zt = zhash_allocate();
+	zt = zhash_allocate();
 	TESTP(zt, NULL);
 
 	offset += sizeof(zhash_header_t);
@@ -683,22 +872,44 @@ ztable_t *zhash_from_buf(const char *buf, const size_t size)
 		char                *key_str = NULL;
 		void                *val;
 		const zhash_entry_t *zent    = (zhash_entry_t  *)(buf + offset);
-		offset += sizeof(zhash_entry_t);
 
-		/* Set watermark */
+		/* The entry header, then its string key and value must be inside of the buffer */
+		if (offset + sizeof(zhash_entry_t) > size ||
+			offset + sizeof(zhash_entry_t) + (size_t)zent->key_str_len + zent->val_size > size) {
+			DE("Zhash entry %zu is out of the buffer (%zu)\n", index, size);
+			goto err;
+		}
+
 		if (ZENTRY_WATERMARK != zent->watemark) {
 			DE("Bad watermark in zhash_entry_t: expected %X but it is %X\n", ZENTRY_WATERMARK, zent->watemark);
+			goto err;
+		}
+
+		offset += sizeof(zhash_entry_t);
+
+		if (zent->checksum != zhash_entry_checksum(zent, zhead->checksum_alg, (zent->key_str_len > 0) ? buf + offset : NULL,
+												   buf + offset + zent->key_str_len)) {
+			DE("Wrong checksum of zhash entry %zu\n", index);
+			goto err;
 		}
 
 		/* Extract ket string, if any */
 		if (zent->key_str_len > 0) {
 			key_str = zmalloc(zent->key_str_len + 1);
+			if (NULL == key_str) {
+				goto err;
+			}
 			/* The string key, if exists, placed right after the zhash_entry_t struct */
 			memcpy(key_str, (buf + offset), zent->key_str_len);
 			offset += zent->key_str_len;
 		}
 
 		val = malloc(zent->val_size);
+		if (NULL == val && zent->val_size > 0) {
+			free(key_str);
+			goto err;
+		}
+
 		/* Extract the value into the buffer */
 		memcpy(val, (buf + offset), zent->val_size);
 		offset += zent->val_size;
@@ -708,14 +919,13 @@ ztable_t *zhash_from_buf(const char *buf, const size_t size)
 			(NULL != key_str) ? key_str : "NULL",
 			zent->key_str_len, val, zent->val_size);
 
+		/* A key dumped twice is a broken buffer too */
 		rc = zhash_insert(zt, zent->key_int64, key_str, zent->key_str_len, val, zent->val_size);
-		if (rc < 0) {
-			DE("Error on a new entry insert (extracted frpm buf) into new zhash\n");
-			abort();
-		}
-		if (rc > 0) {
-			DE("Collision on a new entry insert (extracted frpm buf) into new zhash\n");
-			abort();
+		if (0 != rc) {
+			DE("Could not insert entry %zu (extracted from buf) into new zhash: %d\n", index, rc);
+			free(key_str);
+			free(val);
+			goto err;
 		}
 	}
 
@@ -723,13 +933,177 @@ ztable_t *zhash_from_buf(const char *buf, const size_t size)
 
 	if (offset != size) {
 		DE("Size of extracted zhash (%zu) is not what expected (%zu)\n", offset, size);
-		TRY_ABORT();
+		goto err;
 	}
 
 	zhash_dump(zt, "RESTORED FROM FLAT BUFFER");
 	return zt;
 
+err:
+	zhash_release(zt, 1);
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+void *zhash_flat_find_by_int(const char *buf, const size_t size, const uint64_t key_int64, ssize_t *val_size)
+{
+	size_t               index;
+	size_t               offset = sizeof(zhash_header_t);
+	const zhash_header_t *zhead = (zhash_header_t *)buf;
+
+	*val_size = 0;
+
+	if (zhash_is_valid(buf, size)) {
+		DE("Zhash flat buffer is invalid\n");
+		return NULL;
+	}
+
+	/* The dump is a sequence of entries: walk it, nothing is restored */
+	for (index = 0; index < zhead->entry_count; index++) {
+		const zhash_entry_t *zent = (zhash_entry_t *)(buf + offset);
 
+		if (offset + sizeof(zhash_entry_t) > size ||
+			offset + sizeof(zhash_entry_t) + zent->key_str_len + zent->val_size > size) {
+			DE("Zhash entry %zu is out of the buffer (%zu)\n", index, size);
+			return NULL;
+		}
+
+		if (ZENTRY_WATERMARK != zent->watemark) {
+			DE("Bad watermark in zhash_entry_t: expected %X but it is %X\n", ZENTRY_WATERMARK, zent->watemark);
+			return NULL;
+		}
+
+		offset += sizeof(zhash_entry_t) + zent->key_str_len;
+
+		if (key_int64 == zent->key_int64) {
+			if (zent->checksum != zhash_entry_checksum(zent, zhead->checksum_alg, (zent->key_str_len > 0) ? buf + offset - zent->key_str_len : NULL,
+													   buf + offset)) {
+				DE("Wrong checksum of zhash entry %zu\n", index);
+				return NULL;
+			}
+
+			*val_size = (ssize_t)zent->val_size;
+			return (void *)(buf + offset);
+		}
+
+		offset += zent->val_size;
+	}
+
+	return NULL;
+}
+
+__attribute__((warn_unused_result))
+void *zhash_flat_find_by_str(const char *buf, const size_t size, const char *key_str, const size_t key_str_len, ssize_t *val_size)
+{
+	return zhash_flat_find_by_int(buf, size, zhash_key_int64_from_key_str(key_str, key_str_len), val_size);
+}
+
+__attribute__((warn_unused_result))
+ztable_t *zhash_clone(const ztable_t *hash_table)
+{
+	size_t   index;
+	size_t   size;
+	zentry_t *entry;
+	ztable_t *zt;
+
+	TESTP(hash_table, NULL);
+
+	/* The same size as the original: no rehash needed while the entries are copied */
+	zt = zcreate_hash_table_with_size(hash_table->size_index);
+	TESTP(zt, NULL);
+
+	size = hash_sizes[hash_table->size_index];
+
+	for (index = 0; index < size; index++) {
+		for (entry = hash_table->entries[index]; NULL != entry; entry = entry->next) {
+			int8_t rc;
+			char   *key_str = NULL;
+			void   *val     = entry->Val.val;
+
+			/* Entries with a string key own their values; duplicate both */
+			if (NULL != entry->Key.key_str) {
+				key_str = strndup(entry->Key.key_str, entry->Key.key_str_len);
+				val = malloc(entry->Val.val_size);
+				if (NULL == key_str || NULL == val) {
+					DE("Could not allocate memory for a copy of entry\n");
+					free(key_str);
+					free(val);
+					zhash_release(zt, 1);
+					return NULL;
+				}
+				memcpy(val, entry->Val.val, entry->Val.val_size);
+			}
+
+			rc = zhash_insert(zt, entry->Key.key_int64, key_str, entry->Key.key_str_len, val, entry->Val.val_size);
+			if (0 != rc) {
+				DE("Could not insert an entry into the zhash copy\n");
+				/* Not inserted: the copies are not owned by the table yet */
+				if (NULL != key_str) {
+					free(key_str);
+					free(val);
+				}
+				zhash_release(zt, 1);
+				return NULL;
+			}
+		}
+	}
+
+	return zt;
+}
+
+__attribute__((warn_unused_result))
+int8_t zhash_move_all(ztable_t *dst, ztable_t *src)
+{
+	size_t index;
+	size_t size;
+	size_t size_index;
+
+	TESTP(dst, -1);
+	TESTP(src, -1);
+
+	/* Resize once for all the entries; the same keys make the table a bit bigger than needed */
+	size_index = dst->size_index;
+	while (size_index + 1 < COUNT_OF(hash_sizes) && dst->entry_count + src->entry_count > hash_sizes[size_index] / 2) {
+		size_index++;
+	}
+	zhash_rehash(dst, size_index);
+
+	size = hash_sizes[src->size_index];
+
+	for (index = 0; index < size; index++) {
+		zentry_t *entry = src->entries[index];
+
+		while (entry) {
+			zentry_t     *next_entry = entry->next;
+			const size_t hash        = zhash_entry_index_by_int(dst, entry->Key.key_int64);
+			zentry_t     **slot      = &dst->entries[hash];
+
+			/* The same key: the moved entry replaces the old one */
+			for (; NULL != *slot; slot = &(*slot)->next) {
+				if (entry->Key.key_int64 == (*slot)->Key.key_int64) {
+					zentry_t *old_entry = *slot;
+
+					*slot = old_entry->next;
+					dst->dump_size -= zentry_dump_size(old_entry);
+					zentry_t_release(old_entry, false, 1);
+					dst->entry_count--;
+					break;
+				}
+			}
+
+			entry->next = dst->entries[hash];
+			dst->entries[hash] = entry;
+			dst->entry_count++;
+			dst->dump_size += zentry_dump_size(entry);
+			entry = next_entry;
+		}
+
+		src->entries[index] = NULL;
+	}
+
+	src->entry_count = 0;
+	src->dump_size = 0;
+	return 0;
 }
 
 /* Compare two zhash buffers */
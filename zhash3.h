@@ -47,6 +47,7 @@ typedef struct ZHashEntry {
 typedef struct __attribute__((packed)){
 	uint32_t size_index; /**< one of predefined value, a primary number, see ::hash_sizes in zhash3.c */
 	uint32_t entry_count; /**< Number of entries added into hash table */
+	uint64_t dump_size; /**< The size of all entries in the flat buffer, without the zhash_header_t; see ::zhash_to_buf_allocation_size() */
 	zentry_t **entries; /**< Array of entries */
 }
 ztable_t;
@@ -71,8 +72,9 @@ ztable_t;
  */
 typedef struct __attribute__((packed)){
 	uint32_t watemark; /**< Contains predefined pattern, see ::ZENTRY_WATERMARK */
-	uint32_t checksum;
+	uint32_t checksum; /**< Checksum of the header fields after this one */
 	uint32_t entry_count;
+	uint8_t checksum_alg; /**< The algorithm of the header and the entry checksums, checksum_alg_t */
 }
 zhash_header_t;
 
@@ -84,7 +86,7 @@ zhash_header_t;
  */
 typedef struct __attribute__((packed)){
 	uint32_t watemark; /**< Predefined value, for validation */
-	uint32_t checksum; /**< Checksum of this entry, not implemented yet*/
+	uint32_t checksum; /**< Checksum of the entry fields after this one, the string key and the value */
 	uint64_t key_int64; /**< Key: integer */
 	uint32_t key_str_len; /**< Length of the 'char *key', not includes terminating \0 */
 	uint32_t val_size; /**< Length of the entry */
@@ -286,7 +288,8 @@ zentry_t *zhash_list(const ztable_t *hash_table, size_t *index, const zentry_t *
  *  	  bytes) enough to contain a flat zhash dump buffer
  * @param ztable_t* hash_table
  * @return size_t Size of needded buffer, in bytes
- * @details 
+ * @details O(1): the size is counted when entries are inserted
+ *  		and extracted
  */
 __attribute__((warn_unused_result, pure, nonnull(1)))
 size_t zhash_to_buf_allocation_size(const ztable_t *hash_table);
@@ -302,12 +305,69 @@ size_t zhash_to_buf_allocation_size(const ztable_t *hash_table);
  * @return void* Poiter to the new buffer. In case of error a
  *  	   NULL returned.
  * @details The original zhash not affected by this operation,
- *  		you can use it or release it, by your choice.
+ *  		you can use it or release it, by your choice. The
+ *  		dump is checksummed with FNV-1a, see
+ *  		::zhash_to_buf_into() for another algorithm.
  */
 
 __attribute__((warn_unused_result))
 extern void *zhash_to_buf(const ztable_t *hash_table, size_t *size);
 
+/**
+ * @author Sebastian Mountaniol (8/25/22)
+ * @brief Dump the zhash table into a caller's buffer, the same
+ *  	  format as ::zhash_to_buf()
+ * @param const ztable_t* hash_table Hash to dump
+ * @param char* buf   The buffer to dump the table into
+ * @param const size_t buf_size Size of the buffer
+ * @param size_t* written The number of bytes written returned
+ *  			here; if the buffer is too small, the required
+ *  			size is returned here
+ * @param const uint8_t checksum_alg The algorithm of the dump
+ *  			checksums, checksum_alg_t
+ * @return int8_t 0 on success, -ENOSPC if the buffer is too
+ *  	   small, -EINVAL if the algorithm is unknown
+ * @details One pass over the entries, the buffer is not cleaned
+ *  		before: every dumped byte is written explicitly.
+ *  		The header and every entry carry a checksum, tested
+ *  		by ::zhash_from_buf().
+ */
+__attribute__((warn_unused_result, nonnull(1, 2, 4)))
+extern int8_t zhash_to_buf_into(const ztable_t *hash_table, char *buf, const size_t buf_size, size_t *written, const uint8_t checksum_alg);
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief The position of a chunked zhash dump, see
+ *  	  ::zhash_to_buf_stream()
+ */
+typedef struct {
+	size_t bucket; /**< The current bucket */
+	const zentry_t *entry; /**< The current entry, NULL before the first one */
+	size_t offset; /**< Bytes of the current item (the header or the entry) already dumped */
+	uint32_t entry_checksum; /**< The checksum of the current entry, calculated when its dump starts */
+	int8_t header_done; /**< The zhash header is dumped */
+	int8_t done; /**< The whole table is dumped */
+} zhash_stream_t;
+
+/**
+ * @author Sebastian Mountaniol (8/29/22)
+ * @brief Dump the zhash table chunk by chunk; the chunks
+ *  	  together are the same as the ::zhash_to_buf() buffer
+ * @param const ztable_t* hash_table Hash to dump
+ * @param zhash_stream_t* zs The dump position; must be zeroed
+ *  			 before the first call
+ * @param char* buf   The buffer for the next chunk
+ * @param const size_t buf_size Size of the buffer
+ * @param const uint8_t checksum_alg The algorithm of the dump
+ *  			checksums, a valid checksum_alg_t; the same for
+ *  			all the calls
+ * @return size_t Number of bytes written into the buffer; 0 when
+ *  	   the table is dumped completely
+ * @details The table must not be changed between the calls.
+ */
+__attribute__((warn_unused_result, nonnull(1, 2, 3)))
+extern size_t zhash_to_buf_stream(const ztable_t *hash_table, zhash_stream_t *zs, char *buf, const size_t buf_size, const uint8_t checksum_alg);
+
 /**
  * @author Sebastian Mountaniol (7/27/22)
  * @brief Create zhash table from the flat memory buffer. The
@@ -318,11 +378,83 @@ extern void *zhash_to_buf(const ztable_t *hash_table, size_t *size);
  * @param size_t size  Size of the flat memory buffer
  * @return ztable_t* zhash object, restored from the buffer.
  *  	   NULL on an error.
- * @details 
+ * @details The buffer is not trusted: an entry out of the
+ *  		buffer, a wrong watermark or checksum, a key dumped
+ *  		twice or a wrong size returns NULL.
  */
 __attribute__((warn_unused_result))
 extern ztable_t *zhash_from_buf(const char *buf, const size_t size);
 
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Find a value by int key directly in the flat memory
+ *  	  buffer, the result of ::zhash_to_buf(), without
+ *  	  restoring the zhash table
+ * @param const char* buf   Flat memory buffer containing a dump
+ *  		   of zhash table
+ * @param const size_t size  Size of the flat memory buffer
+ * @param const uint64_t key_int64 The key to find
+ * @param ssize_t* val_size The size of the found value returned
+ *  			 here, 0 if not found
+ * @return void* Pointer to the value inside of the buffer, NULL
+ *  	   if not found or if the buffer is broken
+ * @details The checksum of the found entry is tested, the
+ *  		entries before it are only walked. The lookup is linear: it is intended for a few
+ *  		lookups in a received buffer. For many lookups
+ *  		restore the table with ::zhash_from_buf().
+ */
+__attribute__((warn_unused_result, nonnull(1, 4)))
+extern void *zhash_flat_find_by_int(const char *buf, const size_t size, const uint64_t key_int64, ssize_t *val_size);
+
+/**
+ * @author Sebastian Mountaniol (8/26/22)
+ * @brief Find a value by string key directly in the flat memory
+ *  	  buffer, see ::zhash_flat_find_by_int()
+ * @param const char* buf   Flat memory buffer containing a dump
+ *  		   of zhash table
+ * @param const size_t size  Size of the flat memory buffer
+ * @param const char* key_str The key to find
+ * @param const size_t key_str_len Length of the key
+ * @param ssize_t* val_size The size of the found value returned
+ *  			 here, 0 if not found
+ * @return void* Pointer to the value inside of the buffer, NULL
+ *  	   if not found
+ */
+__attribute__((warn_unused_result, nonnull(1, 3, 5)))
+extern void *zhash_flat_find_by_str(const char *buf, const size_t size, const char *key_str, const size_t key_str_len, ssize_t *val_size);
+
+
+/**
+ * @author Sebastian Mountaniol (8/21/22)
+ * @brief Create a copy of the zhash table
+ * @param const ztable_t* hash_table The zhash table to copy
+ * @return ztable_t* A new zhash table on success, NULL on an
+ *  	   error
+ * @details The copy is independent from the original table.
+ *  		The values of entries inserted by a string key
+ *  		(these values are released with the table, see
+ *  		::zhash_release()) are duplicated; the values of
+ *  		entries inserted by an integer key are user's
+ *  		pointers, and the copy keeps the same pointers.
+ */
+__attribute__((warn_unused_result))
+extern ztable_t *zhash_clone(const ztable_t *hash_table);
+
+/**
+ * @author Sebastian Mountaniol (9/6/22)
+ * @brief Move all entries of one zhash table into another
+ * @param ztable_t* dst   The table to move the entries into
+ * @param ztable_t* src   The table to move the entries from;
+ *  			it stays empty
+ * @return int8_t 0 on success, -1 on an error
+ * @details The entries are moved, not copied: neither the keys
+ *  		nor the values are duplicated, and 'dst' is resized
+ *  		at most once. An entry of 'src' replaces the entry of
+ *  		'dst' with the same key; the replaced entry is
+ *  		released as ::zhash_release() does it.
+ */
+__attribute__((warn_unused_result))
+extern int8_t zhash_move_all(ztable_t *dst, ztable_t *src);
 
 /**
  * @author Sebastian Mountaniol (7/31/22)